@@ -138,6 +138,12 @@ try {
     $binPath = Join-Path $buildDir "garage_config_nvs.bin"
 
     $jsonContent = Get-Content -Raw $jsonPathResolved
+    # Must fit GARAGE_CONFIG_HOST_LEN: up to three brokers, 803 characters in all.
+    $maxMqttHostLength = 803
+    $mqttHost = ($jsonContent | ConvertFrom-Json).PSObject.Properties["CONFIG_GARAGE_MQTT_HOST"]
+    if ($mqttHost -and ([string]$mqttHost.Value).Length -gt $maxMqttHostLength) {
+        throw "CONFIG_GARAGE_MQTT_HOST is $(([string]$mqttHost.Value).Length) characters; the firmware accepts at most $maxMqttHostLength"
+    }
     $escapedJson = $jsonContent.Replace('"', '""')
     $csvLines = @(
         "key,type,encoding,value",
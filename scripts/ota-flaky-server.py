@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+"""Serve firmware images over HTTP with Range support and injected drops.
+
+Mirrors the release URL layout, so with CONFIG_GARAGE_OTA_BASE_URL set to
+http://<host>:<port> (and CONFIG_ESP_HTTPS_OTA_ALLOW_HTTP=y) an `ota`
+command for tag T and asset A fetches <dir>/T/A. Each response is cut off
+after --drop-after bytes, so the device has to resume with a Range request
+until the whole image is through.
+
+    python scripts/ota-flaky-server.py --dir dist --drop-after 200000
+"""
+
+import argparse
+import http.server
+import os
+import re
+
+
+class FlakyHandler(http.server.BaseHTTPRequestHandler):
+    root = "."
+    drop_after = 0
+
+    def do_GET(self):
+        # /<owner>/<repo>/releases/download/<tag>/<asset>
+        match = re.fullmatch(r"/[^/]+/[^/]+/releases/download/([^/]+)/([^/]+)", self.path)
+        path = os.path.join(self.root, *match.groups()) if match else None
+        if not path or not os.path.isfile(path):
+            self.send_error(404)
+            return
+
+        size = os.path.getsize(path)
+        start = 0
+        range_header = self.headers.get("Range")
+        if range_header:
+            range_match = re.fullmatch(r"bytes=(\d+)-", range_header.strip())
+            if not range_match or int(range_match.group(1)) >= size:
+                self.send_error(416)
+                return
+            start = int(range_match.group(1))
+            self.send_response(206)
+            self.send_header("Content-Range", f"bytes {start}-{size - 1}/{size}")
+        else:
+            self.send_response(200)
+        self.send_header("Content-Type", "application/octet-stream")
+        self.send_header("Content-Length", str(size - start))
+        self.end_headers()
+
+        budget = self.drop_after if self.drop_after > 0 else size
+        with open(path, "rb") as f:
+            f.seek(start)
+            data = f.read(budget)
+        self.wfile.write(data)
+        if start + len(data) < size:
+            self.log_message("dropping connection at byte %d of %d", start + len(data), size)
+            self.close_connection = True
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--dir", default=".", help="directory holding <tag>/<asset>")
+    parser.add_argument("--port", type=int, default=8000)
+    parser.add_argument("--drop-after", type=int, default=200000, help="bytes per response before dropping (0: never)")
+    args = parser.parse_args()
+
+    FlakyHandler.root = args.dir
+    FlakyHandler.drop_after = args.drop_after
+    server = http.server.ThreadingHTTPServer(("", args.port), FlakyHandler)
+    print(f"serving {args.dir} on :{args.port}, dropping every {args.drop_after} bytes")
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,189 @@
+#!/usr/bin/env python3
+"""Simulate a fleet of openers to exercise staggered OTA rollouts.
+
+Each simulated device follows the firmware's rollout rules (src/garage_rollout.c):
+the same device_id hash picks canaries and per-device delays, canaries start
+within the rollout window, and everyone else waits until canaryQuorum other
+devices reported "success" for the same tag/asset on garage/<id>/state.
+Downloads go to the release URL layout, so pair it with a local broker and
+scripts/ota-flaky-server.py (or any server holding <dir>/<tag>/<asset>).
+Real devices on the same broker take part in the same rollout.
+
+    mosquitto -p 1883 &
+    python scripts/ota-flaky-server.py --dir dist --drop-after 0 &
+    python scripts/ota-fleet-sim.py --devices 20 --http http://localhost:8000 \\
+        --send v1.3.0 GarageDoor-v1.3.0.bin --window 600 --canary-percent 10 --time-scale 60
+
+--time-scale divides every delay so a ten-minute window plays out in ten
+seconds. --fail-canaries makes canaries report failure instead, and the rest
+of the fleet should then stop with canary-timeout.
+
+Needs paho-mqtt (pip install paho-mqtt).
+"""
+
+import argparse
+import json
+import threading
+import time
+import urllib.error
+import urllib.request
+
+import paho.mqtt.client as mqtt
+
+MAX_WINDOW_S = 86400
+MAX_QUORUM = 16
+
+
+def device_hash(device_id):
+    h = 2166136261
+    for b in device_id.encode():
+        h = ((h ^ b) * 16777619) & 0xFFFFFFFF
+    return h
+
+
+def mix32(h):
+    h ^= h >> 16
+    h = (h * 0x85EBCA6B) & 0xFFFFFFFF
+    h ^= h >> 13
+    h = (h * 0xC2B2AE35) & 0xFFFFFFFF
+    h ^= h >> 16
+    return h
+
+
+def rollout_plan(device_id, window_s, canary_percent):
+    h = device_hash(device_id)
+    window_s = min(window_s, MAX_WINDOW_S)
+    return h % 100 < canary_percent, (mix32(h) * window_s * 1000) >> 32
+
+
+class Fleet:
+    def __init__(self, args):
+        self.args = args
+        self.ids = [f"{args.prefix}{i:03d}" for i in range(args.devices)]
+        self.started = time.monotonic()
+        self.lock = threading.Lock()
+        self.gates = {}  # device id -> (detail, quorum, set of reporters, event)
+        self.client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2, client_id=f"{args.prefix}fleet")
+        self.client.on_connect = self.on_connect
+        self.client.on_message = self.on_message
+
+    def log(self, device_id, text):
+        print(f"{time.monotonic() - self.started:8.2f}s {device_id}: {text}", flush=True)
+
+    def publish_ota(self, device_id, **fields):
+        payload = {"type": "ota", "deviceId": device_id, "timestamp": int(time.time() * 1000), **fields}
+        self.client.publish(f"garage/{device_id}/state", json.dumps(payload, separators=(",", ":")), qos=1)
+
+    def on_connect(self, client, userdata, flags, reason_code, properties):
+        client.subscribe([("garage/+/command", 1), ("garage/+/state", 1)])
+
+    def on_message(self, client, userdata, msg):
+        _, device_id, kind = msg.topic.split("/", 2)
+        try:
+            payload = json.loads(msg.payload)
+        except ValueError:
+            return
+        if kind == "command" and device_id in self.ids and payload.get("type") == "ota":
+            threading.Thread(target=self.run_ota, args=(device_id, payload), daemon=True).start()
+        elif kind == "state" and payload.get("type") == "ota" and payload.get("status") == "success":
+            with self.lock:
+                for gated_id, (detail, quorum, reporters, opened) in self.gates.items():
+                    if gated_id != device_id and payload.get("detail") == detail:
+                        reporters.add(device_id)
+                        if len(reporters) >= quorum:
+                            opened.set()
+
+    def sleep_ms(self, ms):
+        time.sleep(ms / 1000 / self.args.time_scale)
+
+    def run_ota(self, device_id, command):
+        tag, asset = command["tag"], command["asset"]
+        detail = f"{tag}/{asset}"
+        window_s = int(command.get("rolloutWindowS", 0))
+        percent = int(command.get("canaryPercent", 0))
+        quorum = min(max(int(command.get("canaryQuorum", 1)), 1), MAX_QUORUM)
+        canary, delay_ms = rollout_plan(device_id, window_s, percent)
+
+        if window_s or percent:
+            if percent and not canary:
+                opened = threading.Event()
+                with self.lock:
+                    self.gates[device_id] = (detail, quorum, set(), opened)
+                self.publish_ota(device_id, status="waiting", detail=detail, canary=False, delayMs=delay_ms)
+                self.log(device_id, f"waiting for {quorum} canary report(s)")
+                timeout_s = (window_s + self.args.canary_timeout) / self.args.time_scale
+                ok = opened.wait(timeout_s)
+                with self.lock:
+                    del self.gates[device_id]
+                if not ok:
+                    self.log(device_id, "canary-timeout")
+                    self.publish_ota(device_id, status="failure", detail="canary-timeout", error="ESP_ERR_TIMEOUT")
+                    return
+            self.publish_ota(device_id, status="scheduled", detail=detail, canary=canary, delayMs=delay_ms)
+            self.log(device_id, f"{'canary ' if canary else ''}scheduled in {delay_ms} ms")
+            self.sleep_ms(delay_ms)
+
+        self.publish_ota(device_id, status="started", detail=detail)
+        self.log(device_id, "downloading")
+        url = f"{self.args.http}/{self.args.owner}/{self.args.repo}/releases/download/{tag}/{asset}"
+        try:
+            with urllib.request.urlopen(url, timeout=30) as response:
+                size = len(response.read())
+        except (urllib.error.URLError, OSError) as err:
+            self.log(device_id, f"download failed: {err}")
+            self.publish_ota(device_id, status="failure", detail=detail, error="ESP_FAIL")
+            return
+        if canary and self.args.fail_canaries:
+            self.log(device_id, "reporting failure (--fail-canaries)")
+            self.publish_ota(device_id, status="failure", detail=detail, error="ESP_ERR_OTA_VALIDATE_FAILED")
+            return
+        self.log(device_id, f"success ({size} bytes)")
+        self.publish_ota(device_id, status="success", detail=detail)
+
+    def send(self, tag, asset, extra_ids):
+        command = {"type": "ota", "tag": tag, "asset": asset}
+        if self.args.window:
+            command["rolloutWindowS"] = self.args.window
+        if self.args.canary_percent:
+            command["canaryPercent"] = self.args.canary_percent
+            command["canaryQuorum"] = self.args.canary_quorum
+        for device_id in self.ids + extra_ids:
+            self.client.publish(f"garage/{device_id}/command", json.dumps(command), qos=1)
+        canaries = [d for d in self.ids + extra_ids if rollout_plan(d, self.args.window, self.args.canary_percent)[0]]
+        print(f"sent {tag}/{asset} to {len(self.ids) + len(extra_ids)} devices; canaries: {', '.join(canaries) or 'none'}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--broker", default="localhost")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--devices", type=int, default=10)
+    parser.add_argument("--prefix", default="sim-")
+    parser.add_argument("--http", default="http://localhost:8000", help="base URL in place of https://github.com")
+    parser.add_argument("--owner", default="owner")
+    parser.add_argument("--repo", default="repo")
+    parser.add_argument("--send", nargs=2, metavar=("TAG", "ASSET"), help="publish an ota command to the fleet")
+    parser.add_argument("--also", nargs="*", default=[], help="real device ids that should get the command too")
+    parser.add_argument("--window", type=int, default=0, help="rolloutWindowS")
+    parser.add_argument("--canary-percent", type=int, default=0)
+    parser.add_argument("--canary-quorum", type=int, default=1)
+    parser.add_argument("--canary-timeout", type=int, default=3600, help="CONFIG_GARAGE_OTA_CANARY_TIMEOUT_S")
+    parser.add_argument("--time-scale", type=float, default=1.0, help="divide every delay by this")
+    parser.add_argument("--fail-canaries", action="store_true")
+    args = parser.parse_args()
+
+    fleet = Fleet(args)
+    fleet.client.connect(args.broker, args.port)
+    fleet.client.loop_start()
+    time.sleep(1)
+    if args.send:
+        fleet.send(args.send[0], args.send[1], args.also)
+    try:
+        while True:
+            time.sleep(1)
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
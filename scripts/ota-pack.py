@@ -0,0 +1,170 @@
+#!/usr/bin/env python3
+"""Pack firmware images as compressed or delta OTA assets (.gdz).
+
+A .gdz file is an 80-byte header followed by one zlib stream:
+
+    magic "GDZ1" | format u8 (0 full, 1 delta) | 3 reserved bytes
+    image_size u32 | base_size u32 (0 for full)
+    sha256(image) | sha256(base) (zeros for full)
+
+For a full image the stream is the image itself. For a delta it is a list
+of ops, each `extra_len u32 | base_offset u32 | add_len u32`, then
+extra_len literal bytes, then add_len bytes that are added (mod 256) to
+the base image starting at base_offset. Like bsdiff, the add bytes are
+mostly zero where code only moved, so they compress well. The device
+inflates and applies the stream on the fly against its running slot
+(src/garage_ota.c), so neither side needs the whole image in RAM.
+
+    python scripts/ota-pack.py full  --image new.bin -o new.gdz
+    python scripts/ota-pack.py delta --base old.bin --image new.bin -o new.from-old.gdz
+    python scripts/ota-pack.py apply --base old.bin --patch new.from-old.gdz -o check.bin
+"""
+
+import argparse
+import hashlib
+import struct
+import sys
+import zlib
+
+MAGIC = b"GDZ1"
+FORMAT_FULL = 0
+FORMAT_DELTA = 1
+HEADER = struct.Struct("<4sB3xII32s32s")
+OP = struct.Struct("<III")
+
+KEY_LEN = 8
+# A match is extended while it gains more matching bytes than it loses;
+# this much slack lets it run across small edits such as moved pointers.
+MISMATCH_SLACK = 32
+MIN_ADD_LEN = 16
+
+
+def header(fmt, image, base=b""):
+    base_digest = hashlib.sha256(base).digest() if base else bytes(32)
+    return HEADER.pack(MAGIC, fmt, len(image), len(base), hashlib.sha256(image).digest(), base_digest)
+
+
+def extend(base, image, o, i):
+    """Length of the approximate match of image[i:] against base[o:]."""
+    best_len = 0
+    best_score = 0
+    score = 0
+    j = 0
+    limit = min(len(base) - o, len(image) - i)
+    while j < limit:
+        if base[o + j:o + j + 64] == image[i + j:i + j + 64] and j + 64 <= limit:
+            j += 64
+            score += 64
+        else:
+            score += 1 if base[o + j] == image[i + j] else -1
+            j += 1
+        if score > best_score:
+            best_score = score
+            best_len = j
+        elif score < best_score - MISMATCH_SLACK:
+            break
+    return best_len
+
+
+def diff(base, image):
+    index = {}
+    for k in range(len(base) - KEY_LEN, -1, -1):
+        index[base[k:k + KEY_LEN]] = k
+
+    ops = []
+    extra_start = 0
+    shift = 0
+    i = 0
+    while i + KEY_LEN <= len(image):
+        key = image[i:i + KEY_LEN]
+        o = i + shift
+        if not (0 <= o <= len(base) - KEY_LEN and base[o:o + KEY_LEN] == key):
+            o = index.get(key)
+        length = extend(base, image, o, i) if o is not None else 0
+        if length < MIN_ADD_LEN:
+            i += 1
+            continue
+        add = bytes((image[i + j] - base[o + j]) & 0xFF for j in range(length))
+        ops.append((image[extra_start:i], o, add))
+        shift = o - i
+        i += length
+        extra_start = i
+    if extra_start < len(image):
+        ops.append((image[extra_start:], 0, b""))
+
+    out = bytearray()
+    for extra, offset, add in ops:
+        out += OP.pack(len(extra), offset, len(add)) + extra + add
+    return bytes(out)
+
+
+def apply(base, stream, image_size):
+    out = bytearray()
+    pos = 0
+    while len(out) < image_size:
+        extra_len, offset, add_len = OP.unpack_from(stream, pos)
+        pos += OP.size
+        out += stream[pos:pos + extra_len]
+        pos += extra_len
+        out += bytes((stream[pos + j] + base[offset + j]) & 0xFF for j in range(add_len))
+        pos += add_len
+    return bytes(out)
+
+
+def read(path):
+    with open(path, "rb") as f:
+        return f.read()
+
+
+def write(path, data):
+    with open(path, "wb") as f:
+        f.write(data)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    sub = parser.add_subparsers(dest="command", required=True)
+    full = sub.add_parser("full", help="zlib-compress an image")
+    full.add_argument("--image", required=True)
+    full.add_argument("-o", "--output", required=True)
+    delta = sub.add_parser("delta", help="delta an image against a base")
+    delta.add_argument("--base", required=True)
+    delta.add_argument("--image", required=True)
+    delta.add_argument("-o", "--output", required=True)
+    check = sub.add_parser("apply", help="rebuild an image from a .gdz, checking its digests")
+    check.add_argument("--base")
+    check.add_argument("--patch", required=True)
+    check.add_argument("-o", "--output", required=True)
+    args = parser.parse_args()
+
+    if args.command == "full":
+        image = read(args.image)
+        packed = header(FORMAT_FULL, image) + zlib.compress(image, 9)
+    elif args.command == "delta":
+        base, image = read(args.base), read(args.image)
+        packed = header(FORMAT_DELTA, image, base) + zlib.compress(diff(base, image), 9)
+    else:
+        packed = read(args.patch)
+        magic, fmt, image_size, base_size, image_digest, base_digest = HEADER.unpack_from(packed)
+        if magic != MAGIC:
+            sys.exit("not a .gdz file")
+        stream = zlib.decompress(packed[HEADER.size:])
+        if fmt == FORMAT_DELTA:
+            base = read(args.base)
+            if len(base) != base_size or hashlib.sha256(base).digest() != base_digest:
+                sys.exit("base image does not match the delta")
+            image = apply(base, stream, image_size)
+        else:
+            image = stream
+        if len(image) != image_size or hashlib.sha256(image).digest() != image_digest:
+            sys.exit("rebuilt image does not match its digest")
+        write(args.output, image)
+        print(f"{args.output}: {image_size} bytes, digest ok")
+        return
+
+    write(args.output, packed)
+    print(f"{args.output}: {len(packed)} bytes for a {len(image)}-byte image ({100 * len(packed) // len(image)}%)")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+"""Build a 4 MB flash image for exercising OTA validation and rollback in QEMU.
+
+ota_0 gets a known-good build and ota_1 the candidate. otadata selects ota_1
+in the NEW state, exactly as after a successful OTA download, so the
+bootloader starts the candidate pending verification. QEMU has no Wi-Fi, so
+the candidate misses its first milestone, rolls back after
+CONFIG_GARAGE_OTA_VALIDATE_TIMEOUT_S and ota_0 boots again reporting
+"rolled-back" with reason "wifi-timeout".
+
+    python scripts/ota-qemu-image.py \
+        --bootloader .pio/build/seeed_xiao_esp32c6/bootloader.bin \
+        --partition-table .pio/build/seeed_xiao_esp32c6/partitions.bin \
+        --good good.bin --candidate .pio/build/seeed_xiao_esp32c6/firmware.bin \
+        -o flash.bin
+    qemu-system-riscv32 -nographic -machine esp32c6 \
+        -drive file=flash.bin,if=mtd,format=raw
+"""
+
+import argparse
+import struct
+import zlib
+
+FLASH_SIZE = 0x400000
+BOOTLOADER_OFFSET = 0x0
+PARTITION_TABLE_OFFSET = 0x8000
+# Must match partitions.csv.
+OTADATA_OFFSET = 0xF000
+OTA_0_OFFSET = 0x20000
+OTA_1_OFFSET = 0x200000
+APP_SLOT_SIZE = 0x1E0000
+
+ESP_OTA_IMG_NEW = 0x0
+
+
+def otadata_entry(seq):
+    # esp_ota_select_entry_t: ota_seq, seq_label[20], ota_state, crc over ota_seq.
+    crc = zlib.crc32(struct.pack("<I", seq), 0xFFFFFFFF)
+    return struct.pack("<I20sII", seq, b"\xff" * 20, ESP_OTA_IMG_NEW, crc)
+
+
+def place(image, offset, data, limit, name):
+    if len(data) > limit:
+        raise SystemExit(f"{name} is {len(data)} bytes, slot holds {limit}")
+    image[offset:offset + len(data)] = data
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--bootloader", required=True)
+    parser.add_argument("--partition-table", required=True)
+    parser.add_argument("--good", required=True, help="image for ota_0, the rollback target")
+    parser.add_argument("--candidate", required=True, help="image for ota_1, booted pending verification")
+    parser.add_argument("-o", "--output", default="flash.bin")
+    args = parser.parse_args()
+
+    image = bytearray(b"\xff" * FLASH_SIZE)
+    with open(args.bootloader, "rb") as f:
+        place(image, BOOTLOADER_OFFSET, f.read(), PARTITION_TABLE_OFFSET - BOOTLOADER_OFFSET, "bootloader")
+    with open(args.partition_table, "rb") as f:
+        place(image, PARTITION_TABLE_OFFSET, f.read(), 0x1000, "partition table")
+    with open(args.good, "rb") as f:
+        place(image, OTA_0_OFFSET, f.read(), APP_SLOT_SIZE, "good image")
+    with open(args.candidate, "rb") as f:
+        place(image, OTA_1_OFFSET, f.read(), APP_SLOT_SIZE, "candidate image")
+    # Sequence 2 selects ota_1 ((seq - 1) % 2); the second otadata sector stays erased.
+    place(image, OTADATA_OFFSET, otadata_entry(2), 0x1000, "otadata")
+
+    with open(args.output, "wb") as f:
+        f.write(image)
+    print(f"wrote {args.output}: ota_0 <- {args.good}, ota_1 <- {args.candidate} (pending verify)")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,38 @@
+#include "garage_backoff.h"
+
+void garage_backoff_init(garage_backoff_t *backoff, uint32_t base_ms, uint32_t max_ms)
+{
+    backoff->base_ms = base_ms > 0 ? base_ms : 1;
+    backoff->max_ms = max_ms > backoff->base_ms ? max_ms : backoff->base_ms;
+    backoff->attempts = 0;
+    backoff->outage_started_us = 0;
+}
+
+uint32_t garage_backoff_next_delay_ms(garage_backoff_t *backoff, int64_t now_us, uint32_t random)
+{
+    if (backoff->outage_started_us == 0) {
+        backoff->outage_started_us = now_us > 0 ? now_us : 1;
+    }
+
+    uint32_t cap = backoff->base_ms;
+    for (uint32_t i = 0; i < backoff->attempts && cap < backoff->max_ms; ++i) {
+        cap = cap > backoff->max_ms / 2 ? backoff->max_ms : cap * 2;
+    }
+    if (backoff->attempts < UINT32_MAX) {
+        ++backoff->attempts;
+    }
+
+    uint32_t half = cap / 2;
+    return half + random % (cap - half + 1);
+}
+
+int64_t garage_backoff_reset(garage_backoff_t *backoff, int64_t now_us)
+{
+    int64_t outage_us = 0;
+    if (backoff->outage_started_us != 0 && now_us > backoff->outage_started_us) {
+        outage_us = now_us - backoff->outage_started_us;
+    }
+    backoff->attempts = 0;
+    backoff->outage_started_us = 0;
+    return outage_us;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Capped exponential backoff with jitter for reconnect loops. Pure logic:
+ * time and randomness are passed in, so disconnect sequences can be
+ * replayed on the host. Not thread-safe; each instance belongs to one
+ * context (the Wi-Fi or MQTT event handler).
+ */
+typedef struct {
+    uint32_t base_ms;
+    uint32_t max_ms;
+    uint32_t attempts;         // failures since the link was last up
+    int64_t outage_started_us; // 0 while the link is up
+} garage_backoff_t;
+
+void garage_backoff_init(garage_backoff_t *backoff, uint32_t base_ms, uint32_t max_ms);
+
+/*
+ * Records a failure at now_us and returns how long to wait before the next
+ * attempt: a delay drawn from [cap/2, cap] with cap = min(base * 2^n, max),
+ * so peers that lost the link together spread their retries out.
+ */
+uint32_t garage_backoff_next_delay_ms(garage_backoff_t *backoff, int64_t now_us, uint32_t random);
+
+/*
+ * Records a successful connect. Returns the outage length in microseconds
+ * (first failure to now), or 0 if there was no outage in progress.
+ */
+int64_t garage_backoff_reset(garage_backoff_t *backoff, int64_t now_us);
@@ -0,0 +1,223 @@
+#include "garage_broker.h"
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BROKER_QUARANTINE_BASE_US (30LL * 1000 * 1000)
+#define BROKER_QUARANTINE_MAX_US (10LL * 60 * 1000 * 1000)
+// The primary is kept unless another healthy broker is faster by more than this.
+#define BROKER_PRIMARY_MARGIN_MS 200
+
+static bool parse_entry(const char *entry, size_t len, int default_port, char *uri, size_t uri_size)
+{
+    const char *scheme = "mqtts";
+    if (len > 7 && strncmp(entry, "mqtt://", 7) == 0) {
+        scheme = "mqtt";
+        entry += 7;
+        len -= 7;
+    } else if (len > 8 && strncmp(entry, "mqtts://", 8) == 0) {
+        entry += 8;
+        len -= 8;
+    }
+
+    size_t host_len = 0;
+    while (host_len < len && entry[host_len] != ':') {
+        unsigned char c = (unsigned char)entry[host_len];
+        if (!(isalnum(c) || c == '.' || c == '-' || c == '_')) {
+            return false;
+        }
+        ++host_len;
+    }
+    if (host_len == 0) {
+        return false;
+    }
+
+    long port = default_port;
+    if (host_len < len) {
+        char digits[6] = "";
+        size_t digits_len = len - host_len - 1;
+        if (digits_len == 0 || digits_len >= sizeof(digits)) {
+            return false;
+        }
+        memcpy(digits, entry + host_len + 1, digits_len);
+        char *end = NULL;
+        port = strtol(digits, &end, 10);
+        if (*end != '\0') {
+            return false;
+        }
+    }
+    if (port <= 0 || port > 65535) {
+        return false;
+    }
+
+    int written = snprintf(uri, uri_size, "%s://%.*s:%ld", scheme, (int)host_len, entry, port);
+    return written > 0 && (size_t)written < uri_size;
+}
+
+size_t garage_broker_list_init(garage_broker_list_t *list, const char *hosts, int default_port)
+{
+    memset(list, 0, sizeof(*list));
+    const char *cursor = hosts;
+    while (cursor && *cursor != '\0' && list->count < GARAGE_BROKER_MAX) {
+        const char *comma = strchr(cursor, ',');
+        size_t len = comma ? (size_t)(comma - cursor) : strlen(cursor);
+        const char *entry = cursor;
+        while (len > 0 && isspace((unsigned char)*entry)) {
+            ++entry;
+            --len;
+        }
+        while (len > 0 && isspace((unsigned char)entry[len - 1])) {
+            --len;
+        }
+        garage_broker_t *broker = &list->brokers[list->count];
+        if (len > 0 && parse_entry(entry, len, default_port, broker->uri, sizeof(broker->uri))) {
+            ++list->count;
+        }
+        cursor = comma ? comma + 1 : NULL;
+    }
+    return list->count;
+}
+
+const char *garage_broker_active_uri(const garage_broker_list_t *list)
+{
+    return list->count > 0 ? list->brokers[list->active].uri : NULL;
+}
+
+void garage_broker_record_connect(garage_broker_list_t *list, uint32_t connect_ms)
+{
+    if (list->count == 0) {
+        return;
+    }
+    garage_broker_t *broker = &list->brokers[list->active];
+    broker->connect_ms = connect_ms > 0 ? connect_ms : 1;
+    broker->quarantined_until_us = 0;
+}
+
+void garage_broker_record_ack(garage_broker_list_t *list, uint32_t ack_ms)
+{
+    if (list->count == 0) {
+        return;
+    }
+    garage_broker_t *broker = &list->brokers[list->active];
+    // EWMA with 1/8 weight, seeded by the first sample.
+    broker->ack_ms = broker->ack_ms == 0 ? ack_ms : (broker->ack_ms * 7 + ack_ms) / 8;
+    if (broker->ack_ms == 0) {
+        broker->ack_ms = 1;
+    }
+    // Only an acknowledged publish proves the broker healthy; a connect
+    // alone does not, or a broker that accepts connections but never acks
+    // would never be failed over.
+    broker->failures = 0;
+}
+
+// Unknown RTTs score 0 so an untried broker gets its chance.
+static uint32_t broker_score_ms(const garage_broker_t *broker)
+{
+    return broker->ack_ms ? broker->ack_ms : broker->connect_ms;
+}
+
+static size_t pick_broker(const garage_broker_list_t *list, int64_t now_us)
+{
+    size_t best = list->count;
+    size_t earliest = 0;
+    for (size_t i = 0; i < list->count; ++i) {
+        const garage_broker_t *broker = &list->brokers[i];
+        if (broker->quarantined_until_us < list->brokers[earliest].quarantined_until_us) {
+            earliest = i;
+        }
+        if (broker->quarantined_until_us > now_us) {
+            continue;
+        }
+        if (best == list->count || broker_score_ms(broker) < broker_score_ms(&list->brokers[best])) {
+            best = i;
+        }
+    }
+    if (best == list->count) {
+        // Everything is quarantined: go with the one that comes back first.
+        return earliest;
+    }
+    const garage_broker_t *primary = &list->brokers[0];
+    if (best != 0 && primary->quarantined_until_us <= now_us &&
+        broker_score_ms(primary) <= broker_score_ms(&list->brokers[best]) + BROKER_PRIMARY_MARGIN_MS) {
+        return 0;
+    }
+    return best;
+}
+
+bool garage_broker_record_failure(garage_broker_list_t *list, int64_t now_us)
+{
+    if (list->count == 0) {
+        return false;
+    }
+    garage_broker_t *broker = &list->brokers[list->active];
+    if (++broker->failures < GARAGE_BROKER_FAILOVER_AFTER) {
+        return false;
+    }
+    uint32_t shift = broker->failures - GARAGE_BROKER_FAILOVER_AFTER;
+    int64_t quarantine_us = shift < 5 ? BROKER_QUARANTINE_BASE_US << shift : BROKER_QUARANTINE_MAX_US;
+    if (quarantine_us > BROKER_QUARANTINE_MAX_US) {
+        quarantine_us = BROKER_QUARANTINE_MAX_US;
+    }
+    broker->quarantined_until_us = now_us + quarantine_us;
+
+    size_t next = pick_broker(list, now_us);
+    if (next == list->active) {
+        return false;
+    }
+    list->active = next;
+    return true;
+}
+
+bool garage_broker_primary_due(const garage_broker_list_t *list, int64_t now_us)
+{
+    return list->active != 0 && list->count > 1 && pick_broker(list, now_us) == 0;
+}
+
+void garage_broker_activate(garage_broker_list_t *list, size_t index)
+{
+    if (index < list->count) {
+        list->active = index;
+    }
+}
+
+size_t garage_broker_format(const garage_broker_list_t *list, char *out, size_t size)
+{
+    size_t len = 0;
+    int written = snprintf(out, size, "\"broker\":{\"active\":%u,\"uri\":\"%s\"", (unsigned)list->active,
+                           list->count > 0 ? list->brokers[list->active].uri : "");
+    if (written < 0 || (size_t)written >= size) {
+        return 0;
+    }
+    len = (size_t)written;
+
+    static const char *const names[] = { "connectMs", "ackMs", "failures" };
+    for (size_t field = 0; field < sizeof(names) / sizeof(names[0]); ++field) {
+        written = snprintf(out + len, size - len, ",\"%s\":[", names[field]);
+        if (written < 0 || (size_t)written >= size - len) {
+            return 0;
+        }
+        len += (size_t)written;
+        for (size_t i = 0; i < list->count; ++i) {
+            const garage_broker_t *broker = &list->brokers[i];
+            uint32_t value = field == 0 ? broker->connect_ms : field == 1 ? broker->ack_ms : broker->failures;
+            written = snprintf(out + len, size - len, "%s%" PRIu32, i > 0 ? "," : "", value);
+            if (written < 0 || (size_t)written >= size - len) {
+                return 0;
+            }
+            len += (size_t)written;
+        }
+        if (len + 1 >= size) {
+            return 0;
+        }
+        out[len++] = ']';
+    }
+    if (len + 1 >= size) {
+        return 0;
+    }
+    out[len++] = '}';
+    out[len] = '\0';
+    return len;
+}
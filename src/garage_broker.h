@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define GARAGE_BROKER_MAX 3
+// "mqtts://" + the longest DNS name (253) + ":65535" + NUL.
+#define GARAGE_BROKER_URI_LEN (8 + 253 + 6 + 1)
+
+/*
+ * Ordered MQTT broker list with health tracking for failover. The first
+ * entry is the primary. A broker that fails GARAGE_BROKER_FAILOVER_AFTER
+ * times in a row is quarantined (30 s, doubling up to 10 min) and the
+ * fastest healthy broker takes over; the primary wins whenever it is
+ * healthy and not markedly slower, so the device drifts back to it once it
+ * recovers. RTTs are learned from real connects and PUBACKs on whichever
+ * broker is active. Pure logic like garage_backoff: time is passed in and
+ * the caller serializes access.
+ */
+#define GARAGE_BROKER_FAILOVER_AFTER 2
+
+typedef struct {
+    char uri[GARAGE_BROKER_URI_LEN];
+    uint32_t connect_ms;            // last successful connect (TCP, TLS, CONNACK), 0 if never
+    uint32_t ack_ms;                // smoothed QoS1 publish -> PUBACK, 0 without samples
+    uint32_t failures;              // failures since the last PUBACK
+    int64_t quarantined_until_us;   // 0 when healthy
+} garage_broker_t;
+
+typedef struct {
+    garage_broker_t brokers[GARAGE_BROKER_MAX];
+    size_t count;
+    size_t active;
+} garage_broker_list_t;
+
+/*
+ * Parses "host[:port][,host[:port]...]". Entries may carry an mqtt:// or
+ * mqtts:// prefix; the default is mqtts:// on default_port. Returns the
+ * number of brokers kept; malformed entries are skipped.
+ */
+size_t garage_broker_list_init(garage_broker_list_t *list, const char *hosts, int default_port);
+const char *garage_broker_active_uri(const garage_broker_list_t *list);
+
+void garage_broker_record_connect(garage_broker_list_t *list, uint32_t connect_ms);
+void garage_broker_record_ack(garage_broker_list_t *list, uint32_t ack_ms);
+// Counts a failure of the active broker; returns true if another broker
+// was made active.
+bool garage_broker_record_failure(garage_broker_list_t *list, int64_t now_us);
+// True when a fallback is active and the primary is what a failover would
+// pick now: out of quarantine and within the margin of the fastest broker.
+bool garage_broker_primary_due(const garage_broker_list_t *list, int64_t now_us);
+void garage_broker_activate(garage_broker_list_t *list, size_t index);
+
+// Writes `"broker":{...}` (no surrounding braces) for the metrics payload.
+// Returns the length written, or 0 if it did not fit.
+size_t garage_broker_format(const garage_broker_list_t *list, char *out, size_t size);
@@ -0,0 +1,325 @@
+#include "garage_command.h"
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define COMMAND_JSON_MAX_DEPTH 16
+#define COMMAND_NUMBER_MAX_LEN 63
+
+typedef struct {
+    const char *cur;
+    const char *end;
+} json_cursor_t;
+
+static bool span_equals(json_span_t span, const char *literal, size_t literal_len)
+{
+    return span.len == literal_len && memcmp(span.ptr, literal, literal_len) == 0;
+}
+
+#define SPAN_IS(span, literal) span_equals((span), (literal), sizeof(literal) - 1)
+
+static command_field_id_t command_field_lookup(json_span_t key)
+{
+    switch (key.len) {
+        case 3:
+            return SPAN_IS(key, "tag") ? COMMAND_FIELD_TAG : COMMAND_FIELD_UNKNOWN;
+        case 4:
+            return SPAN_IS(key, "type") ? COMMAND_FIELD_TYPE : COMMAND_FIELD_UNKNOWN;
+        case 5:
+            return SPAN_IS(key, "asset") ? COMMAND_FIELD_ASSET : COMMAND_FIELD_UNKNOWN;
+        case 6:
+            if (SPAN_IS(key, "status")) {
+                return COMMAND_FIELD_STATUS;
+            }
+            return SPAN_IS(key, "detail") ? COMMAND_FIELD_DETAIL : COMMAND_FIELD_UNKNOWN;
+        case 9:
+            if (SPAN_IS(key, "timestamp")) {
+                return COMMAND_FIELD_TIMESTAMP;
+            }
+            return SPAN_IS(key, "requestId") ? COMMAND_FIELD_REQUEST_ID : COMMAND_FIELD_UNKNOWN;
+        case 10:
+            return SPAN_IS(key, "debounceMs") ? COMMAND_FIELD_DEBOUNCE_MS : COMMAND_FIELD_UNKNOWN;
+        case 12:
+            if (SPAN_IS(key, "relayPulseMs")) {
+                return COMMAND_FIELD_RELAY_PULSE_MS;
+            }
+            return SPAN_IS(key, "canaryQuorum") ? COMMAND_FIELD_CANARY_QUORUM : COMMAND_FIELD_UNKNOWN;
+        case 13:
+            return SPAN_IS(key, "canaryPercent") ? COMMAND_FIELD_CANARY_PERCENT : COMMAND_FIELD_UNKNOWN;
+        case 14:
+            return SPAN_IS(key, "rolloutWindowS") ? COMMAND_FIELD_ROLLOUT_WINDOW_S : COMMAND_FIELD_UNKNOWN;
+        case 18:
+            return SPAN_IS(key, "heartbeatIntervalS") ? COMMAND_FIELD_HEARTBEAT_INTERVAL_S : COMMAND_FIELD_UNKNOWN;
+        default:
+            return COMMAND_FIELD_UNKNOWN;
+    }
+}
+
+command_type_t garage_command_type_lookup(json_span_t type)
+{
+    switch (type.len) {
+        case 3:
+            return SPAN_IS(type, "ota") ? COMMAND_TYPE_OTA : COMMAND_TYPE_UNKNOWN;
+        case 4:
+            return SPAN_IS(type, "open") ? COMMAND_TYPE_OPEN : COMMAND_TYPE_UNKNOWN;
+        case 7:
+            return SPAN_IS(type, "metrics") ? COMMAND_TYPE_METRICS : COMMAND_TYPE_UNKNOWN;
+        case 13:
+            return SPAN_IS(type, "config_update") ? COMMAND_TYPE_CONFIG_UPDATE : COMMAND_TYPE_UNKNOWN;
+        default:
+            return COMMAND_TYPE_UNKNOWN;
+    }
+}
+
+// Any control byte or space, as in cJSON; NUL never gets here (see
+// garage_command_tokenize()).
+static void json_skip_ws(json_cursor_t *c)
+{
+    while (c->cur < c->end && (unsigned char)*c->cur <= ' ') {
+        ++c->cur;
+    }
+}
+
+static bool json_expect(json_cursor_t *c, char expected)
+{
+    json_skip_ws(c);
+    if (c->cur >= c->end || *c->cur != expected) {
+        return false;
+    }
+    ++c->cur;
+    return true;
+}
+
+// Reads the four hex digits of a \u escape at c->cur; false if any is not hex.
+static bool json_parse_hex4(json_cursor_t *c, unsigned *code)
+{
+    if (c->end - c->cur < 4) {
+        return false;
+    }
+    char digits[5];
+    for (int i = 0; i < 4; ++i) {
+        if (!isxdigit((unsigned char)c->cur[i])) {
+            return false;
+        }
+        digits[i] = c->cur[i];
+    }
+    digits[4] = '\0';
+    *code = (unsigned)strtoul(digits, NULL, 16);
+    c->cur += 4;
+    return true;
+}
+
+// c->cur is on the 'u'. Surrogates must come as a high/low pair, which is
+// what cJSON requires to decode them.
+static bool json_check_unicode_escape(json_cursor_t *c)
+{
+    unsigned first = 0;
+    ++c->cur;
+    if (!json_parse_hex4(c, &first) || (first >= 0xDC00 && first <= 0xDFFF)) {
+        return false;
+    }
+    if (first >= 0xD800 && first <= 0xDBFF) {
+        unsigned second = 0;
+        if (c->end - c->cur < 2 || c->cur[0] != '\\' || c->cur[1] != 'u') {
+            return false;
+        }
+        c->cur += 2;
+        if (!json_parse_hex4(c, &second) || second < 0xDC00 || second > 0xDFFF) {
+            return false;
+        }
+    }
+    --c->cur;  // the caller steps past the last digit
+    return true;
+}
+
+static bool json_parse_string(json_cursor_t *c, json_span_t *out)
+{
+    if (c->cur >= c->end || *c->cur != '"') {
+        return false;
+    }
+    const char *start = ++c->cur;
+    while (c->cur < c->end) {
+        char ch = *c->cur;
+        if (ch == '"') {
+            out->ptr = start;
+            out->len = (size_t)(c->cur - start);
+            ++c->cur;
+            return true;
+        }
+        if (ch == '\\') {
+            if (++c->cur >= c->end) {
+                return false;
+            }
+            if (*c->cur == 'u') {
+                if (!json_check_unicode_escape(c)) {
+                    return false;
+                }
+            } else if (!strchr("\"\\/bfnrt", *c->cur)) {
+                return false;
+            }
+        }
+        ++c->cur;
+    }
+    return false;
+}
+
+static bool json_parse_number(json_cursor_t *c, command_value_t *out)
+{
+    char token[COMMAND_NUMBER_MAX_LEN + 1];
+    size_t len = 0;
+    while (c->cur + len < c->end && len < COMMAND_NUMBER_MAX_LEN &&
+           strchr("0123456789+-.eE", c->cur[len]) && c->cur[len] != '\0') {
+        token[len] = c->cur[len];
+        ++len;
+    }
+    token[len] = '\0';
+
+    char *parsed_end = NULL;
+    double number = strtod(token, &parsed_end);
+    if (parsed_end == token) {
+        return false;
+    }
+
+    out->kind = COMMAND_VALUE_NUMBER;
+    out->text.ptr = c->cur;
+    out->text.len = (size_t)(parsed_end - token);
+    out->real = number;
+    // Same saturation cJSON applies when it fills valueint.
+    if (number >= INT_MAX) {
+        out->number = INT_MAX;
+    } else if (number <= (double)INT_MIN) {
+        out->number = INT_MIN;
+    } else {
+        out->number = (int)number;
+    }
+    c->cur += out->text.len;
+    return true;
+}
+
+static bool json_match_literal(json_cursor_t *c, const char *literal, size_t len)
+{
+    if ((size_t)(c->end - c->cur) < len || memcmp(c->cur, literal, len) != 0) {
+        return false;
+    }
+    c->cur += len;
+    return true;
+}
+
+static bool json_parse_value(json_cursor_t *c, command_value_t *out, int depth);
+
+static bool json_parse_container(json_cursor_t *c, char close, int depth)
+{
+    ++c->cur;
+    json_skip_ws(c);
+    if (c->cur < c->end && *c->cur == close) {
+        ++c->cur;
+        return true;
+    }
+    command_value_t ignored;
+    for (;;) {
+        json_skip_ws(c);
+        if (close == '}') {
+            json_span_t key;
+            if (!json_parse_string(c, &key) || !json_expect(c, ':')) {
+                return false;
+            }
+        }
+        if (!json_parse_value(c, &ignored, depth + 1)) {
+            return false;
+        }
+        json_skip_ws(c);
+        if (c->cur >= c->end) {
+            return false;
+        }
+        char ch = *c->cur++;
+        if (ch == close) {
+            return true;
+        }
+        if (ch != ',') {
+            return false;
+        }
+    }
+}
+
+static bool json_parse_value(json_cursor_t *c, command_value_t *out, int depth)
+{
+    json_skip_ws(c);
+    if (c->cur >= c->end || depth > COMMAND_JSON_MAX_DEPTH) {
+        return false;
+    }
+    out->kind = COMMAND_VALUE_OTHER;
+    switch (*c->cur) {
+        case '"':
+            out->kind = COMMAND_VALUE_STRING;
+            return json_parse_string(c, &out->text);
+        case '{':
+            return json_parse_container(c, '}', depth);
+        case '[':
+            return json_parse_container(c, ']', depth);
+        case 't':
+            return json_match_literal(c, "true", 4);
+        case 'f':
+            return json_match_literal(c, "false", 5);
+        case 'n':
+            return json_match_literal(c, "null", 4);
+        default:
+            if (*c->cur == '-' || isdigit((unsigned char)*c->cur)) {
+                return json_parse_number(c, out);
+            }
+            return false;
+    }
+}
+
+bool garage_command_tokenize(const char *data, size_t len, command_fields_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    // cJSON_Parse() saw the payload as a C string, so it ended at the first
+    // NUL; a leading UTF-8 byte order mark is skipped the same way.
+    json_cursor_t c = { .cur = data, .end = data + strnlen(data, len) };
+    if (c.end - c.cur >= 3 && memcmp(c.cur, "\xEF\xBB\xBF", 3) == 0) {
+        c.cur += 3;
+    }
+
+    json_skip_ws(&c);
+    if (c.cur >= c.end || *c.cur != '{') {
+        command_value_t ignored;
+        return json_parse_value(&c, &ignored, 0);
+    }
+
+    ++c.cur;
+    json_skip_ws(&c);
+    if (c.cur < c.end && *c.cur == '}') {
+        return true;
+    }
+    for (;;) {
+        json_span_t key;
+        json_skip_ws(&c);
+        if (!json_parse_string(&c, &key) || !json_expect(&c, ':')) {
+            return false;
+        }
+
+        command_value_t value;
+        if (!json_parse_value(&c, &value, 1)) {
+            return false;
+        }
+        command_field_id_t id = command_field_lookup(key);
+        // First occurrence wins, matching cJSON_GetObjectItemCaseSensitive.
+        if (id != COMMAND_FIELD_UNKNOWN && out->fields[id].kind == COMMAND_VALUE_ABSENT) {
+            out->fields[id] = value;
+        }
+
+        json_skip_ws(&c);
+        if (c.cur >= c.end) {
+            return false;
+        }
+        char ch = *c.cur++;
+        if (ch == '}') {
+            return true;
+        }
+        if (ch != ',') {
+            return false;
+        }
+    }
+}
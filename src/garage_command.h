@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * In-place command tokenizer. Walks an MQTT payload once without copying it
+ * or building a DOM, validating the whole top-level object and capturing only
+ * the keys the command handlers consume. String values are returned as spans
+ * into the payload with escapes left undecoded; every string we compare or
+ * forward (type, tag, asset) is restricted to plain ASCII anyway.
+ *
+ * Accepts what cJSON_Parse() accepts, including trailing bytes after the
+ * value, except for nesting deeper than 16 levels below the top-level
+ * object, numbers longer than 63 characters and \u escapes with non-hex
+ * digits (cJSON reads those as U+0000). Keys are matched as spelled, so an
+ * escaped key such as "typ\u0065" is not recognized. test/test_command
+ * checks the two against each other.
+ */
+
+typedef struct {
+    const char *ptr;
+    size_t len;
+} json_span_t;
+
+typedef enum {
+    COMMAND_FIELD_TYPE = 0,
+    COMMAND_FIELD_HEARTBEAT_INTERVAL_S,
+    COMMAND_FIELD_DEBOUNCE_MS,
+    COMMAND_FIELD_RELAY_PULSE_MS,
+    COMMAND_FIELD_TAG,
+    COMMAND_FIELD_ASSET,
+    COMMAND_FIELD_TIMESTAMP,
+    COMMAND_FIELD_REQUEST_ID,
+    COMMAND_FIELD_ROLLOUT_WINDOW_S,
+    COMMAND_FIELD_CANARY_PERCENT,
+    COMMAND_FIELD_CANARY_QUORUM,
+    // OTA status reports from other devices, read while a rollout waits on canaries.
+    COMMAND_FIELD_STATUS,
+    COMMAND_FIELD_DETAIL,
+    COMMAND_FIELD_COUNT,
+    COMMAND_FIELD_UNKNOWN = COMMAND_FIELD_COUNT,
+} command_field_id_t;
+
+typedef enum {
+    COMMAND_VALUE_ABSENT = 0,
+    COMMAND_VALUE_STRING,
+    COMMAND_VALUE_NUMBER,
+    COMMAND_VALUE_OTHER,
+} command_value_kind_t;
+
+typedef struct {
+    command_value_kind_t kind;
+    json_span_t text;
+    int number;   // saturated to int, like cJSON's valueint
+    double real;  // unsaturated, for epoch-millisecond timestamps
+} command_value_t;
+
+typedef struct {
+    command_value_t fields[COMMAND_FIELD_COUNT];
+} command_fields_t;
+
+typedef enum {
+    COMMAND_TYPE_UNKNOWN = 0,
+    COMMAND_TYPE_OPEN,
+    COMMAND_TYPE_CONFIG_UPDATE,
+    COMMAND_TYPE_OTA,
+    COMMAND_TYPE_METRICS,
+} command_type_t;
+
+// Returns false for malformed JSON. A well-formed non-object leaves every
+// field absent, which the caller reports as a missing type.
+bool garage_command_tokenize(const char *data, size_t len, command_fields_t *out);
+command_type_t garage_command_type_lookup(json_span_t type);
@@ -0,0 +1,481 @@
+#include "garage_config.h"
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cJSON.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "freertos/FreeRTOS.h"
+#include "garage_json_arena.h"
+#include "garage_metrics.h"
+#include "nvs.h"
+
+#define GARAGE_CONFIG_JSON_KEY "config"
+#define GARAGE_CONFIG_BLOB_KEY "config_bin"
+#define GARAGE_CONFIG_MAGIC 0x47434647u  // "GCFG"
+// Bump whenever garage_config_t changes layout; older records are then
+// ignored and rebuilt from the JSON config.
+#define GARAGE_CONFIG_SCHEMA_VERSION 2
+#define GARAGE_LINK_CACHE_KEY "link_cache"
+#define GARAGE_LINK_CACHE_MAGIC 0x474c4e4bu  // "GLNK"
+// cJSON needs roughly one node per value plus copies of keys and strings;
+// this covers a flat config object with room to spare.
+#define JSON_ARENA_SIZE(json_size) ((json_size) * 3 + 512)
+
+static const char *TAG = "garage";
+
+typedef enum {
+    CONFIG_FIELD_WIFI_SSID = 0,
+    CONFIG_FIELD_WIFI_PASSWORD,
+    CONFIG_FIELD_DEVICE_ID,
+    CONFIG_FIELD_MQTT_HOST,
+    CONFIG_FIELD_MQTT_PORT,
+    CONFIG_FIELD_MQTT_USERNAME,
+    CONFIG_FIELD_MQTT_PASSWORD,
+    CONFIG_FIELD_RELAY_GPIO,
+    CONFIG_FIELD_STATUS_LED_GPIO,
+    CONFIG_FIELD_RELAY_ACTIVE_HIGH,
+    CONFIG_FIELD_RELAY_PULSE_MS,
+    CONFIG_FIELD_DEBOUNCE_MS,
+    CONFIG_FIELD_HEARTBEAT_INTERVAL_S,
+    CONFIG_FIELD_OTA_REPO_OWNER,
+    CONFIG_FIELD_OTA_REPO_NAME,
+    CONFIG_FIELD_COUNT,
+} config_field_t;
+
+// JSON keys used by garage_config_template.json / scripts/flash-config.ps1.
+static const char *const s_json_keys[CONFIG_FIELD_COUNT] = {
+    [CONFIG_FIELD_WIFI_SSID] = "CONFIG_GARAGE_WIFI_SSID",
+    [CONFIG_FIELD_WIFI_PASSWORD] = "CONFIG_GARAGE_WIFI_PASSWORD",
+    [CONFIG_FIELD_DEVICE_ID] = "CONFIG_GARAGE_DEVICE_ID",
+    [CONFIG_FIELD_MQTT_HOST] = "CONFIG_GARAGE_MQTT_HOST",
+    [CONFIG_FIELD_MQTT_PORT] = "CONFIG_GARAGE_MQTT_PORT",
+    [CONFIG_FIELD_MQTT_USERNAME] = "CONFIG_GARAGE_MQTT_USERNAME",
+    [CONFIG_FIELD_MQTT_PASSWORD] = "CONFIG_GARAGE_MQTT_PASSWORD",
+    [CONFIG_FIELD_RELAY_GPIO] = "CONFIG_GARAGE_RELAY_GPIO",
+    [CONFIG_FIELD_STATUS_LED_GPIO] = "CONFIG_GARAGE_STATUS_LED_GPIO",
+    [CONFIG_FIELD_RELAY_ACTIVE_HIGH] = "CONFIG_GARAGE_RELAY_ACTIVE_HIGH",
+    [CONFIG_FIELD_RELAY_PULSE_MS] = "CONFIG_GARAGE_RELAY_PULSE_MS",
+    [CONFIG_FIELD_DEBOUNCE_MS] = "CONFIG_GARAGE_DEBOUNCE_MS",
+    [CONFIG_FIELD_HEARTBEAT_INTERVAL_S] = "CONFIG_GARAGE_HEARTBEAT_INTERVAL_S",
+    [CONFIG_FIELD_OTA_REPO_OWNER] = "CONFIG_GARAGE_OTA_REPO_OWNER",
+    [CONFIG_FIELD_OTA_REPO_NAME] = "CONFIG_GARAGE_OTA_REPO_NAME",
+};
+
+#define CONFIG_FIELD_BIT(field) (UINT32_C(1) << (field))
+#define CONFIG_REQUIRED_FIELDS \
+    (CONFIG_FIELD_BIT(CONFIG_FIELD_WIFI_SSID) | CONFIG_FIELD_BIT(CONFIG_FIELD_DEVICE_ID) | \
+     CONFIG_FIELD_BIT(CONFIG_FIELD_MQTT_HOST))
+
+typedef struct {
+    uint32_t magic;
+    uint16_t schema_version;
+    uint16_t payload_size;
+    uint32_t present;
+    garage_config_t config;
+    uint32_t crc;  // over every byte before this field
+} garage_config_record_t;
+
+static garage_config_record_t s_record;
+
+typedef enum {
+    CONFIG_TUNABLE_HEARTBEAT_INTERVAL_S = 0,
+    CONFIG_TUNABLE_DEBOUNCE_MS,
+    CONFIG_TUNABLE_RELAY_PULSE_MS,
+    CONFIG_TUNABLE_COUNT,
+} config_tunable_t;
+
+// Per-field i32 keys that override the record; written by garage_config_flush().
+static const char *const s_tunable_keys[CONFIG_TUNABLE_COUNT] = {
+    [CONFIG_TUNABLE_HEARTBEAT_INTERVAL_S] = "heartbeat_s",
+    [CONFIG_TUNABLE_DEBOUNCE_MS] = "debounce_ms",
+    [CONFIG_TUNABLE_RELAY_PULSE_MS] = "relay_pulse_ms",
+};
+
+// Staged and flushed on the control task.
+static portMUX_TYPE s_tunables_lock = portMUX_INITIALIZER_UNLOCKED;
+static int32_t s_staged_tunables[CONFIG_TUNABLE_COUNT];
+static int32_t s_flushed_tunables[CONFIG_TUNABLE_COUNT];
+static uint32_t s_staged_updates;
+
+typedef struct {
+    uint32_t magic;
+    garage_link_cache_t cache;
+    uint32_t crc;  // over every byte before this field
+} garage_link_cache_record_t;
+
+// Mirrors flash so unchanged caches are not rewritten on every reconnect.
+static garage_link_cache_record_t s_link_cache_record;
+
+// Values used for optional fields the stored config does not carry; they
+// mirror the Kconfig defaults.
+static const garage_config_t s_defaults = {
+    .wifi_password = "",
+    .mqtt_port = 8883,
+    .mqtt_username = "",
+    .mqtt_password = "",
+    .relay_gpio = 2,
+    .status_led_gpio = 1,
+    .relay_active_high = true,
+    .relay_pulse_ms = 500,
+    .debounce_ms = 30000,
+    .heartbeat_interval_s = 3600,
+    .ota_repo_owner = "",
+    .ota_repo_name = "",
+};
+
+static uint32_t record_crc(const garage_config_record_t *record)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)record, offsetof(garage_config_record_t, crc));
+}
+
+static bool record_is_valid(const garage_config_record_t *record)
+{
+    return record->magic == GARAGE_CONFIG_MAGIC &&
+           record->schema_version == GARAGE_CONFIG_SCHEMA_VERSION &&
+           record->payload_size == sizeof(record->config) &&
+           (record->present & CONFIG_REQUIRED_FIELDS) == CONFIG_REQUIRED_FIELDS &&
+           record->crc == record_crc(record);
+}
+
+static esp_err_t write_record(nvs_handle_t handle, garage_config_record_t *record)
+{
+    record->magic = GARAGE_CONFIG_MAGIC;
+    record->schema_version = GARAGE_CONFIG_SCHEMA_VERSION;
+    record->payload_size = sizeof(record->config);
+    record->crc = record_crc(record);
+
+    esp_err_t err = nvs_set_blob(handle, GARAGE_CONFIG_BLOB_KEY, record, sizeof(*record));
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    return err;
+}
+
+static int *tunable_field(garage_config_t *config, config_tunable_t tunable)
+{
+    switch (tunable) {
+        case CONFIG_TUNABLE_HEARTBEAT_INTERVAL_S:
+            return &config->heartbeat_interval_s;
+        case CONFIG_TUNABLE_DEBOUNCE_MS:
+            return &config->debounce_ms;
+        case CONFIG_TUNABLE_RELAY_PULSE_MS:
+            return &config->relay_pulse_ms;
+        default:
+            return NULL;
+    }
+}
+
+static void load_tunable_overrides(nvs_handle_t handle, garage_config_t *config)
+{
+    for (unsigned tunable = 0; tunable < CONFIG_TUNABLE_COUNT; ++tunable) {
+        int *field = tunable_field(config, (config_tunable_t)tunable);
+        int32_t value = 0;
+        if (nvs_get_i32(handle, s_tunable_keys[tunable], &value) == ESP_OK) {
+            *field = (int)value;
+        }
+        s_staged_tunables[tunable] = *field;
+        s_flushed_tunables[tunable] = *field;
+    }
+    s_staged_updates = 0;
+}
+
+static bool json_copy_string(const cJSON *root, const char *key, char *dst, size_t dst_size)
+{
+    const cJSON *item = cJSON_GetObjectItemCaseSensitive(root, key);
+    if (!cJSON_IsString(item) || !item->valuestring) {
+        return false;
+    }
+    if (strlen(item->valuestring) >= dst_size) {
+        ESP_LOGE(TAG, "Config field %s longer than %u bytes", key, (unsigned)(dst_size - 1));
+        return false;
+    }
+    strcpy(dst, item->valuestring);
+    return true;
+}
+
+static bool json_read_int(const cJSON *root, const char *key, int *dst)
+{
+    const cJSON *item = cJSON_GetObjectItemCaseSensitive(root, key);
+    if (!cJSON_IsNumber(item)) {
+        return false;
+    }
+    *dst = item->valueint;
+    return true;
+}
+
+static bool json_read_bool(const cJSON *root, const char *key, bool *dst)
+{
+    const cJSON *item = cJSON_GetObjectItemCaseSensitive(root, key);
+    if (cJSON_IsBool(item)) {
+        *dst = cJSON_IsTrue(item);
+        return true;
+    }
+    if (cJSON_IsNumber(item)) {
+        *dst = item->valueint != 0;
+        return true;
+    }
+    if (cJSON_IsString(item) && item->valuestring) {
+        char c = (char)tolower((unsigned char)item->valuestring[0]);
+        if (c == 'y' || c == 't' || c == '1') {
+            *dst = true;
+            return true;
+        }
+        if (c == 'n' || c == 'f' || c == '0') {
+            *dst = false;
+            return true;
+        }
+    }
+    return false;
+}
+
+// One-time conversion of the flashed JSON config into s_record.
+static esp_err_t migrate_json_config(nvs_handle_t handle)
+{
+    size_t json_size = 0;
+    esp_err_t err = nvs_get_str(handle, GARAGE_CONFIG_JSON_KEY, NULL, &json_size);
+    if (err != ESP_OK || json_size == 0) {
+        return err != ESP_OK ? err : ESP_ERR_NOT_FOUND;
+    }
+
+    // One allocation holds the JSON text and every cJSON node, and is
+    // released in one piece instead of dozens of small frees.
+    size_t arena_size = json_size + JSON_ARENA_SIZE(json_size);
+    void *arena_buffer = malloc(arena_size);
+    if (!arena_buffer) {
+        return ESP_ERR_NO_MEM;
+    }
+    garage_json_arena_t arena;
+    garage_json_arena_begin(&arena, arena_buffer, arena_size);
+
+    char *json = garage_json_arena_alloc(json_size);
+    err = json ? nvs_get_str(handle, GARAGE_CONFIG_JSON_KEY, json, &json_size) : ESP_ERR_NO_MEM;
+    cJSON *root = err == ESP_OK ? cJSON_Parse(json) : NULL;
+    if (!root) {
+        garage_json_arena_end(&arena);
+        free(arena_buffer);
+        if (err != ESP_OK) {
+            return err;
+        }
+        ESP_LOGE(TAG, "Failed to parse garage config JSON");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(&s_record, 0, sizeof(s_record));
+    garage_config_t *cfg = &s_record.config;
+    *cfg = s_defaults;
+    uint32_t present = 0;
+
+#define MIGRATE_STRING(field, member) \
+    present |= json_copy_string(root, s_json_keys[field], cfg->member, sizeof(cfg->member)) ? CONFIG_FIELD_BIT(field) : 0
+#define MIGRATE_INT(field, member) \
+    present |= json_read_int(root, s_json_keys[field], &cfg->member) ? CONFIG_FIELD_BIT(field) : 0
+
+    MIGRATE_STRING(CONFIG_FIELD_WIFI_SSID, wifi_ssid);
+    MIGRATE_STRING(CONFIG_FIELD_WIFI_PASSWORD, wifi_password);
+    MIGRATE_STRING(CONFIG_FIELD_DEVICE_ID, device_id);
+    MIGRATE_STRING(CONFIG_FIELD_MQTT_HOST, mqtt_host);
+    MIGRATE_INT(CONFIG_FIELD_MQTT_PORT, mqtt_port);
+    MIGRATE_STRING(CONFIG_FIELD_MQTT_USERNAME, mqtt_username);
+    MIGRATE_STRING(CONFIG_FIELD_MQTT_PASSWORD, mqtt_password);
+    MIGRATE_INT(CONFIG_FIELD_RELAY_GPIO, relay_gpio);
+    MIGRATE_INT(CONFIG_FIELD_STATUS_LED_GPIO, status_led_gpio);
+    if (json_read_bool(root, s_json_keys[CONFIG_FIELD_RELAY_ACTIVE_HIGH], &cfg->relay_active_high)) {
+        present |= CONFIG_FIELD_BIT(CONFIG_FIELD_RELAY_ACTIVE_HIGH);
+    }
+    MIGRATE_INT(CONFIG_FIELD_RELAY_PULSE_MS, relay_pulse_ms);
+    MIGRATE_INT(CONFIG_FIELD_DEBOUNCE_MS, debounce_ms);
+    MIGRATE_INT(CONFIG_FIELD_HEARTBEAT_INTERVAL_S, heartbeat_interval_s);
+    MIGRATE_STRING(CONFIG_FIELD_OTA_REPO_OWNER, ota_repo_owner);
+    MIGRATE_STRING(CONFIG_FIELD_OTA_REPO_NAME, ota_repo_name);
+
+#undef MIGRATE_STRING
+#undef MIGRATE_INT
+
+    cJSON_Delete(root);
+    ESP_LOGI(TAG, "Config JSON parsed in %u of %u arena bytes (%" PRIu32 " allocations, %" PRIu32 " on heap)",
+             (unsigned)arena.high_water, (unsigned)arena.size, arena.allocations, arena.heap_fallbacks);
+    garage_json_arena_end(&arena);
+    free(arena_buffer);
+
+    if ((present & CONFIG_REQUIRED_FIELDS) != CONFIG_REQUIRED_FIELDS) {
+        ESP_LOGE(TAG, "Config JSON lacks Wi-Fi SSID, device id or MQTT host");
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (int field = 0; field < CONFIG_FIELD_COUNT; ++field) {
+        if (!(present & CONFIG_FIELD_BIT(field))) {
+            ESP_LOGW(TAG, "Config field %s missing from JSON; using default", s_json_keys[field]);
+        }
+    }
+
+    s_record.present = present;
+    err = write_record(handle, &s_record);
+    if (err != ESP_OK) {
+        // The parsed values are still usable for this boot; retry next time.
+        ESP_LOGW(TAG, "Failed to store binary config: %s", esp_err_to_name(err));
+    } else {
+        ESP_LOGI(TAG, "Migrated JSON config to binary record v%d", GARAGE_CONFIG_SCHEMA_VERSION);
+    }
+    return ESP_OK;
+}
+
+esp_err_t garage_config_load(garage_config_t *out)
+{
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(GARAGE_CONFIG_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open NVS namespace '%s': %s", GARAGE_CONFIG_NAMESPACE, esp_err_to_name(err));
+        return err;
+    }
+
+    size_t size = sizeof(s_record);
+    err = nvs_get_blob(handle, GARAGE_CONFIG_BLOB_KEY, &s_record, &size);
+    if (err != ESP_OK || size != sizeof(s_record) || !record_is_valid(&s_record)) {
+        if (err == ESP_OK) {
+            ESP_LOGW(TAG, "Binary config record invalid or outdated; rebuilding from JSON");
+        }
+        err = migrate_json_config(handle);
+    }
+    if (err != ESP_OK) {
+        nvs_close(handle);
+        return err;
+    }
+
+    *out = s_record.config;
+    load_tunable_overrides(handle, out);
+    nvs_close(handle);
+    return ESP_OK;
+}
+
+void garage_config_stage(const garage_config_t *config)
+{
+    if (!config) {
+        return;
+    }
+
+    // Only the tunables; the whole struct is too large for a stack copy.
+    const int32_t values[CONFIG_TUNABLE_COUNT] = {
+        [CONFIG_TUNABLE_HEARTBEAT_INTERVAL_S] = config->heartbeat_interval_s,
+        [CONFIG_TUNABLE_DEBOUNCE_MS] = config->debounce_ms,
+        [CONFIG_TUNABLE_RELAY_PULSE_MS] = config->relay_pulse_ms,
+    };
+    taskENTER_CRITICAL(&s_tunables_lock);
+    memcpy(s_staged_tunables, values, sizeof(values));
+    ++s_staged_updates;
+    taskEXIT_CRITICAL(&s_tunables_lock);
+
+    garage_metrics_count(GARAGE_COUNTER_CONFIG_UPDATES, 1);
+}
+
+esp_err_t garage_config_flush(void)
+{
+    int32_t staged[CONFIG_TUNABLE_COUNT];
+    taskENTER_CRITICAL(&s_tunables_lock);
+    memcpy(staged, s_staged_tunables, sizeof(staged));
+    uint32_t updates = s_staged_updates;
+    s_staged_updates = 0;
+    taskEXIT_CRITICAL(&s_tunables_lock);
+
+    if (updates == 0) {
+        return ESP_OK;
+    }
+
+    nvs_handle_t handle;
+    unsigned changed = 0;
+    esp_err_t err = nvs_open(GARAGE_CONFIG_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        for (unsigned tunable = 0; err == ESP_OK && tunable < CONFIG_TUNABLE_COUNT; ++tunable) {
+            if (staged[tunable] == s_flushed_tunables[tunable]) {
+                continue;
+            }
+            err = nvs_set_i32(handle, s_tunable_keys[tunable], staged[tunable]);
+            ++changed;
+        }
+        if (err == ESP_OK && changed > 0) {
+            err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (err != ESP_OK) {
+        // Keep the updates pending so the next flush retries them.
+        taskENTER_CRITICAL(&s_tunables_lock);
+        s_staged_updates += updates;
+        taskEXIT_CRITICAL(&s_tunables_lock);
+        return err;
+    }
+
+    memcpy(s_flushed_tunables, staged, sizeof(staged));
+    uint32_t commits = changed > 0 ? 1 : 0;
+    garage_metrics_count(GARAGE_COUNTER_CONFIG_COMMITS, commits);
+    garage_metrics_count(GARAGE_COUNTER_CONFIG_COMMITS_AVOIDED, updates - commits);
+    ESP_LOGI(TAG, "Flushed %u config field(s) for %" PRIu32 " update(s)", changed, updates);
+    return ESP_OK;
+}
+
+static uint32_t link_cache_crc(const garage_link_cache_record_t *record)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)record, offsetof(garage_link_cache_record_t, crc));
+}
+
+esp_err_t garage_config_load_link_cache(garage_link_cache_t *out)
+{
+    if (!out) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(GARAGE_CONFIG_NAMESPACE, NVS_READONLY, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    garage_link_cache_record_t record;
+    size_t size = sizeof(record);
+    err = nvs_get_blob(handle, GARAGE_LINK_CACHE_KEY, &record, &size);
+    nvs_close(handle);
+    if (err != ESP_OK) {
+        return err == ESP_ERR_NVS_NOT_FOUND ? ESP_ERR_NOT_FOUND : err;
+    }
+    if (size != sizeof(record) || record.magic != GARAGE_LINK_CACHE_MAGIC || record.crc != link_cache_crc(&record)) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    s_link_cache_record = record;
+    *out = record.cache;
+    return ESP_OK;
+}
+
+esp_err_t garage_config_save_link_cache(const garage_link_cache_t *cache)
+{
+    if (!cache) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    garage_link_cache_record_t record;
+    memset(&record, 0, sizeof(record));
+    record.magic = GARAGE_LINK_CACHE_MAGIC;
+    record.cache = *cache;
+    record.crc = link_cache_crc(&record);
+    if (memcmp(&record, &s_link_cache_record, sizeof(record)) == 0) {
+        return ESP_OK;
+    }
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(GARAGE_CONFIG_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_blob(handle, GARAGE_LINK_CACHE_KEY, &record, sizeof(record));
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    if (err == ESP_OK) {
+        s_link_cache_record = record;
+    }
+    return err;
+}
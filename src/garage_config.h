@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "garage_broker.h"
+
+#define GARAGE_CONFIG_NAMESPACE "garage"
+
+// Field capacities include the terminating NUL.
+#define GARAGE_CONFIG_SSID_LEN 33
+#define GARAGE_CONFIG_WIFI_PASSWORD_LEN 65
+#define GARAGE_CONFIG_DEVICE_ID_LEN 64
+// Up to GARAGE_BROKER_MAX full broker URIs; each URI's NUL slot pays for a
+// separating comma.
+#define GARAGE_CONFIG_HOST_LEN (GARAGE_BROKER_MAX * GARAGE_BROKER_URI_LEN)
+#define GARAGE_CONFIG_USERNAME_LEN 64
+#define GARAGE_CONFIG_PASSWORD_LEN 128
+#define GARAGE_CONFIG_REPO_OWNER_LEN 40
+#define GARAGE_CONFIG_REPO_NAME_LEN 101
+
+typedef struct {
+    char wifi_ssid[GARAGE_CONFIG_SSID_LEN];
+    char wifi_password[GARAGE_CONFIG_WIFI_PASSWORD_LEN];
+    char device_id[GARAGE_CONFIG_DEVICE_ID_LEN];
+    char mqtt_host[GARAGE_CONFIG_HOST_LEN];
+    int mqtt_port;
+    char mqtt_username[GARAGE_CONFIG_USERNAME_LEN];
+    char mqtt_password[GARAGE_CONFIG_PASSWORD_LEN];
+    int relay_gpio;
+    int status_led_gpio;
+    bool relay_active_high;
+    int relay_pulse_ms;
+    int debounce_ms;
+    int heartbeat_interval_s;
+    char ota_repo_owner[GARAGE_CONFIG_REPO_OWNER_LEN];
+    char ota_repo_name[GARAGE_CONFIG_REPO_NAME_LEN];
+} garage_config_t;
+
+/*
+ * Loads the typed binary config record (NVS blob "config_bin") into *out
+ * without parsing or heap use. When the record is missing or fails its
+ * version/CRC check, the legacy JSON string under key "config" is parsed
+ * once and migrated to a fresh record.
+ */
+esp_err_t garage_config_load(garage_config_t *out);
+
+/*
+ * Write-behind persistence for the runtime tunables (heartbeat interval,
+ * debounce, relay pulse). garage_config_stage() only records the values in
+ * RAM; garage_config_flush() writes the ones that differ from flash as
+ * individual NVS keys layered over the binary record and commits once, so
+ * a burst of config_update commands costs at most one flash commit.
+ */
+void garage_config_stage(const garage_config_t *config);
+esp_err_t garage_config_flush(void);
+
+// Last successful Wi-Fi association and DHCP lease, used to skip the full
+// scan (and optionally DHCP) on the next connect. Addresses are stored as
+// esp_ip4_addr_t.addr values.
+typedef struct {
+    uint32_t ip;
+    uint32_t netmask;
+    uint32_t gateway;
+    uint32_t dns;
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t reserved;  // keeps the struct free of padding for the CRC
+} garage_link_cache_t;
+
+// Returns ESP_ERR_NOT_FOUND when no valid cache is stored.
+esp_err_t garage_config_load_link_cache(garage_link_cache_t *out);
+// Writes the cache only when it differs from what is already stored.
+esp_err_t garage_config_save_link_cache(const garage_link_cache_t *cache);
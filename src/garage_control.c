@@ -0,0 +1,185 @@
+#include "garage_control.h"
+
+#include <stddef.h>
+
+#include "esp_log.h"
+#include "garage_hal.h"
+#include "garage_publish.h"
+
+static const char *TAG = "garage";
+
+static garage_state_t s_state = GARAGE_STATE_LISTENING;
+static int64_t s_last_trigger_us = 0;
+static int s_relay_pulse_ms = 0;
+static int s_debounce_ms = 0;
+
+void garage_control_init(int relay_pulse_ms, int debounce_ms)
+{
+    s_state = GARAGE_STATE_LISTENING;
+    s_last_trigger_us = 0;
+    s_relay_pulse_ms = relay_pulse_ms;
+    s_debounce_ms = debounce_ms;
+}
+
+void garage_control_set_relay_pulse_ms(int relay_pulse_ms)
+{
+    s_relay_pulse_ms = relay_pulse_ms;
+}
+
+void garage_control_set_debounce_ms(int debounce_ms)
+{
+    s_debounce_ms = debounce_ms;
+}
+
+const char *garage_state_to_string(garage_state_t state)
+{
+    switch (state) {
+        case GARAGE_STATE_LISTENING:
+            return "LISTENING";
+        case GARAGE_STATE_TRIGGERING:
+            return "TRIGGERING";
+        case GARAGE_STATE_THROTTLED:
+            return "THROTTLED";
+        case GARAGE_STATE_UPDATING:
+            return "UPDATING";
+        default:
+            return "UNKNOWN";
+    }
+}
+
+const char *garage_open_result_to_string(garage_open_result_t result)
+{
+    switch (result) {
+        case GARAGE_OPEN_TRIGGERED:
+            return "triggered";
+        case GARAGE_OPEN_BUSY:
+            return "busy";
+        case GARAGE_OPEN_COOLDOWN:
+            return "cooldown";
+        case GARAGE_OPEN_UPDATING:
+            return "updating";
+        default:
+            return "unknown";
+    }
+}
+
+garage_state_t garage_control_state(void)
+{
+    return s_state;
+}
+
+static void update_status_led(void)
+{
+    garage_hal_status_led_set(s_state != GARAGE_STATE_LISTENING);
+}
+
+static void publish_state(const char *extra_key, int32_t extra_value)
+{
+    garage_publish_state(GARAGE_PUBLISH_STATE, s_state, true, extra_key, extra_value);
+}
+
+void garage_control_set_state(garage_state_t state)
+{
+    s_state = state;
+    update_status_led();
+    publish_state(NULL, 0);
+}
+
+int32_t garage_control_remaining_cooldown_ms(void)
+{
+    if (s_last_trigger_us == 0 || s_debounce_ms <= 0) {
+        return 0;
+    }
+    int64_t elapsed_us = garage_hal_now_us() - s_last_trigger_us;
+    if (elapsed_us < 0) {
+        return s_debounce_ms;
+    }
+    int32_t remaining = s_debounce_ms - (int32_t)(elapsed_us / 1000);
+    return remaining > 0 ? remaining : 0;
+}
+
+void garage_control_throttle_expired(void)
+{
+    if (s_state != GARAGE_STATE_THROTTLED) {
+        return;
+    }
+    s_state = GARAGE_STATE_LISTENING;
+    update_status_led();
+    publish_state(NULL, 0);
+}
+
+void garage_control_publish_heartbeat(void)
+{
+    const char *extra_key = NULL;
+    int32_t extra_value = 0;
+    if (s_state == GARAGE_STATE_THROTTLED) {
+        extra_key = "cooldownMs";
+        extra_value = garage_control_remaining_cooldown_ms();
+    }
+    garage_publish_state(GARAGE_PUBLISH_HEARTBEAT, s_state, false, extra_key, extra_value);
+}
+
+void garage_control_publish_snapshot(void)
+{
+    const char *extra_key = NULL;
+    int32_t extra_value = 0;
+    if (s_state == GARAGE_STATE_THROTTLED) {
+        extra_key = "cooldownMs";
+        extra_value = garage_control_remaining_cooldown_ms();
+    }
+    publish_state(extra_key, extra_value);
+}
+
+garage_open_result_t garage_control_open(void)
+{
+    if (s_state == GARAGE_STATE_UPDATING) {
+        ESP_LOGW(TAG, "Ignoring open command during OTA update");
+        publish_state(NULL, 0);
+        return GARAGE_OPEN_UPDATING;
+    }
+
+    int32_t remaining = garage_control_remaining_cooldown_ms();
+    if (s_state == GARAGE_STATE_TRIGGERING) {
+        ESP_LOGW(TAG, "Relay already triggering; ignoring duplicate open command");
+        publish_state(NULL, 0);
+        return GARAGE_OPEN_BUSY;
+    }
+
+    if (remaining > 0) {
+        ESP_LOGI(TAG, "Debounce active (%d ms remaining)", (int)remaining);
+        publish_state("cooldownMs", remaining);
+        return GARAGE_OPEN_COOLDOWN;
+    }
+
+    s_state = GARAGE_STATE_TRIGGERING;
+    update_status_led();
+    publish_state("durationMs", s_relay_pulse_ms);
+
+    garage_hal_relay_set(true);
+
+    // The pulse timer releases the relay and reports back through
+    // garage_control_relay_pulse_done(), so the control context keeps
+    // serving other commands while the relay is held.
+    if (!garage_hal_relay_pulse_start((uint32_t)s_relay_pulse_ms)) {
+        ESP_LOGE(TAG, "Failed to start relay pulse timer");
+        garage_hal_relay_set(false);
+        garage_control_relay_pulse_done(garage_hal_now_us());
+    }
+    return GARAGE_OPEN_TRIGGERED;
+}
+
+void garage_control_relay_pulse_done(int64_t released_us)
+{
+    if (s_state != GARAGE_STATE_TRIGGERING) {
+        return;
+    }
+
+    s_last_trigger_us = released_us;
+    s_state = GARAGE_STATE_THROTTLED;
+    update_status_led();
+    publish_state("cooldownMs", s_debounce_ms);
+
+    if (s_debounce_ms > 0) {
+        garage_hal_debounce_start((uint32_t)s_debounce_ms);
+    }
+}
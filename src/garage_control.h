@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+    GARAGE_STATE_LISTENING = 0,
+    GARAGE_STATE_TRIGGERING,
+    GARAGE_STATE_THROTTLED,
+    GARAGE_STATE_UPDATING,
+} garage_state_t;
+
+typedef enum {
+    GARAGE_OPEN_TRIGGERED = 0,
+    GARAGE_OPEN_BUSY,      // relay pulse already in progress
+    GARAGE_OPEN_COOLDOWN,  // debounce window still running
+    GARAGE_OPEN_UPDATING,  // OTA in progress
+} garage_open_result_t;
+
+/*
+ * Relay/debounce state machine. Every entry point must be called from a
+ * single context (control_task on the device); platform effects go through
+ * garage_hal.h so the same code runs against host shims.
+ */
+void garage_control_init(int relay_pulse_ms, int debounce_ms);
+void garage_control_set_relay_pulse_ms(int relay_pulse_ms);
+void garage_control_set_debounce_ms(int debounce_ms);
+
+garage_state_t garage_control_state(void);
+// Forces a state (used around OTA), updating the LED and retained state.
+void garage_control_set_state(garage_state_t state);
+const char *garage_state_to_string(garage_state_t state);
+int32_t garage_control_remaining_cooldown_ms(void);
+
+garage_open_result_t garage_control_open(void);
+const char *garage_open_result_to_string(garage_open_result_t result);
+void garage_control_relay_pulse_done(int64_t released_us);
+void garage_control_throttle_expired(void);
+void garage_control_publish_heartbeat(void);
+void garage_control_publish_snapshot(void);
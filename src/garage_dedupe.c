@@ -0,0 +1,94 @@
+#include "garage_dedupe.h"
+
+#include <ctype.h>
+#include <string.h>
+
+#define DEDUPE_SLOT_COUNT 16
+
+typedef struct {
+    uint32_t hash;
+    uint8_t len;
+    char id[GARAGE_REQUEST_ID_MAX_LEN];
+    int64_t seen_us;  // 0 for an empty slot
+} dedupe_entry_t;
+
+static dedupe_entry_t s_entries[DEDUPE_SLOT_COUNT];
+static unsigned s_next_slot = 0;
+static int64_t s_ttl_us = 0;
+
+// FNV-1a; only used to skip full compares against unrelated ids.
+static uint32_t id_hash(const char *id, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= (uint8_t)id[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static dedupe_entry_t *find_entry(const char *id, size_t len, uint32_t hash)
+{
+    for (unsigned i = 0; i < DEDUPE_SLOT_COUNT; ++i) {
+        dedupe_entry_t *entry = &s_entries[i];
+        if (entry->seen_us != 0 && entry->hash == hash && entry->len == len && memcmp(entry->id, id, len) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+void garage_dedupe_init(uint32_t ttl_ms)
+{
+    memset(s_entries, 0, sizeof(s_entries));
+    s_next_slot = 0;
+    s_ttl_us = (int64_t)ttl_ms * 1000;
+}
+
+bool garage_dedupe_id_is_valid(const char *id, size_t len)
+{
+    if (!id || len == 0 || len > GARAGE_REQUEST_ID_MAX_LEN) {
+        return false;
+    }
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char ch = (unsigned char)id[i];
+        if (!isalnum(ch) && ch != '-' && ch != '_' && ch != '.' && ch != ':') {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool garage_dedupe_check_and_insert(const char *id, size_t len, int64_t now_us)
+{
+    if (len > GARAGE_REQUEST_ID_MAX_LEN) {
+        return false;
+    }
+
+    uint32_t hash = id_hash(id, len);
+    dedupe_entry_t *entry = find_entry(id, len, hash);
+    if (entry && now_us - entry->seen_us <= s_ttl_us) {
+        return true;
+    }
+
+    if (!entry) {
+        entry = &s_entries[s_next_slot];
+        s_next_slot = (s_next_slot + 1) % DEDUPE_SLOT_COUNT;
+    }
+    entry->hash = hash;
+    entry->len = (uint8_t)len;
+    memcpy(entry->id, id, len);
+    entry->seen_us = now_us > 0 ? now_us : 1;
+    return false;
+}
+
+void garage_dedupe_forget(const char *id, size_t len)
+{
+    if (len > GARAGE_REQUEST_ID_MAX_LEN) {
+        return;
+    }
+    dedupe_entry_t *entry = find_entry(id, len, id_hash(id, len));
+    if (entry) {
+        entry->seen_us = 0;
+    }
+}
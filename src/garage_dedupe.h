@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Longest requestId accepted; fits a UUID with room to spare.
+#define GARAGE_REQUEST_ID_MAX_LEN 40
+
+/*
+ * Fixed-size cache of recently seen command requestIds, so a QoS1
+ * redelivery or a double-tap is acknowledged without running the command
+ * twice. Entries live in a ring: the oldest is overwritten once the ring is
+ * full, and entries older than the TTL no longer match. Not thread-safe;
+ * the firmware serializes the MQTT and local API callers.
+ */
+void garage_dedupe_init(uint32_t ttl_ms);
+
+// requestIds are restricted to [A-Za-z0-9._:-] so they can be echoed as-is.
+bool garage_dedupe_id_is_valid(const char *id, size_t len);
+
+// Returns true if id was seen within the TTL; otherwise records it.
+bool garage_dedupe_check_and_insert(const char *id, size_t len, int64_t now_us);
+
+// Drops id again, e.g. when the command could not be queued and a retry
+// with the same id should run.
+void garage_dedupe_forget(const char *id, size_t len);
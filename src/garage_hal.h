@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Platform services used by the portable control core (garage_control.c,
+ * garage_publish.c). The firmware implements them in main.c on top of GPIO,
+ * esp_timer, FreeRTOS timers and esp-mqtt; a host build links its own shims
+ * (recorded GPIO edges, a fake clock, an in-process broker) instead.
+ */
+
+void garage_hal_relay_set(bool active);
+void garage_hal_status_led_set(bool on);
+int64_t garage_hal_now_us(void);
+
+// Arms the one-shot relay pulse. When it expires the platform releases the
+// relay and calls garage_control_relay_pulse_done() from the control context.
+bool garage_hal_relay_pulse_start(uint32_t duration_ms);
+// (Re)starts the debounce window; on expiry the platform calls
+// garage_control_throttle_expired() from the control context.
+void garage_hal_debounce_start(uint32_t duration_ms);
+
+// Free heap now, lowest free heap since boot and largest allocatable block,
+// in bytes; reported with the metrics so soak runs can spot fragmentation.
+void garage_hal_heap_stats(uint32_t *free_bytes, uint32_t *min_free_bytes, uint32_t *largest_block);
+
+bool garage_hal_mqtt_connected(void);
+// True when a state or result publish would reach anyone: the broker or a
+// local API client.
+bool garage_hal_publish_ready(void);
+// Broker only; returns the message id, or a negative value on failure
+// (including while disconnected).
+int garage_hal_mqtt_publish(const char *topic, const char *payload, size_t len, int qos, bool retain);
+// Fans a message out to local API clients, if any; never blocks on the broker.
+void garage_hal_local_publish(const char *topic, const char *payload, size_t len, bool retain);
+// Short critical section around the publish outbox and state gate, which
+// the control and MQTT tasks both feed.
+void garage_hal_publish_lock(void);
+void garage_hal_publish_unlock(void);
+// (Re)arms the one-shot state window timer; on expiry the platform calls
+// garage_publish_flush_state() from the control context.
+void garage_hal_state_window_start(uint32_t delay_ms);
+// Writes the broker failover status as `"broker":{...}` plus the current
+// `"keepaliveS"` for the metrics payload; returns the length, or 0 if it
+// did not fit.
+size_t garage_hal_format_broker_status(char *out, size_t size);
@@ -0,0 +1,65 @@
+#include "garage_json_arena.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "cJSON.h"
+
+#define ARENA_ALIGN _Alignof(max_align_t)
+
+static garage_json_arena_t *s_active;
+
+static bool arena_owns(const garage_json_arena_t *arena, const void *ptr)
+{
+    const uint8_t *p = ptr;
+    return arena && p >= arena->base && p < arena->base + arena->size;
+}
+
+void *garage_json_arena_alloc(size_t size)
+{
+    garage_json_arena_t *arena = s_active;
+    if (!arena) {
+        return malloc(size);
+    }
+    arena->allocations++;
+    size_t start = (arena->used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (size > arena->size || start > arena->size - size) {
+        arena->heap_fallbacks++;
+        return malloc(size);
+    }
+    arena->used = start + size;
+    if (arena->used > arena->high_water) {
+        arena->high_water = arena->used;
+    }
+    return arena->base + start;
+}
+
+void garage_json_arena_free(void *ptr)
+{
+    if (!arena_owns(s_active, ptr)) {
+        free(ptr);
+    }
+}
+
+void garage_json_arena_begin(garage_json_arena_t *arena, void *buffer, size_t size)
+{
+    *arena = (garage_json_arena_t){
+        .base = buffer,
+        .size = buffer ? size : 0,
+    };
+    s_active = arena;
+    cJSON_Hooks hooks = {
+        .malloc_fn = garage_json_arena_alloc,
+        .free_fn = garage_json_arena_free,
+    };
+    cJSON_InitHooks(&hooks);
+}
+
+void garage_json_arena_end(garage_json_arena_t *arena)
+{
+    if (s_active == arena) {
+        cJSON_InitHooks(NULL);
+        s_active = NULL;
+    }
+    arena->used = 0;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bump allocator that backs cJSON for the duration of one JSON operation.
+ * garage_json_arena_begin() installs it through cJSON_InitHooks; every node
+ * and string cJSON allocates is carved from the caller's buffer, frees are
+ * no-ops, and garage_json_arena_end() drops everything at once and restores
+ * the default heap hooks. Requests that do not fit fall back to the heap and
+ * are freed normally. cJSON hooks are process-wide, so only one arena may be
+ * active and the caller must keep other cJSON users out meanwhile.
+ */
+typedef struct {
+    uint8_t *base;
+    size_t size;
+    size_t used;
+    size_t high_water;
+    uint32_t allocations;
+    uint32_t heap_fallbacks;  // allocations that overflowed to the heap
+} garage_json_arena_t;
+
+void garage_json_arena_begin(garage_json_arena_t *arena, void *buffer, size_t size);
+// Plain allocation from the active arena, e.g. for the JSON text itself.
+void *garage_json_arena_alloc(size_t size);
+void garage_json_arena_free(void *ptr);
+void garage_json_arena_end(garage_json_arena_t *arena);
@@ -0,0 +1,137 @@
+#include "garage_keepalive.h"
+
+#define US_PER_S 1000000LL
+// A connection must outlive this many keepalive periods before a longer one
+// is tried.
+#define KEEPALIVE_STABLE_PERIODS 8
+// Drops later than this many periods after connecting are not blamed on an
+// idle timeout.
+#define KEEPALIVE_SUSPECT_PERIODS 4
+// Consecutive suspect drops before the keepalive shrinks, so one unrelated
+// outage does not cost a step.
+#define KEEPALIVE_SUSPECT_DROPS 2
+#define KEEPALIVE_CEILING_FORGET_US (24LL * 3600 * US_PER_S)
+
+static uint32_t clamp(uint32_t value, uint32_t min_value, uint32_t max_value)
+{
+    return value < min_value ? min_value : value > max_value ? max_value : value;
+}
+
+// Next value to probe, or the current one when a step is not worth a reconnect.
+static uint32_t grow_target(const garage_keepalive_t *keepalive, bool forget_ceiling)
+{
+    uint32_t current = keepalive->keepalive_s;
+    uint32_t target = current + current / 2;
+    if (target > keepalive->max_s) {
+        target = keepalive->max_s;
+    }
+    if (keepalive->ceiling_s > current && !forget_ceiling) {
+        uint32_t midpoint = current + (keepalive->ceiling_s - current) / 2;
+        if (target > midpoint) {
+            target = midpoint;
+        }
+    }
+    return target - current >= current / 8 && target > current ? target : current;
+}
+
+void garage_keepalive_init(garage_keepalive_t *keepalive, uint32_t initial_s, uint32_t min_s, uint32_t max_s)
+{
+    keepalive->min_s = min_s > 0 ? min_s : 1;
+    keepalive->max_s = max_s > keepalive->min_s ? max_s : keepalive->min_s;
+    keepalive->keepalive_s = clamp(initial_s, keepalive->min_s, keepalive->max_s);
+    keepalive->good_s = 0;
+    keepalive->ceiling_s = 0;
+    keepalive->suspect_drops = 0;
+    keepalive->connected_us = 0;
+    keepalive->stable_since_us = 0;
+}
+
+bool garage_keepalive_restore(garage_keepalive_t *keepalive, uint32_t keepalive_s, uint32_t ceiling_s)
+{
+    if (keepalive_s < keepalive->min_s || keepalive_s > keepalive->max_s ||
+        (ceiling_s != 0 && (ceiling_s <= keepalive_s || ceiling_s > keepalive->max_s))) {
+        return false;
+    }
+    keepalive->keepalive_s = keepalive_s;
+    keepalive->ceiling_s = ceiling_s;
+    return true;
+}
+
+void garage_keepalive_connected(garage_keepalive_t *keepalive, int64_t now_us)
+{
+    keepalive->connected_us = now_us > 0 ? now_us : 1;
+    if (keepalive->stable_since_us == 0) {
+        keepalive->stable_since_us = keepalive->connected_us;
+    }
+}
+
+bool garage_keepalive_lost(garage_keepalive_t *keepalive, int64_t now_us)
+{
+    if (keepalive->connected_us == 0) {
+        return false;
+    }
+    int64_t lifetime_us = now_us - keepalive->connected_us;
+    int64_t period_us = (int64_t)keepalive->keepalive_s * US_PER_S;
+    keepalive->connected_us = 0;
+    if (lifetime_us < period_us / 2) {
+        // Too early for an idle timeout: the broker or the network failed.
+        return false;
+    }
+    if (lifetime_us > period_us * KEEPALIVE_SUSPECT_PERIODS) {
+        keepalive->suspect_drops = 0;
+        return false;
+    }
+
+    keepalive->stable_since_us = 0;
+    if (++keepalive->suspect_drops < KEEPALIVE_SUSPECT_DROPS) {
+        return false;
+    }
+    keepalive->suspect_drops = 0;
+    uint32_t failed = keepalive->keepalive_s;
+    keepalive->ceiling_s = failed;
+    // Fall back to the last value that held if this one was a probe.
+    uint32_t next = keepalive->good_s >= keepalive->min_s && keepalive->good_s < failed ? keepalive->good_s
+                                                                                        : failed / 2;
+    keepalive->keepalive_s = clamp(next, keepalive->min_s, keepalive->max_s);
+    keepalive->good_s = 0;
+    if (keepalive->ceiling_s <= keepalive->keepalive_s) {
+        keepalive->ceiling_s = 0;
+    }
+    return keepalive->keepalive_s != failed;
+}
+
+int64_t garage_keepalive_probe_delay_us(const garage_keepalive_t *keepalive)
+{
+    if (keepalive->connected_us == 0 || keepalive->keepalive_s >= keepalive->max_s) {
+        return -1;
+    }
+    int64_t delay_us = (int64_t)keepalive->keepalive_s * KEEPALIVE_STABLE_PERIODS * US_PER_S;
+    if (grow_target(keepalive, false) == keepalive->keepalive_s) {
+        // Only forgetting the ceiling allows another step.
+        int64_t forget_us = keepalive->stable_since_us + KEEPALIVE_CEILING_FORGET_US - keepalive->connected_us;
+        if (forget_us > delay_us) {
+            delay_us = forget_us;
+        }
+    }
+    return delay_us;
+}
+
+bool garage_keepalive_grow(garage_keepalive_t *keepalive, int64_t now_us)
+{
+    if (keepalive->connected_us == 0 ||
+        now_us - keepalive->connected_us < (int64_t)keepalive->keepalive_s * KEEPALIVE_STABLE_PERIODS * US_PER_S) {
+        return false;
+    }
+    keepalive->suspect_drops = 0;
+    bool forget = keepalive->stable_since_us != 0 && now_us - keepalive->stable_since_us >= KEEPALIVE_CEILING_FORGET_US;
+    if (forget) {
+        keepalive->ceiling_s = 0;
+    }
+    uint32_t target = grow_target(keepalive, forget);
+    if (target == keepalive->keepalive_s) {
+        return false;
+    }
+    keepalive->good_s = keepalive->keepalive_s;
+    keepalive->keepalive_s = target;
+    return true;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Learns the longest MQTT keepalive the path to the broker tolerates. A NAT
+ * or firewall that forgets idle flows drops the connection shortly after the
+ * first idle gap, so a connection lost within a few keepalive periods halves
+ * the keepalive and remembers the value that failed as a ceiling. After a
+ * long stable stretch the keepalive is probed upward again, staying below
+ * the ceiling; a day without drops forgets the ceiling so a changed network
+ * is relearned. Pure logic like garage_backoff.h: time is passed in, and
+ * each instance belongs to one context (callers serialize access).
+ */
+typedef struct {
+    uint32_t min_s;
+    uint32_t max_s;
+    uint32_t keepalive_s;
+    uint32_t good_s;         // value before the last probe; 0: none
+    uint32_t ceiling_s;      // smallest keepalive that timed out; 0: none seen
+    uint32_t suspect_drops;  // consecutive drops that looked like an idle timeout
+    int64_t connected_us;    // 0 while disconnected
+    int64_t stable_since_us; // start of the current run without suspect drops
+} garage_keepalive_t;
+
+void garage_keepalive_init(garage_keepalive_t *keepalive, uint32_t initial_s, uint32_t min_s, uint32_t max_s);
+
+// Adopts values learned before a restart; false (and no change) if they do
+// not fit the configured range.
+bool garage_keepalive_restore(garage_keepalive_t *keepalive, uint32_t keepalive_s, uint32_t ceiling_s);
+
+void garage_keepalive_connected(garage_keepalive_t *keepalive, int64_t now_us);
+
+/*
+ * Records an unexpected loss of the connection while the network was up.
+ * Returns true when the keepalive shrank and should be applied before the
+ * next connect.
+ */
+bool garage_keepalive_lost(garage_keepalive_t *keepalive, int64_t now_us);
+
+// Microseconds from connect until a longer keepalive is worth probing, or
+// -1 when the keepalive is already at its maximum or just below the ceiling.
+int64_t garage_keepalive_probe_delay_us(const garage_keepalive_t *keepalive);
+
+/*
+ * Called once the probe delay has passed on a still-open connection.
+ * Returns true when the keepalive grew; the caller reconnects to apply it.
+ */
+bool garage_keepalive_grow(garage_keepalive_t *keepalive, int64_t now_us);
@@ -0,0 +1,351 @@
+#include "garage_local_api.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "garage_command.h"
+#include "garage_dedupe.h"
+#include "mbedtls/base64.h"
+
+#define LOCAL_API_MAX_WS_CLIENTS 4
+#define LOCAL_API_STATE_MAX_LEN 512
+#define LOCAL_API_FRAME_MAX_LEN 256
+// "Basic " + base64 of "<username>:<password>" (64 + 1 + 64 bytes).
+#define LOCAL_API_AUTH_MAX_LEN 184
+#define LOCAL_API_RESPONSE_MAX_LEN (GARAGE_REQUEST_ID_MAX_LEN + 48)
+
+static const char *TAG = "garage";
+
+static httpd_handle_t s_server;
+static const char *(*s_open)(const char *request_id, int64_t received_us);
+static char s_expected_auth[LOCAL_API_AUTH_MAX_LEN];
+static size_t s_expected_auth_len;
+
+// Guards the client list and the state cache, and serializes WebSocket
+// sends from the publishing tasks against the server task.
+static StaticSemaphore_t s_lock_storage;
+static SemaphoreHandle_t s_lock;
+static int s_ws_fds[LOCAL_API_MAX_WS_CLIENTS];
+static char s_state[LOCAL_API_STATE_MAX_LEN];
+static size_t s_state_len;
+
+// Constant time, so response timing does not leak how much of a guess matched.
+static bool auth_matches(const char *value, size_t len)
+{
+    unsigned char diff = len != s_expected_auth_len;
+    for (size_t i = 0; i < s_expected_auth_len; ++i) {
+        diff |= (unsigned char)(value[i < len ? i : 0] ^ s_expected_auth[i]);
+    }
+    return diff == 0;
+}
+
+static bool request_authorized(httpd_req_t *req)
+{
+    char header[LOCAL_API_AUTH_MAX_LEN];
+    size_t len = httpd_req_get_hdr_value_len(req, "Authorization");
+    if (len == 0 || len >= sizeof(header) ||
+        httpd_req_get_hdr_value_str(req, "Authorization", header, sizeof(header)) != ESP_OK) {
+        return false;
+    }
+    return auth_matches(header, len);
+}
+
+static esp_err_t send_unauthorized(httpd_req_t *req)
+{
+    httpd_resp_set_hdr(req, "WWW-Authenticate", "Basic realm=\"garage\"");
+    return httpd_resp_send_err(req, HTTPD_401_UNAUTHORIZED, "unauthorized");
+}
+
+static void ws_client_set(int fd, bool authenticated)
+{
+    int free_slot = -1;
+    for (int i = 0; i < LOCAL_API_MAX_WS_CLIENTS; ++i) {
+        if (s_ws_fds[i] == fd) {
+            if (!authenticated) {
+                s_ws_fds[i] = -1;
+            }
+            return;
+        }
+        if (s_ws_fds[i] < 0 && free_slot < 0) {
+            free_slot = i;
+        }
+    }
+    if (authenticated && free_slot >= 0) {
+        s_ws_fds[free_slot] = fd;
+    } else if (authenticated) {
+        ESP_LOGW(TAG, "Local API WebSocket client limit reached; fd %d gets no pushes", fd);
+    }
+}
+
+static bool ws_client_authenticated(int fd)
+{
+    for (int i = 0; i < LOCAL_API_MAX_WS_CLIENTS; ++i) {
+        if (s_ws_fds[i] == fd) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static size_t format_open_response(char *out, size_t size, const char *request_id, const char *status)
+{
+    int written = request_id[0] != '\0'
+                      ? snprintf(out, size, "{\"requestId\":\"%s\",\"status\":\"%s\"}", request_id, status)
+                      : snprintf(out, size, "{\"status\":\"%s\"}", status);
+    return written > 0 && (size_t)written < size ? (size_t)written : 0;
+}
+
+static const char *run_open(const char *request_id)
+{
+    // Only ids the dedupe cache accepts are echoed back unescaped.
+    if (request_id[0] != '\0' && !garage_dedupe_id_is_valid(request_id, strlen(request_id))) {
+        return "rejected";
+    }
+    return s_open(request_id, esp_timer_get_time());
+}
+
+static esp_err_t open_handler(httpd_req_t *req)
+{
+    if (!request_authorized(req)) {
+        return send_unauthorized(req);
+    }
+
+    char query[GARAGE_REQUEST_ID_MAX_LEN + 16] = "";
+    char request_id[GARAGE_REQUEST_ID_MAX_LEN + 1] = "";
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "requestId", request_id, sizeof(request_id)) != ESP_OK) {
+        request_id[0] = '\0';
+    }
+
+    const char *status = run_open(request_id);
+    char body[LOCAL_API_RESPONSE_MAX_LEN];
+    size_t len = format_open_response(body, sizeof(body), strcmp(status, "rejected") ? request_id : "", status);
+    if (strcmp(status, "queued") == 0) {
+        httpd_resp_set_status(req, "202 Accepted");
+    } else if (strcmp(status, "dropped") == 0) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+    } else if (strcmp(status, "rejected") == 0) {
+        httpd_resp_set_status(req, "400 Bad Request");
+    }
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, body, (ssize_t)len);
+}
+
+static esp_err_t state_handler(httpd_req_t *req)
+{
+    if (!request_authorized(req)) {
+        return send_unauthorized(req);
+    }
+
+    char body[LOCAL_API_STATE_MAX_LEN];
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    size_t len = s_state_len;
+    memcpy(body, s_state, len);
+    xSemaphoreGive(s_lock);
+
+    httpd_resp_set_type(req, "application/json");
+    if (len == 0) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_send(req, "{}", 2);
+    }
+    return httpd_resp_send(req, body, (ssize_t)len);
+}
+
+static esp_err_t ws_send_text(httpd_req_t *req, const char *text, size_t len)
+{
+    httpd_ws_frame_t frame = {
+        .final = true,
+        .type = HTTPD_WS_TYPE_TEXT,
+        .payload = (uint8_t *)text,
+        .len = len,
+    };
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    esp_err_t err = httpd_ws_send_frame(req, &frame);
+    xSemaphoreGive(s_lock);
+    return err;
+}
+
+static esp_err_t ws_handle_command(httpd_req_t *req, const char *data, size_t len)
+{
+    command_fields_t fields;
+    const command_value_t *type = &fields.fields[COMMAND_FIELD_TYPE];
+    const command_value_t *request = &fields.fields[COMMAND_FIELD_REQUEST_ID];
+    char request_id[GARAGE_REQUEST_ID_MAX_LEN + 1] = "";
+    const char *status = "rejected";
+
+    if (garage_command_tokenize(data, len, &fields) && type->kind == COMMAND_VALUE_STRING &&
+        garage_command_type_lookup(type->text) == COMMAND_TYPE_OPEN &&
+        (request->kind == COMMAND_VALUE_ABSENT ||
+         (request->kind == COMMAND_VALUE_STRING && request->text.len <= GARAGE_REQUEST_ID_MAX_LEN))) {
+        if (request->kind == COMMAND_VALUE_STRING) {
+            memcpy(request_id, request->text.ptr, request->text.len);
+            request_id[request->text.len] = '\0';
+        }
+        status = run_open(request_id);
+    }
+
+    char reply[LOCAL_API_RESPONSE_MAX_LEN];
+    size_t reply_len =
+        format_open_response(reply, sizeof(reply), strcmp(status, "rejected") ? request_id : "", status);
+    return ws_send_text(req, reply, reply_len);
+}
+
+static esp_err_t ws_handler(httpd_req_t *req)
+{
+    int fd = httpd_req_to_sockfd(req);
+    if (req->method == HTTP_GET) {
+        // Handshake; fds are reused, so this also clears a previous owner.
+        bool authorized = request_authorized(req);
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        ws_client_set(fd, authorized);
+        xSemaphoreGive(s_lock);
+        return ESP_OK;
+    }
+
+    uint8_t data[LOCAL_API_FRAME_MAX_LEN];
+    httpd_ws_frame_t frame = { .payload = NULL };
+    esp_err_t err = httpd_ws_recv_frame(req, &frame, 0);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (frame.type != HTTPD_WS_TYPE_TEXT || frame.len == 0 || frame.len >= sizeof(data)) {
+        ESP_LOGW(TAG, "Ignoring local API frame (type %d, %u bytes)", (int)frame.type, (unsigned)frame.len);
+        return frame.len >= sizeof(data) ? ESP_ERR_INVALID_SIZE : ESP_OK;
+    }
+    frame.payload = data;
+    err = httpd_ws_recv_frame(req, &frame, sizeof(data));
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    bool authenticated = ws_client_authenticated(fd);
+    if (!authenticated && auth_matches((const char *)data, frame.len)) {
+        ws_client_set(fd, true);
+        authenticated = true;
+    }
+    size_t state_len = s_state_len;
+    char state[LOCAL_API_STATE_MAX_LEN];
+    memcpy(state, s_state, state_len);
+    xSemaphoreGive(s_lock);
+
+    if (!authenticated) {
+        static const char unauthorized[] = "{\"status\":\"unauthorized\"}";
+        ws_send_text(req, unauthorized, sizeof(unauthorized) - 1);
+        return ESP_FAIL;  // closes the socket
+    }
+    if (data[0] != '{') {
+        // Auth frame: answer with the current state so the client renders at once.
+        return state_len > 0 ? ws_send_text(req, state, state_len) : ESP_OK;
+    }
+    return ws_handle_command(req, (const char *)data, frame.len);
+}
+
+static bool build_expected_auth(const char *username, const char *password)
+{
+    char credentials[130];
+    int len = snprintf(credentials, sizeof(credentials), "%s:%s", username, password);
+    if (len <= 0 || (size_t)len >= sizeof(credentials)) {
+        return false;
+    }
+    memcpy(s_expected_auth, "Basic ", 6);
+    size_t encoded_len = 0;
+    if (mbedtls_base64_encode((unsigned char *)s_expected_auth + 6, sizeof(s_expected_auth) - 6, &encoded_len,
+                              (const unsigned char *)credentials, (size_t)len) != 0) {
+        return false;
+    }
+    s_expected_auth_len = 6 + encoded_len;
+    return true;
+}
+
+esp_err_t garage_local_api_start(const garage_local_api_config_t *config)
+{
+    if (s_server) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!config || !config->open || !config->username || !config->password) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // Never expose an unauthenticated relay on the LAN.
+    if (config->username[0] == '\0' && config->password[0] == '\0') {
+        ESP_LOGW(TAG, "Local API disabled: no MQTT credentials to authenticate with");
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!build_expected_auth(config->username, config->password)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    s_lock = xSemaphoreCreateMutexStatic(&s_lock_storage);
+    for (int i = 0; i < LOCAL_API_MAX_WS_CLIENTS; ++i) {
+        s_ws_fds[i] = -1;
+    }
+    s_open = config->open;
+
+    httpd_config_t httpd_config = HTTPD_DEFAULT_CONFIG();
+    httpd_config.server_port = config->port;
+    httpd_config.max_open_sockets = LOCAL_API_MAX_WS_CLIENTS + 1;
+    httpd_config.lru_purge_enable = true;
+
+    httpd_handle_t server = NULL;
+    esp_err_t err = httpd_start(&server, &httpd_config);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    const httpd_uri_t handlers[] = {
+        { .uri = "/api/open", .method = HTTP_POST, .handler = open_handler },
+        { .uri = "/api/state", .method = HTTP_GET, .handler = state_handler },
+        { .uri = "/ws", .method = HTTP_GET, .handler = ws_handler, .is_websocket = true },
+    };
+    for (size_t i = 0; i < sizeof(handlers) / sizeof(handlers[0]); ++i) {
+        err = httpd_register_uri_handler(server, &handlers[i]);
+        if (err != ESP_OK) {
+            httpd_stop(server);
+            return err;
+        }
+    }
+
+    s_server = server;
+    ESP_LOGI(TAG, "Local API listening on port %u", (unsigned)config->port);
+    return ESP_OK;
+}
+
+bool garage_local_api_running(void)
+{
+    return s_server != NULL;
+}
+
+void garage_local_api_push(const char *payload, size_t len, bool retained_state)
+{
+    if (!s_server) {
+        return;
+    }
+
+    httpd_ws_frame_t frame = {
+        .final = true,
+        .type = HTTPD_WS_TYPE_TEXT,
+        .payload = (uint8_t *)payload,
+        .len = len,
+    };
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (retained_state && len <= sizeof(s_state)) {
+        memcpy(s_state, payload, len);
+        s_state_len = len;
+    }
+    for (int i = 0; i < LOCAL_API_MAX_WS_CLIENTS; ++i) {
+        int fd = s_ws_fds[i];
+        if (fd < 0) {
+            continue;
+        }
+        if (httpd_ws_get_fd_info(s_server, fd) != HTTPD_WS_CLIENT_WEBSOCKET ||
+            httpd_ws_send_frame_async(s_server, fd, &frame) != ESP_OK) {
+            s_ws_fds[i] = -1;
+        }
+    }
+    xSemaphoreGive(s_lock);
+}
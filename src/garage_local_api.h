@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/*
+ * Optional on-premises control endpoint (esp_http_server), so an open from
+ * the LAN skips the round trip through the cloud broker:
+ *
+ *   POST /api/open[?requestId=<id>]  queue an open, reply with the queue status
+ *   GET  /api/state                  last retained state message
+ *   GET  /ws                         WebSocket: pushes every state and result
+ *                                    message, accepts {"type":"open",...}
+ *
+ * Requests authenticate with HTTP Basic auth using the device's MQTT
+ * credentials. Browsers cannot set headers on a WebSocket, so a socket that
+ * did not authenticate in the handshake must send the same
+ * "Basic <base64>" string as its first text frame.
+ */
+typedef struct {
+    uint16_t port;
+    const char *username;
+    const char *password;
+    // Runs an open through the same path as an MQTT command; request_id is
+    // empty when the client sent none. Returns the command result status
+    // ("queued", "duplicate", "dropped" or "rejected").
+    const char *(*open)(const char *request_id, int64_t received_us);
+} garage_local_api_config_t;
+
+esp_err_t garage_local_api_start(const garage_local_api_config_t *config);
+bool garage_local_api_running(void);
+// Forwards a state-topic or result-topic message to authenticated
+// WebSocket clients. Retained state messages are also kept for /api/state.
+void garage_local_api_push(const char *payload, size_t len, bool retained_state);
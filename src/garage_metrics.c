@@ -0,0 +1,169 @@
+#include "garage_metrics.h"
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// Bucket i counts samples in [2^i, 2^(i+1)) us; the last one is open-ended
+// (~36 min and up), bucket 0 also takes sub-microsecond samples. The upper
+// range is there for the reconnect recovery stages.
+#define LATENCY_BUCKET_COUNT 32
+
+typedef struct {
+    atomic_uint_fast32_t buckets[LATENCY_BUCKET_COUNT];
+    atomic_uint_fast32_t max_us;
+} latency_histogram_t;
+
+static latency_histogram_t s_histograms[GARAGE_LATENCY_STAGE_COUNT];
+static atomic_uint_fast32_t s_counters[GARAGE_COUNTER_COUNT];
+
+static const char *const s_stage_names[GARAGE_LATENCY_STAGE_COUNT] = {
+    [GARAGE_LATENCY_MQTT_TO_QUEUE] = "mqttToQueue",
+    [GARAGE_LATENCY_QUEUE_WAIT] = "queueWait",
+    [GARAGE_LATENCY_DISPATCH] = "dispatch",
+    [GARAGE_LATENCY_END_TO_END] = "endToEnd",
+    [GARAGE_LATENCY_BOOT_TO_STATE] = "bootToState",
+    [GARAGE_LATENCY_WIFI_RECOVERY] = "wifiRecovery",
+    [GARAGE_LATENCY_MQTT_RECOVERY] = "mqttRecovery",
+    [GARAGE_LATENCY_MQTT_READY] = "mqttReady",
+    [GARAGE_LATENCY_TLS_FULL] = "tlsFull",
+    [GARAGE_LATENCY_TLS_RESUMED] = "tlsResumed",
+};
+
+static const char *const s_counter_names[GARAGE_COUNTER_COUNT] = {
+    [GARAGE_COUNTER_CONFIG_UPDATES] = "configUpdates",
+    [GARAGE_COUNTER_CONFIG_COMMITS] = "configCommits",
+    [GARAGE_COUNTER_CONFIG_COMMITS_AVOIDED] = "configCommitsAvoided",
+    [GARAGE_COUNTER_WIFI_RETRIES] = "wifiRetries",
+    [GARAGE_COUNTER_MQTT_RETRIES] = "mqttRetries",
+    [GARAGE_COUNTER_STALE_COMMANDS] = "staleCommands",
+    [GARAGE_COUNTER_DUPLICATE_COMMANDS] = "duplicateCommands",
+    [GARAGE_COUNTER_DROPPED_OPEN] = "droppedOpen",
+    [GARAGE_COUNTER_DROPPED_OTA] = "droppedOta",
+    [GARAGE_COUNTER_DROPPED_CONFIG] = "droppedConfig",
+    [GARAGE_COUNTER_COALESCED_COMMANDS] = "coalescedCommands",
+    [GARAGE_COUNTER_CONTROL_HEAP_ALLOCS] = "controlHeapAllocs",
+    [GARAGE_COUNTER_BROKER_FAILOVERS] = "brokerFailovers",
+    [GARAGE_COUNTER_PUBLISH_TIMEOUTS] = "publishTimeouts",
+    [GARAGE_COUNTER_OUTBOX_HELD] = "outboxHeld",
+    [GARAGE_COUNTER_OUTBOX_COLLAPSED] = "outboxCollapsed",
+    [GARAGE_COUNTER_OUTBOX_DROPPED] = "outboxDropped",
+    [GARAGE_COUNTER_PUBLISHES_SAVED] = "publishesSaved",
+    [GARAGE_COUNTER_PUBLISH_BYTES_SAVED] = "publishBytesSaved",
+    [GARAGE_COUNTER_OTA_RESUMES] = "otaResumes",
+    [GARAGE_COUNTER_OTA_BYTES_SAVED] = "otaBytesSaved",
+    [GARAGE_COUNTER_MQTT_BYTES_OUT] = "mqttBytesOut",
+};
+
+static unsigned bucket_for(uint32_t value_us)
+{
+    unsigned bucket = 0;
+    while (value_us > 1 && bucket < LATENCY_BUCKET_COUNT - 1) {
+        value_us >>= 1;
+        ++bucket;
+    }
+    return bucket;
+}
+
+void garage_metrics_record(garage_latency_stage_t stage, int64_t duration_us)
+{
+    if (stage >= GARAGE_LATENCY_STAGE_COUNT) {
+        return;
+    }
+    uint32_t value = duration_us <= 0 ? 0 : (duration_us > UINT32_MAX ? UINT32_MAX : (uint32_t)duration_us);
+    latency_histogram_t *h = &s_histograms[stage];
+
+    atomic_fetch_add_explicit(&h->buckets[bucket_for(value)], 1, memory_order_relaxed);
+
+    uint_fast32_t seen = atomic_load_explicit(&h->max_us, memory_order_relaxed);
+    while (value > seen &&
+           !atomic_compare_exchange_weak_explicit(&h->max_us, &seen, value, memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+    }
+}
+
+void garage_metrics_count(garage_counter_t counter, uint32_t delta)
+{
+    if (counter >= GARAGE_COUNTER_COUNT) {
+        return;
+    }
+    // Saturate rather than wrap, so a long-running byte counter never
+    // appears to go backwards.
+    uint_fast32_t seen = atomic_load_explicit(&s_counters[counter], memory_order_relaxed);
+    uint_fast32_t next;
+    do {
+        next = seen > UINT32_MAX - delta ? UINT32_MAX : seen + delta;
+    } while (next != seen && !atomic_compare_exchange_weak_explicit(&s_counters[counter], &seen, next,
+                                                                    memory_order_relaxed, memory_order_relaxed));
+}
+
+// Upper bound of the bucket holding the given percentile.
+static uint32_t histogram_percentile_us(const uint32_t *buckets, uint32_t count, unsigned percent)
+{
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t target = ((uint64_t)count * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < LATENCY_BUCKET_COUNT; ++i) {
+        seen += buckets[i];
+        if (seen >= target) {
+            return i + 1 < 32 ? (UINT32_C(1) << (i + 1)) : UINT32_MAX;
+        }
+    }
+    return UINT32_MAX;
+}
+
+size_t garage_metrics_format(char *out, size_t size)
+{
+    size_t len = 0;
+    int written = snprintf(out, size, "\"stages\":{");
+    if (written < 0 || (size_t)written >= size) {
+        return 0;
+    }
+    len = (size_t)written;
+
+    for (unsigned stage = 0; stage < GARAGE_LATENCY_STAGE_COUNT; ++stage) {
+        const latency_histogram_t *h = &s_histograms[stage];
+        uint32_t buckets[LATENCY_BUCKET_COUNT];
+        uint32_t count = 0;
+        for (unsigned i = 0; i < LATENCY_BUCKET_COUNT; ++i) {
+            buckets[i] = (uint32_t)atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+            count += buckets[i];
+        }
+
+        written = snprintf(out + len, size - len,
+                           "%s\"%s\":{\"n\":%" PRIu32 ",\"p50Us\":%" PRIu32 ",\"p99Us\":%" PRIu32 ",\"maxUs\":%" PRIu32 "}",
+                           stage == 0 ? "" : ",", s_stage_names[stage], count,
+                           histogram_percentile_us(buckets, count, 50),
+                           histogram_percentile_us(buckets, count, 99),
+                           (uint32_t)atomic_load_explicit(&h->max_us, memory_order_relaxed));
+        if (written < 0 || (size_t)written >= size - len) {
+            return 0;
+        }
+        len += (size_t)written;
+    }
+
+    written = snprintf(out + len, size - len, "},\"counters\":{");
+    if (written < 0 || (size_t)written >= size - len) {
+        return 0;
+    }
+    len += (size_t)written;
+
+    for (unsigned counter = 0; counter < GARAGE_COUNTER_COUNT; ++counter) {
+        written = snprintf(out + len, size - len, "%s\"%s\":%" PRIu32, counter == 0 ? "" : ",",
+                           s_counter_names[counter],
+                           (uint32_t)atomic_load_explicit(&s_counters[counter], memory_order_relaxed));
+        if (written < 0 || (size_t)written >= size - len) {
+            return 0;
+        }
+        len += (size_t)written;
+    }
+
+    written = snprintf(out + len, size - len, "}");
+    if (written < 0 || (size_t)written >= size - len) {
+        return 0;
+    }
+    return len + (size_t)written;
+}
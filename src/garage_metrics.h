@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Per-stage command latency histograms. Recording is lock-free (relaxed
+ * atomic increments) so it is safe from the MQTT task, timer callbacks and
+ * control_task at once; readers get an approximate but consistent-enough
+ * snapshot for diagnostics.
+ */
+typedef enum {
+    GARAGE_LATENCY_MQTT_TO_QUEUE = 0,  // MQTT_EVENT_DATA arrival -> control_post()
+    GARAGE_LATENCY_QUEUE_WAIT,         // control_post() -> dequeue in control_task
+    GARAGE_LATENCY_DISPATCH,           // dequeue -> relay asserted
+    GARAGE_LATENCY_END_TO_END,         // MQTT_EVENT_DATA arrival -> relay asserted
+    GARAGE_LATENCY_BOOT_TO_STATE,      // boot -> first retained state published (once per boot)
+    GARAGE_LATENCY_WIFI_RECOVERY,      // first Wi-Fi failure -> IP address again
+    GARAGE_LATENCY_MQTT_RECOVERY,      // MQTT disconnect -> broker session again
+    GARAGE_LATENCY_MQTT_READY,         // connect attempt -> subscribed (or session resumed)
+    GARAGE_LATENCY_TLS_FULL,           // TCP connect + full TLS handshake to the broker
+    GARAGE_LATENCY_TLS_RESUMED,        // TCP connect + handshake offering a cached session
+    GARAGE_LATENCY_STAGE_COUNT,
+} garage_latency_stage_t;
+
+// Monotonic event counters reported alongside the latency histograms; they
+// stop at UINT32_MAX instead of wrapping.
+typedef enum {
+    GARAGE_COUNTER_CONFIG_UPDATES = 0,     // config_update commands applied in RAM
+    GARAGE_COUNTER_CONFIG_COMMITS,         // NVS commits performed for them
+    GARAGE_COUNTER_CONFIG_COMMITS_AVOIDED, // updates absorbed by write-behind coalescing
+    GARAGE_COUNTER_WIFI_RETRIES,           // Wi-Fi connect attempts after a failure
+    GARAGE_COUNTER_MQTT_RETRIES,           // MQTT reconnect attempts
+    GARAGE_COUNTER_STALE_COMMANDS,         // commands dropped for exceeding the max age
+    GARAGE_COUNTER_DUPLICATE_COMMANDS,     // repeated requestIds acknowledged without running
+    GARAGE_COUNTER_DROPPED_OPEN,           // opens refused by a full high-priority lane
+    GARAGE_COUNTER_DROPPED_OTA,            // OTA requests refused by a full low lane or payload pool
+    GARAGE_COUNTER_DROPPED_CONFIG,         // config updates refused by a full low lane or payload pool
+    GARAGE_COUNTER_COALESCED_COMMANDS,     // idempotent commands merged into one already pending
+    GARAGE_COUNTER_CONTROL_HEAP_ALLOCS,    // heap allocations on control_task (needs CONFIG_HEAP_USE_HOOKS)
+    GARAGE_COUNTER_BROKER_FAILOVERS,       // switches of the active MQTT broker
+    GARAGE_COUNTER_PUBLISH_TIMEOUTS,       // QoS1 publishes left unacknowledged past the timeout
+    GARAGE_COUNTER_OUTBOX_HELD,            // messages held for the broker while it was unreachable
+    GARAGE_COUNTER_OUTBOX_COLLAPSED,       // held retained states replaced by a newer one
+    GARAGE_COUNTER_OUTBOX_DROPPED,         // held messages evicted by a full outbox
+    GARAGE_COUNTER_PUBLISHES_SAVED,        // unchanged, superseded or redundant publishes skipped
+    GARAGE_COUNTER_PUBLISH_BYTES_SAVED,    // payload bytes of those
+    GARAGE_COUNTER_OTA_RESUMES,            // OTA downloads resumed after a dropped connection
+    GARAGE_COUNTER_OTA_BYTES_SAVED,        // image bytes not downloaded thanks to compressed or delta assets
+    GARAGE_COUNTER_MQTT_BYTES_OUT,         // PUBLISH packet bytes sent, before TLS and TCP/IP overhead
+    GARAGE_COUNTER_COUNT,
+} garage_counter_t;
+
+void garage_metrics_record(garage_latency_stage_t stage, int64_t duration_us);
+void garage_metrics_count(garage_counter_t counter, uint32_t delta);
+// Writes `"stages":{...},"counters":{...}` (no surrounding braces) for
+// embedding in a JSON object. Returns the length written, or 0 if it did
+// not fit.
+size_t garage_metrics_format(char *out, size_t size);
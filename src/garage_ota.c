@@ -0,0 +1,689 @@
+#include "garage_ota.h"
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_app_desc.h"
+#include "esp_attr.h"
+#include "esp_crt_bundle.h"
+#include "esp_http_client.h"
+#include "esp_https_ota.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_rom_crc.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "garage_metrics.h"
+#include "garage_publish.h"
+#include "mbedtls/sha256.h"
+#include "miniz.h"
+
+#define OTA_RTC_MAGIC 0x474f5441u  // "GOTA"
+#define OTA_ALL_MILESTONES                                                                           \
+    ((1u << GARAGE_OTA_MILESTONE_WIFI) | (1u << GARAGE_OTA_MILESTONE_MQTT) |                         \
+     (1u << GARAGE_OTA_MILESTONE_PUBLISH))
+// Attempts in a row that add no bytes before a download is abandoned.
+#define OTA_MAX_STALLED_ATTEMPTS 5
+#define OTA_RETRY_BASE_MS 1000
+#define OTA_PROGRESS_INTERVAL_US (5 * 1000000LL)
+#define OTA_MAX_REDIRECTS 5
+
+// .gdz layout, see scripts/ota-pack.py.
+#define OTA_PACK_MAGIC "GDZ1"
+#define OTA_PACK_FORMAT_DELTA 1
+#define OTA_PACK_HEADER_LEN 80
+#define OTA_PACK_IMAGE_SHA_OFFSET 16
+#define OTA_PACK_BASE_SHA_OFFSET 48
+#define OTA_PACK_OP_LEN 12
+#define OTA_PACK_IO_LEN 1024
+
+static const char *TAG = "garage";
+
+// Written by the image that installed an update, read by whichever image
+// boots next: the new one (on success) or the old one (after a rollback).
+typedef struct {
+    uint32_t magic;
+    uint32_t crc;                // over the fields below
+    char target_label[17];       // slot the update was written to
+    char reason[24];             // why the target was rolled back, empty if unknown
+} rtc_ota_record_t;
+
+static RTC_NOINIT_ATTR rtc_ota_record_t s_rtc_record;
+
+static atomic_bool s_pending;
+static atomic_uint s_milestones;
+static esp_timer_handle_t s_deadline_timer;
+
+static uint32_t rtc_record_crc(const rtc_ota_record_t *record)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)record->target_label,
+                            sizeof(*record) - offsetof(rtc_ota_record_t, target_label));
+}
+
+static bool rtc_record_valid(void)
+{
+    return s_rtc_record.magic == OTA_RTC_MAGIC && s_rtc_record.crc == rtc_record_crc(&s_rtc_record);
+}
+
+static void rtc_record_set_reason(const char *reason)
+{
+    snprintf(s_rtc_record.reason, sizeof(s_rtc_record.reason), "%s", reason);
+    s_rtc_record.crc = rtc_record_crc(&s_rtc_record);
+}
+
+// The reset that ended the rejected image, when it did not roll itself back.
+static const char *reset_reason_name(esp_reset_reason_t reason)
+{
+    switch (reason) {
+        case ESP_RST_PANIC:
+            return "panic";
+        case ESP_RST_INT_WDT:
+        case ESP_RST_TASK_WDT:
+        case ESP_RST_WDT:
+            return "watchdog";
+        case ESP_RST_BROWNOUT:
+            return "brownout";
+        case ESP_RST_SW:
+            return "restart";
+        default:
+            return "reset";
+    }
+}
+
+static const char *missing_milestone(unsigned seen)
+{
+    if (!(seen & (1u << GARAGE_OTA_MILESTONE_WIFI))) {
+        return "wifi-timeout";
+    }
+    if (!(seen & (1u << GARAGE_OTA_MILESTONE_MQTT))) {
+        return "mqtt-timeout";
+    }
+    return "publish-timeout";
+}
+
+static void deadline_timer_callback(void *arg)
+{
+    if (!atomic_load(&s_pending)) {
+        return;
+    }
+    const char *reason = missing_milestone(atomic_load(&s_milestones));
+    ESP_LOGE(TAG, "New image not confirmed in time (%s); rolling back", reason);
+    if (rtc_record_valid()) {
+        rtc_record_set_reason(reason);
+    }
+    esp_err_t err = esp_ota_mark_app_invalid_rollback_and_reboot();
+    // Only returns when there is no other bootable slot.
+    ESP_LOGE(TAG, "Rollback failed: %s", esp_err_to_name(err));
+}
+
+void garage_ota_boot_init(uint32_t validate_timeout_s)
+{
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    const esp_app_desc_t *app = esp_app_get_description();
+    esp_ota_img_states_t state = ESP_OTA_IMG_UNDEFINED;
+    esp_ota_get_state_partition(running, &state);
+
+    bool record = rtc_record_valid();
+    if (state == ESP_OTA_IMG_PENDING_VERIFY) {
+        ESP_LOGW(TAG, "Running unconfirmed image %s from %s; confirming within %" PRIu32 " s", app->version,
+                 running->label, validate_timeout_s);
+        atomic_store(&s_pending, true);
+        const esp_timer_create_args_t args = {
+            .callback = deadline_timer_callback,
+            .name = "ota_validate",
+        };
+        if (esp_timer_create(&args, &s_deadline_timer) != ESP_OK ||
+            esp_timer_start_once(s_deadline_timer, (uint64_t)validate_timeout_s * 1000000) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to arm OTA validation deadline");
+        }
+        garage_publish_ota_boot("validating", running->label, app->version, NULL, NULL);
+        return;
+    }
+
+    if (record && strcmp(s_rtc_record.target_label, running->label) != 0) {
+        // The update went to the other slot, yet we are back here.
+        const char *reason = s_rtc_record.reason[0] ? s_rtc_record.reason : reset_reason_name(esp_reset_reason());
+        esp_app_desc_t failed = {0};
+        const esp_partition_t *invalid = esp_ota_get_last_invalid_partition();
+        if (invalid) {
+            esp_ota_get_partition_description(invalid, &failed);
+        }
+        ESP_LOGW(TAG, "Update %s was rolled back (%s); running %s from %s", failed.version[0] ? failed.version : "?",
+                 reason, app->version, running->label);
+        garage_publish_ota_boot("rolled-back", running->label, app->version, failed.version[0] ? failed.version : NULL,
+                                reason);
+    } else {
+        garage_publish_ota_boot("running", running->label, app->version, NULL, NULL);
+    }
+    s_rtc_record.magic = 0;
+}
+
+bool garage_ota_validation_pending(void)
+{
+    return atomic_load(&s_pending);
+}
+
+void garage_ota_milestone(garage_ota_milestone_t milestone)
+{
+    unsigned seen = atomic_fetch_or(&s_milestones, 1u << milestone) | (1u << milestone);
+    if (seen != OTA_ALL_MILESTONES || !atomic_load(&s_pending)) {
+        return;
+    }
+    bool expected = true;
+    if (!atomic_compare_exchange_strong(&s_pending, &expected, false)) {
+        return;
+    }
+
+    if (s_deadline_timer) {
+        esp_timer_stop(s_deadline_timer);
+    }
+    esp_err_t err = esp_ota_mark_app_valid_cancel_rollback();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to confirm image: %s", esp_err_to_name(err));
+        return;
+    }
+    s_rtc_record.magic = 0;
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    const esp_app_desc_t *app = esp_app_get_description();
+    ESP_LOGI(TAG, "Image %s on %s confirmed", app->version, running->label);
+    garage_publish_ota_boot("validated", running->label, app->version, NULL, NULL);
+}
+
+void garage_ota_prepare_restart(void)
+{
+    const esp_partition_t *target = esp_ota_get_boot_partition();
+    if (!target) {
+        return;
+    }
+    memset(&s_rtc_record, 0, sizeof(s_rtc_record));
+    snprintf(s_rtc_record.target_label, sizeof(s_rtc_record.target_label), "%s", target->label);
+    s_rtc_record.crc = rtc_record_crc(&s_rtc_record);
+    s_rtc_record.magic = OTA_RTC_MAGIC;
+}
+
+typedef struct {
+    int64_t started_us;
+    size_t start_bytes;        // already on flash when this download began
+    int64_t last_report_us;
+    uint32_t max_kib_s;
+} ota_transfer_t;
+
+static uint32_t transfer_bytes_per_s(const ota_transfer_t *transfer, size_t read)
+{
+    int64_t elapsed_us = esp_timer_get_time() - transfer->started_us;
+    if (elapsed_us <= 0 || read <= transfer->start_bytes) {
+        return 0;
+    }
+    return (uint32_t)((int64_t)(read - transfer->start_bytes) * 1000000 / elapsed_us);
+}
+
+// Sleeps off any lead over the rate cap, then reports progress if due.
+static void transfer_pace(ota_transfer_t *transfer, size_t read, int64_t total)
+{
+    int64_t now_us = esp_timer_get_time();
+    if (transfer->max_kib_s > 0) {
+        int64_t due_us = transfer->started_us +
+                         (int64_t)(read - transfer->start_bytes) * 1000000 / ((int64_t)transfer->max_kib_s * 1024);
+        if (due_us > now_us) {
+            vTaskDelay(pdMS_TO_TICKS((due_us - now_us) / 1000) + 1);
+            now_us = esp_timer_get_time();
+        }
+    }
+    if (now_us - transfer->last_report_us >= OTA_PROGRESS_INTERVAL_US) {
+        transfer->last_report_us = now_us;
+        garage_publish_ota_progress(read, total, transfer_bytes_per_s(transfer, read));
+    }
+}
+
+// Final transfer report; savings are timed at the throughput actually seen.
+static void transfer_report(const ota_transfer_t *transfer, const char *format, size_t bytes, size_t image_bytes)
+{
+    uint32_t bytes_per_s = transfer_bytes_per_s(transfer, bytes);
+    size_t saved = image_bytes > bytes ? image_bytes - bytes : 0;
+    uint32_t duration_ms = (uint32_t)((esp_timer_get_time() - transfer->started_us) / 1000);
+    uint32_t saved_ms = bytes_per_s > 0 ? (uint32_t)((uint64_t)saved * 1000 / bytes_per_s) : 0;
+    ESP_LOGI(TAG, "OTA %s download: %u bytes for a %u-byte image in %" PRIu32 " ms", format, (unsigned)bytes,
+             (unsigned)image_bytes, duration_ms);
+    garage_metrics_count(GARAGE_COUNTER_OTA_BYTES_SAVED, saved);
+    garage_publish_ota_transfer(format, bytes, image_bytes, duration_ms, saved_ms);
+}
+
+// Errors that another attempt cannot fix.
+static bool transfer_error_final(esp_err_t err)
+{
+    return err == ESP_OK || err == ESP_ERR_OTA_VALIDATE_FAILED || err == ESP_ERR_NOT_FOUND ||
+           err == ESP_ERR_INVALID_VERSION || err == ESP_ERR_NOT_SUPPORTED || err == ESP_ERR_INVALID_CRC ||
+           err == ESP_ERR_INVALID_RESPONSE || err == ESP_ERR_NO_MEM;
+}
+
+// One connection's worth of streaming; *progress tracks bytes that a retry
+// does not have to fetch again.
+typedef esp_err_t (*transfer_attempt_fn)(void *ctx, ota_transfer_t *transfer, size_t *progress);
+
+static esp_err_t transfer_run(transfer_attempt_fn attempt, void *ctx, ota_transfer_t *transfer)
+{
+    size_t progress = 0;
+    unsigned stalled = 0;
+    for (;;) {
+        size_t before = progress;
+        esp_err_t err = attempt(ctx, transfer, &progress);
+        if (transfer_error_final(err)) {
+            return err;
+        }
+        stalled = progress > before ? 0 : stalled + 1;
+        if (stalled >= OTA_MAX_STALLED_ATTEMPTS) {
+            return err;
+        }
+        uint32_t delay_ms = OTA_RETRY_BASE_MS << (stalled < 4 ? stalled : 4);
+        ESP_LOGW(TAG, "OTA download interrupted at %u bytes (%s); resuming in %" PRIu32 " ms", (unsigned)progress,
+                 esp_err_to_name(err), delay_ms);
+        garage_metrics_count(GARAGE_COUNTER_OTA_RESUMES, 1);
+        vTaskDelay(pdMS_TO_TICKS(delay_ms));
+    }
+}
+
+static esp_err_t transfer_attempt(void *ctx, ota_transfer_t *transfer, size_t *written)
+{
+    esp_https_ota_config_t *ota_cfg = ctx;
+    ota_cfg->ota_resumption = *written > 0;
+    ota_cfg->ota_image_bytes_written = *written;
+    esp_https_ota_handle_t handle = NULL;
+    esp_err_t err = esp_https_ota_begin(ota_cfg, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    do {
+        err = esp_https_ota_perform(handle);
+        int read = esp_https_ota_get_image_len_read(handle);
+        if (read > 0) {
+            *written = (size_t)read;
+        }
+        if (err == ESP_ERR_HTTPS_OTA_IN_PROGRESS) {
+            transfer_pace(transfer, *written, esp_https_ota_get_image_size(handle));
+        }
+    } while (err == ESP_ERR_HTTPS_OTA_IN_PROGRESS);
+
+    if (err == ESP_OK && !esp_https_ota_is_complete_data_received(handle)) {
+        // The server closed the stream early; resume from here.
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    if (err != ESP_OK) {
+        esp_https_ota_abort(handle);
+        return err;
+    }
+    garage_publish_ota_progress(*written, esp_https_ota_get_image_size(handle), transfer_bytes_per_s(transfer, *written));
+    // Verifies the image and switches the boot partition.
+    err = esp_https_ota_finish(handle);
+    if (err == ESP_OK) {
+        transfer_report(transfer, "image", *written, *written);
+    }
+    return err;
+}
+
+esp_err_t garage_ota_download(const char *url, uint32_t max_kib_s)
+{
+    esp_http_client_config_t http_cfg = {
+        .url = url,
+        .crt_bundle_attach = esp_crt_bundle_attach,
+        .timeout_ms = 10000,
+        .keep_alive_enable = true,
+    };
+    esp_https_ota_config_t ota_cfg = {
+        .http_config = &http_cfg,
+    };
+    ota_transfer_t transfer = {
+        .started_us = esp_timer_get_time(),
+        .max_kib_s = max_kib_s,
+    };
+    return transfer_run(transfer_attempt, &ota_cfg, &transfer);
+}
+
+/*
+ * Packed (.gdz) images, as written by scripts/ota-pack.py: a fixed header,
+ * then a zlib stream holding either the whole image or a delta against the
+ * running image. The stream is inflated into a 32 KiB window and written
+ * out as it arrives; delta ops pull their base bytes straight from the
+ * running slot. Everything lives in one heap block of about 45 KiB that
+ * survives reconnects, so a resume picks up mid-stream with a Range request.
+ */
+typedef struct {
+    uint8_t header[OTA_PACK_HEADER_LEN];
+    size_t received;             // bytes of the .gdz consumed; a resume starts here
+    int64_t total;               // size of the .gdz, -1 until a response announces it
+    uint32_t image_size;
+    uint32_t base_size;
+    size_t written;              // image bytes on flash
+    bool delta;
+    bool inflated;               // zlib stream complete
+    tinfl_decompressor inflator;
+    uint8_t window[TINFL_LZ_DICT_SIZE];
+    size_t window_pos;
+    uint8_t op[OTA_PACK_OP_LEN];
+    size_t op_len;
+    uint32_t extra_left;
+    uint32_t add_left;
+    uint32_t base_offset;
+    uint8_t io[OTA_PACK_IO_LEN];     // network reads
+    uint8_t base[OTA_PACK_IO_LEN];   // running slot reads
+    const esp_partition_t *running;
+    const esp_partition_t *target;
+    esp_ota_handle_t ota;
+    bool ota_begun;
+    mbedtls_sha256_context sha;
+} ota_packed_t;
+
+static uint32_t read_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static esp_err_t packed_emit(ota_packed_t *packed, const uint8_t *data, size_t len)
+{
+    if (len > packed->image_size - packed->written) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    esp_err_t err = esp_ota_write(packed->ota, data, len);
+    if (err != ESP_OK) {
+        return err;
+    }
+    mbedtls_sha256_update(&packed->sha, data, len);
+    packed->written += len;
+    return ESP_OK;
+}
+
+static esp_err_t packed_patch(ota_packed_t *packed, const uint8_t *data, size_t len)
+{
+    while (len > 0) {
+        if (packed->op_len < OTA_PACK_OP_LEN) {
+            size_t n = OTA_PACK_OP_LEN - packed->op_len;
+            n = n < len ? n : len;
+            memcpy(packed->op + packed->op_len, data, n);
+            packed->op_len += n;
+            data += n;
+            len -= n;
+            if (packed->op_len == OTA_PACK_OP_LEN) {
+                packed->extra_left = read_le32(packed->op);
+                packed->base_offset = read_le32(packed->op + 4);
+                packed->add_left = read_le32(packed->op + 8);
+                if (packed->base_offset > packed->base_size ||
+                    packed->add_left > packed->base_size - packed->base_offset) {
+                    return ESP_ERR_INVALID_RESPONSE;
+                }
+            }
+        } else if (packed->extra_left > 0) {
+            size_t n = packed->extra_left < len ? packed->extra_left : len;
+            esp_err_t err = packed_emit(packed, data, n);
+            if (err != ESP_OK) {
+                return err;
+            }
+            packed->extra_left -= n;
+            data += n;
+            len -= n;
+        } else {
+            size_t n = packed->add_left < len ? packed->add_left : len;
+            n = n < sizeof(packed->base) ? n : sizeof(packed->base);
+            esp_err_t err = esp_partition_read(packed->running, packed->base_offset, packed->base, n);
+            if (err != ESP_OK) {
+                return err;
+            }
+            for (size_t i = 0; i < n; i++) {
+                packed->base[i] += data[i];
+            }
+            err = packed_emit(packed, packed->base, n);
+            if (err != ESP_OK) {
+                return err;
+            }
+            packed->base_offset += n;
+            packed->add_left -= n;
+            data += n;
+            len -= n;
+        }
+        if (packed->op_len == OTA_PACK_OP_LEN && packed->extra_left == 0 && packed->add_left == 0) {
+            packed->op_len = 0;
+        }
+    }
+    return ESP_OK;
+}
+
+// A delta only applies to the exact image it was made against.
+static bool packed_base_matches(ota_packed_t *packed)
+{
+    if (packed->base_size > packed->running->size) {
+        return false;
+    }
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    bool ok = true;
+    for (uint32_t offset = 0; ok && offset < packed->base_size; offset += sizeof(packed->base)) {
+        size_t n = packed->base_size - offset;
+        n = n < sizeof(packed->base) ? n : sizeof(packed->base);
+        ok = esp_partition_read(packed->running, offset, packed->base, n) == ESP_OK;
+        mbedtls_sha256_update(&sha, packed->base, n);
+    }
+    uint8_t digest[32];
+    mbedtls_sha256_finish(&sha, digest);
+    mbedtls_sha256_free(&sha);
+    return ok && memcmp(digest, packed->header + OTA_PACK_BASE_SHA_OFFSET, sizeof(digest)) == 0;
+}
+
+static esp_err_t packed_start(ota_packed_t *packed)
+{
+    const uint8_t *header = packed->header;
+    if (memcmp(header, OTA_PACK_MAGIC, 4) != 0 || header[4] > OTA_PACK_FORMAT_DELTA) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    packed->delta = header[4] == OTA_PACK_FORMAT_DELTA;
+    packed->image_size = read_le32(header + 8);
+    packed->base_size = read_le32(header + 12);
+    if (packed->image_size == 0 || packed->image_size > packed->target->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (packed->delta && !packed_base_matches(packed)) {
+        ESP_LOGW(TAG, "OTA delta was not made against the running image");
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    esp_err_t err = esp_ota_begin(packed->target, OTA_WITH_SEQUENTIAL_WRITES, &packed->ota);
+    if (err != ESP_OK) {
+        return err;
+    }
+    packed->ota_begun = true;
+    tinfl_init(&packed->inflator);
+    mbedtls_sha256_starts(&packed->sha, 0);
+    return ESP_OK;
+}
+
+static esp_err_t packed_feed(ota_packed_t *packed, const uint8_t *data, size_t len)
+{
+    if (packed->received < OTA_PACK_HEADER_LEN) {
+        size_t n = OTA_PACK_HEADER_LEN - packed->received;
+        n = n < len ? n : len;
+        memcpy(packed->header + packed->received, data, n);
+        packed->received += n;
+        data += n;
+        len -= n;
+        if (packed->received < OTA_PACK_HEADER_LEN) {
+            return ESP_OK;
+        }
+        esp_err_t err = packed_start(packed);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    for (;;) {
+        size_t in = len;
+        size_t out = sizeof(packed->window) - packed->window_pos;
+        tinfl_status status = tinfl_decompress(&packed->inflator, data, &in, packed->window,
+                                               packed->window + packed->window_pos, &out,
+                                               TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_HAS_MORE_INPUT);
+        data += in;
+        len -= in;
+        packed->received += in;
+        if (out > 0) {
+            const uint8_t *chunk = packed->window + packed->window_pos;
+            esp_err_t err = packed->delta ? packed_patch(packed, chunk, out) : packed_emit(packed, chunk, out);
+            if (err != ESP_OK) {
+                return err;
+            }
+            packed->window_pos = (packed->window_pos + out) & (sizeof(packed->window) - 1);
+        }
+        if (status < TINFL_STATUS_DONE) {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        if (status == TINFL_STATUS_DONE) {
+            packed->inflated = true;
+            return ESP_OK;
+        }
+        if (status == TINFL_STATUS_NEEDS_MORE_INPUT) {
+            return ESP_OK;
+        }
+    }
+}
+
+// Switches the boot partition only for a complete image with the digest
+// the packer recorded; esp_ota_end() then checks the app image itself.
+static esp_err_t packed_finish(ota_packed_t *packed)
+{
+    uint8_t digest[32];
+    mbedtls_sha256_finish(&packed->sha, digest);
+    if (packed->written != packed->image_size ||
+        memcmp(digest, packed->header + OTA_PACK_IMAGE_SHA_OFFSET, sizeof(digest)) != 0) {
+        ESP_LOGE(TAG, "Rebuilt OTA image does not match its digest");
+        return ESP_ERR_INVALID_CRC;
+    }
+    packed->ota_begun = false;
+    esp_err_t err = esp_ota_end(packed->ota);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return esp_ota_set_boot_partition(packed->target);
+}
+
+static esp_err_t http_open_following_redirects(esp_http_client_handle_t client, int *status)
+{
+    for (int redirects = 0;; redirects++) {
+        esp_err_t err = esp_http_client_open(client, 0);
+        if (err != ESP_OK) {
+            return err;
+        }
+        esp_http_client_fetch_headers(client);
+        *status = esp_http_client_get_status_code(client);
+        bool redirect = *status == 301 || *status == 302 || *status == 303 || *status == 307 || *status == 308;
+        if (!redirect || redirects >= OTA_MAX_REDIRECTS) {
+            return ESP_OK;
+        }
+        esp_http_client_flush_response(client, NULL);
+        err = esp_http_client_set_redirection(client);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+}
+
+typedef struct {
+    const char *url;
+    ota_packed_t *packed;
+} ota_packed_source_t;
+
+static esp_err_t packed_attempt(void *ctx, ota_transfer_t *transfer, size_t *progress)
+{
+    const ota_packed_source_t *source = ctx;
+    ota_packed_t *packed = source->packed;
+    esp_http_client_config_t http_cfg = {
+        .url = source->url,
+        .crt_bundle_attach = esp_crt_bundle_attach,
+        .timeout_ms = 10000,
+        .keep_alive_enable = true,
+    };
+    esp_http_client_handle_t client = esp_http_client_init(&http_cfg);
+    if (!client) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (packed->received > 0) {
+        char range[32];
+        snprintf(range, sizeof(range), "bytes=%u-", (unsigned)packed->received);
+        esp_http_client_set_header(client, "Range", range);
+    }
+
+    int status = 0;
+    esp_err_t err = http_open_following_redirects(client, &status);
+    if (err == ESP_OK && status == 404) {
+        err = ESP_ERR_NOT_FOUND;
+    } else if (err == ESP_OK && status != (packed->received > 0 ? 206 : 200)) {
+        ESP_LOGW(TAG, "Unexpected HTTP status %d for OTA image", status);
+        err = ESP_FAIL;
+    }
+    if (err == ESP_OK) {
+        int64_t length = esp_http_client_get_content_length(client);
+        if (length > 0) {
+            packed->total = (int64_t)packed->received + length;
+        }
+    }
+
+    // Past this point the decoder state has moved on, so an error other than
+    // a dropped connection cannot be retried.
+    bool stream_error = false;
+    while (err == ESP_OK && !packed->inflated) {
+        int read = esp_http_client_read(client, (char *)packed->io, sizeof(packed->io));
+        if (read < 0) {
+            err = ESP_FAIL;
+        } else if (read == 0) {
+            // The server closed the stream early; resume from here.
+            err = ESP_ERR_INVALID_SIZE;
+        } else {
+            err = packed_feed(packed, packed->io, (size_t)read);
+            stream_error = err != ESP_OK;
+            *progress = packed->received;
+            transfer_pace(transfer, packed->received, packed->total);
+        }
+    }
+    esp_http_client_close(client);
+    esp_http_client_cleanup(client);
+    if (err == ESP_OK) {
+        err = packed_finish(packed);
+        stream_error = true;
+    }
+    return stream_error && !transfer_error_final(err) ? ESP_ERR_INVALID_RESPONSE : err;
+}
+
+esp_err_t garage_ota_download_packed(const char *url, uint32_t max_kib_s)
+{
+    ota_packed_t *packed = calloc(1, sizeof(*packed));
+    if (!packed) {
+        return ESP_ERR_NO_MEM;
+    }
+    packed->total = -1;
+    packed->running = esp_ota_get_running_partition();
+    packed->target = esp_ota_get_next_update_partition(NULL);
+    mbedtls_sha256_init(&packed->sha);
+    ota_packed_source_t source = {
+        .url = url,
+        .packed = packed,
+    };
+    ota_transfer_t transfer = {
+        .started_us = esp_timer_get_time(),
+        .max_kib_s = max_kib_s,
+    };
+
+    esp_err_t err = packed->target ? transfer_run(packed_attempt, &source, &transfer) : ESP_ERR_NOT_FOUND;
+    if (err == ESP_OK) {
+        garage_publish_ota_progress(packed->received, packed->total, transfer_bytes_per_s(&transfer, packed->received));
+        transfer_report(&transfer, packed->delta ? "delta" : "compressed", packed->received, packed->image_size);
+    }
+    if (packed->ota_begun) {
+        esp_ota_abort(packed->ota);
+    }
+    mbedtls_sha256_free(&packed->sha);
+    free(packed);
+    return err;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/*
+ * A/B image bookkeeping on top of the bootloader's app rollback. A new image
+ * boots pending verification and is confirmed only once it has reached
+ * Wi-Fi, the broker and had a publish acknowledged; if that does not happen
+ * within the deadline it is marked invalid and the previous slot boots
+ * again. What happened to the previous image (and why) is carried across
+ * the restart in RTC memory and published by the image that runs next.
+ */
+typedef enum {
+    GARAGE_OTA_MILESTONE_WIFI = 0,
+    GARAGE_OTA_MILESTONE_MQTT,
+    GARAGE_OTA_MILESTONE_PUBLISH,
+} garage_ota_milestone_t;
+
+// Early in app_main, after garage_publish_init(); publishes the running
+// slot and version and arms the rollback deadline if the image is unconfirmed.
+void garage_ota_boot_init(uint32_t validate_timeout_s);
+bool garage_ota_validation_pending(void);
+// Safe from any task; confirms the image once every milestone was seen.
+void garage_ota_milestone(garage_ota_milestone_t milestone);
+// Right before restarting into a freshly written image.
+void garage_ota_prepare_restart(void);
+
+/*
+ * Streams the image at url into the idle slot and makes it the boot
+ * partition; blocks for the whole transfer, so it runs on its own
+ * low-priority task. A dropped connection resumes where it left off with
+ * an HTTP Range request; the download gives up after a few attempts in a
+ * row that make no progress. max_kib_s caps the average rate (0: no cap).
+ * Progress is published on the OTA status topic every few seconds.
+ */
+esp_err_t garage_ota_download(const char *url, uint32_t max_kib_s);
+
+/*
+ * Same for a packed asset (scripts/ota-pack.py): a compressed image or a
+ * delta against the running image, inflated and patched on the fly with
+ * bounded RAM. The rebuilt image must match the SHA-256 recorded by the
+ * packer before the boot partition is switched. Returns ESP_ERR_NOT_FOUND
+ * when the server has no such asset and ESP_ERR_INVALID_VERSION when a
+ * delta was made against another image, so the caller can fall back.
+ */
+esp_err_t garage_ota_download_packed(const char *url, uint32_t max_kib_s);
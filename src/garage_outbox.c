@@ -0,0 +1,103 @@
+#include "garage_outbox.h"
+
+#include <string.h>
+
+// Records start 4-byte aligned so the header can be read in place.
+#define OUTBOX_ALIGN(n) (((n) + 3u) & ~(size_t)3u)
+#define OUTBOX_RECORD_SIZE(len) OUTBOX_ALIGN(sizeof(garage_outbox_record_t) + (len))
+
+// Live records occupy [s_head, s_tail); s_last is the newest, valid when
+// the outbox is not empty.
+static _Alignas(4) uint8_t s_buffer[GARAGE_OUTBOX_BYTES];
+static size_t s_head = 0;
+static size_t s_tail = 0;
+static size_t s_last = 0;
+static uint32_t s_next_seq = 1;
+
+static garage_outbox_record_t *record_at(size_t offset)
+{
+    return (garage_outbox_record_t *)(void *)&s_buffer[offset];
+}
+
+static void drop_oldest(garage_outbox_push_result_t *result)
+{
+    const garage_outbox_record_t *oldest = record_at(s_head);
+    result->evicted++;
+    result->evicted_collapsible |= oldest->collapsible;
+    s_head += OUTBOX_RECORD_SIZE(oldest->len);
+    if (s_head == s_tail) {
+        s_head = s_tail = 0;
+    }
+}
+
+void garage_outbox_init(void)
+{
+    s_head = s_tail = s_last = 0;
+    s_next_seq = 1;
+}
+
+bool garage_outbox_empty(void)
+{
+    return s_head == s_tail;
+}
+
+bool garage_outbox_push(uint8_t kind, bool collapsible, const char *payload, size_t len,
+                        garage_outbox_push_result_t *result)
+{
+    *result = (garage_outbox_push_result_t){0};
+    size_t needed = OUTBOX_RECORD_SIZE(len);
+    if (len > UINT16_MAX || needed > sizeof(s_buffer)) {
+        return false;
+    }
+
+    if (collapsible && !garage_outbox_empty() && record_at(s_last)->collapsible) {
+        s_tail = s_last;
+        result->collapsed = true;
+        if (s_head == s_tail) {
+            s_head = s_tail = 0;
+        }
+    }
+
+    while (!garage_outbox_empty() && sizeof(s_buffer) - (s_tail - s_head) < needed) {
+        drop_oldest(result);
+    }
+    if (sizeof(s_buffer) - s_tail < needed) {
+        // Enough room in total, just not at the end: slide the live records down.
+        memmove(s_buffer, &s_buffer[s_head], s_tail - s_head);
+        s_tail -= s_head;
+        s_head = 0;
+    }
+
+    garage_outbox_record_t *record = record_at(s_tail);
+    record->seq = s_next_seq++;
+    record->kind = kind;
+    record->collapsible = collapsible;
+    record->len = (uint16_t)len;
+    memcpy(record + 1, payload, len);
+    s_last = s_tail;
+    s_tail += needed;
+    return true;
+}
+
+bool garage_outbox_peek(garage_outbox_record_t *record, char *payload, size_t size)
+{
+    if (garage_outbox_empty()) {
+        return false;
+    }
+    const garage_outbox_record_t *oldest = record_at(s_head);
+    *record = *oldest;
+    if (oldest->len > size) {
+        return false;
+    }
+    memcpy(payload, oldest + 1, oldest->len);
+    return true;
+}
+
+void garage_outbox_pop(uint32_t seq)
+{
+    if (garage_outbox_empty() || record_at(s_head)->seq != seq) {
+        return;
+    }
+    garage_outbox_push_result_t ignored = {0};
+    drop_oldest(&ignored);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Payload bytes held while the broker is unreachable, record headers included.
+#define GARAGE_OUTBOX_BYTES 2048
+
+/*
+ * Bounded FIFO of messages the broker has not seen yet. Records are packed
+ * back to back in a static byte buffer; when a new one does not fit, the
+ * oldest are evicted. A collapsible record (retained state) replaces the
+ * newest record if that one is collapsible too, so a run of state changes
+ * costs one slot while events around it keep their order. Not thread-safe;
+ * garage_publish serializes callers.
+ */
+typedef struct {
+    uint32_t seq;
+    uint8_t kind;  // caller-defined, e.g. a garage_publish_kind_t
+    bool collapsible;
+    uint16_t len;
+} garage_outbox_record_t;
+
+typedef struct {
+    bool collapsed;             // replaced the newest record
+    uint32_t evicted;           // oldest records dropped to make room
+    bool evicted_collapsible;   // one of them was collapsible
+} garage_outbox_push_result_t;
+
+void garage_outbox_init(void);
+bool garage_outbox_empty(void);
+
+// Returns false only if the payload can never fit.
+bool garage_outbox_push(uint8_t kind, bool collapsible, const char *payload, size_t len,
+                        garage_outbox_push_result_t *result);
+
+// Copies the oldest record into payload (size bytes); false when empty or
+// the record does not fit.
+bool garage_outbox_peek(garage_outbox_record_t *record, char *payload, size_t size);
+// Removes the oldest record if it is still the one with seq.
+void garage_outbox_pop(uint32_t seq);
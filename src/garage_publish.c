@@ -0,0 +1,591 @@
+#include "garage_publish.h"
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "garage_hal.h"
+#include "garage_metrics.h"
+#include "garage_outbox.h"
+
+#define PUBLISH_PREFIX_MAX_LEN 160
+#define PUBLISH_PAYLOAD_MAX_LEN 512
+// Stage and counter tables grow with every metric; only the metrics
+// publisher (on control_task) needs the larger buffer.
+#define PUBLISH_METRICS_MAX_LEN 2048
+#define PUBLISH_DETAIL_MAX_LEN 192
+
+static const char *TAG = "garage";
+
+// Constant head of an outgoing message ({"type":..,"deviceId":..,) and the
+// topic it goes to, rendered once at boot so publishes only append the tail.
+typedef struct {
+    const char *type;
+    const char *topic;
+    char prefix[PUBLISH_PREFIX_MAX_LEN];
+    size_t prefix_len;
+} publish_template_t;
+
+static publish_template_t s_publish_templates[GARAGE_PUBLISH_COUNT];
+// Guarded by garage_hal_publish_lock(); set when a held retained state was
+// evicted, so the broker's retained copy needs a fresh snapshot.
+static bool s_outbox_state_lost = false;
+
+// What a retained state says, minus its timestamp. extra_key is always a
+// string literal, so comparing pointers is enough.
+typedef struct {
+    garage_state_t state;
+    const char *extra_key;
+} state_content_t;
+
+/*
+ * Publish-on-change gate for retained states, guarded by
+ * garage_hal_publish_lock(). A state equal to the newest one sent or
+ * pending is dropped. A change within the window of the previous send is
+ * parked in pending (replacing anything parked before) and goes out when
+ * the window timer fires, so the last state always reaches the broker.
+ * Countdown values such as cooldownMs are not part of the content: clients
+ * can derive them from the timestamp.
+ */
+static struct {
+    uint32_t window_ms;
+    bool sent_valid;
+    state_content_t sent;
+    int64_t sent_us;
+    bool pending_valid;
+    state_content_t pending;
+    char pending_payload[PUBLISH_PAYLOAD_MAX_LEN];
+    size_t pending_len;
+    bool topic_active;  // a state or OTA message went out since the last heartbeat
+} s_state_gate;
+
+static size_t json_escape_into(char *out, size_t out_size, const char *value)
+{
+    size_t written = 0;
+    for (const char *c = value; *c; ++c) {
+        char escaped = 0;
+        switch (*c) {
+            case '"':
+                escaped = '"';
+                break;
+            case '\\':
+                escaped = '\\';
+                break;
+            case '\n':
+                escaped = 'n';
+                break;
+            case '\r':
+                escaped = 'r';
+                break;
+            case '\t':
+                escaped = 't';
+                break;
+            default:
+                break;
+        }
+        if (escaped) {
+            if (written + 2 >= out_size) {
+                break;
+            }
+            out[written++] = '\\';
+            out[written++] = escaped;
+        } else if ((unsigned char)*c >= 0x20) {
+            if (written + 1 >= out_size) {
+                break;
+            }
+            out[written++] = *c;
+        }
+    }
+    if (out_size > 0) {
+        out[written] = '\0';
+    }
+    return written;
+}
+
+static bool publish_template_build(garage_publish_kind_t kind, const char *type, const char *raw_device_id,
+                                   const char *topic)
+{
+    publish_template_t *tpl = &s_publish_templates[kind];
+    char device_id[96];
+    json_escape_into(device_id, sizeof(device_id), raw_device_id);
+
+    int written = snprintf(tpl->prefix, sizeof(tpl->prefix), "{\"type\":\"%s\",\"deviceId\":\"%s\",", type, device_id);
+    if (written <= 0 || written >= (int)sizeof(tpl->prefix)) {
+        return false;
+    }
+    tpl->type = type;
+    tpl->topic = topic;
+    tpl->prefix_len = (size_t)written;
+    return true;
+}
+
+bool garage_publish_init(const char *device_id, const char *state_topic, const char *metrics_topic,
+                         const char *result_topic, uint32_t state_window_ms)
+{
+    garage_outbox_init();
+    s_state_gate.window_ms = state_window_ms;
+    return publish_template_build(GARAGE_PUBLISH_STATE, "state", device_id, state_topic) &&
+           publish_template_build(GARAGE_PUBLISH_HEARTBEAT, "heartbeat", device_id, state_topic) &&
+           publish_template_build(GARAGE_PUBLISH_OTA, "ota", device_id, state_topic) &&
+           publish_template_build(GARAGE_PUBLISH_METRICS, "metrics", device_id, metrics_topic) &&
+           publish_template_build(GARAGE_PUBLISH_RESULT, "result", device_id, result_topic);
+}
+
+// Appends printf-style text at *len; returns false once the buffer is exhausted.
+static bool payload_appendf(char *buffer, size_t size, size_t *len, const char *fmt, ...)
+{
+    if (*len >= size) {
+        return false;
+    }
+    va_list args;
+    va_start(args, fmt);
+    int written = vsnprintf(buffer + *len, size - *len, fmt, args);
+    va_end(args);
+    if (written < 0 || (size_t)written >= size - *len) {
+        *len = size;
+        return false;
+    }
+    *len += (size_t)written;
+    return true;
+}
+
+// Keeps the message for the broker while it is unreachable, or while older
+// held messages are still waiting so it cannot overtake them. Retained
+// states collapse into the one before them; everything else keeps order.
+static bool outbox_hold(garage_publish_kind_t kind, bool retain, const char *payload, size_t len)
+{
+    bool connected = garage_hal_mqtt_connected();
+    bool held = false;
+    garage_outbox_push_result_t result;
+    garage_hal_publish_lock();
+    if (!connected || !garage_outbox_empty()) {
+        held = garage_outbox_push((uint8_t)kind, retain, payload, len, &result);
+        s_outbox_state_lost |= held && result.evicted_collapsible;
+    }
+    garage_hal_publish_unlock();
+    if (!held) {
+        return false;
+    }
+
+    garage_metrics_count(GARAGE_COUNTER_OUTBOX_HELD, 1);
+    if (result.collapsed) {
+        garage_metrics_count(GARAGE_COUNTER_OUTBOX_COLLAPSED, 1);
+    }
+    if (result.evicted > 0) {
+        garage_metrics_count(GARAGE_COUNTER_OUTBOX_DROPPED, result.evicted);
+        ESP_LOGW(TAG, "Outbox full; dropped %" PRIu32 " oldest message(s)", result.evicted);
+    }
+    return true;
+}
+
+static void count_saved(size_t bytes)
+{
+    garage_metrics_count(GARAGE_COUNTER_PUBLISHES_SAVED, 1);
+    garage_metrics_count(GARAGE_COUNTER_PUBLISH_BYTES_SAVED, (uint32_t)bytes);
+}
+
+// Returns true if the state should go out now; otherwise it was a repeat,
+// or it is parked until the window timer fires.
+static bool state_gate_admit(garage_state_t state, const char *extra_key, const char *payload, size_t len)
+{
+    state_content_t content = {.state = state, .extra_key = extra_key};
+    int64_t now_us = garage_hal_now_us();
+    int64_t window_us = (int64_t)s_state_gate.window_ms * 1000;
+    size_t saved = 0;
+    uint32_t arm_ms = 0;
+    bool publish_now = false;
+
+    garage_hal_publish_lock();
+    const state_content_t *latest = s_state_gate.pending_valid ? &s_state_gate.pending
+                                    : s_state_gate.sent_valid  ? &s_state_gate.sent
+                                                               : NULL;
+    int64_t elapsed_us = now_us - s_state_gate.sent_us;
+    if (latest && latest->state == content.state && latest->extra_key == content.extra_key) {
+        saved = len;
+    } else if (s_state_gate.sent_valid && elapsed_us < window_us) {
+        if (s_state_gate.pending_valid) {
+            saved = s_state_gate.pending_len;
+        } else {
+            arm_ms = (uint32_t)((window_us - elapsed_us + 999) / 1000);
+        }
+        if (s_state_gate.sent.state == content.state && s_state_gate.sent.extra_key == content.extra_key) {
+            // Back to what the broker already has; the detour never goes out.
+            s_state_gate.pending_valid = false;
+            saved += len;
+        } else {
+            s_state_gate.pending = content;
+            s_state_gate.pending_valid = true;
+            memcpy(s_state_gate.pending_payload, payload, len);
+            s_state_gate.pending_len = len;
+        }
+    } else {
+        if (s_state_gate.pending_valid) {
+            saved = s_state_gate.pending_len;
+            s_state_gate.pending_valid = false;
+        }
+        s_state_gate.sent = content;
+        s_state_gate.sent_valid = true;
+        s_state_gate.sent_us = now_us;
+        publish_now = true;
+    }
+    garage_hal_publish_unlock();
+
+    if (saved > 0) {
+        count_saved(saved);
+    }
+    if (arm_ms > 0) {
+        garage_hal_state_window_start(arm_ms);
+    }
+    return publish_now;
+}
+
+// A heartbeat only proves liveness; any state-topic message since the
+// previous one already did that.
+static bool heartbeat_redundant(void)
+{
+    garage_hal_publish_lock();
+    bool active = s_state_gate.topic_active;
+    s_state_gate.topic_active = false;
+    garage_hal_publish_unlock();
+    return active;
+}
+
+// hold: queue in the outbox rather than drop while the broker is away.
+static void publish_payload(garage_publish_kind_t kind, const char *payload, size_t len, int qos, bool retain,
+                            const char *what, bool hold)
+{
+    const publish_template_t *tpl = &s_publish_templates[kind];
+    if (kind == GARAGE_PUBLISH_STATE || kind == GARAGE_PUBLISH_OTA) {
+        garage_hal_publish_lock();
+        s_state_gate.topic_active = true;
+        garage_hal_publish_unlock();
+    }
+    garage_hal_local_publish(tpl->topic, payload, len, retain);
+    if (hold && outbox_hold(kind, retain, payload, len)) {
+        ESP_LOGI(TAG, "Holding %s message until MQTT reconnects", what);
+        return;
+    }
+
+    int msg_id = garage_hal_mqtt_publish(tpl->topic, payload, len, qos, retain);
+    if (msg_id < 0) {
+        ESP_LOGW(TAG, "Failed to publish %s message", what);
+    } else {
+        ESP_LOGI(TAG, "Published %s message id=%d", what, msg_id);
+    }
+}
+
+void garage_publish_ota_status(const char *status, const char *detail, const char *error)
+{
+    const publish_template_t *tpl = &s_publish_templates[GARAGE_PUBLISH_OTA];
+    char payload[PUBLISH_PAYLOAD_MAX_LEN];
+    size_t len = tpl->prefix_len;
+    memcpy(payload, tpl->prefix, len);
+
+    bool ok = payload_appendf(payload, sizeof(payload), &len, "\"status\":\"%s\",\"timestamp\":%" PRId64,
+                              status, garage_hal_now_us() / 1000);
+    if (ok && detail) {
+        char escaped[PUBLISH_DETAIL_MAX_LEN];
+        json_escape_into(escaped, sizeof(escaped), detail);
+        ok = payload_appendf(payload, sizeof(payload), &len, ",\"detail\":\"%s\"", escaped);
+    }
+    if (ok && error) {
+        ok = payload_appendf(payload, sizeof(payload), &len, ",\"error\":\"%s\"", error);
+    }
+    if (ok) {
+        ok = payload_appendf(payload, sizeof(payload), &len, "}");
+    }
+    if (!ok) {
+        ESP_LOGE(TAG, "OTA status payload too long");
+        return;
+    }
+
+    publish_payload(GARAGE_PUBLISH_OTA, payload, len, 1, false, "OTA status", true);
+}
+
+void garage_publish_ota_progress(size_t bytes, int64_t total, uint32_t bytes_per_s)
+{
+    const publish_template_t *tpl = &s_publish_templates[GARAGE_PUBLISH_OTA];
+    char payload[PUBLISH_PAYLOAD_MAX_LEN];
+    size_t len = tpl->prefix_len;
+    memcpy(payload, tpl->prefix, len);
+
+    bool ok = payload_appendf(payload, sizeof(payload), &len,
+                              "\"status\":\"downloading\",\"timestamp\":%" PRId64 ",\"bytes\":%u,\"bytesPerSecond\":%" PRIu32,
+                              garage_hal_now_us() / 1000, (unsigned)bytes, bytes_per_s);
+    if (ok && total > 0) {
+        int64_t percent = (int64_t)bytes * 100 / total;
+        ok = payload_appendf(payload, sizeof(payload), &len, ",\"totalBytes\":%" PRId64 ",\"percent\":%d", total,
+                             (int)(percent < 100 ? percent : 100));
+    }
+    if (ok) {
+        ok = payload_appendf(payload, sizeof(payload), &len, "}");
+    }
+    if (!ok) {
+        ESP_LOGE(TAG, "OTA progress payload too long");
+        return;
+    }
+
+    // Progress is only worth anything live.
+    publish_payload(GARAGE_PUBLISH_OTA, payload, len, 0, false, "OTA progress", false);
+}
+
+void garage_publish_ota_rollout(const char *status, const char *detail, bool canary, uint32_t delay_ms)
+{
+    const publish_template_t *tpl = &s_publish_templates[GARAGE_PUBLISH_OTA];
+    char payload[PUBLISH_PAYLOAD_MAX_LEN];
+    size_t len = tpl->prefix_len;
+    memcpy(payload, tpl->prefix, len);
+
+    char escaped[PUBLISH_DETAIL_MAX_LEN];
+    json_escape_into(escaped, sizeof(escaped), detail);
+    bool ok = payload_appendf(payload, sizeof(payload), &len,
+                              "\"status\":\"%s\",\"timestamp\":%" PRId64 ",\"detail\":\"%s\",\"canary\":%s,"
+                              "\"delayMs\":%" PRIu32 "}",
+                              status, garage_hal_now_us() / 1000, escaped, canary ? "true" : "false", delay_ms);
+    if (!ok) {
+        ESP_LOGE(TAG, "OTA rollout payload too long");
+        return;
+    }
+
+    publish_payload(GARAGE_PUBLISH_OTA, payload, len, 1, false, "OTA status", true);
+}
+
+void garage_publish_ota_transfer(const char *format, size_t bytes, size_t image_bytes, uint32_t duration_ms,
+                                 uint32_t saved_ms)
+{
+    const publish_template_t *tpl = &s_publish_templates[GARAGE_PUBLISH_OTA];
+    char payload[PUBLISH_PAYLOAD_MAX_LEN];
+    size_t len = tpl->prefix_len;
+    memcpy(payload, tpl->prefix, len);
+
+    bool ok = payload_appendf(payload, sizeof(payload), &len,
+                              "\"status\":\"downloaded\",\"timestamp\":%" PRId64 ",\"format\":\"%s\",\"bytes\":%u,"
+                              "\"imageBytes\":%u,\"durationMs\":%" PRIu32 ",\"savedBytes\":%u,\"savedMs\":%" PRIu32 "}",
+                              garage_hal_now_us() / 1000, format, (unsigned)bytes, (unsigned)image_bytes, duration_ms,
+                              (unsigned)(image_bytes > bytes ? image_bytes - bytes : 0), saved_ms);
+    if (!ok) {
+        ESP_LOGE(TAG, "OTA transfer payload too long");
+        return;
+    }
+
+    publish_payload(GARAGE_PUBLISH_OTA, payload, len, 1, false, "OTA status", true);
+}
+
+void garage_publish_ota_boot(const char *status, const char *slot, const char *version, const char *failed_version,
+                             const char *reason)
+{
+    const publish_template_t *tpl = &s_publish_templates[GARAGE_PUBLISH_OTA];
+    char payload[PUBLISH_PAYLOAD_MAX_LEN];
+    size_t len = tpl->prefix_len;
+    memcpy(payload, tpl->prefix, len);
+
+    char escaped[PUBLISH_DETAIL_MAX_LEN];
+    json_escape_into(escaped, sizeof(escaped), version);
+    bool ok = payload_appendf(payload, sizeof(payload), &len,
+                              "\"status\":\"%s\",\"timestamp\":%" PRId64 ",\"slot\":\"%s\",\"version\":\"%s\"", status,
+                              garage_hal_now_us() / 1000, slot, escaped);
+    if (ok && failed_version) {
+        json_escape_into(escaped, sizeof(escaped), failed_version);
+        ok = payload_appendf(payload, sizeof(payload), &len, ",\"failedVersion\":\"%s\"", escaped);
+    }
+    if (ok && reason) {
+        ok = payload_appendf(payload, sizeof(payload), &len, ",\"reason\":\"%s\"", reason);
+    }
+    if (ok) {
+        ok = payload_appendf(payload, sizeof(payload), &len, "}");
+    }
+    if (!ok) {
+        ESP_LOGE(TAG, "OTA boot payload too long");
+        return;
+    }
+
+    publish_payload(GARAGE_PUBLISH_OTA, payload, len, 1, false, "OTA status", true);
+}
+
+void garage_publish_state(garage_publish_kind_t kind, garage_state_t state, bool retain,
+                          const char *extra_key, int32_t extra_value)
+{
+    const publish_template_t *tpl = &s_publish_templates[kind];
+    // Heartbeats are only worth anything live; state changes are held.
+    if (!retain && !garage_hal_publish_ready()) {
+        ESP_LOGD(TAG, "Skipping %s publish; MQTT not connected", tpl->type);
+        return;
+    }
+
+    // Stack buffer rather than a shared static one: both the control task and
+    // the MQTT task publish, and neither path should touch the heap.
+    char payload[PUBLISH_PAYLOAD_MAX_LEN];
+    size_t len = tpl->prefix_len;
+    memcpy(payload, tpl->prefix, len);
+
+    bool ok = payload_appendf(payload, sizeof(payload), &len, "\"state\":\"%s\",\"timestamp\":%" PRId64,
+                              garage_state_to_string(state), garage_hal_now_us() / 1000);
+    if (ok && extra_key) {
+        ok = payload_appendf(payload, sizeof(payload), &len, ",\"%s\":%" PRId32, extra_key, extra_value);
+    }
+    if (ok) {
+        ok = payload_appendf(payload, sizeof(payload), &len, "}");
+    }
+    if (!ok) {
+        ESP_LOGE(TAG, "%s payload too long", tpl->type);
+        return;
+    }
+
+    if (kind == GARAGE_PUBLISH_HEARTBEAT && heartbeat_redundant()) {
+        ESP_LOGD(TAG, "Skipping heartbeat; state topic active since the last one");
+        count_saved(len);
+        return;
+    }
+    if (retain && !state_gate_admit(state, extra_key, payload, len)) {
+        return;
+    }
+    publish_payload(kind, payload, len, 1, retain, tpl->type, retain);
+}
+
+void garage_publish_metrics(void)
+{
+    const publish_template_t *tpl = &s_publish_templates[GARAGE_PUBLISH_METRICS];
+    if (!garage_hal_mqtt_connected()) {
+        ESP_LOGD(TAG, "Skipping metrics publish; MQTT not connected");
+        return;
+    }
+
+    // Static: only control_task publishes metrics, and this is too big for
+    // its stack.
+    static char payload[PUBLISH_METRICS_MAX_LEN];
+    size_t len = tpl->prefix_len;
+    memcpy(payload, tpl->prefix, len);
+
+    uint32_t heap_free = 0;
+    uint32_t heap_min_free = 0;
+    uint32_t heap_largest = 0;
+    garage_hal_heap_stats(&heap_free, &heap_min_free, &heap_largest);
+
+    bool ok = payload_appendf(payload, sizeof(payload), &len, "\"timestamp\":%" PRId64 ",", garage_hal_now_us() / 1000);
+    if (ok) {
+        ok = payload_appendf(payload, sizeof(payload), &len,
+                             "\"heap\":{\"free\":%" PRIu32 ",\"minFree\":%" PRIu32 ",\"largestBlock\":%" PRIu32 "},",
+                             heap_free, heap_min_free, heap_largest);
+    }
+    if (ok) {
+        size_t broker_len = garage_hal_format_broker_status(payload + len, sizeof(payload) - len);
+        len += broker_len;
+        ok = broker_len > 0 && payload_appendf(payload, sizeof(payload), &len, ",");
+    }
+    if (ok) {
+        size_t stages_len = garage_metrics_format(payload + len, sizeof(payload) - len);
+        ok = stages_len > 0;
+        len += stages_len;
+    }
+    if (ok) {
+        ok = payload_appendf(payload, sizeof(payload), &len, "}");
+    }
+    if (!ok) {
+        ESP_LOGE(TAG, "metrics payload too long");
+        return;
+    }
+
+    publish_payload(GARAGE_PUBLISH_METRICS, payload, len, 0, false, tpl->type, false);
+}
+
+void garage_publish_result(const char *request_id, const char *status, const char *detail)
+{
+    const publish_template_t *tpl = &s_publish_templates[GARAGE_PUBLISH_RESULT];
+    char payload[PUBLISH_PAYLOAD_MAX_LEN];
+    size_t len = tpl->prefix_len;
+    memcpy(payload, tpl->prefix, len);
+
+    char escaped_id[PUBLISH_DETAIL_MAX_LEN];
+    json_escape_into(escaped_id, sizeof(escaped_id), request_id);
+    bool ok = payload_appendf(payload, sizeof(payload), &len,
+                              "\"requestId\":\"%s\",\"status\":\"%s\",\"timestamp\":%" PRId64, escaped_id, status,
+                              garage_hal_now_us() / 1000);
+    if (ok && detail) {
+        char escaped[PUBLISH_DETAIL_MAX_LEN];
+        json_escape_into(escaped, sizeof(escaped), detail);
+        ok = payload_appendf(payload, sizeof(payload), &len, ",\"detail\":\"%s\"", escaped);
+    }
+    if (ok) {
+        ok = payload_appendf(payload, sizeof(payload), &len, "}");
+    }
+    if (!ok) {
+        ESP_LOGE(TAG, "result payload too long");
+        return;
+    }
+
+    publish_payload(GARAGE_PUBLISH_RESULT, payload, len, 1, false, "result", true);
+}
+
+void garage_publish_flush_state(void)
+{
+    // Static: control_task only.
+    static char payload[PUBLISH_PAYLOAD_MAX_LEN];
+    size_t len = 0;
+    garage_hal_publish_lock();
+    if (s_state_gate.pending_valid) {
+        len = s_state_gate.pending_len;
+        memcpy(payload, s_state_gate.pending_payload, len);
+        s_state_gate.sent = s_state_gate.pending;
+        s_state_gate.sent_valid = true;
+        s_state_gate.sent_us = garage_hal_now_us();
+        s_state_gate.pending_valid = false;
+    }
+    garage_hal_publish_unlock();
+    if (len > 0) {
+        publish_payload(GARAGE_PUBLISH_STATE, payload, len, 1, true, "state", true);
+    }
+}
+
+void garage_publish_forget_state(void)
+{
+    garage_hal_publish_lock();
+    s_state_gate.sent_valid = false;
+    s_state_gate.sent_us = 0;
+    garage_hal_publish_unlock();
+}
+
+bool garage_publish_flush_outbox(void)
+{
+    // Static: control_task only.
+    static char payload[PUBLISH_PAYLOAD_MAX_LEN];
+    unsigned sent = 0;
+    for (;;) {
+        garage_outbox_record_t record;
+        garage_hal_publish_lock();
+        bool pending = garage_outbox_peek(&record, payload, sizeof(payload));
+        garage_hal_publish_unlock();
+        if (!pending) {
+            break;
+        }
+
+        // Only retained states collapse, so the flag doubles as the retain bit.
+        const publish_template_t *tpl = &s_publish_templates[record.kind];
+        if (garage_hal_mqtt_publish(tpl->topic, payload, record.len, 1, record.collapsible) < 0) {
+            ESP_LOGW(TAG, "Outbox flush interrupted after %u message(s)", sent);
+            return false;
+        }
+        garage_hal_publish_lock();
+        garage_outbox_pop(record.seq);
+        garage_hal_publish_unlock();
+        ++sent;
+    }
+
+    garage_hal_publish_lock();
+    bool state_lost = s_outbox_state_lost;
+    s_outbox_state_lost = false;
+    garage_hal_publish_unlock();
+    if (sent > 0) {
+        ESP_LOGI(TAG, "Flushed %u held message(s)", sent);
+    }
+    return state_lost;
+}
+
+bool garage_publish_outbox_pending(void)
+{
+    garage_hal_publish_lock();
+    bool pending = !garage_outbox_empty();
+    garage_hal_publish_unlock();
+    return pending;
+}
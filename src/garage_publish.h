@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "garage_control.h"
+
+typedef enum {
+    GARAGE_PUBLISH_STATE = 0,
+    GARAGE_PUBLISH_HEARTBEAT,
+    GARAGE_PUBLISH_OTA,
+    GARAGE_PUBLISH_METRICS,
+    GARAGE_PUBLISH_RESULT,
+    GARAGE_PUBLISH_COUNT,
+} garage_publish_kind_t;
+
+// Renders the per-kind message templates; false if device_id does not fit.
+// state_window_ms is the minimum spacing of retained state publishes (0: none).
+bool garage_publish_init(const char *device_id, const char *state_topic, const char *metrics_topic,
+                         const char *result_topic, uint32_t state_window_ms);
+/*
+ * Retained states are published on change only and at most once per state
+ * window; a change inside the window is sent when it closes, so the last
+ * state is never lost. A heartbeat is skipped when another message went out
+ * on the state topic since the previous heartbeat.
+ */
+void garage_publish_state(garage_publish_kind_t kind, garage_state_t state, bool retain,
+                          const char *extra_key, int32_t extra_value);
+// Sends the state parked by the window; called when the window timer fires.
+void garage_publish_flush_state(void);
+// Makes the next state publish go out immediately even if unchanged, e.g.
+// for a snapshot to a broker that may hold an older retained copy.
+void garage_publish_forget_state(void);
+// error is an esp_err_t name, or NULL when the status carries no error.
+void garage_publish_ota_status(const char *status, const char *detail, const char *error);
+// Download progress on the OTA status topic; total is negative when the
+// server did not announce the image size.
+void garage_publish_ota_progress(size_t bytes, int64_t total, uint32_t bytes_per_s);
+// Staggered rollout plan: "scheduled" with the delay until the download
+// starts, or "waiting" while a non-canary holds for canary reports.
+void garage_publish_ota_rollout(const char *status, const char *detail, bool canary, uint32_t delay_ms);
+// Summary of a finished download: the asset format, bytes fetched against
+// the image size, and the time the smaller transfer saved.
+void garage_publish_ota_transfer(const char *format, size_t bytes, size_t image_bytes, uint32_t duration_ms,
+                                 uint32_t saved_ms);
+// Running image report on the OTA status topic: slot and version, plus the
+// rejected version and the reason after a rollback (both may be NULL).
+void garage_publish_ota_boot(const char *status, const char *slot, const char *version, const char *failed_version,
+                             const char *reason);
+// Latency summary from garage_metrics.h on the metrics topic (QoS 0).
+void garage_publish_metrics(void);
+// Outcome of the command tagged with request_id on the result topic (QoS 1);
+// detail may be NULL.
+void garage_publish_result(const char *request_id, const char *status, const char *detail);
+
+/*
+ * State changes, OTA status and results published while the broker is
+ * unreachable are held in a bounded outbox (garage_outbox.h) with their
+ * original timestamps and sent in order by this call, from the control
+ * task once MQTT is back. Returns true when a held state had to be
+ * evicted, i.e. the caller should publish a fresh snapshot.
+ */
+bool garage_publish_flush_outbox(void);
+// True while held messages are still waiting, e.g. after a flush that a
+// failed publish cut short; the caller retries the flush later.
+bool garage_publish_outbox_pending(void);
@@ -0,0 +1,49 @@
+#include "garage_reassembly.h"
+
+#include <string.h>
+
+void garage_reassembly_init(garage_reassembly_t *reassembly, char *buffer, size_t capacity)
+{
+    reassembly->buffer = buffer;
+    reassembly->capacity = capacity;
+    garage_reassembly_reset(reassembly);
+}
+
+void garage_reassembly_reset(garage_reassembly_t *reassembly)
+{
+    reassembly->active = false;
+    reassembly->expected = 0;
+    reassembly->received = 0;
+    reassembly->started_us = 0;
+}
+
+garage_reassembly_result_t garage_reassembly_feed(garage_reassembly_t *reassembly, const char *data, size_t chunk,
+                                                  size_t offset, size_t total, int64_t now_us)
+{
+    if (offset == 0) {
+        garage_reassembly_reset(reassembly);
+        if (total > reassembly->capacity) {
+            return GARAGE_REASSEMBLY_OVERSIZE;
+        }
+        reassembly->active = true;
+        reassembly->expected = total;
+        reassembly->started_us = now_us;
+    } else if (!reassembly->active) {
+        return GARAGE_REASSEMBLY_IGNORED;
+    } else if (offset != reassembly->received || total != reassembly->expected) {
+        garage_reassembly_reset(reassembly);
+        return GARAGE_REASSEMBLY_OUT_OF_SEQUENCE;
+    }
+    if (chunk > reassembly->expected - reassembly->received) {
+        garage_reassembly_reset(reassembly);
+        return GARAGE_REASSEMBLY_OUT_OF_SEQUENCE;
+    }
+
+    memcpy(reassembly->buffer + reassembly->received, data, chunk);
+    reassembly->received += chunk;
+    if (reassembly->received < reassembly->expected) {
+        return GARAGE_REASSEMBLY_PENDING;
+    }
+    reassembly->active = false;
+    return GARAGE_REASSEMBLY_COMPLETE;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Stitches an MQTT payload the client delivered in several fragments back
+ * together in a caller-provided buffer. Fragments of one message arrive in
+ * order, so anything that does not continue the message in progress is
+ * treated as corruption and the message is dropped. Pure logic like
+ * garage_backoff.h: time is passed in and the caller serializes access.
+ */
+typedef struct {
+    char *buffer;
+    size_t capacity;
+    size_t expected;
+    size_t received;
+    int64_t started_us;  // arrival of the first fragment
+    bool active;         // a message is in progress
+} garage_reassembly_t;
+
+typedef enum {
+    GARAGE_REASSEMBLY_PENDING = 0,     // stored; more fragments to come
+    GARAGE_REASSEMBLY_COMPLETE,        // buffer holds received bytes of the whole message
+    GARAGE_REASSEMBLY_OVERSIZE,        // first fragment announced more than capacity; message ignored
+    GARAGE_REASSEMBLY_OUT_OF_SEQUENCE, // message in progress dropped
+    GARAGE_REASSEMBLY_IGNORED,         // continuation of a message that was never started
+} garage_reassembly_result_t;
+
+void garage_reassembly_init(garage_reassembly_t *reassembly, char *buffer, size_t capacity);
+void garage_reassembly_reset(garage_reassembly_t *reassembly);
+
+/*
+ * Adds chunk bytes found at offset of a total-byte message. A fragment at
+ * offset 0 always starts a new message, abandoning one in progress. After
+ * GARAGE_REASSEMBLY_COMPLETE the buffer stays valid until the next call.
+ */
+garage_reassembly_result_t garage_reassembly_feed(garage_reassembly_t *reassembly, const char *data, size_t chunk,
+                                                  size_t offset, size_t total, int64_t now_us);
@@ -0,0 +1,92 @@
+#include "garage_rollout.h"
+
+#include <stdio.h>
+#include <string.h>
+
+typedef struct {
+    bool armed;
+    uint32_t self_hash;
+    unsigned quorum;
+    unsigned seen_count;
+    uint32_t seen[GARAGE_ROLLOUT_MAX_QUORUM];  // device id hashes of canaries that reported
+    char detail[GARAGE_ROLLOUT_DETAIL_MAX_LEN];
+} rollout_gate_t;
+
+static rollout_gate_t s_gate;
+
+// FNV-1a; stable across builds and trivial to mirror in the fleet simulator.
+static uint32_t device_hash(const char *id, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)id[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// murmur3 finalizer, so the delay is not correlated with the canary bucket.
+static uint32_t mix32(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+garage_rollout_plan_t garage_rollout_plan(const char *device_id, uint32_t window_s, unsigned canary_percent)
+{
+    uint32_t hash = device_hash(device_id, strlen(device_id));
+    if (window_s > GARAGE_ROLLOUT_MAX_WINDOW_S) {
+        window_s = GARAGE_ROLLOUT_MAX_WINDOW_S;
+    }
+    garage_rollout_plan_t plan = {
+        .canary = hash % 100 < canary_percent,
+        .delay_ms = (uint32_t)(((uint64_t)mix32(hash) * window_s * 1000) >> 32),
+    };
+    return plan;
+}
+
+void garage_rollout_gate_arm(const char *self_id, const char *detail, unsigned quorum)
+{
+    memset(&s_gate, 0, sizeof(s_gate));
+    s_gate.self_hash = device_hash(self_id, strlen(self_id));
+    s_gate.quorum = quorum == 0 ? 1 : quorum > GARAGE_ROLLOUT_MAX_QUORUM ? GARAGE_ROLLOUT_MAX_QUORUM : quorum;
+    snprintf(s_gate.detail, sizeof(s_gate.detail), "%s", detail);
+    s_gate.armed = true;
+}
+
+void garage_rollout_gate_disarm(void)
+{
+    s_gate.armed = false;
+}
+
+bool garage_rollout_gate_armed(void)
+{
+    return s_gate.armed;
+}
+
+bool garage_rollout_gate_observe(const char *device_id, size_t device_id_len, const char *status, size_t status_len,
+                                 const char *detail, size_t detail_len)
+{
+    if (!s_gate.armed || s_gate.seen_count >= s_gate.quorum) {
+        return false;
+    }
+    if (status_len != strlen("success") || memcmp(status, "success", status_len) != 0 ||
+        detail_len != strlen(s_gate.detail) || memcmp(detail, s_gate.detail, detail_len) != 0) {
+        return false;
+    }
+    uint32_t hash = device_hash(device_id, device_id_len);
+    if (hash == s_gate.self_hash) {
+        return false;
+    }
+    for (unsigned i = 0; i < s_gate.seen_count; i++) {
+        if (s_gate.seen[i] == hash) {
+            return false;
+        }
+    }
+    s_gate.seen[s_gate.seen_count++] = hash;
+    return s_gate.seen_count == s_gate.quorum;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Staggered fleet OTA. Each device hashes its device_id into a fixed bucket,
+ * so every device derives the same plan from the same command without any
+ * coordination. Devices whose bucket falls under the canary percentage go
+ * first, spread over the rollout window. The rest hold until enough
+ * distinct canaries have reported success for the same release, then
+ * spread over the window themselves. scripts/ota-fleet-sim.py implements
+ * the same hash, so simulated devices can join a real fleet.
+ *
+ * Plain logic without locking; main.c owns the timers and the fleet
+ * subscription, and serialises gate calls across tasks.
+ */
+#define GARAGE_ROLLOUT_MAX_WINDOW_S 86400
+#define GARAGE_ROLLOUT_MAX_QUORUM 16
+#define GARAGE_ROLLOUT_DETAIL_MAX_LEN 160
+
+typedef struct {
+    bool canary;
+    uint32_t delay_ms;  // from the command for canaries, from the gate opening otherwise
+} garage_rollout_plan_t;
+
+garage_rollout_plan_t garage_rollout_plan(const char *device_id, uint32_t window_s, unsigned canary_percent);
+
+// Starts counting "success" reports for detail ("<tag>/<asset>") from
+// devices other than self_id.
+void garage_rollout_gate_arm(const char *self_id, const char *detail, unsigned quorum);
+void garage_rollout_gate_disarm(void);
+bool garage_rollout_gate_armed(void);
+// Feeds one OTA status seen on device_id's state topic; true exactly once,
+// for the report that completes the quorum.
+bool garage_rollout_gate_observe(const char *device_id, size_t device_id_len, const char *status, size_t status_len,
+                                 const char *detail, size_t detail_len);
@@ -0,0 +1,214 @@
+#include "garage_tls_transport.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/select.h>
+
+#include "esp_crt_bundle.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_tls.h"
+#include "garage_metrics.h"
+
+#define TLS_SESSION_HOST_LEN 128
+
+static const char *TAG = "garage";
+
+typedef struct {
+    esp_tls_t *tls;
+    bool plain;
+} tls_transport_t;
+
+static tls_transport_t s_transport;
+
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+static esp_tls_client_session_t *s_session;
+static char s_session_host[TLS_SESSION_HOST_LEN];
+static int s_session_port;
+
+static void session_drop(void)
+{
+    if (s_session) {
+        esp_tls_free_client_session(s_session);
+        s_session = NULL;
+    }
+}
+
+static esp_tls_client_session_t *session_for(const char *host, int port)
+{
+    if (s_session && (s_session_port != port || strcmp(s_session_host, host) != 0)) {
+        // Sessions are bound to a broker; a failover starts over.
+        session_drop();
+    }
+    return s_session;
+}
+
+static void session_update(const tls_transport_t *ctx, const char *host, int port)
+{
+    esp_tls_client_session_t *fresh = esp_tls_get_client_session(ctx->tls);
+    if (!fresh) {
+        return;
+    }
+    session_drop();
+    s_session = fresh;
+    snprintf(s_session_host, sizeof(s_session_host), "%s", host);
+    s_session_port = port;
+}
+#endif
+
+static int tls_connect(esp_transport_handle_t t, const char *host, int port, int timeout_ms)
+{
+    tls_transport_t *ctx = esp_transport_get_context_data(t);
+    ctx->tls = esp_tls_init();
+    if (!ctx->tls) {
+        return -1;
+    }
+
+    esp_tls_cfg_t cfg = {
+        .timeout_ms = timeout_ms,
+        .is_plain_tcp = ctx->plain,
+    };
+    if (!ctx->plain) {
+        cfg.crt_bundle_attach = esp_crt_bundle_attach;
+    }
+    bool resuming = false;
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    if (!ctx->plain) {
+        cfg.client_session = session_for(host, port);
+        resuming = cfg.client_session != NULL;
+    }
+#endif
+
+    int64_t started_us = esp_timer_get_time();
+    if (esp_tls_conn_new_sync(host, (int)strlen(host), port, &cfg, ctx->tls) <= 0) {
+        ESP_LOGW(TAG, "TLS connect to %s:%d failed%s", host, port, resuming ? " (resumed session)" : "");
+        esp_tls_conn_destroy(ctx->tls);
+        ctx->tls = NULL;
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        if (resuming) {
+            // Do not keep offering a session that may be what the broker
+            // chokes on.
+            session_drop();
+        }
+#endif
+        return -1;
+    }
+    if (ctx->plain) {
+        return 0;
+    }
+
+    garage_metrics_record(resuming ? GARAGE_LATENCY_TLS_RESUMED : GARAGE_LATENCY_TLS_FULL,
+                          esp_timer_get_time() - started_us);
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    session_update(ctx, host, port);
+#endif
+    return 0;
+}
+
+static int tls_poll(esp_transport_handle_t t, int timeout_ms, bool for_write)
+{
+    tls_transport_t *ctx = esp_transport_get_context_data(t);
+    if (!ctx->tls) {
+        return -1;
+    }
+    if (!for_write && esp_tls_get_bytes_avail(ctx->tls) > 0) {
+        return 1;  // already decrypted, the socket may have nothing more
+    }
+    int sockfd = -1;
+    if (esp_tls_get_conn_sockfd(ctx->tls, &sockfd) != ESP_OK || sockfd < 0) {
+        return -1;
+    }
+
+    fd_set ready;
+    fd_set errors;
+    FD_ZERO(&ready);
+    FD_ZERO(&errors);
+    FD_SET(sockfd, &ready);
+    FD_SET(sockfd, &errors);
+    struct timeval timeout = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_usec = (timeout_ms % 1000) * 1000,
+    };
+    int ret = select(sockfd + 1, for_write ? NULL : &ready, for_write ? &ready : NULL, &errors,
+                     timeout_ms >= 0 ? &timeout : NULL);
+    if (ret > 0 && FD_ISSET(sockfd, &errors)) {
+        return -1;
+    }
+    return ret;
+}
+
+static int tls_poll_read(esp_transport_handle_t t, int timeout_ms)
+{
+    return tls_poll(t, timeout_ms, false);
+}
+
+static int tls_poll_write(esp_transport_handle_t t, int timeout_ms)
+{
+    return tls_poll(t, timeout_ms, true);
+}
+
+static int tls_read(esp_transport_handle_t t, char *buffer, int len, int timeout_ms)
+{
+    tls_transport_t *ctx = esp_transport_get_context_data(t);
+    int poll = tls_poll_read(t, timeout_ms);
+    if (poll <= 0) {
+        return poll == 0 ? ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT : ERR_TCP_TRANSPORT_CONNECTION_FAILED;
+    }
+    ssize_t ret = esp_tls_conn_read(ctx->tls, buffer, (size_t)len);
+    if (ret == ESP_TLS_ERR_SSL_WANT_READ || ret == ESP_TLS_ERR_SSL_TIMEOUT) {
+        return ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT;
+    }
+    if (ret == 0) {
+        return ERR_TCP_TRANSPORT_CONNECTION_CLOSED_BY_FIN;
+    }
+    return ret < 0 ? ERR_TCP_TRANSPORT_CONNECTION_FAILED : (int)ret;
+}
+
+static int tls_write(esp_transport_handle_t t, const char *buffer, int len, int timeout_ms)
+{
+    tls_transport_t *ctx = esp_transport_get_context_data(t);
+    int poll = tls_poll_write(t, timeout_ms);
+    if (poll <= 0) {
+        return poll == 0 ? ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT : ERR_TCP_TRANSPORT_CONNECTION_FAILED;
+    }
+    ssize_t ret = esp_tls_conn_write(ctx->tls, buffer, (size_t)len);
+    if (ret == ESP_TLS_ERR_SSL_WANT_WRITE) {
+        return ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT;
+    }
+    return ret < 0 ? ERR_TCP_TRANSPORT_CONNECTION_FAILED : (int)ret;
+}
+
+static int tls_close(esp_transport_handle_t t)
+{
+    tls_transport_t *ctx = esp_transport_get_context_data(t);
+    if (ctx->tls) {
+        esp_tls_conn_destroy(ctx->tls);
+        ctx->tls = NULL;
+    }
+    return 0;
+}
+
+static int tls_destroy(esp_transport_handle_t t)
+{
+    return tls_close(t);
+}
+
+esp_transport_handle_t garage_tls_transport_create(void)
+{
+    esp_transport_handle_t t = esp_transport_init();
+    if (!t) {
+        return NULL;
+    }
+    s_transport = (tls_transport_t){ 0 };
+    esp_transport_set_context_data(t, &s_transport);
+    esp_transport_set_func(t, tls_connect, tls_read, tls_write, tls_close, tls_poll_read, tls_poll_write,
+                           tls_destroy);
+    esp_transport_set_default_port(t, 8883);
+    return t;
+}
+
+void garage_tls_transport_set_plain(esp_transport_handle_t transport, bool plain)
+{
+    tls_transport_t *ctx = esp_transport_get_context_data(transport);
+    ctx->plain = plain;
+}
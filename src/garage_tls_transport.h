@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "esp_transport.h"
+
+/*
+ * esp-mqtt transport on top of esp_tls that resumes TLS sessions. The
+ * stock SSL transport performs a full handshake on every reconnect; this one
+ * keeps the session from the last successful handshake (per broker host and
+ * port) and offers it on the next connect, so a reconnect after a Wi-Fi
+ * blip skips the certificate chain verification and key exchange.
+ *
+ * Handshake times are recorded as GARAGE_LATENCY_TLS_FULL or
+ * GARAGE_LATENCY_TLS_RESUMED. A session the broker declines still lands in
+ * the resumed stage, as a full-length sample.
+ *
+ * The session lives in RAM only, through esp_tls_get_client_session() and
+ * esp_tls_free_client_session(); a restart starts with a full handshake.
+ * One instance per process.
+ */
+esp_transport_handle_t garage_tls_transport_create(void);
+
+// Plain TCP for mqtt:// brokers (local test setups); TLS otherwise.
+void garage_tls_transport_set_plain(esp_transport_handle_t transport, bool plain);
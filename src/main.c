@@ -4,6 +4,8 @@
 #include <inttypes.h>
 #include <stdbool.h>
 #include <ctype.h>
+#include <stdatomic.h>
+#include <time.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
@@ -11,325 +13,481 @@
 #include "freertos/task.h"
 #include "freertos/timers.h"
 
-#include "cJSON.h"
+#include "esp_app_desc.h"
+#include "esp_attr.h"
 #include "esp_crt_bundle.h"
 #include "driver/gpio.h"
 #include "esp_event.h"
 #include "esp_err.h"
+#include "esp_heap_caps.h"
 #include "esp_log.h"
 #include "esp_netif.h"
+#include "esp_netif_sntp.h"
+#include "esp_random.h"
 #include "esp_system.h"
 #include "esp_timer.h"
 #include "esp_wifi.h"
 #include "mqtt_client.h"
-#include "esp_https_ota.h"
-#include "esp_http_client.h"
 #include "nvs.h"
 #include "nvs_flash.h"
 
+#include "garage_backoff.h"
+#include "garage_broker.h"
+#include "garage_command.h"
+#include "garage_config.h"
+#include "garage_control.h"
+#include "garage_dedupe.h"
+#include "garage_hal.h"
+#include "garage_keepalive.h"
+#include "garage_local_api.h"
+#include "garage_metrics.h"
+#include "garage_ota.h"
+#include "garage_publish.h"
+#include "garage_reassembly.h"
+#include "garage_rollout.h"
+#include "garage_tls_transport.h"
+
 #define TOPIC_MAX_LEN 128
 #define OTA_TAG_MAX_LEN 64
 #define OTA_ASSET_MAX_LEN 96
 
-static const char *TAG = "garage";
+#ifdef CONFIG_GARAGE_MQTT_MAX_COMMAND_LEN
+#define COMMAND_MAX_LEN CONFIG_GARAGE_MQTT_MAX_COMMAND_LEN
+#else
+#define COMMAND_MAX_LEN 2048
+#endif
+
+#ifdef CONFIG_GARAGE_METRICS_INTERVAL_S
+#define METRICS_INTERVAL_S CONFIG_GARAGE_METRICS_INTERVAL_S
+#else
+#define METRICS_INTERVAL_S 300
+#endif
+
+#ifdef CONFIG_GARAGE_CONFIG_FLUSH_DELAY_MS
+#define CONFIG_FLUSH_DELAY_MS CONFIG_GARAGE_CONFIG_FLUSH_DELAY_MS
+#else
+#define CONFIG_FLUSH_DELAY_MS 5000
+#endif
+
+#ifdef CONFIG_GARAGE_WIFI_FAST_CONNECT
+#define WIFI_FAST_CONNECT true
+#else
+#define WIFI_FAST_CONNECT false
+#endif
+
+#ifdef CONFIG_GARAGE_WIFI_REUSE_IP_LEASE
+#define WIFI_REUSE_IP_LEASE true
+#else
+#define WIFI_REUSE_IP_LEASE false
+#endif
+
+#ifdef CONFIG_GARAGE_RECONNECT_BASE_MS
+#define RECONNECT_BASE_MS CONFIG_GARAGE_RECONNECT_BASE_MS
+#else
+#define RECONNECT_BASE_MS 500
+#endif
+
+#ifdef CONFIG_GARAGE_RECONNECT_MAX_MS
+#define RECONNECT_MAX_MS CONFIG_GARAGE_RECONNECT_MAX_MS
+#else
+#define RECONNECT_MAX_MS 60000
+#endif
+
+#ifdef CONFIG_GARAGE_MQTT_PERSISTENT_SESSION
+#define MQTT_PERSISTENT_SESSION true
+#else
+#define MQTT_PERSISTENT_SESSION false
+#endif
+
+#ifdef CONFIG_GARAGE_MQTT_KEEPALIVE_S
+#define MQTT_KEEPALIVE_S CONFIG_GARAGE_MQTT_KEEPALIVE_S
+#else
+#define MQTT_KEEPALIVE_S 120
+#endif
+
+#ifdef CONFIG_GARAGE_MQTT_KEEPALIVE_MAX_S
+#define MQTT_KEEPALIVE_MAX_S CONFIG_GARAGE_MQTT_KEEPALIVE_MAX_S
+#else
+#define MQTT_KEEPALIVE_MAX_S 600
+#endif
+
+#define MQTT_KEEPALIVE_MIN_S 30
+#define MQTT_KEEPALIVE_BUSY_RETRY_MS 1000
+#define MQTT_KEEPALIVE_RTC_MAGIC 0x474b414cu  // "GKAL"
+#define OUTBOX_RETRY_MS 1000
+
+#ifdef CONFIG_GARAGE_COMMAND_MAX_AGE_S
+#define COMMAND_MAX_AGE_S CONFIG_GARAGE_COMMAND_MAX_AGE_S
+#else
+#define COMMAND_MAX_AGE_S 60
+#endif
+
+#ifdef CONFIG_GARAGE_SNTP_SERVER
+#define SNTP_SERVER CONFIG_GARAGE_SNTP_SERVER
+#else
+#define SNTP_SERVER ""
+#endif
+
+// Only a persistent session makes the broker hold commands long enough to
+// go stale, so without one there is no age check and no SNTP traffic.
+#define COMMAND_AGE_CHECK (MQTT_PERSISTENT_SESSION && COMMAND_MAX_AGE_S > 0 && SNTP_SERVER[0] != '\0')
+
+#ifdef CONFIG_GARAGE_REQUEST_DEDUPE_TTL_S
+#define REQUEST_DEDUPE_TTL_S CONFIG_GARAGE_REQUEST_DEDUPE_TTL_S
+#else
+#define REQUEST_DEDUPE_TTL_S 300
+#endif
+
+#ifdef CONFIG_GARAGE_STATIC_ALLOCATION
+#define STATIC_ALLOCATION true
+#else
+#define STATIC_ALLOCATION false
+#endif
+
+#define CONTROL_TASK_STACK_SIZE 4096
+// TLS plus the image header checks; well below control_task and esp-mqtt
+// (both 5) so a download never delays a command.
+#define OTA_TASK_STACK_SIZE 8192
+#define OTA_TASK_PRIORITY 2
+
+#ifdef CONFIG_GARAGE_OTA_BASE_URL
+#define OTA_BASE_URL CONFIG_GARAGE_OTA_BASE_URL
+#else
+#define OTA_BASE_URL "https://github.com"
+#endif
+
+#ifdef CONFIG_GARAGE_OTA_MAX_KIB_S
+#define OTA_MAX_KIB_S CONFIG_GARAGE_OTA_MAX_KIB_S
+#else
+#define OTA_MAX_KIB_S 0
+#endif
+
+#ifdef CONFIG_GARAGE_OTA_PACKED
+#define OTA_PACKED true
+#else
+#define OTA_PACKED false
+#endif
+// Delta from the running version, compressed image, plain image.
+#define OTA_MAX_SOURCES 3
+
+#ifdef CONFIG_GARAGE_OTA_CANARY_TIMEOUT_S
+#define OTA_CANARY_TIMEOUT_S CONFIG_GARAGE_OTA_CANARY_TIMEOUT_S
+#else
+#define OTA_CANARY_TIMEOUT_S 3600
+#endif
+// Subscribed only while a staggered rollout waits on canary reports.
+#define FLEET_STATE_TOPIC "garage/+/state"
+#define OTA_ROLLOUT_BUSY_RETRY_MS 1000
+#define OTA_URL_MAX_LEN 256
+
+#ifdef CONFIG_GARAGE_MQTT_PUBLISH_TIMEOUT_MS
+#define MQTT_PUBLISH_TIMEOUT_MS CONFIG_GARAGE_MQTT_PUBLISH_TIMEOUT_MS
+#else
+#define MQTT_PUBLISH_TIMEOUT_MS 5000
+#endif
+
+// How often the active broker is checked for stalled publishes and whether
+// the primary can take over again.
+#define BROKER_CHECK_PERIOD_MS 5000
+
+#ifdef CONFIG_GARAGE_MQTT_TLS_RESUMPTION
+#define MQTT_TLS_RESUMPTION true
+#else
+#define MQTT_TLS_RESUMPTION false
+#endif
+
+#ifdef CONFIG_GARAGE_LOCAL_API
+#define LOCAL_API true
+#define LOCAL_API_PORT CONFIG_GARAGE_LOCAL_API_PORT
+#else
+#define LOCAL_API false
+#define LOCAL_API_PORT 80
+#endif
+
+#ifdef CONFIG_GARAGE_OTA_VALIDATE_TIMEOUT_S
+#define OTA_VALIDATE_TIMEOUT_S CONFIG_GARAGE_OTA_VALIDATE_TIMEOUT_S
+#else
+#define OTA_VALIDATE_TIMEOUT_S 300
+#endif
+
+#ifdef CONFIG_GARAGE_STATE_PUBLISH_WINDOW_MS
+#define STATE_PUBLISH_WINDOW_MS CONFIG_GARAGE_STATE_PUBLISH_WINDOW_MS
+#else
+#define STATE_PUBLISH_WINDOW_MS 1000
+#endif
+
+// Wall-clock readings before this (2024-01-01) mean SNTP has not synced yet.
+#define CLOCK_VALID_EPOCH_S 1704067200
 
-typedef enum {
-    GARAGE_STATE_LISTENING = 0,
-    GARAGE_STATE_TRIGGERING,
-    GARAGE_STATE_THROTTLED,
-    GARAGE_STATE_UPDATING,
-} garage_state_t;
+static const char *TAG = "garage";
 
 typedef enum {
     CONTROL_CMD_OPEN = 0,
+    CONTROL_CMD_RELAY_PULSE_DONE,
     CONTROL_CMD_THROTTLE_EXPIRED,
     CONTROL_CMD_PUBLISH_HEARTBEAT,
     CONTROL_CMD_PUBLISH_STATE_SNAPSHOT,
     CONTROL_CMD_START_OTA,
+    CONTROL_CMD_CONFIG_UPDATE,
+    CONTROL_CMD_PUBLISH_METRICS,
+    CONTROL_CMD_FLUSH_CONFIG,
+    CONTROL_CMD_FLUSH_OUTBOX,
+    CONTROL_CMD_FLUSH_STATE,
+    CONTROL_CMD_OTA_DONE,
+    CONTROL_CMD_OTA_ROLLOUT_DUE,
+    CONTROL_CMD_OTA_CANARIES_OK,
+    CONTROL_CMD_KEEPALIVE_PROBE,
 } control_cmd_t;
 
+/*
+ * control_task inputs come in two lanes. The high lane (open, relay pulse
+ * completion, debounce expiry) is always drained before the low lane
+ * (heartbeat, snapshot, metrics, config updates, config/outbox/state
+ * flushes, OTA start, rollout timing and completion, keepalive probes).
+ *
+ * Idempotent commands are signals: a bit in s_control_signals, so a repeat
+ * posted before the first is handled costs nothing and can never be
+ * dropped. Only OPEN, START_OTA and CONFIG_UPDATE occupy queue slots; their
+ * arguments live in s_payload_pool so a slot stays small.
+ */
+#define CONTROL_SIGNAL(cmd) (UINT32_C(1) << (cmd))
+#define CONTROL_HIGH_SIGNALS (CONTROL_SIGNAL(CONTROL_CMD_RELAY_PULSE_DONE) | CONTROL_SIGNAL(CONTROL_CMD_THROTTLE_EXPIRED))
+#define CONTROL_LOW_SIGNALS                                                                                  \
+    (CONTROL_SIGNAL(CONTROL_CMD_PUBLISH_HEARTBEAT) | CONTROL_SIGNAL(CONTROL_CMD_PUBLISH_STATE_SNAPSHOT) |    \
+     CONTROL_SIGNAL(CONTROL_CMD_PUBLISH_METRICS) | CONTROL_SIGNAL(CONTROL_CMD_FLUSH_CONFIG) |                \
+     CONTROL_SIGNAL(CONTROL_CMD_FLUSH_OUTBOX) | CONTROL_SIGNAL(CONTROL_CMD_FLUSH_STATE) |                   \
+     CONTROL_SIGNAL(CONTROL_CMD_OTA_DONE) | CONTROL_SIGNAL(CONTROL_CMD_OTA_ROLLOUT_DUE) |                   \
+     CONTROL_SIGNAL(CONTROL_CMD_OTA_CANARIES_OK) | CONTROL_SIGNAL(CONTROL_CMD_KEEPALIVE_PROBE))
+
+#define CONTROL_HIGH_QUEUE_LEN 8
+#define CONTROL_LOW_QUEUE_LEN 4
+#define CONTROL_PAYLOAD_POOL_SIZE 4
+#define CONTROL_PAYLOAD_NONE UINT8_MAX
+
+// Staggering requested by an ota command; all zero starts right away.
 typedef struct {
-    control_cmd_t cmd;
+    uint32_t window_s;
+    uint8_t canary_percent;
+    uint8_t canary_quorum;
+} ota_rollout_t;
+
+// Validated config_update fields; the set_ flags mark what the command carried.
+typedef struct {
+    bool set_heartbeat;
+    bool set_debounce;
+    bool set_relay;
+    int heartbeat_interval_s;
+    int debounce_ms;
+    int relay_pulse_ms;
+} config_update_t;
+
+typedef struct {
+    char request_id[GARAGE_REQUEST_ID_MAX_LEN + 1];  // empty when the command had none
     char ota_tag[OTA_TAG_MAX_LEN];
     char ota_asset[OTA_ASSET_MAX_LEN];
+    ota_rollout_t ota_rollout;
+    config_update_t config_update;
+} control_payload_t;
+
+typedef struct {
+    control_cmd_t cmd;
+    uint8_t payload;      // s_payload_pool slot or CONTROL_PAYLOAD_NONE
+    int64_t received_us;  // MQTT_EVENT_DATA arrival, 0 for internally generated commands
+    int64_t posted_us;
 } control_message_t;
 
 static EventGroupHandle_t s_connection_event_group;
-static QueueHandle_t s_control_queue;
+static QueueHandle_t s_control_high_queue;
+static QueueHandle_t s_control_low_queue;
+static TaskHandle_t s_control_task;
+#if defined(CONFIG_HEAP_USE_HOOKS) && !defined(CONFIG_FREERTOS_PLACE_FUNCTIONS_INTO_FLASH)
+#define CONTROL_HEAP_HOOKS 1
+static DRAM_ATTR atomic_uint s_control_heap_allocs;
+#else
+#define CONTROL_HEAP_HOOKS 0
+#endif
+static TaskHandle_t s_ota_task;
+// Written by control_task before it wakes ota_task; the UPDATING state keeps
+// a second request out until the result is back.
+typedef struct {
+    char url[OTA_URL_MAX_LEN];
+    bool packed;
+} ota_source_t;
+static ota_source_t s_ota_sources[OTA_MAX_SOURCES];
+static size_t s_ota_source_count;
+static char s_ota_detail[GARAGE_ROLLOUT_DETAIL_MAX_LEN];
+static atomic_int s_ota_result;
+// A scheduled download waits in DELAY for its slot in the window; a
+// non-canary waits in GATED for canary reports first. control_task only,
+// except the gate itself, which the MQTT task feeds under s_rollout_lock.
+typedef enum {
+    OTA_ROLLOUT_IDLE = 0,
+    OTA_ROLLOUT_DELAY,
+    OTA_ROLLOUT_GATED,
+} ota_rollout_phase_t;
+static ota_rollout_phase_t s_ota_rollout_phase;
+static garage_rollout_plan_t s_ota_rollout_plan;
+static int64_t s_ota_rollout_due_us;
+static esp_timer_handle_t s_ota_rollout_timer;
+static portMUX_TYPE s_rollout_lock = portMUX_INITIALIZER_UNLOCKED;
+static atomic_uint_fast32_t s_control_signals;
+static control_payload_t s_payload_pool[CONTROL_PAYLOAD_POOL_SIZE];
+static atomic_uint_fast32_t s_payload_free = (UINT32_C(1) << CONTROL_PAYLOAD_POOL_SIZE) - 1;
 static TimerHandle_t s_debounce_timer;
 static TimerHandle_t s_heartbeat_timer;
+static TimerHandle_t s_metrics_timer;
+static TimerHandle_t s_config_flush_timer;
+static TimerHandle_t s_state_window_timer;
+static esp_timer_handle_t s_relay_pulse_timer;
+static esp_timer_handle_t s_wifi_retry_timer;
+static esp_timer_handle_t s_mqtt_retry_timer;
 static esp_mqtt_client_handle_t s_mqtt_client;
+static esp_transport_handle_t s_mqtt_transport;  // NULL: esp-mqtt's own SSL transport
+static atomic_bool s_mqtt_started;
+static esp_netif_t *s_sta_netif;
 
 #define WIFI_CONNECTED_BIT BIT0
 #define MQTT_CONNECTED_BIT BIT1
 
-static garage_state_t s_state = GARAGE_STATE_LISTENING;
-static int64_t s_last_trigger_us = 0;
+static volatile int64_t s_relay_released_us = 0;
+static int64_t s_relay_asserted_us = 0;
 static int s_relay_active_level = 1;
 static int s_relay_inactive_level = 0;
 
 static char s_command_topic[TOPIC_MAX_LEN];
 static char s_state_topic[TOPIC_MAX_LEN];
-static char s_mqtt_uri[TOPIC_MAX_LEN];
-
-#define GARAGE_CONFIG_NAMESPACE "garage"
-#define GARAGE_CONFIG_KEY "config"
-
+static char s_metrics_topic[TOPIC_MAX_LEN];
+static char s_result_topic[TOPIC_MAX_LEN];
+static char s_status_topic[TOPIC_MAX_LEN];
+
+static garage_config_t s_config;
+
+static garage_link_cache_t s_link_cache;
+static bool s_link_cache_valid = false;
+static bool s_wifi_fast_attempt = false;  // current association targets the cached BSSID/channel
+static int64_t s_wifi_connect_started_us = 0;
+static bool s_boot_state_published = false;
+
+// MQTT client task only.
+static int64_t s_mqtt_connect_started_us = 0;
+static int s_subscribe_msg_id = -1;
+static portMUX_TYPE s_publish_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Wi-Fi backoff lives on the default event loop task, MQTT backoff on the
+// MQTT client task.
+static garage_backoff_t s_wifi_backoff;
+static garage_backoff_t s_mqtt_backoff;
+
+// Broker failover state: updated from the MQTT task and the esp_timer task,
+// read by control_task for metrics.
+static garage_broker_list_t s_brokers;
+static portMUX_TYPE s_broker_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t s_broker_check_timer;
+// Set by mqtt_reconnect_deliberately() so the disconnect is not taken for
+// a failure.
+static atomic_bool s_broker_switch_pending;
+// One unacknowledged QoS1 publish at a time doubles as RTT probe and stall
+// detector. s_last_acked_msg_id covers a PUBACK that beats the probe setup.
+static atomic_int s_probe_msg_id = -1;
+static atomic_int_fast64_t s_probe_sent_us;
+static atomic_int s_last_acked_msg_id = -1;
+
+// Keepalive learning: updated from the MQTT task and, for probes, from
+// control_task.
+// The learned values survive soft restarts in RTC memory, so a device
+// behind a short NAT timeout does not relearn it after every OTA.
 typedef struct {
-    char *wifi_ssid;
-    char *wifi_password;
-    char *device_id;
-    char *mqtt_host;
-    int mqtt_port;
-    char *mqtt_username;
-    char *mqtt_password;
-    int relay_gpio;
-    int status_led_gpio;
-    bool relay_active_high;
-    int relay_pulse_ms;
-    int debounce_ms;
-    int heartbeat_interval_s;
-    char *ota_repo_owner;
-    char *ota_repo_name;
-} garage_config_t;
-
-static garage_config_t s_config = {
-    .status_led_gpio = -1,
-};
+    uint32_t magic;
+    uint32_t keepalive_s;
+    uint32_t ceiling_s;
+} rtc_keepalive_t;
+
+static garage_keepalive_t s_keepalive;
+static portMUX_TYPE s_keepalive_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t s_keepalive_probe_timer;
+static RTC_NOINIT_ATTR rtc_keepalive_t s_rtc_keepalive;
+
+// Re-arms an outbox flush that a failed publish cut short while the
+// connection stayed up, so held messages do not wait for a reconnect.
+static esp_timer_handle_t s_outbox_retry_timer;
+
+// Commands arrive on the MQTT task and, with the local API, on the HTTP
+// server task; both share the dedupe cache.
+static portMUX_TYPE s_dedupe_lock = portMUX_INITIALIZER_UNLOCKED;
+
+#if STATIC_ALLOCATION
+// Backing storage for every FreeRTOS object, so none of them touches the
+// heap and a long uptime cannot fragment it.
+static struct {
+    StaticEventGroup_t connection_event_group;
+    StaticQueue_t control_high_queue;
+    StaticQueue_t control_low_queue;
+    uint8_t control_high_storage[CONTROL_HIGH_QUEUE_LEN * sizeof(control_message_t)];
+    uint8_t control_low_storage[CONTROL_LOW_QUEUE_LEN * sizeof(control_message_t)];
+    StaticTimer_t debounce_timer;
+    StaticTimer_t heartbeat_timer;
+    StaticTimer_t metrics_timer;
+    StaticTimer_t config_flush_timer;
+    StaticTimer_t state_window_timer;
+    StaticTask_t control_task;
+    StackType_t control_task_stack[CONTROL_TASK_STACK_SIZE];
+    StaticTask_t ota_task;
+    StackType_t ota_task_stack[OTA_TASK_STACK_SIZE];
+} s_rtos;
+#define RTOS_STORAGE(field) (&s_rtos.field)
+#define RTOS_BUFFER(field) (s_rtos.field)
+#else
+#define RTOS_STORAGE(field) NULL
+#define RTOS_BUFFER(field) NULL
+#endif
 
 static void control_task(void *param);
-static void garage_config_load(void);
+static void ota_task(void *param);
 static void ensure(bool condition, const char *message);
 static void wifi_init_sta(void);
-static void mqtt_start(void);
-static void publish_state_message(const char *type, bool retain, const char *extra_key, int32_t extra_value);
-static int32_t remaining_cooldown_ms(void);
+static void mqtt_prepare(void);
+static void mqtt_start_once(void);
 static bool mqtt_is_connected(void);
-static void update_status_led(void);
 static bool control_post(control_cmd_t cmd);
-static bool control_post_ota(const char *tag, const char *asset);
-static void handle_start_ota(const char *tag, const char *asset);
-static void handle_open_request(void);
-static void handle_throttle_expired(void);
-static void handle_publish_heartbeat(void);
-static void handle_publish_snapshot(void);
-static void process_command_payload(const char *data, int len);
+static bool control_post_request(control_cmd_t cmd, int64_t received_us, const char *request_id);
+static bool control_post_ota(const char *tag, size_t tag_len, const char *asset, size_t asset_len,
+                             const ota_rollout_t *rollout);
+static bool control_post_config(const config_update_t *update, const char *request_id);
+static void apply_config_update(const config_update_t *update);
+static void handle_start_ota(const char *tag, const char *asset, const ota_rollout_t *rollout);
+static void process_command_payload(const char *data, int len, int64_t received_us);
+static void command_reassembly_feed(const esp_mqtt_event_t *event);
 static void publish_ota_status(const char *status, const char *detail, esp_err_t err);
 static bool is_valid_release_component(const char *value, size_t max_len);
+static bool is_valid_release_span(const char *value, size_t len, size_t max_len);
 static void apply_debounce_timer_config(void);
 static void apply_heartbeat_timer_config(void);
-static esp_err_t garage_config_read_json_string(char **out_json);
-static esp_err_t garage_config_persist_updates(bool update_heartbeat, int heartbeat_value,
-                                               bool update_debounce, int debounce_value,
-                                               bool update_relay_pulse, int relay_pulse_value);
+static void config_flush_now(void);
 static void debounce_timer_callback(TimerHandle_t timer);
 static void heartbeat_timer_callback(TimerHandle_t timer);
-
-static char *duplicate_json_string_field(const cJSON *root, const char *field)
-{
-    const cJSON *item = cJSON_GetObjectItemCaseSensitive(root, field);
-    char msg[96];
-    snprintf(msg, sizeof(msg), "Missing or invalid string field: %s", field);
-    ensure(cJSON_IsString(item) && item->valuestring, msg);
-
-    char *copy = strdup(item->valuestring);
-    ensure(copy != NULL, "Out of memory duplicating config string");
-    return copy;
-}
-
-static int extract_json_int_field(const cJSON *root, const char *field)
-{
-    const cJSON *item = cJSON_GetObjectItemCaseSensitive(root, field);
-    char msg[96];
-    snprintf(msg, sizeof(msg), "Missing or invalid integer field: %s", field);
-    ensure(cJSON_IsNumber(item), msg);
-    return item->valueint;
-}
-
-static bool extract_json_bool_field(const cJSON *root, const char *field)
-{
-    const cJSON *item = cJSON_GetObjectItemCaseSensitive(root, field);
-    char msg[96];
-    snprintf(msg, sizeof(msg), "Missing boolean field: %s", field);
-    ensure(item != NULL, msg);
-
-    if (cJSON_IsBool(item)) {
-        return cJSON_IsTrue(item);
-    }
-    if (cJSON_IsNumber(item)) {
-        return item->valueint != 0;
-    }
-    if (cJSON_IsString(item) && item->valuestring) {
-        char c = (char)tolower((unsigned char)item->valuestring[0]);
-        if (c == 'y' || c == 't' || c == '1') {
-            return true;
-        }
-        if (c == 'n' || c == 'f' || c == '0') {
-            return false;
-        }
-    }
-
-    snprintf(msg, sizeof(msg), "Invalid boolean field: %s", field);
-    ensure(false, msg);
-    return false;
-}
-
-static void garage_config_load(void)
-{
-    if (s_config.wifi_ssid) {
-        return;
-    }
-
-    nvs_handle_t handle;
-    esp_err_t err = nvs_open(GARAGE_CONFIG_NAMESPACE, NVS_READONLY, &handle);
-    ensure(err == ESP_OK, "Failed to open NVS namespace 'garage'");
-
-    size_t json_size = 0;
-    err = nvs_get_str(handle, GARAGE_CONFIG_KEY, NULL, &json_size);
-    ensure(err == ESP_OK && json_size > 0, "Missing garage config JSON in NVS");
-
-    char *json = malloc(json_size);
-    ensure(json != NULL, "Out of memory allocating config buffer");
-
-    err = nvs_get_str(handle, GARAGE_CONFIG_KEY, json, &json_size);
-    nvs_close(handle);
-    ensure(err == ESP_OK, "Failed to read garage config JSON from NVS");
-
-    cJSON *root = cJSON_Parse(json);
-    free(json);
-    ensure(root != NULL, "Failed to parse garage config JSON");
-
-    s_config.wifi_ssid = duplicate_json_string_field(root, "CONFIG_GARAGE_WIFI_SSID");
-    s_config.wifi_password = duplicate_json_string_field(root, "CONFIG_GARAGE_WIFI_PASSWORD");
-    s_config.device_id = duplicate_json_string_field(root, "CONFIG_GARAGE_DEVICE_ID");
-    s_config.mqtt_host = duplicate_json_string_field(root, "CONFIG_GARAGE_MQTT_HOST");
-    s_config.mqtt_port = extract_json_int_field(root, "CONFIG_GARAGE_MQTT_PORT");
-    s_config.mqtt_username = duplicate_json_string_field(root, "CONFIG_GARAGE_MQTT_USERNAME");
-    s_config.mqtt_password = duplicate_json_string_field(root, "CONFIG_GARAGE_MQTT_PASSWORD");
-    s_config.relay_gpio = extract_json_int_field(root, "CONFIG_GARAGE_RELAY_GPIO");
-    s_config.status_led_gpio = extract_json_int_field(root, "CONFIG_GARAGE_STATUS_LED_GPIO");
-    s_config.relay_active_high = extract_json_bool_field(root, "CONFIG_GARAGE_RELAY_ACTIVE_HIGH");
-    s_config.relay_pulse_ms = extract_json_int_field(root, "CONFIG_GARAGE_RELAY_PULSE_MS");
-    s_config.debounce_ms = extract_json_int_field(root, "CONFIG_GARAGE_DEBOUNCE_MS");
-    s_config.heartbeat_interval_s = extract_json_int_field(root, "CONFIG_GARAGE_HEARTBEAT_INTERVAL_S");
-    s_config.ota_repo_owner = duplicate_json_string_field(root, "CONFIG_GARAGE_OTA_REPO_OWNER");
-    s_config.ota_repo_name = duplicate_json_string_field(root, "CONFIG_GARAGE_OTA_REPO_NAME");
-
-    cJSON_Delete(root);
-
-    ESP_LOGI(TAG, "Loaded garage config for device '%s'", s_config.device_id);
-}
-
-static esp_err_t garage_config_save_json_string(const char *json)
-{
-    if (!json) {
-        return ESP_ERR_INVALID_ARG;
-    }
-
-    nvs_handle_t handle;
-    esp_err_t err = nvs_open(GARAGE_CONFIG_NAMESPACE, NVS_READWRITE, &handle);
-    if (err != ESP_OK) {
-        return err;
-    }
-
-    err = nvs_set_str(handle, GARAGE_CONFIG_KEY, json);
-    if (err == ESP_OK) {
-        err = nvs_commit(handle);
-    }
-    nvs_close(handle);
-    return err;
-}
-
-static esp_err_t garage_config_read_json_string(char **out_json)
-{
-    if (!out_json) {
-        return ESP_ERR_INVALID_ARG;
-    }
-
-    nvs_handle_t handle;
-    esp_err_t err = nvs_open(GARAGE_CONFIG_NAMESPACE, NVS_READONLY, &handle);
-    if (err != ESP_OK) {
-        return err;
-    }
-
-    size_t json_size = 0;
-    err = nvs_get_str(handle, GARAGE_CONFIG_KEY, NULL, &json_size);
-    if (err != ESP_OK || json_size == 0) {
-        nvs_close(handle);
-        return err != ESP_OK ? err : ESP_ERR_NOT_FOUND;
-    }
-
-    char *json = malloc(json_size);
-    if (!json) {
-        nvs_close(handle);
-        return ESP_ERR_NO_MEM;
-    }
-
-    err = nvs_get_str(handle, GARAGE_CONFIG_KEY, json, &json_size);
-    nvs_close(handle);
-    if (err != ESP_OK) {
-        free(json);
-        return err;
-    }
-
-    *out_json = json;
-    return ESP_OK;
-}
-
-static esp_err_t garage_config_persist_updates(bool update_heartbeat, int heartbeat_value,
-                                               bool update_debounce, int debounce_value,
-                                               bool update_relay_pulse, int relay_pulse_value)
+static void relay_pulse_timer_callback(void *arg);
+static void ota_rollout_timer_callback(void *arg);
+static void outbox_retry_timer_callback(void *arg);
+static void mqtt_retry_timer_callback(void *arg);
+static void handle_keepalive_probe(void);
+static void mqtt_use_active_broker(void);
+static void mqtt_apply_keepalive(void);
+static void mqtt_publish_availability(bool online);
+
+// Persists staged config updates right away; used before anything that may
+// restart the device so a pending write-behind flush is not lost.
+static void config_flush_now(void)
 {
-    if (!update_heartbeat && !update_debounce && !update_relay_pulse) {
-        return ESP_OK;
+    if (s_config_flush_timer) {
+        xTimerStop(s_config_flush_timer, 0);
     }
-
-    char *json = NULL;
-    esp_err_t err = garage_config_read_json_string(&json);
+    esp_err_t err = garage_config_flush();
     if (err != ESP_OK) {
-        return err;
-    }
-
-    cJSON *root = cJSON_Parse(json);
-    free(json);
-    if (!root) {
-        return ESP_FAIL;
-    }
-
-    if (update_heartbeat) {
-        cJSON *item = cJSON_GetObjectItemCaseSensitive(root, "CONFIG_GARAGE_HEARTBEAT_INTERVAL_S");
-        if (!item) {
-            cJSON_AddNumberToObject(root, "CONFIG_GARAGE_HEARTBEAT_INTERVAL_S", heartbeat_value);
-        } else {
-            cJSON_SetNumberValue(item, heartbeat_value);
-        }
-    }
-    if (update_debounce) {
-        cJSON *item = cJSON_GetObjectItemCaseSensitive(root, "CONFIG_GARAGE_DEBOUNCE_MS");
-        if (!item) {
-            cJSON_AddNumberToObject(root, "CONFIG_GARAGE_DEBOUNCE_MS", debounce_value);
-        } else {
-            cJSON_SetNumberValue(item, debounce_value);
-        }
-    }
-    if (update_relay_pulse) {
-        cJSON *item = cJSON_GetObjectItemCaseSensitive(root, "CONFIG_GARAGE_RELAY_PULSE_MS");
-        if (!item) {
-            cJSON_AddNumberToObject(root, "CONFIG_GARAGE_RELAY_PULSE_MS", relay_pulse_value);
-        } else {
-            cJSON_SetNumberValue(item, relay_pulse_value);
+        ESP_LOGE(TAG, "Failed to persist config update: %s", esp_err_to_name(err));
+        if (s_config_flush_timer) {
+            xTimerStart(s_config_flush_timer, 0);
         }
     }
-
-    char *serialized = cJSON_PrintUnformatted(root);
-    cJSON_Delete(root);
-    if (!serialized) {
-        return ESP_ERR_NO_MEM;
-    }
-
-    err = garage_config_save_json_string(serialized);
-    cJSON_free(serialized);
-    return err;
 }
 
 static void ensure(bool condition, const char *message)
@@ -340,22 +498,6 @@ static void ensure(bool condition, const char *message)
     }
 }
 
-static const char *state_to_string(garage_state_t state)
-{
-    switch (state) {
-        case GARAGE_STATE_LISTENING:
-            return "LISTENING";
-        case GARAGE_STATE_TRIGGERING:
-            return "TRIGGERING";
-        case GARAGE_STATE_THROTTLED:
-            return "THROTTLED";
-        case GARAGE_STATE_UPDATING:
-            return "UPDATING";
-        default:
-            return "UNKNOWN";
-    }
-}
-
 static bool mqtt_is_connected(void)
 {
     if (!s_mqtt_client) {
@@ -367,127 +509,67 @@ static bool mqtt_is_connected(void)
 
 static void publish_ota_status(const char *status, const char *detail, esp_err_t err)
 {
-    if (!mqtt_is_connected()) {
-        ESP_LOGI(TAG, "Skipping OTA status publish (%s); MQTT not connected", status);
-        return;
-    }
-
-    cJSON *root = cJSON_CreateObject();
-    if (!root) {
-        ESP_LOGE(TAG, "Failed to allocate JSON for OTA status");
-        return;
-    }
-
-    cJSON_AddStringToObject(root, "type", "ota");
-    cJSON_AddStringToObject(root, "status", status);
-    cJSON_AddStringToObject(root, "deviceId", s_config.device_id);
-    cJSON_AddNumberToObject(root, "timestamp", esp_timer_get_time() / 1000);
-
-    if (detail) {
-        cJSON_AddStringToObject(root, "detail", detail);
-    }
-    if (err != ESP_OK) {
-        cJSON_AddStringToObject(root, "error", esp_err_to_name(err));
-    }
-
-    char *payload = cJSON_PrintUnformatted(root);
-    cJSON_Delete(root);
-
-    if (!payload) {
-        ESP_LOGE(TAG, "Failed to serialize OTA status");
-        return;
-    }
-
-    int msg_id = esp_mqtt_client_publish(s_mqtt_client, s_state_topic, payload, 0, 1, 0);
-    if (msg_id < 0) {
-        ESP_LOGW(TAG, "Failed to publish OTA status: %s", status);
-    } else {
-        ESP_LOGI(TAG, "Published OTA status '%s' (msg_id=%d)", status, msg_id);
-    }
-
-    cJSON_free(payload);
+    garage_publish_ota_status(status, detail, err != ESP_OK ? esp_err_to_name(err) : NULL);
 }
 
-static void publish_state_message(const char *type, bool retain, const char *extra_key, int32_t extra_value)
+static bool is_valid_release_span(const char *value, size_t len, size_t max_len)
 {
-    if (!mqtt_is_connected()) {
-        ESP_LOGD(TAG, "Skipping %s publish; MQTT not connected", type);
-        return;
-    }
-
-    cJSON *root = cJSON_CreateObject();
-    if (!root) {
-        ESP_LOGE(TAG, "Failed to allocate JSON root");
-        return;
-    }
-
-    cJSON_AddStringToObject(root, "type", type);
-    cJSON_AddStringToObject(root, "state", state_to_string(s_state));
-    cJSON_AddStringToObject(root, "deviceId", s_config.device_id);
-    cJSON_AddNumberToObject(root, "timestamp", esp_timer_get_time() / 1000);
-
-    if (extra_key) {
-        cJSON_AddNumberToObject(root, extra_key, extra_value);
+    if (!value || len == 0 || len > max_len) {
+        return false;
     }
-
-    char *payload = cJSON_PrintUnformatted(root);
-    cJSON_Delete(root);
-
-    if (!payload) {
-        ESP_LOGE(TAG, "Failed to serialize JSON");
-        return;
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char c = (unsigned char)value[i];
+        if (!(isalnum(c) || c == '-' || c == '_' || c == '.')) {
+            return false;
+        }
+        if (c == '.' && i + 1 < len && value[i + 1] == '.') {
+            return false;
+        }
     }
+    return true;
+}
 
-    int msg_id = esp_mqtt_client_publish(s_mqtt_client, s_state_topic, payload, 0, 1, retain ? 1 : 0);
-    if (msg_id < 0) {
-        ESP_LOGW(TAG, "Failed to publish %s message", type);
-    } else {
-        ESP_LOGI(TAG, "Published %s message id=%d", type, msg_id);
+static bool is_valid_release_component(const char *value, size_t max_len)
+{
+    if (!value) {
+        return false;
     }
-
-    cJSON_free(payload);
+    return is_valid_release_span(value, strnlen(value, max_len + 1), max_len);
 }
 
-static int32_t remaining_cooldown_ms(void)
+static TimerHandle_t rtos_timer_create(const char *name, TickType_t period_ticks, bool auto_reload,
+                                       TimerCallbackFunction_t callback, StaticTimer_t *storage)
 {
-    if (s_last_trigger_us == 0 || s_config.debounce_ms <= 0) {
-        return 0;
-    }
-    int64_t elapsed_us = esp_timer_get_time() - s_last_trigger_us;
-    if (elapsed_us < 0) {
-        return s_config.debounce_ms;
-    }
-    int32_t remaining = s_config.debounce_ms - (int32_t)(elapsed_us / 1000);
-    return remaining > 0 ? remaining : 0;
+#if STATIC_ALLOCATION
+    return xTimerCreateStatic(name, period_ticks, auto_reload ? pdTRUE : pdFALSE, NULL, callback, storage);
+#else
+    (void)storage;
+    return xTimerCreate(name, period_ticks, auto_reload ? pdTRUE : pdFALSE, NULL, callback);
+#endif
 }
 
-static bool is_valid_release_component(const char *value, size_t max_len)
+static QueueHandle_t rtos_queue_create(UBaseType_t length, uint8_t *storage, StaticQueue_t *queue)
 {
-    if (!value) {
-        return false;
-    }
-    size_t len = strnlen(value, max_len + 1);
-    if (len == 0 || len > max_len) {
-        return false;
-    }
-    if (strstr(value, "..") != NULL) {
-        return false;
-    }
-    for (size_t i = 0; i < len; ++i) {
-        unsigned char c = (unsigned char)value[i];
-        if (!(isalnum(c) || c == '-' || c == '_' || c == '.')) {
-            return false;
-        }
-    }
-    return true;
+#if STATIC_ALLOCATION
+    return xQueueCreateStatic(length, sizeof(control_message_t), storage, queue);
+#else
+    (void)storage;
+    (void)queue;
+    return xQueueCreate(length, sizeof(control_message_t));
+#endif
 }
 
+/*
+ * Timers are created on first use and afterwards only retuned or stopped,
+ * never deleted, so a config update cannot allocate.
+ */
 static void apply_debounce_timer_config(void)
 {
     if (s_config.debounce_ms > 0) {
         TickType_t period_ticks = pdMS_TO_TICKS(s_config.debounce_ms);
         if (!s_debounce_timer) {
-            s_debounce_timer = xTimerCreate("debounce", period_ticks, pdFALSE, NULL, debounce_timer_callback);
+            s_debounce_timer = rtos_timer_create("debounce", period_ticks, false, debounce_timer_callback,
+                                                 RTOS_STORAGE(debounce_timer));
             if (!s_debounce_timer) {
                 ESP_LOGE(TAG, "Failed to create debounce timer");
             }
@@ -502,8 +584,6 @@ static void apply_debounce_timer_config(void)
         }
     } else if (s_debounce_timer) {
         xTimerStop(s_debounce_timer, 0);
-        xTimerDelete(s_debounce_timer, 0);
-        s_debounce_timer = NULL;
     }
 }
 
@@ -512,7 +592,8 @@ static void apply_heartbeat_timer_config(void)
     if (s_config.heartbeat_interval_s > 0) {
         TickType_t period_ticks = pdMS_TO_TICKS(s_config.heartbeat_interval_s * 1000);
         if (!s_heartbeat_timer) {
-            s_heartbeat_timer = xTimerCreate("heartbeat", period_ticks, pdTRUE, NULL, heartbeat_timer_callback);
+            s_heartbeat_timer = rtos_timer_create("heartbeat", period_ticks, true, heartbeat_timer_callback,
+                                                  RTOS_STORAGE(heartbeat_timer));
             if (!s_heartbeat_timer) {
                 ESP_LOGE(TAG, "Failed to create heartbeat timer");
             } else {
@@ -528,110 +609,157 @@ static void apply_heartbeat_timer_config(void)
         }
     } else if (s_heartbeat_timer) {
         xTimerStop(s_heartbeat_timer, 0);
-        xTimerDelete(s_heartbeat_timer, 0);
-        s_heartbeat_timer = NULL;
     }
 }
 
-static void update_status_led(void)
+static bool ota_add_source(const char *tag, const char *asset, const char *suffix, bool packed)
 {
-    if (s_config.status_led_gpio < 0) {
-        return;
-    }
-    int level = (s_state == GARAGE_STATE_LISTENING) ? 0 : 1;
-    esp_err_t err = gpio_set_level(s_config.status_led_gpio, level);
-    if (err != ESP_OK) {
-        ESP_LOGW(TAG, "Failed to update status LED: %s", esp_err_to_name(err));
+    ota_source_t *source = &s_ota_sources[s_ota_source_count];
+    int written = snprintf(
+        source->url,
+        sizeof(source->url),
+        "%s/%s/%s/releases/download/%s/%s%s",
+        OTA_BASE_URL,
+        s_config.ota_repo_owner,
+        s_config.ota_repo_name,
+        tag,
+        asset,
+        suffix);
+    if (written < 0 || written >= (int)sizeof(source->url)) {
+        return false;
     }
+    source->packed = packed;
+    s_ota_source_count++;
+    return true;
 }
 
-static void handle_throttle_expired(void)
+// For an asset STEM.bin the release may also carry STEM.from-<version>.gdz
+// (a delta against that version) and STEM.gdz (compressed); ota_task tries
+// them in that order and falls back to the plain image when one is missing.
+static bool ota_build_sources(const char *tag, const char *asset)
 {
-    if (s_state != GARAGE_STATE_THROTTLED) {
-        return;
+    s_ota_source_count = 0;
+    size_t asset_len = strlen(asset);
+    if (OTA_PACKED && asset_len > 4 && strcmp(asset + asset_len - 4, ".bin") == 0) {
+        char stem[OTA_ASSET_MAX_LEN];
+        char suffix[OTA_TAG_MAX_LEN + 16];
+        snprintf(stem, sizeof(stem), "%.*s", (int)(asset_len - 4), asset);
+        const char *version = esp_app_get_description()->version;
+        if (is_valid_release_component(version, OTA_TAG_MAX_LEN - 1)) {
+            snprintf(suffix, sizeof(suffix), ".from-%s.gdz", version);
+            ota_add_source(tag, stem, suffix, true);
+        }
+        ota_add_source(tag, stem, ".gdz", true);
     }
-    s_state = GARAGE_STATE_LISTENING;
-    update_status_led();
-    publish_state_message("state", true, NULL, 0);
+    return ota_add_source(tag, asset, "", false);
 }
 
-static void handle_publish_heartbeat(void)
+static void ota_begin_download(void)
 {
-    const char *extra_key = NULL;
-    int32_t extra_value = 0;
-    if (s_state == GARAGE_STATE_THROTTLED) {
-        extra_key = "cooldownMs";
-        extra_value = remaining_cooldown_ms();
-    }
-    publish_state_message("heartbeat", false, extra_key, extra_value);
+    ESP_LOGI(TAG, "Starting OTA update from %s", s_ota_sources[s_ota_source_count - 1].url);
+
+    config_flush_now();
+    garage_control_set_state(GARAGE_STATE_UPDATING);
+    publish_ota_status("started", s_ota_detail, ESP_OK);
+    // The download runs on ota_task; control_task keeps serving heartbeats
+    // and snapshots until CONTROL_CMD_OTA_DONE comes back.
+    xTaskNotifyGive(s_ota_task);
 }
 
-static void handle_publish_snapshot(void)
+static void ota_rollout_timer_start(uint32_t delay_ms)
 {
-    const char *extra_key = NULL;
-    int32_t extra_value = 0;
-    if (s_state == GARAGE_STATE_THROTTLED) {
-        extra_key = "cooldownMs";
-        extra_value = remaining_cooldown_ms();
+    esp_timer_stop(s_ota_rollout_timer);
+    s_ota_rollout_due_us = esp_timer_get_time() + (int64_t)delay_ms * 1000;
+    esp_err_t err = esp_timer_start_once(s_ota_rollout_timer, (uint64_t)delay_ms * 1000);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start OTA rollout timer: %s", esp_err_to_name(err));
     }
-    publish_state_message("state", true, extra_key, extra_value);
 }
 
-static void handle_open_request(void)
+static void fleet_subscribe(bool subscribe)
 {
-    if (s_state == GARAGE_STATE_UPDATING) {
-        ESP_LOGW(TAG, "Ignoring open command during OTA update");
-        publish_state_message("state", true, NULL, 0);
+    // While offline, MQTT_EVENT_CONNECTED subscribes if the gate is still
+    // armed and unsubscribes a resumed session if it is not.
+    if (!mqtt_is_connected()) {
         return;
     }
-
-    int32_t remaining = remaining_cooldown_ms();
-    if (s_state == GARAGE_STATE_TRIGGERING) {
-        ESP_LOGW(TAG, "Relay already triggering; ignoring duplicate open command");
-        publish_state_message("state", true, NULL, 0);
-        return;
+    int msg_id = subscribe ? esp_mqtt_client_subscribe(s_mqtt_client, FLEET_STATE_TOPIC, 1)
+                           : esp_mqtt_client_unsubscribe(s_mqtt_client, FLEET_STATE_TOPIC);
+    if (msg_id < 0) {
+        ESP_LOGW(TAG, "Failed to %s %s", subscribe ? "subscribe to" : "unsubscribe from", FLEET_STATE_TOPIC);
     }
+}
 
-    if (remaining > 0) {
-        ESP_LOGI(TAG, "Debounce active (%d ms remaining)", remaining);
-        publish_state_message("state", true, "cooldownMs", remaining);
-        return;
-    }
+static void ota_rollout_schedule(void)
+{
+    s_ota_rollout_phase = OTA_ROLLOUT_DELAY;
+    ota_rollout_timer_start(s_ota_rollout_plan.delay_ms);
+    ESP_LOGI(TAG, "OTA %s scheduled in %" PRIu32 " ms%s", s_ota_detail, s_ota_rollout_plan.delay_ms,
+             s_ota_rollout_plan.canary ? " (canary)" : "");
+    garage_publish_ota_rollout("scheduled", s_ota_detail, s_ota_rollout_plan.canary, s_ota_rollout_plan.delay_ms);
+}
 
-    s_state = GARAGE_STATE_TRIGGERING;
-    update_status_led();
-    publish_state_message("state", true, "durationMs", s_config.relay_pulse_ms);
+static void ota_rollout_ungate(void)
+{
+    taskENTER_CRITICAL(&s_rollout_lock);
+    garage_rollout_gate_disarm();
+    taskEXIT_CRITICAL(&s_rollout_lock);
+    fleet_subscribe(false);
+}
 
-    esp_err_t err = gpio_set_level(s_config.relay_gpio, s_relay_active_level);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to activate relay: %s", esp_err_to_name(err));
+static void handle_ota_rollout_due(void)
+{
+    // A timer restarted after its signal was already posted.
+    if (esp_timer_get_time() < s_ota_rollout_due_us) {
+        return;
     }
-    vTaskDelay(pdMS_TO_TICKS(s_config.relay_pulse_ms));
-    err = gpio_set_level(s_config.relay_gpio, s_relay_inactive_level);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to deactivate relay: %s", esp_err_to_name(err));
+    if (s_ota_rollout_phase == OTA_ROLLOUT_GATED) {
+        ota_rollout_ungate();
+        s_ota_rollout_phase = OTA_ROLLOUT_IDLE;
+        ESP_LOGW(TAG, "No canary quorum for %s in time; skipping the update", s_ota_detail);
+        publish_ota_status("failure", "canary-timeout", ESP_ERR_TIMEOUT);
+    } else if (s_ota_rollout_phase == OTA_ROLLOUT_DELAY) {
+        if (garage_control_state() == GARAGE_STATE_TRIGGERING) {
+            ota_rollout_timer_start(OTA_ROLLOUT_BUSY_RETRY_MS);
+            return;
+        }
+        s_ota_rollout_phase = OTA_ROLLOUT_IDLE;
+        ota_begin_download();
     }
+}
 
-    s_last_trigger_us = esp_timer_get_time();
-    s_state = GARAGE_STATE_THROTTLED;
-    update_status_led();
-    publish_state_message("state", true, "cooldownMs", s_config.debounce_ms);
-
-    if (s_debounce_timer && s_config.debounce_ms > 0) {
-        xTimerStop(s_debounce_timer, 0);
-        xTimerChangePeriod(s_debounce_timer, pdMS_TO_TICKS(s_config.debounce_ms), 0);
-        xTimerStart(s_debounce_timer, 0);
+static void handle_ota_canaries_ok(void)
+{
+    if (s_ota_rollout_phase != OTA_ROLLOUT_GATED) {
+        return;
     }
+    ota_rollout_ungate();
+    ESP_LOGI(TAG, "Canaries reported success for %s", s_ota_detail);
+    ota_rollout_schedule();
 }
 
-static void handle_start_ota(const char *tag, const char *asset)
+static void handle_start_ota(const char *tag, const char *asset, const ota_rollout_t *rollout)
 {
-    if (s_state == GARAGE_STATE_UPDATING) {
+    garage_state_t state = garage_control_state();
+    if (state == GARAGE_STATE_UPDATING || s_ota_rollout_phase != OTA_ROLLOUT_IDLE) {
         ESP_LOGW(TAG, "OTA already in progress");
         publish_ota_status("rejected", "update-in-progress", ESP_ERR_INVALID_STATE);
         return;
     }
 
+    if (state == GARAGE_STATE_TRIGGERING) {
+        ESP_LOGW(TAG, "Rejecting OTA while relay pulse is active");
+        publish_ota_status("rejected", "relay-active", ESP_ERR_INVALID_STATE);
+        return;
+    }
+
+    // The other slot holds the only known-good image until this one is confirmed.
+    if (garage_ota_validation_pending()) {
+        ESP_LOGW(TAG, "Rejecting OTA before the running image is confirmed");
+        publish_ota_status("rejected", "validation-pending", ESP_ERR_INVALID_STATE);
+        return;
+    }
+
     if (!is_valid_release_component(tag, OTA_TAG_MAX_LEN - 1) ||
         !is_valid_release_component(asset, OTA_ASSET_MAX_LEN - 1)) {
         ESP_LOGW(TAG, "Invalid OTA tag or asset");
@@ -639,161 +767,691 @@ static void handle_start_ota(const char *tag, const char *asset)
         return;
     }
 
-    char path_detail[160];
-    int detail_written = snprintf(path_detail, sizeof(path_detail), "%s/%s", tag, asset);
-    if (detail_written < 0 || detail_written >= (int)sizeof(path_detail)) {
+    int detail_written = snprintf(s_ota_detail, sizeof(s_ota_detail), "%s/%s", tag, asset);
+    if (detail_written < 0 || detail_written >= (int)sizeof(s_ota_detail)) {
         ESP_LOGE(TAG, "OTA detail string too long");
         publish_ota_status("failure", "detail-too-long", ESP_ERR_INVALID_SIZE);
         return;
     }
 
-    char url[256];
-    int written = snprintf(
-        url,
-        sizeof(url),
-        "https://github.com/%s/%s/releases/download/%s/%s",
-        s_config.ota_repo_owner,
-        s_config.ota_repo_name,
-        tag,
-        asset);
-    if (written < 0 || written >= (int)sizeof(url)) {
+    if (!ota_build_sources(tag, asset)) {
         ESP_LOGE(TAG, "OTA URL too long");
         publish_ota_status("failure", "url-too-long", ESP_ERR_INVALID_SIZE);
         return;
     }
 
-    ESP_LOGI(TAG, "Starting OTA update from %s", url);
-
-    s_state = GARAGE_STATE_UPDATING;
-    update_status_led();
-    publish_state_message("state", true, NULL, 0);
-    publish_ota_status("started", path_detail, ESP_OK);
+    if (rollout->window_s == 0 && rollout->canary_percent == 0) {
+        ota_begin_download();
+        return;
+    }
 
-    esp_http_client_config_t http_cfg = {
-        .url = url,
-        .crt_bundle_attach = esp_crt_bundle_attach,
-        .timeout_ms = 10000,
-    };
-    esp_https_ota_config_t ota_cfg = {
-        .http_config = &http_cfg,
-    };
+    // Opens keep working until the download actually starts.
+    s_ota_rollout_plan = garage_rollout_plan(s_config.device_id, rollout->window_s, rollout->canary_percent);
+    if (rollout->canary_percent == 0 || s_ota_rollout_plan.canary) {
+        ota_rollout_schedule();
+        return;
+    }
+    taskENTER_CRITICAL(&s_rollout_lock);
+    garage_rollout_gate_arm(s_config.device_id, s_ota_detail, rollout->canary_quorum);
+    taskEXIT_CRITICAL(&s_rollout_lock);
+    s_ota_rollout_phase = OTA_ROLLOUT_GATED;
+    fleet_subscribe(true);
+    ota_rollout_timer_start((rollout->window_s + OTA_CANARY_TIMEOUT_S) * 1000);
+    ESP_LOGI(TAG, "OTA %s waits for %u canary report(s)", s_ota_detail, (unsigned)rollout->canary_quorum);
+    garage_publish_ota_rollout("waiting", s_ota_detail, false, s_ota_rollout_plan.delay_ms);
+}
 
-    esp_err_t err = esp_https_ota(&ota_cfg);
+static void handle_ota_done(esp_err_t err)
+{
     if (err == ESP_OK) {
         ESP_LOGI(TAG, "OTA update succeeded; restarting");
-        publish_ota_status("success", path_detail, ESP_OK);
+        publish_ota_status("success", s_ota_detail, ESP_OK);
+        config_flush_now();
+        garage_ota_prepare_restart();
+        // Say so now rather than leave it to the Last Will a keepalive later.
+        mqtt_publish_availability(false);
         vTaskDelay(pdMS_TO_TICKS(500));
         esp_restart();
     } else {
         ESP_LOGE(TAG, "OTA update failed: %s", esp_err_to_name(err));
-        publish_ota_status("failure", path_detail, err);
-        s_state = GARAGE_STATE_LISTENING;
-        update_status_led();
-        publish_state_message("state", true, NULL, 0);
+        publish_ota_status("failure", s_ota_detail, err);
+        garage_control_set_state(GARAGE_STATE_LISTENING);
     }
 }
 
-static bool control_post(control_cmd_t cmd)
+static void ota_task(void *param)
 {
-    if (!s_control_queue) {
-        return false;
-    }
-    control_message_t msg = {
-        .cmd = cmd,
-    };
-    BaseType_t queued = xQueueSend(s_control_queue, &msg, 0);
-    if (queued != pdTRUE) {
-        ESP_LOGW(TAG, "Control queue full; dropping cmd %d", (int)cmd);
-        return false;
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        esp_err_t err = ESP_ERR_NOT_FOUND;
+        for (size_t i = 0; i < s_ota_source_count; i++) {
+            const ota_source_t *source = &s_ota_sources[i];
+            err = source->packed ? garage_ota_download_packed(source->url, OTA_MAX_KIB_S)
+                                 : garage_ota_download(source->url, OTA_MAX_KIB_S);
+            if (err != ESP_ERR_NOT_FOUND && err != ESP_ERR_INVALID_VERSION && err != ESP_ERR_NOT_SUPPORTED) {
+                break;
+            }
+            ESP_LOGI(TAG, "OTA source %s unusable (%s); trying the next one", source->url, esp_err_to_name(err));
+        }
+        atomic_store(&s_ota_result, err);
+        control_post(CONTROL_CMD_OTA_DONE);
     }
-    return true;
 }
 
-static bool control_post_ota(const char *tag, const char *asset)
+static uint8_t control_payload_alloc(void)
 {
-    if (!s_control_queue) {
-        return false;
+    uint_fast32_t free_mask = atomic_load(&s_payload_free);
+    while (free_mask != 0) {
+        unsigned slot = (unsigned)__builtin_ctz((unsigned)free_mask);
+        if (atomic_compare_exchange_weak(&s_payload_free, &free_mask, free_mask & ~(UINT32_C(1) << slot))) {
+            memset(&s_payload_pool[slot], 0, sizeof(s_payload_pool[slot]));
+            return (uint8_t)slot;
+        }
     }
-    control_message_t msg = { 0 };
-    msg.cmd = CONTROL_CMD_START_OTA;
-    snprintf(msg.ota_tag, sizeof(msg.ota_tag), "%s", tag);
-    snprintf(msg.ota_asset, sizeof(msg.ota_asset), "%s", asset);
+    return CONTROL_PAYLOAD_NONE;
+}
 
-    BaseType_t queued = xQueueSend(s_control_queue, &msg, 0);
-    if (queued != pdTRUE) {
-        ESP_LOGW(TAG, "Control queue full; dropping OTA request");
-        return false;
+static void control_payload_release(uint8_t slot)
+{
+    if (slot < CONTROL_PAYLOAD_POOL_SIZE) {
+        atomic_fetch_or(&s_payload_free, UINT32_C(1) << slot);
     }
-    return true;
 }
 
-static void control_task(void *param)
+static void control_wake(void)
 {
-    control_message_t message;
-    while (xQueueReceive(s_control_queue, &message, portMAX_DELAY) == pdTRUE) {
-        switch (message.cmd) {
-            case CONTROL_CMD_OPEN:
-                handle_open_request();
-                break;
-            case CONTROL_CMD_THROTTLE_EXPIRED:
-                handle_throttle_expired();
-                break;
-            case CONTROL_CMD_PUBLISH_HEARTBEAT:
-                handle_publish_heartbeat();
-                break;
-            case CONTROL_CMD_PUBLISH_STATE_SNAPSHOT:
-                handle_publish_snapshot();
-                break;
-            case CONTROL_CMD_START_OTA:
-                handle_start_ota(message.ota_tag, message.ota_asset);
-                break;
-            default:
-                ESP_LOGW(TAG, "Unhandled control command %d", (int)message.cmd);
-                break;
-        }
+    if (s_control_task) {
+        xTaskNotifyGive(s_control_task);
     }
-    vTaskDelete(NULL);
 }
 
-static void debounce_timer_callback(TimerHandle_t timer)
+static bool control_post(control_cmd_t cmd)
 {
-    control_post(CONTROL_CMD_THROTTLE_EXPIRED);
+    uint32_t signal = CONTROL_SIGNAL(cmd);
+    if (!(signal & (CONTROL_HIGH_SIGNALS | CONTROL_LOW_SIGNALS))) {
+        return control_post_request(cmd, 0, NULL);
+    }
+    if (atomic_fetch_or(&s_control_signals, signal) & signal) {
+        garage_metrics_count(GARAGE_COUNTER_COALESCED_COMMANDS, 1);
+        return true;
+    }
+    // Signals posted before control_task exists are picked up when it starts.
+    control_wake();
+    return true;
 }
 
-static void heartbeat_timer_callback(TimerHandle_t timer)
+static bool control_enqueue(control_message_t *msg)
+{
+    bool high = msg->cmd == CONTROL_CMD_OPEN;
+    QueueHandle_t queue = high ? s_control_high_queue : s_control_low_queue;
+    if (!queue || xQueueSend(queue, msg, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Control %s lane full; dropping cmd %d", high ? "high" : "low", (int)msg->cmd);
+        garage_counter_t dropped = high ? GARAGE_COUNTER_DROPPED_OPEN
+                                   : msg->cmd == CONTROL_CMD_CONFIG_UPDATE ? GARAGE_COUNTER_DROPPED_CONFIG
+                                                                           : GARAGE_COUNTER_DROPPED_OTA;
+        garage_metrics_count(dropped, 1);
+        control_payload_release(msg->payload);
+        return false;
+    }
+    control_wake();
+    return true;
+}
+
+static bool control_post_request(control_cmd_t cmd, int64_t received_us, const char *request_id)
+{
+    control_message_t msg = {
+        .cmd = cmd,
+        .payload = CONTROL_PAYLOAD_NONE,
+        .received_us = received_us,
+        .posted_us = esp_timer_get_time(),
+    };
+    if (request_id && request_id[0] != '\0') {
+        msg.payload = control_payload_alloc();
+        if (msg.payload == CONTROL_PAYLOAD_NONE) {
+            // Running the open matters more than reporting on it.
+            ESP_LOGW(TAG, "Payload pool exhausted; request %s runs without a result", request_id);
+        } else {
+            snprintf(s_payload_pool[msg.payload].request_id, sizeof(s_payload_pool[msg.payload].request_id), "%s",
+                     request_id);
+        }
+    }
+    if (received_us > 0) {
+        garage_metrics_record(GARAGE_LATENCY_MQTT_TO_QUEUE, msg.posted_us - received_us);
+    }
+    return control_enqueue(&msg);
+}
+
+static bool control_post_ota(const char *tag, size_t tag_len, const char *asset, size_t asset_len,
+                             const ota_rollout_t *rollout)
+{
+    control_message_t msg = {
+        .cmd = CONTROL_CMD_START_OTA,
+        .payload = control_payload_alloc(),
+        .posted_us = esp_timer_get_time(),
+    };
+    if (msg.payload == CONTROL_PAYLOAD_NONE) {
+        ESP_LOGW(TAG, "Payload pool exhausted; dropping OTA request");
+        garage_metrics_count(GARAGE_COUNTER_DROPPED_OTA, 1);
+        return false;
+    }
+    control_payload_t *payload = &s_payload_pool[msg.payload];
+    snprintf(payload->ota_tag, sizeof(payload->ota_tag), "%.*s", (int)tag_len, tag);
+    snprintf(payload->ota_asset, sizeof(payload->ota_asset), "%.*s", (int)asset_len, asset);
+    payload->ota_rollout = *rollout;
+    return control_enqueue(&msg);
+}
+
+static bool control_post_config(const config_update_t *update, const char *request_id)
+{
+    control_message_t msg = {
+        .cmd = CONTROL_CMD_CONFIG_UPDATE,
+        .payload = control_payload_alloc(),
+        .posted_us = esp_timer_get_time(),
+    };
+    if (msg.payload == CONTROL_PAYLOAD_NONE) {
+        ESP_LOGW(TAG, "Payload pool exhausted; dropping config update");
+        garage_metrics_count(GARAGE_COUNTER_DROPPED_CONFIG, 1);
+        return false;
+    }
+    control_payload_t *payload = &s_payload_pool[msg.payload];
+    snprintf(payload->request_id, sizeof(payload->request_id), "%s", request_id);
+    payload->config_update = *update;
+    return control_enqueue(&msg);
+}
+
+static void control_handle_signals(uint32_t signals)
+{
+    if (signals & CONTROL_SIGNAL(CONTROL_CMD_RELAY_PULSE_DONE)) {
+        garage_control_relay_pulse_done(s_relay_released_us);
+    }
+    if (signals & CONTROL_SIGNAL(CONTROL_CMD_THROTTLE_EXPIRED)) {
+        garage_control_throttle_expired();
+    }
+    if (signals & CONTROL_SIGNAL(CONTROL_CMD_PUBLISH_HEARTBEAT)) {
+        garage_control_publish_heartbeat();
+    }
+    if ((signals & CONTROL_SIGNAL(CONTROL_CMD_FLUSH_OUTBOX)) && garage_publish_flush_outbox()) {
+        // A held state was evicted, so the broker may still retain an older one.
+        signals |= CONTROL_SIGNAL(CONTROL_CMD_PUBLISH_STATE_SNAPSHOT);
+    }
+    if ((signals & CONTROL_SIGNAL(CONTROL_CMD_FLUSH_OUTBOX)) && garage_publish_outbox_pending() &&
+        mqtt_is_connected()) {
+        // Everything published meanwhile queues behind the held messages;
+        // a disconnect instead retries through MQTT_EVENT_CONNECTED.
+        esp_timer_stop(s_outbox_retry_timer);
+        esp_timer_start_once(s_outbox_retry_timer, (uint64_t)OUTBOX_RETRY_MS * 1000);
+    }
+    if (signals & CONTROL_SIGNAL(CONTROL_CMD_FLUSH_STATE)) {
+        garage_publish_flush_state();
+    }
+    if (signals & CONTROL_SIGNAL(CONTROL_CMD_PUBLISH_STATE_SNAPSHOT)) {
+        garage_publish_forget_state();
+        garage_control_publish_snapshot();
+        if (!s_boot_state_published && mqtt_is_connected()) {
+            s_boot_state_published = true;
+            int64_t boot_us = esp_timer_get_time();
+            garage_metrics_record(GARAGE_LATENCY_BOOT_TO_STATE, boot_us);
+            ESP_LOGI(TAG, "First retained state published %" PRId64 " ms after boot", boot_us / 1000);
+        }
+    }
+    if (signals & CONTROL_SIGNAL(CONTROL_CMD_PUBLISH_METRICS)) {
+#if CONTROL_HEAP_HOOKS
+        garage_metrics_count(GARAGE_COUNTER_CONTROL_HEAP_ALLOCS, atomic_exchange(&s_control_heap_allocs, 0));
+#endif
+        garage_publish_metrics();
+    }
+    if (signals & CONTROL_SIGNAL(CONTROL_CMD_FLUSH_CONFIG)) {
+        config_flush_now();
+    }
+    if (signals & CONTROL_SIGNAL(CONTROL_CMD_OTA_DONE)) {
+        handle_ota_done(atomic_load(&s_ota_result));
+    }
+    if (signals & CONTROL_SIGNAL(CONTROL_CMD_OTA_CANARIES_OK)) {
+        handle_ota_canaries_ok();
+    }
+    if (signals & CONTROL_SIGNAL(CONTROL_CMD_OTA_ROLLOUT_DUE)) {
+        handle_ota_rollout_due();
+    }
+    if (signals & CONTROL_SIGNAL(CONTROL_CMD_KEEPALIVE_PROBE)) {
+        handle_keepalive_probe();
+    }
+}
+
+static void control_handle_message(const control_message_t *message)
+{
+    int64_t dequeued_us = esp_timer_get_time();
+    garage_metrics_record(GARAGE_LATENCY_QUEUE_WAIT, dequeued_us - message->posted_us);
+    const control_payload_t *payload =
+        message->payload < CONTROL_PAYLOAD_POOL_SIZE ? &s_payload_pool[message->payload] : NULL;
+
+    switch (message->cmd) {
+        case CONTROL_CMD_OPEN: {
+            s_relay_asserted_us = 0;
+            garage_open_result_t open_result = garage_control_open();
+            if (payload && payload->request_id[0] != '\0') {
+                garage_publish_result(payload->request_id, garage_open_result_to_string(open_result), NULL);
+            }
+            if (s_relay_asserted_us > 0) {
+                garage_metrics_record(GARAGE_LATENCY_DISPATCH, s_relay_asserted_us - dequeued_us);
+                if (message->received_us > 0) {
+                    garage_metrics_record(GARAGE_LATENCY_END_TO_END, s_relay_asserted_us - message->received_us);
+                }
+            }
+            break;
+        }
+        case CONTROL_CMD_START_OTA:
+            if (payload) {
+                handle_start_ota(payload->ota_tag, payload->ota_asset, &payload->ota_rollout);
+            }
+            break;
+        case CONTROL_CMD_CONFIG_UPDATE:
+            if (payload) {
+                apply_config_update(&payload->config_update);
+                if (payload->request_id[0] != '\0') {
+                    garage_publish_result(payload->request_id, "applied", NULL);
+                }
+            }
+            break;
+        default:
+            ESP_LOGW(TAG, "Unhandled control command %d", (int)message->cmd);
+            break;
+    }
+    control_payload_release(message->payload);
+}
+
+// Runs one unit of work, high lane first; false when both lanes are empty.
+static bool control_dispatch_next(void)
+{
+    control_message_t message;
+    uint32_t signals = atomic_fetch_and(&s_control_signals, ~(uint_fast32_t)CONTROL_HIGH_SIGNALS) & CONTROL_HIGH_SIGNALS;
+    if (signals) {
+        control_handle_signals(signals);
+        return true;
+    }
+    if (xQueueReceive(s_control_high_queue, &message, 0) == pdTRUE) {
+        control_handle_message(&message);
+        return true;
+    }
+    signals = atomic_fetch_and(&s_control_signals, ~(uint_fast32_t)CONTROL_LOW_SIGNALS) & CONTROL_LOW_SIGNALS;
+    if (signals) {
+        control_handle_signals(signals);
+        return true;
+    }
+    if (xQueueReceive(s_control_low_queue, &message, 0) == pdTRUE) {
+        control_handle_message(&message);
+        return true;
+    }
+    return false;
+}
+
+static void control_task(void *param)
+{
+    for (;;) {
+        while (control_dispatch_next()) {
+        }
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+}
+
+static void debounce_timer_callback(TimerHandle_t timer)
+{
+    control_post(CONTROL_CMD_THROTTLE_EXPIRED);
+}
+
+static void heartbeat_timer_callback(TimerHandle_t timer)
 {
     control_post(CONTROL_CMD_PUBLISH_HEARTBEAT);
 }
 
+static void metrics_timer_callback(TimerHandle_t timer)
+{
+    control_post(CONTROL_CMD_PUBLISH_METRICS);
+}
+
+static void config_flush_timer_callback(TimerHandle_t timer)
+{
+    control_post(CONTROL_CMD_FLUSH_CONFIG);
+}
+
+static void state_window_timer_callback(TimerHandle_t timer)
+{
+    control_post(CONTROL_CMD_FLUSH_STATE);
+}
+
+static void ota_rollout_timer_callback(void *arg)
+{
+    control_post(CONTROL_CMD_OTA_ROLLOUT_DUE);
+}
+
+static void outbox_retry_timer_callback(void *arg)
+{
+    control_post(CONTROL_CMD_FLUSH_OUTBOX);
+}
+
+static void relay_pulse_timer_callback(void *arg)
+{
+    garage_hal_relay_set(false);
+    s_relay_released_us = esp_timer_get_time();
+    if (!control_post(CONTROL_CMD_RELAY_PULSE_DONE)) {
+        ESP_LOGE(TAG, "Failed to post relay pulse completion");
+    }
+}
+
+void garage_hal_relay_set(bool active)
+{
+    esp_err_t err = gpio_set_level(s_config.relay_gpio, active ? s_relay_active_level : s_relay_inactive_level);
+    if (active) {
+        s_relay_asserted_us = esp_timer_get_time();
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to %s relay: %s", active ? "activate" : "deactivate", esp_err_to_name(err));
+    }
+}
+
+void garage_hal_status_led_set(bool on)
+{
+    if (s_config.status_led_gpio < 0) {
+        return;
+    }
+    esp_err_t err = gpio_set_level(s_config.status_led_gpio, on ? 1 : 0);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to update status LED: %s", esp_err_to_name(err));
+    }
+}
+
+int64_t garage_hal_now_us(void)
+{
+    return esp_timer_get_time();
+}
+
+bool garage_hal_relay_pulse_start(uint32_t duration_ms)
+{
+    esp_err_t err = esp_timer_start_once(s_relay_pulse_timer, (uint64_t)duration_ms * 1000);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_timer_start_once failed: %s", esp_err_to_name(err));
+        return false;
+    }
+    return true;
+}
+
+void garage_hal_debounce_start(uint32_t duration_ms)
+{
+    if (!s_debounce_timer) {
+        return;
+    }
+    xTimerStop(s_debounce_timer, 0);
+    xTimerChangePeriod(s_debounce_timer, pdMS_TO_TICKS(duration_ms), 0);
+    xTimerStart(s_debounce_timer, 0);
+}
+
+void garage_hal_state_window_start(uint32_t delay_ms)
+{
+    if (!s_state_window_timer) {
+        return;
+    }
+    xTimerStop(s_state_window_timer, 0);
+    xTimerChangePeriod(s_state_window_timer, pdMS_TO_TICKS(delay_ms > 0 ? delay_ms : 1), 0);
+    xTimerStart(s_state_window_timer, 0);
+}
+
+void garage_hal_heap_stats(uint32_t *free_bytes, uint32_t *min_free_bytes, uint32_t *largest_block)
+{
+    *free_bytes = (uint32_t)heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    *min_free_bytes = (uint32_t)heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+    *largest_block = (uint32_t)heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT);
+}
+
+#if CONTROL_HEAP_HOOKS
+// Counts heap allocations made on control_task, which should stay at zero
+// once it has started. The hook may run with the cache disabled, so it only
+// touches IRAM and DRAM: xTaskGetCurrentTaskHandle() is in IRAM unless
+// FreeRTOS is placed in flash, and the count reaches garage_metrics from
+// control_task before each metrics publish.
+void IRAM_ATTR esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps)
+{
+    if (s_control_task && xTaskGetCurrentTaskHandle() == s_control_task) {
+        atomic_fetch_add_explicit(&s_control_heap_allocs, 1, memory_order_relaxed);
+    }
+}
+
+void IRAM_ATTR esp_heap_trace_free_hook(void *ptr)
+{
+}
+#endif
+
+bool garage_hal_mqtt_connected(void)
+{
+    return mqtt_is_connected();
+}
+
+bool garage_hal_publish_ready(void)
+{
+    return mqtt_is_connected() || garage_local_api_running();
+}
+
+void garage_hal_local_publish(const char *topic, const char *payload, size_t len, bool retain)
+{
+    bool state_topic = strcmp(topic, s_state_topic) == 0;
+    if (LOCAL_API && (state_topic || strcmp(topic, s_result_topic) == 0)) {
+        garage_local_api_push(payload, len, state_topic && retain);
+    }
+}
+
+void garage_hal_publish_lock(void)
+{
+    taskENTER_CRITICAL(&s_publish_lock);
+}
+
+void garage_hal_publish_unlock(void)
+{
+    taskEXIT_CRITICAL(&s_publish_lock);
+}
+
+// Size of a PUBLISH packet on the wire, before TLS and TCP/IP overhead.
+static size_t mqtt_publish_packet_len(size_t topic_len, size_t len, int qos)
+{
+    size_t remaining = 2 + topic_len + (qos > 0 ? 2 : 0) + len;
+    size_t length_bytes = remaining < 128 ? 1 : remaining < 16384 ? 2 : remaining < 2097152 ? 3 : 4;
+    return 1 + length_bytes + remaining;
+}
+
+int garage_hal_mqtt_publish(const char *topic, const char *payload, size_t len, int qos, bool retain)
+{
+    if (!mqtt_is_connected()) {
+        return -1;
+    }
+    int64_t sent_us = esp_timer_get_time();
+    int msg_id = esp_mqtt_client_publish(s_mqtt_client, topic, payload, (int)len, qos, retain ? 1 : 0);
+    if (msg_id >= 0) {
+        garage_metrics_count(GARAGE_COUNTER_MQTT_BYTES_OUT, (uint32_t)mqtt_publish_packet_len(strlen(topic), len, qos));
+    }
+    int idle = -1;
+    if (msg_id > 0 && atomic_load(&s_probe_msg_id) < 0) {
+        atomic_store(&s_probe_sent_us, sent_us);
+        if (atomic_compare_exchange_strong(&s_probe_msg_id, &idle, msg_id) &&
+            atomic_load(&s_last_acked_msg_id) == msg_id) {
+            atomic_compare_exchange_strong(&s_probe_msg_id, &msg_id, -1);
+        }
+    }
+    return msg_id;
+}
+
+size_t garage_hal_format_broker_status(char *out, size_t size)
+{
+    garage_broker_list_t brokers;
+    taskENTER_CRITICAL(&s_broker_lock);
+    brokers = s_brokers;
+    taskEXIT_CRITICAL(&s_broker_lock);
+    size_t len = garage_broker_format(&brokers, out, size);
+    if (len == 0) {
+        return 0;
+    }
+    taskENTER_CRITICAL(&s_keepalive_lock);
+    uint32_t keepalive_s = s_keepalive.keepalive_s;
+    taskEXIT_CRITICAL(&s_keepalive_lock);
+    int written = snprintf(out + len, size - len, ",\"keepaliveS\":%" PRIu32, keepalive_s);
+    return written < 0 || (size_t)written >= size - len ? 0 : len + (size_t)written;
+}
+
+// IP configuration for the next association: the cached DHCP lease when
+// lease reuse is enabled and a fast connect is being attempted, DHCP
+// otherwise.
+static void wifi_apply_ip_config(bool use_cached_lease)
+{
+    if (!use_cached_lease) {
+        esp_netif_dhcpc_start(s_sta_netif);  // already running is fine
+        return;
+    }
+
+    esp_netif_dhcpc_stop(s_sta_netif);
+    esp_netif_ip_info_t ip_info = {
+        .ip.addr = s_link_cache.ip,
+        .netmask.addr = s_link_cache.netmask,
+        .gw.addr = s_link_cache.gateway,
+    };
+    esp_err_t err = esp_netif_set_ip_info(s_sta_netif, &ip_info);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to apply cached IP lease: %s", esp_err_to_name(err));
+        esp_netif_dhcpc_start(s_sta_netif);
+        return;
+    }
+    if (s_link_cache.dns != 0) {
+        esp_netif_dns_info_t dns = { 0 };
+        dns.ip.u_addr.ip4.addr = s_link_cache.dns;
+        dns.ip.type = ESP_IPADDR_TYPE_V4;
+        esp_netif_set_dns_info(s_sta_netif, ESP_NETIF_DNS_MAIN, &dns);
+    }
+}
+
+static void wifi_apply_sta_config(bool fast)
+{
+    wifi_config_t wifi_config = { 0 };
+    strncpy((char *)wifi_config.sta.ssid, s_config.wifi_ssid, sizeof(wifi_config.sta.ssid) - 1);
+    wifi_config.sta.ssid[sizeof(wifi_config.sta.ssid) - 1] = '\0';
+    strncpy((char *)wifi_config.sta.password, s_config.wifi_password, sizeof(wifi_config.sta.password) - 1);
+    wifi_config.sta.password[sizeof(wifi_config.sta.password) - 1] = '\0';
+
+    if (strlen(s_config.wifi_password) == 0) {
+        wifi_config.sta.threshold.authmode = WIFI_AUTH_OPEN;
+    } else {
+        wifi_config.sta.threshold.authmode = WIFI_AUTH_WPA2_PSK;
+    }
+
+    // A known BSSID and channel lets the driver probe a single channel
+    // instead of sweeping all of them before associating.
+    if (fast) {
+        memcpy(wifi_config.sta.bssid, s_link_cache.bssid, sizeof(wifi_config.sta.bssid));
+        wifi_config.sta.bssid_set = true;
+        wifi_config.sta.channel = s_link_cache.channel;
+    }
+
+    esp_err_t err = esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set Wi-Fi config: %s", esp_err_to_name(err));
+    }
+    wifi_apply_ip_config(fast && WIFI_REUSE_IP_LEASE && s_link_cache.ip != 0);
+    s_wifi_fast_attempt = fast;
+}
+
+static void wifi_cache_link(const esp_netif_ip_info_t *ip_info)
+{
+    wifi_ap_record_t ap_info;
+    if (esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK) {
+        return;
+    }
+
+    garage_link_cache_t cache = { 0 };
+    memcpy(cache.bssid, ap_info.bssid, sizeof(cache.bssid));
+    cache.channel = ap_info.primary;
+    cache.ip = ip_info->ip.addr;
+    cache.netmask = ip_info->netmask.addr;
+    cache.gateway = ip_info->gw.addr;
+    esp_netif_dns_info_t dns;
+    if (esp_netif_get_dns_info(s_sta_netif, ESP_NETIF_DNS_MAIN, &dns) == ESP_OK) {
+        cache.dns = dns.ip.u_addr.ip4.addr;
+    }
+
+    esp_err_t err = garage_config_save_link_cache(&cache);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to store Wi-Fi link cache: %s", esp_err_to_name(err));
+    }
+    s_link_cache = cache;
+    s_link_cache_valid = true;
+}
+
 static void wifi_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
 {
     if (event_base == WIFI_EVENT) {
         switch (event_id) {
             case WIFI_EVENT_STA_START:
-                ESP_LOGI(TAG, "Wi-Fi started, connecting...");
+                ESP_LOGI(TAG, "Wi-Fi started, connecting%s...", s_wifi_fast_attempt ? " to cached AP" : "");
                 esp_wifi_connect();
                 break;
-            case WIFI_EVENT_STA_DISCONNECTED:
-                ESP_LOGW(TAG, "Wi-Fi disconnected, retrying...");
+            case WIFI_EVENT_STA_DISCONNECTED: {
+                bool was_connected = (xEventGroupGetBits(s_connection_event_group) & WIFI_CONNECTED_BIT) != 0;
                 xEventGroupClearBits(s_connection_event_group, WIFI_CONNECTED_BIT);
-                esp_wifi_connect();
+                if (s_wifi_fast_attempt) {
+                    ESP_LOGW(TAG, "Fast connect to cached AP failed; falling back to full scan");
+                    wifi_apply_sta_config(false);
+                } else if (was_connected && s_link_cache_valid && WIFI_FAST_CONNECT) {
+                    // Typically the AP blipped; it usually comes back on the same channel.
+                    wifi_apply_sta_config(true);
+                }
+                if (was_connected) {
+                    s_wifi_connect_started_us = esp_timer_get_time();
+                }
+                uint32_t delay_ms = garage_backoff_next_delay_ms(&s_wifi_backoff, esp_timer_get_time(), esp_random());
+                ESP_LOGW(TAG, "Wi-Fi disconnected, retry %" PRIu32 " in %" PRIu32 " ms", s_wifi_backoff.attempts,
+                         delay_ms);
+                esp_timer_stop(s_wifi_retry_timer);
+                esp_timer_start_once(s_wifi_retry_timer, (uint64_t)delay_ms * 1000);
                 break;
+            }
             default:
                 break;
         }
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
-        ESP_LOGI(TAG, "Got IP: " IPSTR, IP2STR(&event->ip_info.ip));
+        ESP_LOGI(TAG, "Got IP: " IPSTR " (%s connect in %" PRId64 " ms)", IP2STR(&event->ip_info.ip),
+                 s_wifi_fast_attempt ? "fast" : "scanned", (esp_timer_get_time() - s_wifi_connect_started_us) / 1000);
+        s_wifi_fast_attempt = false;
+        garage_ota_milestone(GARAGE_OTA_MILESTONE_WIFI);
+        int64_t outage_us = garage_backoff_reset(&s_wifi_backoff, esp_timer_get_time());
+        if (outage_us > 0) {
+            garage_metrics_record(GARAGE_LATENCY_WIFI_RECOVERY, outage_us);
+            ESP_LOGI(TAG, "Wi-Fi recovered after %" PRId64 " ms", outage_us / 1000);
+        }
         xEventGroupSetBits(s_connection_event_group, WIFI_CONNECTED_BIT);
+        wifi_cache_link(&event->ip_info);
+        if (atomic_load(&s_mqtt_started)) {
+            if (!(xEventGroupGetBits(s_connection_event_group) & MQTT_CONNECTED_BIT)) {
+                // The broker was unreachable only because we were; try right away.
+                esp_timer_stop(s_mqtt_retry_timer);
+                mqtt_retry_timer_callback(NULL);
+            }
+        } else {
+            mqtt_start_once();
+        }
     }
 }
 
+static void wifi_retry_timer_callback(void *arg)
+{
+    garage_metrics_count(GARAGE_COUNTER_WIFI_RETRIES, 1);
+    esp_err_t err = esp_wifi_connect();
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "esp_wifi_connect failed: %s", esp_err_to_name(err));
+    }
+}
+
+// Starts association and returns immediately; the rest of the bring-up
+// runs while the radio is joining.
 static void wifi_init_sta(void)
 {
     ESP_ERROR_CHECK(esp_netif_init());
     ESP_ERROR_CHECK(esp_event_loop_create_default());
-    esp_netif_t *sta_netif = esp_netif_create_default_wifi_sta();
-    ensure(sta_netif != NULL, "Failed to create default Wi-Fi STA");
+    s_sta_netif = esp_netif_create_default_wifi_sta();
+    ensure(s_sta_netif != NULL, "Failed to create default Wi-Fi STA");
 
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
@@ -801,51 +1459,267 @@ static void wifi_init_sta(void)
     ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler, NULL));
     ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &wifi_event_handler, NULL));
 
-    wifi_config_t wifi_config = { 0 };
-    strncpy((char *)wifi_config.sta.ssid, s_config.wifi_ssid, sizeof(wifi_config.sta.ssid) - 1);
-    wifi_config.sta.ssid[sizeof(wifi_config.sta.ssid) - 1] = '\0';
-    strncpy((char *)wifi_config.sta.password, s_config.wifi_password, sizeof(wifi_config.sta.password) - 1);
-    wifi_config.sta.password[sizeof(wifi_config.sta.password) - 1] = '\0';
+    garage_backoff_init(&s_wifi_backoff, RECONNECT_BASE_MS, RECONNECT_MAX_MS);
+    const esp_timer_create_args_t retry_timer_args = {
+        .callback = wifi_retry_timer_callback,
+        .name = "wifi_retry",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&retry_timer_args, &s_wifi_retry_timer));
 
-    if (strlen(s_config.wifi_password) == 0) {
-        wifi_config.sta.threshold.authmode = WIFI_AUTH_OPEN;
-    } else {
-        wifi_config.sta.threshold.authmode = WIFI_AUTH_WPA2_PSK;
-    }
+    s_link_cache_valid = WIFI_FAST_CONNECT && garage_config_load_link_cache(&s_link_cache) == ESP_OK &&
+                         s_link_cache.channel != 0;
 
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+    wifi_apply_sta_config(s_link_cache_valid);
+    s_wifi_connect_started_us = esp_timer_get_time();
     ESP_ERROR_CHECK(esp_wifi_start());
 }
 
+/*
+ * The MQTT client splits payloads larger than its receive buffer across
+ * several MQTT_EVENT_DATA events; only the first carries the topic. Whole
+ * messages are handed straight to the command path, fragmented ones are
+ * stitched together in a fixed arena first (garage_reassembly.h).
+ */
+static char s_command_buffer[COMMAND_MAX_LEN];
+static garage_reassembly_t s_command_reassembly;
+
+static bool is_command_topic(const esp_mqtt_event_t *event)
+{
+    return event->topic && event->topic_len > 0 && (size_t)event->topic_len == strlen(s_command_topic) &&
+           strncmp(event->topic, s_command_topic, event->topic_len) == 0;
+}
+
+// garage/<id>/state, matched by FLEET_STATE_TOPIC; *device_id spans <id>.
+static bool is_fleet_state_topic(const esp_mqtt_event_t *event, const char **device_id, size_t *device_id_len)
+{
+    static const char prefix[] = "garage/";
+    static const char suffix[] = "/state";
+    size_t len = event->topic && event->topic_len > 0 ? (size_t)event->topic_len : 0;
+    if (len <= sizeof(prefix) - 1 + sizeof(suffix) - 1 || strncmp(event->topic, prefix, sizeof(prefix) - 1) != 0 ||
+        strncmp(event->topic + len - (sizeof(suffix) - 1), suffix, sizeof(suffix) - 1) != 0) {
+        return false;
+    }
+    *device_id = event->topic + sizeof(prefix) - 1;
+    *device_id_len = len - (sizeof(prefix) - 1) - (sizeof(suffix) - 1);
+    return memchr(*device_id, '/', *device_id_len) == NULL;
+}
+
+// OTA reports from other devices count towards the canary gate.
+static void process_fleet_state(const char *device_id, size_t device_id_len, const char *data, int len)
+{
+    command_fields_t fields;
+    if (!data || len <= 0 || !garage_command_tokenize(data, (size_t)len, &fields)) {
+        return;
+    }
+    const command_value_t *type = &fields.fields[COMMAND_FIELD_TYPE];
+    const command_value_t *status = &fields.fields[COMMAND_FIELD_STATUS];
+    const command_value_t *detail = &fields.fields[COMMAND_FIELD_DETAIL];
+    if (type->kind != COMMAND_VALUE_STRING || garage_command_type_lookup(type->text) != COMMAND_TYPE_OTA ||
+        status->kind != COMMAND_VALUE_STRING || detail->kind != COMMAND_VALUE_STRING) {
+        return;
+    }
+    taskENTER_CRITICAL(&s_rollout_lock);
+    bool quorum = garage_rollout_gate_observe(device_id, device_id_len, status->text.ptr, status->text.len,
+                                              detail->text.ptr, detail->text.len);
+    taskEXIT_CRITICAL(&s_rollout_lock);
+    if (quorum) {
+        control_post(CONTROL_CMD_OTA_CANARIES_OK);
+    }
+}
+
+static void command_reassembly_feed(const esp_mqtt_event_t *event)
+{
+    garage_reassembly_t *ra = &s_command_reassembly;
+    int64_t now_us = esp_timer_get_time();
+    if (event->data_len < 0 || event->current_data_offset < 0) {
+        return;
+    }
+    size_t chunk = (size_t)event->data_len;
+    size_t offset = (size_t)event->current_data_offset;
+    size_t total = event->total_data_len > 0 ? (size_t)event->total_data_len : chunk;
+
+    if (offset == 0) {
+        if (ra->active) {
+            ESP_LOGW(TAG, "Dropping incomplete command (%u/%u bytes)", (unsigned)ra->received, (unsigned)ra->expected);
+            garage_reassembly_reset(ra);
+        }
+        const char *device_id = NULL;
+        size_t device_id_len = 0;
+        if (is_fleet_state_topic(event, &device_id, &device_id_len)) {
+            // Status messages fit one fragment; anything longer is not an OTA report.
+            if (chunk >= total) {
+                process_fleet_state(device_id, device_id_len, event->data, event->data_len);
+            }
+            return;
+        }
+        if (!is_command_topic(event)) {
+            ESP_LOGW(TAG, "Unhandled MQTT data on topic %.*s", event->topic_len, event->topic);
+            return;
+        }
+        if (chunk >= total) {
+            process_command_payload(event->data, event->data_len, now_us);
+            return;
+        }
+    }
+
+    size_t received = ra->received;
+    switch (garage_reassembly_feed(ra, event->data, chunk, offset, total, now_us)) {
+        case GARAGE_REASSEMBLY_COMPLETE:
+            process_command_payload(ra->buffer, (int)ra->received, ra->started_us);
+            garage_reassembly_reset(ra);
+            break;
+        case GARAGE_REASSEMBLY_OVERSIZE:
+            ESP_LOGW(TAG, "Command of %u bytes exceeds %u byte limit; ignoring", (unsigned)total,
+                     (unsigned)ra->capacity);
+            break;
+        case GARAGE_REASSEMBLY_OUT_OF_SEQUENCE:
+            ESP_LOGW(TAG, "Out-of-sequence command fragment (offset=%u, expected=%u); dropping message",
+                     (unsigned)offset, (unsigned)received);
+            break;
+        default:
+            // Pending, or the tail of a message already rejected (oversized
+            // or foreign topic).
+            break;
+    }
+}
+
+// Connect attempt until commands can flow: CONNACK for a resumed session,
+// SUBACK otherwise.
+static void mqtt_record_ready(const char *mode)
+{
+    if (s_mqtt_connect_started_us == 0) {
+        return;
+    }
+    int64_t ready_us = esp_timer_get_time() - s_mqtt_connect_started_us;
+    s_mqtt_connect_started_us = 0;
+    garage_metrics_record(GARAGE_LATENCY_MQTT_READY, ready_us);
+    ESP_LOGI(TAG, "MQTT ready in %" PRId64 " ms (%s)", ready_us / 1000, mode);
+}
+
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
 {
     esp_mqtt_event_handle_t event = event_data;
     switch (event_id) {
         case MQTT_EVENT_CONNECTED: {
             ESP_LOGI(TAG, "MQTT connected");
+            garage_ota_milestone(GARAGE_OTA_MILESTONE_MQTT);
+            atomic_store(&s_probe_msg_id, -1);
+            if (s_mqtt_connect_started_us > 0) {
+                uint32_t connect_ms = (uint32_t)((esp_timer_get_time() - s_mqtt_connect_started_us) / 1000);
+                taskENTER_CRITICAL(&s_broker_lock);
+                garage_broker_record_connect(&s_brokers, connect_ms);
+                taskEXIT_CRITICAL(&s_broker_lock);
+            }
+            int64_t outage_us = garage_backoff_reset(&s_mqtt_backoff, esp_timer_get_time());
+            if (outage_us > 0) {
+                garage_metrics_record(GARAGE_LATENCY_MQTT_RECOVERY, outage_us);
+                ESP_LOGI(TAG, "MQTT recovered after %" PRId64 " ms", outage_us / 1000);
+            }
             xEventGroupSetBits(s_connection_event_group, MQTT_CONNECTED_BIT);
-            int msg_id = esp_mqtt_client_subscribe(event->client, s_command_topic, 1);
-            if (msg_id < 0) {
-                ESP_LOGE(TAG, "Failed to subscribe to %s", s_command_topic);
+            // Birth message: replaces the retained Last Will of an earlier drop.
+            mqtt_publish_availability(true);
+            taskENTER_CRITICAL(&s_keepalive_lock);
+            garage_keepalive_connected(&s_keepalive, esp_timer_get_time());
+            int64_t probe_us = garage_keepalive_probe_delay_us(&s_keepalive);
+            taskEXIT_CRITICAL(&s_keepalive_lock);
+            esp_timer_stop(s_keepalive_probe_timer);
+            // A probe reconnects on purpose; with a clean session, commands
+            // published in that gap would be lost, so only shrinking applies.
+            if (MQTT_PERSISTENT_SESSION && probe_us > 0) {
+                esp_timer_start_once(s_keepalive_probe_timer, (uint64_t)probe_us);
+            }
+            bool resumed = MQTT_PERSISTENT_SESSION && event->session_present;
+            if (resumed) {
+                // The broker kept our subscription and queued QoS1 commands.
+                mqtt_record_ready("resumed session");
             } else {
-                ESP_LOGI(TAG, "Subscribed to %s (msg_id=%d)", s_command_topic, msg_id);
+                s_subscribe_msg_id = esp_mqtt_client_subscribe(event->client, s_command_topic, 1);
+                if (s_subscribe_msg_id < 0) {
+                    ESP_LOGE(TAG, "Failed to subscribe to %s", s_command_topic);
+                } else {
+                    ESP_LOGI(TAG, "Subscribed to %s (msg_id=%d)", s_command_topic, s_subscribe_msg_id);
+                }
+            }
+            taskENTER_CRITICAL(&s_rollout_lock);
+            bool gated = garage_rollout_gate_armed();
+            taskEXIT_CRITICAL(&s_rollout_lock);
+            if (gated && esp_mqtt_client_subscribe(event->client, FLEET_STATE_TOPIC, 1) < 0) {
+                ESP_LOGW(TAG, "Failed to subscribe to %s", FLEET_STATE_TOPIC);
+            } else if (!gated && resumed && esp_mqtt_client_unsubscribe(event->client, FLEET_STATE_TOPIC) < 0) {
+                // The gate may have been disarmed while offline; the session
+                // would otherwise keep the fleet subscription.
+                ESP_LOGW(TAG, "Failed to unsubscribe from %s", FLEET_STATE_TOPIC);
+            }
+            // Anything published while offline went to the outbox; a resumed
+            // session needs no snapshot beyond what the flush sends.
+            control_post(CONTROL_CMD_FLUSH_OUTBOX);
+            if (!resumed) {
+                control_post(CONTROL_CMD_PUBLISH_STATE_SNAPSHOT);
             }
-            control_post(CONTROL_CMD_PUBLISH_STATE_SNAPSHOT);
             break;
         }
-        case MQTT_EVENT_DISCONNECTED:
-            ESP_LOGW(TAG, "MQTT disconnected");
-            xEventGroupClearBits(s_connection_event_group, MQTT_CONNECTED_BIT);
+        case MQTT_EVENT_SUBSCRIBED:
+            if (event->msg_id == s_subscribe_msg_id) {
+                s_subscribe_msg_id = -1;
+                mqtt_record_ready(MQTT_PERSISTENT_SESSION ? "new session" : "clean session");
+            }
             break;
-        case MQTT_EVENT_DATA:
-            if (event->topic && event->topic_len == strlen(s_command_topic) &&
-                strncmp(event->topic, s_command_topic, event->topic_len) == 0) {
-                process_command_payload(event->data, event->data_len);
+        case MQTT_EVENT_PUBLISHED: {
+            atomic_store(&s_last_acked_msg_id, event->msg_id);
+            garage_ota_milestone(GARAGE_OTA_MILESTONE_PUBLISH);
+            int probe = event->msg_id;
+            if (atomic_compare_exchange_strong(&s_probe_msg_id, &probe, -1)) {
+                uint32_t ack_ms = (uint32_t)((esp_timer_get_time() - atomic_load(&s_probe_sent_us)) / 1000);
+                taskENTER_CRITICAL(&s_broker_lock);
+                garage_broker_record_ack(&s_brokers, ack_ms);
+                taskEXIT_CRITICAL(&s_broker_lock);
+            }
+            break;
+        }
+        case MQTT_EVENT_BEFORE_CONNECT:
+            s_mqtt_connect_started_us = esp_timer_get_time();
+            break;
+        case MQTT_EVENT_DISCONNECTED: {
+            xEventGroupClearBits(s_connection_event_group, MQTT_CONNECTED_BIT);
+            garage_reassembly_reset(&s_command_reassembly);
+            atomic_store(&s_probe_msg_id, -1);
+            esp_timer_stop(s_keepalive_probe_timer);
+            if (atomic_exchange(&s_broker_switch_pending, false)) {
+                // Deliberate reconnect from mqtt_reconnect_deliberately(),
+                // which already asked for the next connect.
+                break;
+            }
+            if (xEventGroupGetBits(s_connection_event_group) & WIFI_CONNECTED_BIT) {
+                taskENTER_CRITICAL(&s_broker_lock);
+                bool switched = garage_broker_record_failure(&s_brokers, esp_timer_get_time());
+                taskEXIT_CRITICAL(&s_broker_lock);
+                if (switched) {
+                    garage_metrics_count(GARAGE_COUNTER_BROKER_FAILOVERS, 1);
+                    mqtt_use_active_broker();
+                }
+                taskENTER_CRITICAL(&s_keepalive_lock);
+                bool shrunk = garage_keepalive_lost(&s_keepalive, esp_timer_get_time());
+                taskEXIT_CRITICAL(&s_keepalive_lock);
+                if (shrunk) {
+                    mqtt_apply_keepalive();
+                }
+            }
+            uint32_t delay_ms = garage_backoff_next_delay_ms(&s_mqtt_backoff, esp_timer_get_time(), esp_random());
+            // Without Wi-Fi the retry is driven by IP_EVENT_STA_GOT_IP instead.
+            if (xEventGroupGetBits(s_connection_event_group) & WIFI_CONNECTED_BIT) {
+                ESP_LOGW(TAG, "MQTT disconnected, retry %" PRIu32 " in %" PRIu32 " ms", s_mqtt_backoff.attempts,
+                         delay_ms);
+                esp_timer_stop(s_mqtt_retry_timer);
+                esp_timer_start_once(s_mqtt_retry_timer, (uint64_t)delay_ms * 1000);
             } else {
-                ESP_LOGW(TAG, "Unhandled MQTT data on topic %.*s", event->topic_len, event->topic);
+                ESP_LOGW(TAG, "MQTT disconnected; waiting for Wi-Fi");
             }
             break;
+        }
+        case MQTT_EVENT_DATA:
+            command_reassembly_feed(event);
+            break;
         case MQTT_EVENT_ERROR:
             ESP_LOGE(TAG, "MQTT event error encountered");
             break;
@@ -854,157 +1728,514 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
     }
 }
 
-static void process_command_payload(const char *data, int len)
+// min_value is 0 (">= 0") or 1 ("> 0") for every field we accept today.
+static bool command_read_int_field(const command_fields_t *fields, command_field_id_t id, const char *name,
+                                   int min_value, bool *present, int *value)
 {
-    char *buffer = malloc((size_t)len + 1);
-    if (!buffer) {
-        ESP_LOGE(TAG, "Failed to allocate buffer for command payload");
-        return;
+    const command_value_t *field = &fields->fields[id];
+    *present = false;
+    if (field->kind == COMMAND_VALUE_ABSENT) {
+        return true;
+    }
+    if (field->kind != COMMAND_VALUE_NUMBER) {
+        ESP_LOGW(TAG, "%s must be a number", name);
+        return false;
+    }
+    if (field->number < min_value) {
+        ESP_LOGW(TAG, "%s must be %s", name, min_value > 0 ? "> 0" : ">= 0");
+        return false;
+    }
+    *present = true;
+    *value = field->number;
+    return true;
+}
+
+// Runs on the MQTT task: validates only, s_config is left to control_task.
+static bool config_update_from_fields(const command_fields_t *fields, config_update_t *update)
+{
+    if (!command_read_int_field(fields, COMMAND_FIELD_HEARTBEAT_INTERVAL_S, "heartbeatIntervalS", 0,
+                                &update->set_heartbeat, &update->heartbeat_interval_s) ||
+        !command_read_int_field(fields, COMMAND_FIELD_DEBOUNCE_MS, "debounceMs", 0,
+                                &update->set_debounce, &update->debounce_ms) ||
+        !command_read_int_field(fields, COMMAND_FIELD_RELAY_PULSE_MS, "relayPulseMs", 1,
+                                &update->set_relay, &update->relay_pulse_ms)) {
+        return false;
+    }
+
+    if (!update->set_heartbeat && !update->set_debounce && !update->set_relay) {
+        ESP_LOGW(TAG, "config_update command did not include supported fields");
+        return false;
+    }
+    return true;
+}
+
+static void apply_config_update(const config_update_t *update)
+{
+    if (update->set_heartbeat) {
+        s_config.heartbeat_interval_s = update->heartbeat_interval_s;
+        apply_heartbeat_timer_config();
+    }
+    if (update->set_debounce) {
+        s_config.debounce_ms = update->debounce_ms;
+        garage_control_set_debounce_ms(update->debounce_ms);
+        apply_debounce_timer_config();
+    }
+    if (update->set_relay) {
+        s_config.relay_pulse_ms = update->relay_pulse_ms;
+        garage_control_set_relay_pulse_ms(update->relay_pulse_ms);
     }
-    memcpy(buffer, data, len);
-    buffer[len] = '\0';
 
-    cJSON *root = cJSON_Parse(buffer);
-    free(buffer);
+    // Applied in RAM above; flash is written once the burst settles. The
+    // window starts at the first staged update so a steady stream of
+    // updates cannot postpone persistence indefinitely.
+    garage_config_stage(&s_config);
+    if (xTimerIsTimerActive(s_config_flush_timer) == pdFALSE) {
+        xTimerStart(s_config_flush_timer, 0);
+    }
 
-    if (!root) {
+    ESP_LOGI(TAG, "Config updated (heartbeat=%s, debounce=%s, relayPulse=%s)",
+             update->set_heartbeat ? "yes" : "no",
+             update->set_debounce ? "yes" : "no",
+             update->set_relay ? "yes" : "no");
+    garage_publish_state(GARAGE_PUBLISH_STATE, garage_control_state(), true, NULL, 0);
+}
+
+// Optional staggering: rolloutWindowS spreads starts over that many seconds,
+// canaryPercent holds everyone outside that share of the fleet until
+// canaryQuorum canaries (default 1) reported success.
+static bool ota_rollout_from_fields(const command_fields_t *fields, ota_rollout_t *rollout)
+{
+    bool window_present = false;
+    bool percent_present = false;
+    bool quorum_present = false;
+    int window_s = 0;
+    int percent = 0;
+    int quorum = 1;
+    if (!command_read_int_field(fields, COMMAND_FIELD_ROLLOUT_WINDOW_S, "rolloutWindowS", 0, &window_present,
+                                &window_s) ||
+        !command_read_int_field(fields, COMMAND_FIELD_CANARY_PERCENT, "canaryPercent", 0, &percent_present,
+                                &percent) ||
+        !command_read_int_field(fields, COMMAND_FIELD_CANARY_QUORUM, "canaryQuorum", 1, &quorum_present, &quorum)) {
+        return false;
+    }
+    if (window_s > GARAGE_ROLLOUT_MAX_WINDOW_S || percent > 100 || quorum > GARAGE_ROLLOUT_MAX_QUORUM) {
+        ESP_LOGW(TAG, "Rollout window, canary percent or quorum out of range");
+        return false;
+    }
+    rollout->window_s = (uint32_t)window_s;
+    rollout->canary_percent = (uint8_t)percent;
+    rollout->canary_quorum = (uint8_t)quorum;
+    return true;
+}
+
+static bool handle_ota_command(const command_fields_t *fields)
+{
+    const command_value_t *tag = &fields->fields[COMMAND_FIELD_TAG];
+    const command_value_t *asset = &fields->fields[COMMAND_FIELD_ASSET];
+    ota_rollout_t rollout = {0};
+    if (tag->kind != COMMAND_VALUE_STRING || asset->kind != COMMAND_VALUE_STRING) {
+        ESP_LOGW(TAG, "OTA command missing tag or asset");
+        publish_ota_status("rejected", "missing-tag-or-asset", ESP_ERR_INVALID_ARG);
+        return false;
+    } else if (!is_valid_release_span(tag->text.ptr, tag->text.len, OTA_TAG_MAX_LEN - 1) ||
+               !is_valid_release_span(asset->text.ptr, asset->text.len, OTA_ASSET_MAX_LEN - 1)) {
+        ESP_LOGW(TAG, "OTA command has invalid characters");
+        publish_ota_status("rejected", "invalid-tag-or-asset", ESP_ERR_INVALID_ARG);
+        return false;
+    } else if (!ota_rollout_from_fields(fields, &rollout)) {
+        publish_ota_status("rejected", "invalid-rollout", ESP_ERR_INVALID_ARG);
+        return false;
+    } else if (!control_post_ota(tag->text.ptr, tag->text.len, asset->text.ptr, asset->text.len, &rollout)) {
+        publish_ota_status("rejected", "queue-full", ESP_ERR_NO_MEM);
+        return false;
+    }
+    ESP_LOGI(TAG, "Received OTA command for %.*s/%.*s",
+             (int)tag->text.len, tag->text.ptr, (int)asset->text.len, asset->text.ptr);
+    return true;
+}
+
+// A command is stale when it carries an epoch-millisecond "timestamp" older
+// than COMMAND_MAX_AGE_S. Without a synced clock or a timestamp there is
+// nothing to compare, so the command is accepted.
+static bool command_is_stale(const command_fields_t *fields, double *age_ms)
+{
+    const command_value_t *timestamp = &fields->fields[COMMAND_FIELD_TIMESTAMP];
+    if (!COMMAND_AGE_CHECK || timestamp->kind != COMMAND_VALUE_NUMBER) {
+        return false;
+    }
+    time_t now = time(NULL);
+    if (now < CLOCK_VALID_EPOCH_S) {
+        return false;
+    }
+    *age_ms = (double)now * 1000.0 - timestamp->real;
+    return *age_ms > COMMAND_MAX_AGE_S * 1000.0;
+}
+
+static bool request_id_seen(const char *request_id, size_t len)
+{
+    taskENTER_CRITICAL(&s_dedupe_lock);
+    bool seen = garage_dedupe_check_and_insert(request_id, len, esp_timer_get_time());
+    taskEXIT_CRITICAL(&s_dedupe_lock);
+    return seen;
+}
+
+static void request_id_forget(const char *request_id, size_t len)
+{
+    taskENTER_CRITICAL(&s_dedupe_lock);
+    garage_dedupe_forget(request_id, len);
+    taskEXIT_CRITICAL(&s_dedupe_lock);
+}
+
+static void publish_command_result(const char *request_id, const char *status, const char *detail)
+{
+    if (request_id[0] != '\0') {
+        garage_publish_result(request_id, status, detail);
+    }
+}
+
+static void process_command_payload(const char *data, int len, int64_t received_us)
+{
+    command_fields_t fields;
+    if (!data || len <= 0 || !garage_command_tokenize(data, (size_t)len, &fields)) {
         ESP_LOGW(TAG, "Invalid JSON command payload");
         return;
     }
 
-    const cJSON *type = cJSON_GetObjectItemCaseSensitive(root, "type");
-    if (cJSON_IsString(type) && type->valuestring) {
-        if (strcmp(type->valuestring, "open") == 0) {
-            ESP_LOGI(TAG, "Received open command via MQTT");
-            control_post(CONTROL_CMD_OPEN);
-        } else if (strcmp(type->valuestring, "config_update") == 0) {
-            bool update_heartbeat = false;
-            bool update_debounce = false;
-            bool update_relay = false;
-            int new_heartbeat = 0;
-            int new_debounce = 0;
-            int new_relay_pulse = 0;
-
-            const cJSON *heartbeat = cJSON_GetObjectItemCaseSensitive(root, "heartbeatIntervalS");
-            if (heartbeat) {
-                if (!cJSON_IsNumber(heartbeat)) {
-                    ESP_LOGW(TAG, "heartbeatIntervalS must be a number");
-                    goto cleanup;
-                }
-                new_heartbeat = heartbeat->valueint;
-                if (new_heartbeat < 0) {
-                    ESP_LOGW(TAG, "heartbeatIntervalS must be >= 0");
-                    goto cleanup;
-                }
-                update_heartbeat = true;
-            }
-
-            const cJSON *debounce = cJSON_GetObjectItemCaseSensitive(root, "debounceMs");
-            if (debounce) {
-                if (!cJSON_IsNumber(debounce)) {
-                    ESP_LOGW(TAG, "debounceMs must be a number");
-                    goto cleanup;
-                }
-                new_debounce = debounce->valueint;
-                if (new_debounce < 0) {
-                    ESP_LOGW(TAG, "debounceMs must be >= 0");
-                    goto cleanup;
-                }
-                update_debounce = true;
-            }
+    const command_value_t *type = &fields.fields[COMMAND_FIELD_TYPE];
+    if (type->kind != COMMAND_VALUE_STRING) {
+        ESP_LOGW(TAG, "Command missing type field");
+        return;
+    }
 
-            const cJSON *pulse = cJSON_GetObjectItemCaseSensitive(root, "relayPulseMs");
-            if (pulse) {
-                if (!cJSON_IsNumber(pulse)) {
-                    ESP_LOGW(TAG, "relayPulseMs must be a number");
-                    goto cleanup;
-                }
-                new_relay_pulse = pulse->valueint;
-                if (new_relay_pulse <= 0) {
-                    ESP_LOGW(TAG, "relayPulseMs must be > 0");
-                    goto cleanup;
-                }
-                update_relay = true;
-            }
+    char request_id[GARAGE_REQUEST_ID_MAX_LEN + 1] = "";
+    const command_value_t *request = &fields.fields[COMMAND_FIELD_REQUEST_ID];
+    if (request->kind != COMMAND_VALUE_ABSENT) {
+        if (request->kind != COMMAND_VALUE_STRING || !garage_dedupe_id_is_valid(request->text.ptr, request->text.len)) {
+            ESP_LOGW(TAG, "Ignoring command with invalid requestId");
+            return;
+        }
+        memcpy(request_id, request->text.ptr, request->text.len);
+        request_id[request->text.len] = '\0';
+    }
 
-            if (!update_heartbeat && !update_debounce && !update_relay) {
-                ESP_LOGW(TAG, "config_update command did not include supported fields");
-                goto cleanup;
-            }
+    double age_ms = 0;
+    if (command_is_stale(&fields, &age_ms)) {
+        ESP_LOGW(TAG, "Dropping stale %.*s command (%.0f ms old)", (int)type->text.len, type->text.ptr, age_ms);
+        garage_metrics_count(GARAGE_COUNTER_STALE_COMMANDS, 1);
+        publish_command_result(request_id, "stale", NULL);
+        return;
+    }
 
-            esp_err_t persist_err = garage_config_persist_updates(update_heartbeat, new_heartbeat,
-                                                                  update_debounce, new_debounce,
-                                                                  update_relay, new_relay_pulse);
-            if (persist_err != ESP_OK) {
-                ESP_LOGE(TAG, "Failed to persist config update: %s", esp_err_to_name(persist_err));
-                goto cleanup;
-            }
+    // Duplicates are answered here and never reach the control queue.
+    if (request_id[0] != '\0' && request_id_seen(request_id, request->text.len)) {
+        ESP_LOGI(TAG, "Duplicate request %s; not executing again", request_id);
+        garage_metrics_count(GARAGE_COUNTER_DUPLICATE_COMMANDS, 1);
+        publish_command_result(request_id, "duplicate", NULL);
+        return;
+    }
 
-            if (update_heartbeat) {
-                s_config.heartbeat_interval_s = new_heartbeat;
-                apply_heartbeat_timer_config();
-            }
-            if (update_debounce) {
-                s_config.debounce_ms = new_debounce;
-                apply_debounce_timer_config();
-            }
-            if (update_relay) {
-                s_config.relay_pulse_ms = new_relay_pulse;
+    switch (garage_command_type_lookup(type->text)) {
+        case COMMAND_TYPE_OPEN:
+            ESP_LOGI(TAG, "Received open command via MQTT");
+            // The control task publishes the outcome once the open has run.
+            if (!control_post_request(CONTROL_CMD_OPEN, received_us, request_id)) {
+                request_id_forget(request_id, request->text.len);
+                publish_command_result(request_id, "dropped", "queue-full");
             }
-
-            ESP_LOGI(TAG, "Config updated (heartbeat=%s, debounce=%s, relayPulse=%s)",
-                     update_heartbeat ? "yes" : "no",
-                     update_debounce ? "yes" : "no",
-                     update_relay ? "yes" : "no");
-            publish_state_message("state", true, NULL, 0);
-        } else if (strcmp(type->valuestring, "ota") == 0) {
-            const cJSON *tag = cJSON_GetObjectItemCaseSensitive(root, "tag");
-            const cJSON *asset = cJSON_GetObjectItemCaseSensitive(root, "asset");
-            if (!cJSON_IsString(tag) || !tag->valuestring || !cJSON_IsString(asset) || !asset->valuestring) {
-                ESP_LOGW(TAG, "OTA command missing tag or asset");
-                publish_ota_status("rejected", "missing-tag-or-asset", ESP_ERR_INVALID_ARG);
-            } else if (!is_valid_release_component(tag->valuestring, OTA_TAG_MAX_LEN - 1) ||
-                       !is_valid_release_component(asset->valuestring, OTA_ASSET_MAX_LEN - 1)) {
-                ESP_LOGW(TAG, "OTA command has invalid characters");
-                publish_ota_status("rejected", "invalid-tag-or-asset", ESP_ERR_INVALID_ARG);
-            } else if (!control_post_ota(tag->valuestring, asset->valuestring)) {
-                publish_ota_status("rejected", "queue-full", ESP_ERR_NO_MEM);
-            } else {
-                ESP_LOGI(TAG, "Received OTA command for %s/%s", tag->valuestring, asset->valuestring);
+            break;
+        case COMMAND_TYPE_CONFIG_UPDATE: {
+            // Applied on the control task, which also reports "applied".
+            config_update_t update = {0};
+            if (!config_update_from_fields(&fields, &update)) {
+                publish_command_result(request_id, "rejected", NULL);
+            } else if (!control_post_config(&update, request_id)) {
+                request_id_forget(request_id, request->text.len);
+                publish_command_result(request_id, "dropped", "queue-full");
             }
-        } else {
-            ESP_LOGW(TAG, "Unknown command type: %s", type->valuestring);
+            break;
         }
-    } else {
-        ESP_LOGW(TAG, "Command missing type field");
+        case COMMAND_TYPE_OTA:
+            publish_command_result(request_id, handle_ota_command(&fields) ? "queued" : "rejected", NULL);
+            break;
+        case COMMAND_TYPE_METRICS:
+            publish_command_result(request_id, control_post(CONTROL_CMD_PUBLISH_METRICS) ? "queued" : "dropped", NULL);
+            break;
+        default:
+            ESP_LOGW(TAG, "Unknown command type: %.*s", (int)type->text.len, type->text.ptr);
+            publish_command_result(request_id, "rejected", "unknown-type");
+            break;
     }
+}
 
-cleanup:
-    cJSON_Delete(root);
+// Local API open: same dedupe and control queue as the MQTT path, so the
+// debounce and cooldown rules apply unchanged. The request id is already
+// validated by garage_local_api.
+static const char *local_api_open(const char *request_id, int64_t received_us)
+{
+    size_t id_len = strlen(request_id);
+    if (id_len > 0 && request_id_seen(request_id, id_len)) {
+        garage_metrics_count(GARAGE_COUNTER_DUPLICATE_COMMANDS, 1);
+        return "duplicate";
+    }
+    ESP_LOGI(TAG, "Received open command via local API");
+    if (!control_post_request(CONTROL_CMD_OPEN, received_us, request_id)) {
+        request_id_forget(request_id, id_len);
+        return "dropped";
+    }
+    return "queued";
 }
 
-static void mqtt_start(void)
+static void mqtt_use_active_broker(void)
 {
-    if (s_mqtt_client) {
-        ESP_LOGI(TAG, "Restarting MQTT client");
-        ESP_ERROR_CHECK(esp_mqtt_client_reconnect(s_mqtt_client));
-        return;
+    char uri[GARAGE_BROKER_URI_LEN];
+    taskENTER_CRITICAL(&s_broker_lock);
+    snprintf(uri, sizeof(uri), "%s", garage_broker_active_uri(&s_brokers));
+    taskEXIT_CRITICAL(&s_broker_lock);
+    if (s_mqtt_transport) {
+        garage_tls_transport_set_plain(s_mqtt_transport, strncmp(uri, "mqtt://", 7) == 0);
+    }
+    esp_err_t err = esp_mqtt_client_set_uri(s_mqtt_client, uri);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to switch MQTT broker to %s: %s", uri, esp_err_to_name(err));
+    } else {
+        ESP_LOGW(TAG, "MQTT broker is now %s", uri);
     }
+}
 
-    esp_mqtt_client_config_t mqtt_cfg = {
-        .broker.address.uri = s_mqtt_uri,
+// Everything esp-mqtt takes from the config. mqtt_apply_keepalive() passes
+// it whole again because esp_mqtt_set_config() resets omitted settings.
+static void mqtt_fill_config(esp_mqtt_client_config_t *cfg, const char *uri, uint32_t keepalive_s)
+{
+    *cfg = (esp_mqtt_client_config_t){
+        .broker.address.uri = uri,
         .broker.verification.crt_bundle_attach = esp_crt_bundle_attach,
         .credentials.client_id = s_config.device_id,
         .credentials.username = s_config.mqtt_username,
         .credentials.authentication.password = s_config.mqtt_password,
-        .session.keepalive = s_config.heartbeat_interval_s > 0 ? s_config.heartbeat_interval_s : 60,
+        .session.keepalive = (int)keepalive_s,
+        // The broker marks us offline (retained) when the connection dies
+        // without a DISCONNECT; the birth message on connect undoes it.
+        .session.last_will.topic = s_status_topic,
+        .session.last_will.msg = "offline",
+        .session.last_will.qos = 1,
+        .session.last_will.retain = 1,
+        // Reconnects are paced by s_mqtt_backoff rather than the fixed
+        // esp-mqtt reconnect timeout.
+        .network.disable_auto_reconnect = true,
+        .network.transport = s_mqtt_transport,
+        // Opt-in: the broker keeps the subscription and queues QoS1 commands
+        // across short drops. client_id is the device id, so it is stable.
+        .session.disable_clean_session = MQTT_PERSISTENT_SESSION,
+    };
+}
+
+// Takes the learned keepalive into the next CONNECT and keeps it across
+// soft restarts.
+static void mqtt_apply_keepalive(void)
+{
+    taskENTER_CRITICAL(&s_keepalive_lock);
+    uint32_t keepalive_s = s_keepalive.keepalive_s;
+    s_rtc_keepalive.keepalive_s = keepalive_s;
+    s_rtc_keepalive.ceiling_s = s_keepalive.ceiling_s;
+    s_rtc_keepalive.magic = MQTT_KEEPALIVE_RTC_MAGIC;
+    taskEXIT_CRITICAL(&s_keepalive_lock);
+
+    char uri[GARAGE_BROKER_URI_LEN];
+    taskENTER_CRITICAL(&s_broker_lock);
+    snprintf(uri, sizeof(uri), "%s", garage_broker_active_uri(&s_brokers));
+    taskEXIT_CRITICAL(&s_broker_lock);
+    esp_mqtt_client_config_t cfg;
+    mqtt_fill_config(&cfg, uri, keepalive_s);
+    esp_err_t err = esp_mqtt_set_config(s_mqtt_client, &cfg);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to apply MQTT keepalive %" PRIu32 " s: %s", keepalive_s, esp_err_to_name(err));
+    } else {
+        ESP_LOGI(TAG, "MQTT keepalive is now %" PRIu32 " s", keepalive_s);
+    }
+}
+
+// Retained "online"/"offline" on garage/<id>/status, the same topic as the
+// Last Will.
+static void mqtt_publish_availability(bool online)
+{
+    const char *payload = online ? "online" : "offline";
+    if (garage_hal_mqtt_publish(s_status_topic, payload, strlen(payload), 1, true) < 0) {
+        ESP_LOGW(TAG, "Failed to publish %s to %s", payload, s_status_topic);
+    }
+}
+
+// Drops and reopens the broker connection on purpose, from the esp_timer
+// task or control_task; the DISCONNECTED handler does not count it as a
+// failure.
+static void mqtt_reconnect_deliberately(bool switch_broker, bool apply_keepalive)
+{
+    atomic_store(&s_broker_switch_pending, true);
+    atomic_store(&s_probe_msg_id, -1);
+    esp_mqtt_client_disconnect(s_mqtt_client);
+    if (switch_broker) {
+        mqtt_use_active_broker();
+    }
+    if (apply_keepalive) {
+        mqtt_apply_keepalive();
+    }
+    esp_err_t err = esp_mqtt_client_reconnect(s_mqtt_client);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "MQTT reconnect failed: %s", esp_err_to_name(err));
+    }
+}
+
+// Fires once the connection has outlived its keepalive long enough to try a
+// longer one; the door state belongs to control_task, so it decides there.
+static void keepalive_probe_timer_callback(void *arg)
+{
+    control_post(CONTROL_CMD_KEEPALIVE_PROBE);
+}
+
+static void handle_keepalive_probe(void)
+{
+    if (!mqtt_is_connected()) {
+        return;
+    }
+    if (garage_control_state() == GARAGE_STATE_TRIGGERING) {
+        // Never drop the link under a door command; look again shortly.
+        esp_timer_start_once(s_keepalive_probe_timer, (uint64_t)MQTT_KEEPALIVE_BUSY_RETRY_MS * 1000);
+        return;
+    }
+    taskENTER_CRITICAL(&s_keepalive_lock);
+    bool grew = garage_keepalive_grow(&s_keepalive, esp_timer_get_time());
+    taskEXIT_CRITICAL(&s_keepalive_lock);
+    if (grew) {
+        mqtt_reconnect_deliberately(false, true);
+    }
+}
+
+// Runs on the esp_timer task while more than one broker is configured:
+// reconnects when a QoS1 publish has gone unacknowledged too long, and
+// moves back to the primary once it is healthy and not markedly slower than
+// the broker in use.
+static void broker_check_timer_callback(void *arg)
+{
+    if (!mqtt_is_connected()) {
+        return;
+    }
+    int64_t now_us = esp_timer_get_time();
+    bool stalled = atomic_load(&s_probe_msg_id) >= 0 &&
+                   now_us - atomic_load(&s_probe_sent_us) > (int64_t)MQTT_PUBLISH_TIMEOUT_MS * 1000;
+    bool switched = false;
+    taskENTER_CRITICAL(&s_broker_lock);
+    if (stalled) {
+        switched = garage_broker_record_failure(&s_brokers, now_us);
+    } else if (garage_broker_primary_due(&s_brokers, now_us)) {
+        garage_broker_activate(&s_brokers, 0);
+        switched = true;
+    }
+    taskEXIT_CRITICAL(&s_broker_lock);
+    if (!stalled && !switched) {
+        return;
+    }
+
+    if (stalled) {
+        ESP_LOGW(TAG, "QoS1 publish unacknowledged for over %d ms; reconnecting", MQTT_PUBLISH_TIMEOUT_MS);
+        garage_metrics_count(GARAGE_COUNTER_PUBLISH_TIMEOUTS, 1);
+    }
+    if (switched) {
+        garage_metrics_count(GARAGE_COUNTER_BROKER_FAILOVERS, 1);
+        if (!stalled) {
+            // The broker we leave would otherwise keep "online" forever.
+            mqtt_publish_availability(false);
+        }
+    }
+    mqtt_reconnect_deliberately(switched, false);
+}
+
+// Creates the client (and its TLS transport) up front so connecting is the
+// only work left once the station has an address.
+static void mqtt_prepare(void)
+{
+    if (MQTT_TLS_RESUMPTION) {
+        // Our own transport so reconnects can resume the TLS session; it
+        // verifies the broker against the same certificate bundle.
+        s_mqtt_transport = garage_tls_transport_create();
+        ensure(s_mqtt_transport != NULL, "Failed to create MQTT TLS transport");
+        garage_tls_transport_set_plain(s_mqtt_transport,
+                                       strncmp(garage_broker_active_uri(&s_brokers), "mqtt://", 7) == 0);
+    }
+
+    garage_keepalive_init(&s_keepalive, MQTT_KEEPALIVE_S, MQTT_KEEPALIVE_MIN_S, MQTT_KEEPALIVE_MAX_S);
+    if (s_rtc_keepalive.magic == MQTT_KEEPALIVE_RTC_MAGIC &&
+        garage_keepalive_restore(&s_keepalive, s_rtc_keepalive.keepalive_s, s_rtc_keepalive.ceiling_s)) {
+        ESP_LOGI(TAG, "MQTT keepalive %" PRIu32 " s learned before restart", s_keepalive.keepalive_s);
+    }
+    esp_mqtt_client_config_t mqtt_cfg;
+    mqtt_fill_config(&mqtt_cfg, garage_broker_active_uri(&s_brokers), s_keepalive.keepalive_s);
+    const esp_timer_create_args_t probe_timer_args = {
+        .callback = keepalive_probe_timer_callback,
+        .name = "mqtt_keepalive",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&probe_timer_args, &s_keepalive_probe_timer));
+
+    garage_backoff_init(&s_mqtt_backoff, RECONNECT_BASE_MS, RECONNECT_MAX_MS);
+    const esp_timer_create_args_t retry_timer_args = {
+        .callback = mqtt_retry_timer_callback,
+        .name = "mqtt_retry",
     };
+    ESP_ERROR_CHECK(esp_timer_create(&retry_timer_args, &s_mqtt_retry_timer));
+
+    esp_mqtt_client_handle_t client = esp_mqtt_client_init(&mqtt_cfg);
+    ensure(client != NULL, "Failed to create MQTT client");
+
+    if (s_brokers.count > 1) {
+        const esp_timer_create_args_t check_timer_args = {
+            .callback = broker_check_timer_callback,
+            .name = "broker_check",
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&check_timer_args, &s_broker_check_timer));
+        ESP_ERROR_CHECK(esp_timer_start_periodic(s_broker_check_timer, (uint64_t)BROKER_CHECK_PERIOD_MS * 1000));
+    }
+
+    if (COMMAND_AGE_CHECK) {
+        // Wall clock for command_is_stale(); syncs once the station is up.
+        esp_sntp_config_t sntp_cfg = ESP_NETIF_SNTP_DEFAULT_CONFIG(SNTP_SERVER);
+        esp_err_t err = esp_netif_sntp_init(&sntp_cfg);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "SNTP init failed: %s; command age checks disabled", esp_err_to_name(err));
+        }
+    }
 
-    s_mqtt_client = esp_mqtt_client_init(&mqtt_cfg);
-    ensure(s_mqtt_client != NULL, "Failed to create MQTT client");
+    ESP_ERROR_CHECK(esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL));
+    // Published only once the handler is in place: the IP event may call
+    // mqtt_start_once() as soon as it sees the client.
+    s_mqtt_client = client;
 
-    ESP_ERROR_CHECK(esp_mqtt_client_register_event(s_mqtt_client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL));
-    ESP_ERROR_CHECK(esp_mqtt_client_start(s_mqtt_client));
+    if (xEventGroupGetBits(s_connection_event_group) & WIFI_CONNECTED_BIT) {
+        mqtt_start_once();
+    }
+}
+
+static void mqtt_retry_timer_callback(void *arg)
+{
+    if (!(xEventGroupGetBits(s_connection_event_group) & WIFI_CONNECTED_BIT)) {
+        return;
+    }
+    garage_metrics_count(GARAGE_COUNTER_MQTT_RETRIES, 1);
+    esp_err_t err = esp_mqtt_client_reconnect(s_mqtt_client);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "MQTT reconnect failed: %s", esp_err_to_name(err));
+    }
+}
+
+// Called from both app_main and the IP event, whichever sees the client and
+// the address last; the client reconnects on its own afterwards.
+static void mqtt_start_once(void)
+{
+    if (!s_mqtt_client || atomic_exchange(&s_mqtt_started, true)) {
+        return;
+    }
+    esp_err_t err = esp_mqtt_client_start(s_mqtt_client);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start MQTT client: %s", esp_err_to_name(err));
+        atomic_store(&s_mqtt_started, false);
+    }
 }
 
 void app_main(void)
@@ -1016,13 +2247,24 @@ void app_main(void)
     }
     ESP_ERROR_CHECK(ret);
 
-    garage_config_load();
+    int64_t config_start_us = esp_timer_get_time();
+    ret = garage_config_load(&s_config);
+    ensure(ret == ESP_OK, "Failed to load garage config from NVS");
+    ESP_LOGI(TAG, "Loaded garage config for device '%s' in %" PRId64 " us (min free heap %" PRIu32 " bytes)",
+             s_config.device_id, esp_timer_get_time() - config_start_us, esp_get_minimum_free_heap_size());
 
+#if STATIC_ALLOCATION
+    s_connection_event_group = xEventGroupCreateStatic(RTOS_STORAGE(connection_event_group));
+#else
     s_connection_event_group = xEventGroupCreate();
+#endif
     ensure(s_connection_event_group != NULL, "Failed to create connection event group");
 
-    s_control_queue = xQueueCreate(10, sizeof(control_message_t));
-    ensure(s_control_queue != NULL, "Failed to create control queue");
+    s_control_high_queue = rtos_queue_create(CONTROL_HIGH_QUEUE_LEN, RTOS_BUFFER(control_high_storage),
+                                             RTOS_STORAGE(control_high_queue));
+    s_control_low_queue = rtos_queue_create(CONTROL_LOW_QUEUE_LEN, RTOS_BUFFER(control_low_storage),
+                                            RTOS_STORAGE(control_low_queue));
+    ensure(s_control_high_queue != NULL && s_control_low_queue != NULL, "Failed to create control queues");
 
     if (s_config.relay_active_high) {
         s_relay_active_level = 1;
@@ -1042,6 +2284,27 @@ void app_main(void)
     ESP_ERROR_CHECK(gpio_config(&relay_conf));
     ESP_ERROR_CHECK(gpio_set_level(s_config.relay_gpio, s_relay_inactive_level));
 
+    snprintf(s_command_topic, sizeof(s_command_topic), "garage/%s/command", s_config.device_id);
+    snprintf(s_state_topic, sizeof(s_state_topic), "garage/%s/state", s_config.device_id);
+    snprintf(s_metrics_topic, sizeof(s_metrics_topic), "garage/%s/metrics", s_config.device_id);
+    snprintf(s_result_topic, sizeof(s_result_topic), "garage/%s/result", s_config.device_id);
+    snprintf(s_status_topic, sizeof(s_status_topic), "garage/%s/status", s_config.device_id);
+    ensure(garage_broker_list_init(&s_brokers, s_config.mqtt_host, s_config.mqtt_port) > 0,
+           "No usable MQTT broker in mqtt_host");
+    for (size_t i = 0; i < s_brokers.count; ++i) {
+        ESP_LOGI(TAG, "MQTT broker %u: %s", (unsigned)i, s_brokers.brokers[i].uri);
+    }
+    ensure(garage_publish_init(s_config.device_id, s_state_topic, s_metrics_topic, s_result_topic,
+                               STATE_PUBLISH_WINDOW_MS),
+           "Device id too long for publish templates");
+    garage_ota_boot_init(OTA_VALIDATE_TIMEOUT_S);
+    garage_dedupe_init(REQUEST_DEDUPE_TTL_S * 1000);
+    garage_reassembly_init(&s_command_reassembly, s_command_buffer, sizeof(s_command_buffer));
+
+    // Association takes the longest, so start it as soon as the relay is in
+    // a safe state and finish the remaining setup while it runs.
+    wifi_init_sta();
+
     if (s_config.status_led_gpio >= 0) {
         gpio_config_t led_conf = {
             .pin_bit_mask = 1ULL << s_config.status_led_gpio,
@@ -1054,18 +2317,74 @@ void app_main(void)
         ESP_ERROR_CHECK(gpio_set_level(s_config.status_led_gpio, 0));
     }
 
+    const esp_timer_create_args_t pulse_timer_args = {
+        .callback = relay_pulse_timer_callback,
+        .name = "relay_pulse",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&pulse_timer_args, &s_relay_pulse_timer));
+    const esp_timer_create_args_t rollout_timer_args = {
+        .callback = ota_rollout_timer_callback,
+        .name = "ota_rollout",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&rollout_timer_args, &s_ota_rollout_timer));
+    const esp_timer_create_args_t outbox_timer_args = {
+        .callback = outbox_retry_timer_callback,
+        .name = "outbox_retry",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&outbox_timer_args, &s_outbox_retry_timer));
+
+    garage_control_init(s_config.relay_pulse_ms, s_config.debounce_ms);
     apply_debounce_timer_config();
     apply_heartbeat_timer_config();
 
-    BaseType_t task_created = xTaskCreate(control_task, "control_task", 4096, NULL, 5, NULL);
+    if (METRICS_INTERVAL_S > 0) {
+        s_metrics_timer = rtos_timer_create("metrics", pdMS_TO_TICKS(METRICS_INTERVAL_S * 1000), true,
+                                            metrics_timer_callback, RTOS_STORAGE(metrics_timer));
+        ensure(s_metrics_timer != NULL, "Failed to create metrics timer");
+        xTimerStart(s_metrics_timer, 0);
+    }
+
+    s_config_flush_timer = rtos_timer_create("cfg_flush", pdMS_TO_TICKS(CONFIG_FLUSH_DELAY_MS), false,
+                                             config_flush_timer_callback, RTOS_STORAGE(config_flush_timer));
+    ensure(s_config_flush_timer != NULL, "Failed to create config flush timer");
+
+    // The period is set each time the window is armed.
+    s_state_window_timer = rtos_timer_create("state_win", 1, false, state_window_timer_callback,
+                                             RTOS_STORAGE(state_window_timer));
+    ensure(s_state_window_timer != NULL, "Failed to create state window timer");
+
+#if STATIC_ALLOCATION
+    s_control_task = xTaskCreateStatic(control_task, "control_task", CONTROL_TASK_STACK_SIZE, NULL, 5,
+                                       RTOS_BUFFER(control_task_stack), RTOS_STORAGE(control_task));
+    ensure(s_control_task != NULL, "Failed to create control task");
+#else
+    BaseType_t task_created =
+        xTaskCreate(control_task, "control_task", CONTROL_TASK_STACK_SIZE, NULL, 5, &s_control_task);
     ensure(task_created == pdPASS, "Failed to create control task");
+#endif
+#if STATIC_ALLOCATION
+    s_ota_task = xTaskCreateStatic(ota_task, "ota_task", OTA_TASK_STACK_SIZE, NULL, OTA_TASK_PRIORITY,
+                                   RTOS_BUFFER(ota_task_stack), RTOS_STORAGE(ota_task));
+    ensure(s_ota_task != NULL, "Failed to create OTA task");
+#else
+    task_created = xTaskCreate(ota_task, "ota_task", OTA_TASK_STACK_SIZE, NULL, OTA_TASK_PRIORITY, &s_ota_task);
+    ensure(task_created == pdPASS, "Failed to create OTA task");
+#endif
+
+    if (LOCAL_API) {
+        const garage_local_api_config_t local_api_config = {
+            .port = LOCAL_API_PORT,
+            .username = s_config.mqtt_username,
+            .password = s_config.mqtt_password,
+            .open = local_api_open,
+        };
+        esp_err_t local_err = garage_local_api_start(&local_api_config);
+        if (local_err != ESP_OK) {
+            ESP_LOGW(TAG, "Local API not started: %s", esp_err_to_name(local_err));
+        }
+    }
 
-    snprintf(s_command_topic, sizeof(s_command_topic), "garage/%s/command", s_config.device_id);
-    snprintf(s_state_topic, sizeof(s_state_topic), "garage/%s/state", s_config.device_id);
-    snprintf(s_mqtt_uri, sizeof(s_mqtt_uri), "mqtts://%s:%d", s_config.mqtt_host, s_config.mqtt_port);
-
-    wifi_init_sta();
-    mqtt_start();
+    mqtt_prepare();
 
     control_post(CONTROL_CMD_PUBLISH_STATE_SNAPSHOT);
 }
@@ -0,0 +1,173 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "garage_command.h"
+#include "garage_control.h"
+#include "garage_dedupe.h"
+#include "garage_publish.h"
+#include "host_hal.h"
+
+/*
+ * Command path throughput and command-to-GPIO latency on the host: each
+ * event is tokenized, deduplicated and dispatched the way main.c does it
+ * (without the FreeRTOS queue hop), against the recording GPIO shim and
+ * the fake broker. Opens are timed from payload arrival to the relay edge;
+ * config updates and heartbeats until they return.
+ *
+ *   bench_command_latency [events]
+ */
+#define DEFAULT_EVENTS 100000
+#define RELAY_PULSE_MS 500
+#define DEBOUNCE_MS 2000
+
+typedef enum {
+    EVENT_OPEN = 0,
+    EVENT_CONFIG,
+    EVENT_HEARTBEAT,
+    EVENT_COUNT,
+} event_kind_t;
+
+static const char *const s_event_names[EVENT_COUNT] = {"open", "config_update", "heartbeat"};
+
+typedef struct {
+    uint64_t *samples;
+    size_t count;
+} series_t;
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(const series_t *series, unsigned pct)
+{
+    if (series->count == 0) {
+        return 0;
+    }
+    size_t index = (series->count * pct + 99) / 100;
+    return series->samples[index > 0 ? index - 1 : 0];
+}
+
+static void dispatch(const char *payload, size_t len)
+{
+    command_fields_t fields;
+    if (!garage_command_tokenize(payload, len, &fields) || fields.fields[COMMAND_FIELD_TYPE].kind != COMMAND_VALUE_STRING) {
+        return;
+    }
+    const command_value_t *request = &fields.fields[COMMAND_FIELD_REQUEST_ID];
+    char request_id[GARAGE_REQUEST_ID_MAX_LEN + 1] = "";
+    if (request->kind == COMMAND_VALUE_STRING && garage_dedupe_id_is_valid(request->text.ptr, request->text.len)) {
+        memcpy(request_id, request->text.ptr, request->text.len);
+        request_id[request->text.len] = '\0';
+        if (garage_dedupe_check_and_insert(request_id, request->text.len, garage_hal_now_us())) {
+            garage_publish_result(request_id, "duplicate", NULL);
+            return;
+        }
+    }
+
+    switch (garage_command_type_lookup(fields.fields[COMMAND_FIELD_TYPE].text)) {
+        case COMMAND_TYPE_OPEN: {
+            garage_open_result_t result = garage_control_open();
+            garage_publish_result(request_id, result == GARAGE_OPEN_TRIGGERED ? "executed" : "refused",
+                                  garage_open_result_to_string(result));
+            break;
+        }
+        case COMMAND_TYPE_CONFIG_UPDATE: {
+            const command_value_t *debounce = &fields.fields[COMMAND_FIELD_DEBOUNCE_MS];
+            if (debounce->kind == COMMAND_VALUE_NUMBER && debounce->number >= 0) {
+                garage_control_set_debounce_ms(debounce->number);
+            }
+            garage_publish_result(request_id, "applied", NULL);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    size_t events = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_EVENTS;
+    if (events < EVENT_COUNT) {
+        events = EVENT_COUNT;
+    }
+
+    host_hal_reset();
+    garage_publish_init("bench", "garage/bench/state", "garage/bench/metrics", "garage/bench/result", 0);
+    garage_control_init(RELAY_PULSE_MS, DEBOUNCE_MS);
+    garage_dedupe_init(60000);
+
+    series_t series[EVENT_COUNT];
+    for (int kind = 0; kind < EVENT_COUNT; ++kind) {
+        series[kind].samples = calloc(events, sizeof(uint64_t));
+        series[kind].count = 0;
+        if (!series[kind].samples) {
+            return 1;
+        }
+    }
+
+    char payload[192];
+    uint64_t busy_ns = 0;
+    uint32_t missed_edges = 0;
+    for (size_t i = 0; i < events; ++i) {
+        // Mostly opens, as on a real opener; one event in eight is a
+        // config update and one in eight a heartbeat tick.
+        event_kind_t kind = i % 8 == 7 ? EVENT_HEARTBEAT : i % 4 == 3 ? EVENT_CONFIG : EVENT_OPEN;
+        int len = 0;
+        if (kind == EVENT_OPEN) {
+            len = snprintf(payload, sizeof(payload), "{\"type\":\"open\",\"requestId\":\"bench-%zu\"}", i);
+        } else if (kind == EVENT_CONFIG) {
+            len = snprintf(payload, sizeof(payload),
+                           "{\"type\":\"config_update\",\"debounceMs\":%d,\"requestId\":\"cfg-%zu\"}", DEBOUNCE_MS, i);
+        }
+
+        uint32_t edges = host_gpio_edge_count();
+        uint64_t start_ns = host_hal_mono_ns();
+        if (kind == EVENT_HEARTBEAT) {
+            garage_control_publish_heartbeat();
+        } else {
+            dispatch(payload, (size_t)len);
+        }
+        uint64_t end_ns = host_hal_mono_ns();
+        busy_ns += end_ns - start_ns;
+
+        uint64_t latency_ns = end_ns - start_ns;
+        if (kind == EVENT_OPEN) {
+            const host_gpio_edge_t *press = NULL;
+            for (uint32_t back = 0; back < host_gpio_edge_count() - edges; ++back) {
+                const host_gpio_edge_t *edge = host_gpio_edge(back);
+                if (edge && edge->pin == HOST_GPIO_RELAY && edge->level) {
+                    press = edge;
+                }
+            }
+            if (!press) {
+                ++missed_edges;
+                continue;
+            }
+            latency_ns = press->mono_ns - start_ns;
+            // Let the pulse and the cooldown run out so the next open fires.
+            host_hal_advance_ms(RELAY_PULSE_MS + DEBOUNCE_MS);
+        }
+        series[kind].samples[series[kind].count++] = latency_ns;
+    }
+
+    printf("command path: %zu events in %.1f ms busy, %.0f events/s\n", events, busy_ns / 1e6,
+           busy_ns > 0 ? events * 1e9 / (double)busy_ns : 0.0);
+    for (int kind = 0; kind < EVENT_COUNT; ++kind) {
+        qsort(series[kind].samples, series[kind].count, sizeof(uint64_t), compare_u64);
+        printf("  %-14s n=%-7zu p50 %6" PRIu64 " ns  p99 %6" PRIu64 " ns  max %7" PRIu64 " ns\n", s_event_names[kind],
+               series[kind].count, percentile(&series[kind], 50), percentile(&series[kind], 99),
+               series[kind].count ? series[kind].samples[series[kind].count - 1] : 0);
+        free(series[kind].samples);
+    }
+    printf("  broker messages: %" PRIu32 "\n", host_broker_publish_count());
+    if (missed_edges > 0) {
+        fprintf(stderr, "%" PRIu32 " open(s) did not reach the relay\n", missed_edges);
+        return 1;
+    }
+    return 0;
+}
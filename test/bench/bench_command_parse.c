@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cJSON.h"
+#include "garage_command.h"
+#include "host_hal.h"
+
+/*
+ * Command parsing cost: the previous path (NUL-terminated heap copy,
+ * cJSON_Parse, field lookups, cJSON_Delete) against garage_command_tokenize()
+ * on the same payloads. Reports ns/op and heap allocations per op.
+ *
+ *   bench_command_parse [iterations]
+ */
+#define DEFAULT_ITERATIONS 200000
+
+static const char *const s_payloads[] = {
+    "{\"type\":\"open\",\"requestId\":\"6f1c2a4e-0b7d-4d55-9a51-1f2e3d4c5b6a\",\"timestamp\":1700000000123}",
+    "{\"type\":\"config_update\",\"debounceMs\":1500,\"relayPulseMs\":250,\"heartbeatIntervalS\":3600}",
+    "{\"type\":\"ota\",\"tag\":\"v1.4.0\",\"asset\":\"firmware.bin\",\"rolloutWindowS\":600,\"canaryPercent\":10}",
+};
+#define PAYLOAD_COUNT (sizeof(s_payloads) / sizeof(s_payloads[0]))
+
+static volatile int s_sink;
+
+static void parse_with_cjson(const char *data, size_t len)
+{
+    char *copy = malloc(len + 1);
+    if (!copy) {
+        return;
+    }
+    memcpy(copy, data, len);
+    copy[len] = '\0';
+    cJSON *root = cJSON_Parse(copy);
+    free(copy);
+    if (!root) {
+        return;
+    }
+    const cJSON *type = cJSON_GetObjectItemCaseSensitive(root, "type");
+    const cJSON *debounce = cJSON_GetObjectItemCaseSensitive(root, "debounceMs");
+    const cJSON *request = cJSON_GetObjectItemCaseSensitive(root, "requestId");
+    s_sink += (cJSON_IsString(type) ? type->valuestring[0] : 0) + (cJSON_IsNumber(debounce) ? debounce->valueint : 0) +
+              (cJSON_IsString(request) ? 1 : 0);
+    cJSON_Delete(root);
+}
+
+static void parse_with_tokenizer(const char *data, size_t len)
+{
+    command_fields_t fields;
+    if (!garage_command_tokenize(data, len, &fields)) {
+        return;
+    }
+    s_sink += (int)garage_command_type_lookup(fields.fields[COMMAND_FIELD_TYPE].text) +
+              fields.fields[COMMAND_FIELD_DEBOUNCE_MS].number +
+              (fields.fields[COMMAND_FIELD_REQUEST_ID].kind == COMMAND_VALUE_STRING ? 1 : 0);
+}
+
+static void run(const char *name, void (*parse)(const char *, size_t), size_t iterations)
+{
+    size_t lens[PAYLOAD_COUNT];
+    for (size_t i = 0; i < PAYLOAD_COUNT; ++i) {
+        lens[i] = strlen(s_payloads[i]);
+    }
+
+    host_heap_stats_t before;
+    host_heap_stats_t after;
+    host_heap_reset_peak();
+    host_heap_snapshot(&before);
+    uint64_t start_ns = host_hal_mono_ns();
+    for (size_t i = 0; i < iterations; ++i) {
+        parse(s_payloads[i % PAYLOAD_COUNT], lens[i % PAYLOAD_COUNT]);
+    }
+    uint64_t elapsed_ns = host_hal_mono_ns() - start_ns;
+    host_heap_snapshot(&after);
+
+    printf("  %-10s %8.1f ns/op  %6.2f allocs/op  peak %6zu B\n", name, (double)elapsed_ns / (double)iterations,
+           (double)(after.allocations - before.allocations) / (double)iterations, after.peak_bytes - before.live_bytes);
+}
+
+int main(int argc, char **argv)
+{
+    size_t iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_ITERATIONS;
+    if (iterations == 0) {
+        iterations = 1;
+    }
+
+    printf("command parse: %zu payloads\n", iterations);
+    run("cJSON", parse_with_cjson, iterations);
+    run("tokenizer", parse_with_tokenizer, iterations);
+    return 0;
+}
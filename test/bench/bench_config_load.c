@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "garage_config.h"
+#include "host_hal.h"
+#include "nvs.h"
+
+/*
+ * Boot-time config load: the first boot, which parses the JSON config and
+ * migrates it, against every later boot, which reads the binary record.
+ * Reports ns/load, allocations per load and the heap high-water mark.
+ *
+ *   bench_config_load [loads]
+ */
+#define DEFAULT_LOADS 20000
+
+static const char *const s_json =
+    "{\"CONFIG_GARAGE_WIFI_SSID\":\"garage-net\",\"CONFIG_GARAGE_WIFI_PASSWORD\":\"secret-passphrase\","
+    "\"CONFIG_GARAGE_DEVICE_ID\":\"garage-esp32c6\",\"CONFIG_GARAGE_MQTT_HOST\":\"broker.example,backup.example:8884\","
+    "\"CONFIG_GARAGE_MQTT_PORT\":8883,\"CONFIG_GARAGE_MQTT_USERNAME\":\"garage\","
+    "\"CONFIG_GARAGE_MQTT_PASSWORD\":\"mqtt-password\",\"CONFIG_GARAGE_RELAY_GPIO\":2,"
+    "\"CONFIG_GARAGE_STATUS_LED_GPIO\":1,\"CONFIG_GARAGE_RELAY_ACTIVE_HIGH\":\"y\","
+    "\"CONFIG_GARAGE_RELAY_PULSE_MS\":500,\"CONFIG_GARAGE_DEBOUNCE_MS\":30000,"
+    "\"CONFIG_GARAGE_HEARTBEAT_INTERVAL_S\":3600,\"CONFIG_GARAGE_OTA_REPO_OWNER\":\"owner\","
+    "\"CONFIG_GARAGE_OTA_REPO_NAME\":\"garage-firmware\"}";
+
+static nvs_handle_t s_handle;
+
+static void forget_record(void)
+{
+    nvs_erase_key(s_handle, "config_bin");
+}
+
+static void keep_record(void)
+{
+}
+
+static int run(const char *name, void (*prepare)(void), size_t loads)
+{
+    garage_config_t config;
+    host_heap_stats_t before;
+    host_heap_stats_t after;
+    uint64_t elapsed_ns = 0;
+    host_heap_reset_peak();
+    host_heap_snapshot(&before);
+    for (size_t i = 0; i < loads; ++i) {
+        prepare();
+        uint64_t start_ns = host_hal_mono_ns();
+        esp_err_t err = garage_config_load(&config);
+        elapsed_ns += host_hal_mono_ns() - start_ns;
+        if (err != ESP_OK) {
+            fprintf(stderr, "%s load failed: %s\n", name, esp_err_to_name(err));
+            return 1;
+        }
+    }
+    host_heap_snapshot(&after);
+
+    printf("  %-7s %9.1f ns/load  %6.2f allocs/load  peak %6zu B\n", name, (double)elapsed_ns / (double)loads,
+           (double)(after.allocations - before.allocations) / (double)loads, after.peak_bytes - before.live_bytes);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    size_t loads = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_LOADS;
+    if (loads == 0) {
+        loads = 1;
+    }
+
+    host_hal_reset();
+    host_nvs_init(NULL);
+    if (nvs_open(GARAGE_CONFIG_NAMESPACE, NVS_READWRITE, &s_handle) != ESP_OK ||
+        nvs_set_str(s_handle, "config", s_json) != ESP_OK) {
+        return 1;
+    }
+
+    printf("config load: %zu loads per path\n", loads);
+    int failed = run("json", forget_record, loads);
+    failed |= run("binary", keep_record, loads);
+    nvs_close(s_handle);
+    return failed;
+}
@@ -0,0 +1,128 @@
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "cJSON.h"
+#include "garage_json_arena.h"
+#include "host_hal.h"
+
+/*
+ * cJSON on the shared heap against cJSON in a per-message arena
+ * (garage_json_arena.h). Each operation parses one payload, reads a few
+ * fields and frees the tree, while a ring of longer-lived blocks of mixed
+ * sizes churns next to it the way other tasks' buffers do on the device.
+ * Each allocator runs in its own process so they start from the same heap;
+ * after the soak, the free bytes left in holes below the top of the heap
+ * (glibc mallinfo2) show how much the short-lived cJSON nodes fragmented it.
+ *
+ *   bench_json_arena [operations]
+ */
+#define DEFAULT_OPERATIONS 1000000
+#define ARENA_SIZE 4096
+#define CHURN_SLOTS 64
+
+static const char *const s_payloads[] = {
+    "{\"type\":\"open\",\"requestId\":\"6f1c2a4e-0b7d-4d55-9a51-1f2e3d4c5b6a\",\"timestamp\":1700000000123}",
+    "{\"type\":\"config_update\",\"debounceMs\":1500,\"relayPulseMs\":250,\"heartbeatIntervalS\":3600}",
+    "{\"type\":\"ota\",\"tag\":\"v1.4.0\",\"asset\":\"firmware.bin\",\"rolloutWindowS\":600,\"canaryPercent\":10}",
+    "{\"CONFIG_GARAGE_WIFI_SSID\":\"garage-net\",\"CONFIG_GARAGE_DEVICE_ID\":\"garage-esp32c6\","
+    "\"CONFIG_GARAGE_MQTT_HOST\":\"broker.example,backup.example:8884\",\"CONFIG_GARAGE_MQTT_PORT\":8883,"
+    "\"CONFIG_GARAGE_RELAY_GPIO\":2,\"CONFIG_GARAGE_RELAY_ACTIVE_HIGH\":\"y\",\"CONFIG_GARAGE_DEBOUNCE_MS\":30000}",
+};
+#define PAYLOAD_COUNT (sizeof(s_payloads) / sizeof(s_payloads[0]))
+
+static volatile int s_sink;
+static void *s_churn[CHURN_SLOTS];
+static uint32_t s_seed = 1;
+
+static void parse_fields(const char *json)
+{
+    cJSON *root = cJSON_Parse(json);
+    if (!root) {
+        return;
+    }
+    const cJSON *type = cJSON_GetObjectItemCaseSensitive(root, "type");
+    const cJSON *debounce = cJSON_GetObjectItemCaseSensitive(root, "debounceMs");
+    s_sink += (cJSON_IsString(type) ? type->valuestring[0] : 0) + (cJSON_IsNumber(debounce) ? debounce->valueint : 0);
+    cJSON_Delete(root);
+}
+
+static void parse_on_heap(const char *json)
+{
+    parse_fields(json);
+}
+
+static void parse_in_arena(const char *json)
+{
+    static uint8_t buffer[ARENA_SIZE];
+    garage_json_arena_t arena;
+    garage_json_arena_begin(&arena, buffer, sizeof(buffer));
+    parse_fields(json);
+    garage_json_arena_end(&arena);
+}
+
+static void churn(void)
+{
+    s_seed = s_seed * 1103515245u + 12345u;
+    unsigned slot = (s_seed >> 16) % CHURN_SLOTS;
+    free(s_churn[slot]);
+    s_churn[slot] = malloc(16 + (s_seed >> 8) % 240);
+}
+
+static int run(const char *name, void (*parse)(const char *), size_t operations)
+{
+    host_heap_stats_t before;
+    host_heap_stats_t after;
+    uint64_t busy_ns = 0;
+    host_heap_snapshot(&before);
+    for (size_t i = 0; i < operations; ++i) {
+        uint64_t start_ns = host_hal_mono_ns();
+        parse(s_payloads[i % PAYLOAD_COUNT]);
+        busy_ns += host_hal_mono_ns() - start_ns;
+        churn();
+    }
+    host_heap_snapshot(&after);
+
+    uint64_t churn_allocs = operations;
+    struct mallinfo2 info = mallinfo2();
+    // Free space below the top chunk is what later allocations have to fit into.
+    size_t stranded = info.fordblks - info.keepcost;
+    printf("  %-6s %7.1f ns/op  %6.2f allocs/op  %6zu B in use, %6zu B free in holes\n", name,
+           (double)busy_ns / (double)operations,
+           (double)(after.allocations - before.allocations - churn_allocs) / (double)operations, info.uordblks,
+           stranded);
+    return 0;
+}
+
+static int run_isolated(const char *name, void (*parse)(const char *), size_t operations)
+{
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+        int failed = run(name, parse, operations);
+        fflush(stdout);
+        _exit(failed);
+    }
+    int status = 0;
+    if (child < 0 || waitpid(child, &status, 0) != child) {
+        return 1;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+int main(int argc, char **argv)
+{
+    size_t operations = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_OPERATIONS;
+    if (operations == 0) {
+        operations = 1;
+    }
+
+    printf("cJSON allocator: %zu operations, %d churning blocks\n", operations, CHURN_SLOTS);
+    int failed = run_isolated("heap", parse_on_heap, operations);
+    failed |= run_isolated("arena", parse_in_arena, operations);
+    return failed;
+}
@@ -0,0 +1,177 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "garage_command.h"
+#include "garage_control.h"
+#include "garage_dedupe.h"
+#include "garage_publish.h"
+#include "host_hal.h"
+
+/*
+ * LAN against cloud opens, device side. Both paths end in the same
+ * control_task open; what differs before it is the entry point:
+ *
+ *   cloud  MQTT payload -> garage_command_tokenize -> requestId dedupe
+ *   lan    ?requestId= query value -> id validation -> requestId dedupe,
+ *          after a constant-time compare of the Authorization header
+ *
+ * Each open is timed from arrival to the relay edge on the host HAL, and
+ * the "executed" result is published to the fake broker in both cases.
+ * esp_http_server and the network are not part of the host build: the
+ * device-side numbers show what the firmware adds, and the network legs
+ * (one LAN hop against client -> broker -> device over the WAN) are
+ * measured on hardware as described in example.md.
+ *
+ *   bench_local_api [opens]
+ */
+#define DEFAULT_OPENS 100000
+#define RELAY_PULSE_MS 500
+#define DEBOUNCE_MS 2000
+// "Basic " + base64 of a 64-byte username and a 64-byte password.
+#define AUTH_LEN 178
+
+typedef enum {
+    PATH_CLOUD = 0,
+    PATH_LAN,
+    PATH_COUNT,
+} path_t;
+
+static const char *const s_path_names[PATH_COUNT] = {"cloud", "lan"};
+static char s_expected_auth[AUTH_LEN + 1];
+static char s_auth[AUTH_LEN + 1];
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Same shape as the compare in garage_local_api.c.
+static bool auth_matches(const char *value, size_t len)
+{
+    unsigned char diff = len != AUTH_LEN;
+    for (size_t i = 0; i < AUTH_LEN; ++i) {
+        diff |= (unsigned char)(value[i < len ? i : 0] ^ s_expected_auth[i]);
+    }
+    return diff == 0;
+}
+
+static void open_with_id(const char *request_id, size_t len)
+{
+    if (len > 0 && garage_dedupe_check_and_insert(request_id, len, garage_hal_now_us())) {
+        garage_publish_result(request_id, "duplicate", NULL);
+        return;
+    }
+    garage_open_result_t result = garage_control_open();
+    garage_publish_result(request_id, result == GARAGE_OPEN_TRIGGERED ? "executed" : "refused",
+                          garage_open_result_to_string(result));
+}
+
+static void arrive_cloud(const char *payload, size_t len)
+{
+    command_fields_t fields;
+    if (!garage_command_tokenize(payload, len, &fields) || fields.fields[COMMAND_FIELD_TYPE].kind != COMMAND_VALUE_STRING ||
+        garage_command_type_lookup(fields.fields[COMMAND_FIELD_TYPE].text) != COMMAND_TYPE_OPEN) {
+        return;
+    }
+    const command_value_t *request = &fields.fields[COMMAND_FIELD_REQUEST_ID];
+    char request_id[GARAGE_REQUEST_ID_MAX_LEN + 1] = "";
+    if (request->kind == COMMAND_VALUE_STRING && garage_dedupe_id_is_valid(request->text.ptr, request->text.len)) {
+        memcpy(request_id, request->text.ptr, request->text.len);
+        request_id[request->text.len] = '\0';
+    }
+    open_with_id(request_id, strlen(request_id));
+}
+
+static void arrive_lan(const char *query, size_t len)
+{
+    if (!auth_matches(s_auth, AUTH_LEN)) {
+        return;
+    }
+    static const char key[] = "requestId=";
+    char request_id[GARAGE_REQUEST_ID_MAX_LEN + 1] = "";
+    if (len > sizeof(key) - 1 && memcmp(query, key, sizeof(key) - 1) == 0 &&
+        len - (sizeof(key) - 1) <= GARAGE_REQUEST_ID_MAX_LEN) {
+        memcpy(request_id, query + sizeof(key) - 1, len - (sizeof(key) - 1));
+        request_id[len - (sizeof(key) - 1)] = '\0';
+    }
+    size_t id_len = strlen(request_id);
+    if (id_len > 0 && !garage_dedupe_id_is_valid(request_id, id_len)) {
+        return;
+    }
+    open_with_id(request_id, id_len);
+}
+
+int main(int argc, char **argv)
+{
+    size_t opens = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_OPENS;
+    if (opens < PATH_COUNT) {
+        opens = PATH_COUNT;
+    }
+
+    host_hal_reset();
+    garage_publish_init("bench", "garage/bench/state", "garage/bench/metrics", "garage/bench/result", 0);
+    garage_control_init(RELAY_PULSE_MS, DEBOUNCE_MS);
+    garage_dedupe_init(60000);
+    memcpy(s_expected_auth, "Basic ", 6);
+    memset(s_expected_auth + 6, 'A', AUTH_LEN - 6);
+    memcpy(s_auth, s_expected_auth, sizeof(s_auth));
+
+    uint64_t *samples[PATH_COUNT];
+    size_t counts[PATH_COUNT] = {0};
+    for (int path = 0; path < PATH_COUNT; ++path) {
+        samples[path] = calloc(opens, sizeof(uint64_t));
+        if (!samples[path]) {
+            return 1;
+        }
+    }
+
+    char message[128];
+    uint32_t missed_edges = 0;
+    for (size_t i = 0; i < opens; ++i) {
+        path_t path = (path_t)(i % PATH_COUNT);
+        int len = path == PATH_CLOUD
+                      ? snprintf(message, sizeof(message), "{\"type\":\"open\",\"requestId\":\"cloud-%zu\"}", i)
+                      : snprintf(message, sizeof(message), "requestId=lan-%zu", i);
+
+        uint32_t edges = host_gpio_edge_count();
+        uint64_t start_ns = host_hal_mono_ns();
+        if (path == PATH_CLOUD) {
+            arrive_cloud(message, (size_t)len);
+        } else {
+            arrive_lan(message, (size_t)len);
+        }
+
+        const host_gpio_edge_t *press = NULL;
+        for (uint32_t back = 0; back < host_gpio_edge_count() - edges; ++back) {
+            const host_gpio_edge_t *edge = host_gpio_edge(back);
+            if (edge && edge->pin == HOST_GPIO_RELAY && edge->level) {
+                press = edge;
+            }
+        }
+        if (!press) {
+            ++missed_edges;
+            continue;
+        }
+        samples[path][counts[path]++] = press->mono_ns - start_ns;
+        host_hal_advance_ms(RELAY_PULSE_MS + DEBOUNCE_MS);
+    }
+
+    printf("local api: %zu opens, arrival to relay edge (device side only)\n", opens);
+    for (int path = 0; path < PATH_COUNT; ++path) {
+        qsort(samples[path], counts[path], sizeof(uint64_t), compare_u64);
+        size_t p50 = counts[path] / 2;
+        size_t p99 = counts[path] ? (counts[path] * 99 + 99) / 100 - 1 : 0;
+        printf("  %-6s n=%-7zu p50 %6" PRIu64 " ns  p99 %6" PRIu64 " ns\n", s_path_names[path], counts[path],
+               counts[path] ? samples[path][p50] : 0, counts[path] ? samples[path][p99] : 0);
+        free(samples[path]);
+    }
+    if (missed_edges > 0) {
+        fprintf(stderr, "%" PRIu32 " open(s) did not reach the relay\n", missed_edges);
+        return 1;
+    }
+    return 0;
+}
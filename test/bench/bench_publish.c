@@ -0,0 +1,126 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cJSON.h"
+#include "garage_control.h"
+#include "garage_publish.h"
+#include "host_hal.h"
+
+/*
+ * State and OTA status publishing: the previous path (cJSON tree,
+ * cJSON_PrintUnformatted, free) against the preformatted templates in
+ * garage_publish.c, both ending in the fake broker. Reports ns/op and heap
+ * allocations per publish; fails if a template publish allocates.
+ *
+ *   bench_publish [publishes]
+ */
+#define DEFAULT_PUBLISHES 200000
+#define DEVICE_ID "bench"
+#define STATE_TOPIC "garage/bench/state"
+
+typedef struct {
+    double ns_per_op;
+    double allocs_per_op;
+} result_t;
+
+static garage_state_t state_for(size_t i)
+{
+    // Alternate so the template path never skips an unchanged state.
+    return i % 2 ? GARAGE_STATE_TRIGGERING : GARAGE_STATE_LISTENING;
+}
+
+static void publish_json(cJSON *root)
+{
+    char *payload = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    if (payload) {
+        garage_hal_mqtt_publish(STATE_TOPIC, payload, strlen(payload), 1, false);
+        cJSON_free(payload);
+    }
+}
+
+static void state_with_cjson(size_t i)
+{
+    cJSON *root = cJSON_CreateObject();
+    if (!root) {
+        return;
+    }
+    cJSON_AddStringToObject(root, "type", "state");
+    cJSON_AddStringToObject(root, "state", garage_state_to_string(state_for(i)));
+    cJSON_AddStringToObject(root, "deviceId", DEVICE_ID);
+    cJSON_AddNumberToObject(root, "timestamp", (double)(garage_hal_now_us() / 1000));
+    cJSON_AddNumberToObject(root, "cooldownMs", 1500);
+    publish_json(root);
+}
+
+static void state_with_template(size_t i)
+{
+    garage_publish_state(GARAGE_PUBLISH_STATE, state_for(i), true, "cooldownMs", 1500);
+}
+
+static void ota_with_cjson(size_t i)
+{
+    cJSON *root = cJSON_CreateObject();
+    if (!root) {
+        return;
+    }
+    cJSON_AddStringToObject(root, "type", "ota");
+    cJSON_AddStringToObject(root, "status", "downloading");
+    cJSON_AddStringToObject(root, "deviceId", DEVICE_ID);
+    cJSON_AddNumberToObject(root, "timestamp", (double)(garage_hal_now_us() / 1000));
+    cJSON_AddStringToObject(root, "detail", "v1.4.0/firmware.bin");
+    publish_json(root);
+}
+
+static void ota_with_template(size_t i)
+{
+    garage_publish_ota_status("downloading", "v1.4.0/firmware.bin", NULL);
+}
+
+static result_t run(const char *name, void (*publish)(size_t), size_t publishes)
+{
+    host_heap_stats_t before;
+    host_heap_stats_t after;
+    uint32_t sent = host_broker_publish_count();
+    host_heap_snapshot(&before);
+    uint64_t start_ns = host_hal_mono_ns();
+    for (size_t i = 0; i < publishes; ++i) {
+        publish(i);
+    }
+    uint64_t elapsed_ns = host_hal_mono_ns() - start_ns;
+    host_heap_snapshot(&after);
+
+    result_t result = {
+        .ns_per_op = (double)elapsed_ns / (double)publishes,
+        .allocs_per_op = (double)(after.allocations - before.allocations) / (double)publishes,
+    };
+    printf("  %-14s %8.1f ns/op  %6.2f allocs/op  %" PRIu32 " sent\n", name, result.ns_per_op, result.allocs_per_op,
+           host_broker_publish_count() - sent);
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    size_t publishes = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_PUBLISHES;
+    if (publishes == 0) {
+        publishes = 1;
+    }
+
+    host_hal_reset();
+    if (!garage_publish_init(DEVICE_ID, STATE_TOPIC, "garage/bench/metrics", "garage/bench/result", 0)) {
+        return 1;
+    }
+
+    printf("publish: %zu messages per path\n", publishes);
+    run("state cJSON", state_with_cjson, publishes);
+    result_t state = run("state template", state_with_template, publishes);
+    run("ota cJSON", ota_with_cjson, publishes);
+    result_t ota = run("ota template", ota_with_template, publishes);
+    if (state.allocs_per_op > 0 || ota.allocs_per_op > 0) {
+        fprintf(stderr, "template publishes allocated\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "garage_control.h"
+#include "garage_publish.h"
+#include "host_hal.h"
+
+/*
+ * State snapshot cost with the door idle against with a relay pulse in
+ * flight. The pulse is timer driven, so both should match; a blocking
+ * pulse would show up here as a snapshot that waits for the relay.
+ *
+ *   bench_snapshot_latency [snapshots]
+ */
+#define DEFAULT_SNAPSHOTS 100000
+#define RELAY_PULSE_MS 500
+#define DEBOUNCE_MS 2000
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(const uint64_t *samples, size_t count, unsigned pct)
+{
+    size_t index = (count * pct + 99) / 100;
+    return samples[index > 0 ? index - 1 : 0];
+}
+
+static uint64_t timed_snapshot(void)
+{
+    uint64_t start_ns = host_hal_mono_ns();
+    garage_publish_forget_state();
+    garage_control_publish_snapshot();
+    return host_hal_mono_ns() - start_ns;
+}
+
+static void report(const char *name, uint64_t *samples, size_t count)
+{
+    qsort(samples, count, sizeof(uint64_t), compare_u64);
+    printf("  %-8s n=%-7zu p50 %6" PRIu64 " ns  p99 %6" PRIu64 " ns  max %7" PRIu64 " ns\n", name, count,
+           percentile(samples, count, 50), percentile(samples, count, 99), samples[count - 1]);
+}
+
+int main(int argc, char **argv)
+{
+    size_t snapshots = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_SNAPSHOTS;
+    if (snapshots == 0) {
+        snapshots = 1;
+    }
+
+    host_hal_reset();
+    garage_publish_init("bench", "garage/bench/state", "garage/bench/metrics", "garage/bench/result", 0);
+    garage_control_init(RELAY_PULSE_MS, DEBOUNCE_MS);
+
+    uint64_t *idle = calloc(snapshots, sizeof(uint64_t));
+    uint64_t *pulsing = calloc(snapshots, sizeof(uint64_t));
+    if (!idle || !pulsing) {
+        return 1;
+    }
+
+    for (size_t i = 0; i < snapshots; ++i) {
+        idle[i] = timed_snapshot();
+    }
+
+    // One snapshot per virtual millisecond of each pulse, then let the pulse
+    // and the cooldown run out before the next open.
+    size_t taken = 0;
+    unsigned late = 0;
+    while (taken < snapshots) {
+        if (garage_control_open() != GARAGE_OPEN_TRIGGERED) {
+            fprintf(stderr, "open refused\n");
+            return 1;
+        }
+        for (int ms = 1; ms < RELAY_PULSE_MS && taken < snapshots; ++ms) {
+            host_hal_advance_ms(1);
+            pulsing[taken++] = timed_snapshot();
+            if (garage_control_state() != GARAGE_STATE_TRIGGERING) {
+                ++late;
+            }
+        }
+        host_hal_advance_ms(RELAY_PULSE_MS + DEBOUNCE_MS);
+    }
+
+    printf("state snapshot: %zu per phase\n", snapshots);
+    report("idle", idle, snapshots);
+    report("pulsing", pulsing, snapshots);
+    free(idle);
+    free(pulsing);
+    if (late > 0) {
+        fprintf(stderr, "%u snapshot(s) taken after the pulse ended\n", late);
+        return 1;
+    }
+    return 0;
+}
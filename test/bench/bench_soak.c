@@ -0,0 +1,141 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "garage_command.h"
+#include "garage_control.h"
+#include "garage_dedupe.h"
+#include "garage_hal.h"
+#include "garage_publish.h"
+#include "host_hal.h"
+
+/*
+ * Heap soak for the static-allocation build: drives the command path the
+ * way bench_command_latency does (opens, config updates, duplicate request
+ * ids, heartbeats and metrics) and samples garage_hal_heap_stats() as the
+ * firmware's metrics publish would. After a warm-up, every event must run
+ * without touching the heap; any allocation fails the run.
+ *
+ * On the host the largest free block is reported as the free byte count,
+ * since the host heap model has no fragmentation of its own; on the device
+ * the same fields come from heap_caps_get_largest_free_block().
+ *
+ *   bench_soak [events]
+ */
+#define DEFAULT_EVENTS 1000000
+#define WARMUP_EVENTS 1000
+#define SAMPLE_EVERY 1000
+#define RELAY_PULSE_MS 500
+#define DEBOUNCE_MS 2000
+
+static void dispatch(const char *payload, size_t len)
+{
+    command_fields_t fields;
+    if (!garage_command_tokenize(payload, len, &fields) || fields.fields[COMMAND_FIELD_TYPE].kind != COMMAND_VALUE_STRING) {
+        return;
+    }
+    const command_value_t *request = &fields.fields[COMMAND_FIELD_REQUEST_ID];
+    char request_id[GARAGE_REQUEST_ID_MAX_LEN + 1] = "";
+    if (request->kind == COMMAND_VALUE_STRING && garage_dedupe_id_is_valid(request->text.ptr, request->text.len)) {
+        memcpy(request_id, request->text.ptr, request->text.len);
+        request_id[request->text.len] = '\0';
+        if (garage_dedupe_check_and_insert(request_id, request->text.len, garage_hal_now_us())) {
+            garage_publish_result(request_id, "duplicate", NULL);
+            return;
+        }
+    }
+
+    switch (garage_command_type_lookup(fields.fields[COMMAND_FIELD_TYPE].text)) {
+        case COMMAND_TYPE_OPEN: {
+            garage_open_result_t result = garage_control_open();
+            garage_publish_result(request_id, result == GARAGE_OPEN_TRIGGERED ? "executed" : "refused",
+                                  garage_open_result_to_string(result));
+            break;
+        }
+        case COMMAND_TYPE_CONFIG_UPDATE: {
+            const command_value_t *debounce = &fields.fields[COMMAND_FIELD_DEBOUNCE_MS];
+            if (debounce->kind == COMMAND_VALUE_NUMBER && debounce->number >= 0) {
+                garage_control_set_debounce_ms(debounce->number);
+            }
+            garage_publish_result(request_id, "applied", NULL);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static void run_event(size_t i)
+{
+    char payload[192];
+    int len = 0;
+    switch (i % 16) {
+        case 15:
+            garage_control_publish_heartbeat();
+            return;
+        case 11:
+            garage_publish_metrics();
+            return;
+        case 7:
+            len = snprintf(payload, sizeof(payload),
+                           "{\"type\":\"config_update\",\"debounceMs\":%d,\"requestId\":\"cfg-%zu\"}", DEBOUNCE_MS, i);
+            break;
+        case 3:
+            // Redelivery of the previous open.
+            len = snprintf(payload, sizeof(payload), "{\"type\":\"open\",\"requestId\":\"soak-%zu\"}", i - 1);
+            break;
+        default:
+            len = snprintf(payload, sizeof(payload), "{\"type\":\"open\",\"requestId\":\"soak-%zu\"}", i);
+            break;
+    }
+    dispatch(payload, (size_t)len);
+    host_hal_advance_ms(RELAY_PULSE_MS + DEBOUNCE_MS);
+}
+
+int main(int argc, char **argv)
+{
+    size_t events = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_EVENTS;
+
+    host_hal_reset();
+    garage_publish_init("bench", "garage/bench/state", "garage/bench/metrics", "garage/bench/result", 0);
+    garage_control_init(RELAY_PULSE_MS, DEBOUNCE_MS);
+    garage_dedupe_init(60000);
+
+    for (size_t i = 0; i < WARMUP_EVENTS; ++i) {
+        run_event(i);
+    }
+
+    host_heap_stats_t before;
+    host_heap_stats_t after;
+    host_heap_reset_peak();
+    host_heap_snapshot(&before);
+    uint32_t min_free = UINT32_MAX;
+    uint32_t min_largest = UINT32_MAX;
+    uint64_t start_ns = host_hal_mono_ns();
+    for (size_t i = 0; i < events; ++i) {
+        run_event(WARMUP_EVENTS + i);
+        if (i % SAMPLE_EVERY == 0 || i + 1 == events) {
+            uint32_t free_bytes;
+            uint32_t low_water;
+            uint32_t largest;
+            garage_hal_heap_stats(&free_bytes, &low_water, &largest);
+            min_free = low_water < min_free ? low_water : min_free;
+            min_largest = largest < min_largest ? largest : min_largest;
+        }
+    }
+    uint64_t elapsed_ns = host_hal_mono_ns() - start_ns;
+    host_heap_snapshot(&after);
+
+    uint64_t allocations = after.allocations - before.allocations;
+    printf("soak: %zu events in %.1f ms, %" PRIu32 " broker messages\n", events, elapsed_ns / 1e6,
+           host_broker_publish_count());
+    printf("  min free heap   %8" PRIu32 " B\n", min_free);
+    printf("  largest block   %8" PRIu32 " B (min)\n", min_largest);
+    printf("  allocations     %8" PRIu64 " after warm-up\n", allocations);
+    if (allocations > 0) {
+        fprintf(stderr, "steady state allocated %" PRIu64 " time(s)\n", allocations);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,334 @@
+#include "host_hal.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_err.h"
+#include "garage_broker.h"
+#include "garage_control.h"
+#include "garage_publish.h"
+
+#define HOST_CLOCK_START_US 1000000LL
+#define HOST_BROKER_RETAINED_MAX 8
+#define HOST_HEAP_SIZE (320u * 1024u)
+
+typedef enum {
+    HOST_TIMER_RELAY_PULSE = 0,
+    HOST_TIMER_DEBOUNCE,
+    HOST_TIMER_STATE_WINDOW,
+    HOST_TIMER_COUNT,
+} host_timer_t;
+
+typedef struct {
+    char topic[HOST_BROKER_TOPIC_LEN];
+    char payload[HOST_BROKER_PAYLOAD_LEN];
+} host_retained_t;
+
+static int64_t s_now_us;
+static int64_t s_deadline_us[HOST_TIMER_COUNT];  // -1 while idle
+
+static bool s_levels[2];
+static host_gpio_edge_t s_edges[HOST_GPIO_EDGES_MAX];
+static uint32_t s_edge_count;
+
+static bool s_connected;
+static uint32_t s_fail_next;
+static int s_next_msg_id;
+static host_broker_message_t s_log[HOST_BROKER_LOG_MAX];
+static uint32_t s_publish_count;
+static host_retained_t s_retained[HOST_BROKER_RETAINED_MAX];
+
+static garage_broker_list_t s_brokers;
+
+void host_hal_reset(void)
+{
+    s_now_us = HOST_CLOCK_START_US;
+    for (int timer = 0; timer < HOST_TIMER_COUNT; ++timer) {
+        s_deadline_us[timer] = -1;
+    }
+    memset(s_levels, 0, sizeof(s_levels));
+    s_edge_count = 0;
+    s_connected = true;
+    s_fail_next = 0;
+    s_next_msg_id = 1;
+    s_publish_count = 0;
+    memset(s_retained, 0, sizeof(s_retained));
+    garage_broker_list_init(&s_brokers, "broker.test", 8883);
+}
+
+uint64_t host_hal_mono_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void fire(host_timer_t timer)
+{
+    s_deadline_us[timer] = -1;
+    switch (timer) {
+        case HOST_TIMER_RELAY_PULSE:
+            garage_hal_relay_set(false);
+            garage_control_relay_pulse_done(s_now_us);
+            break;
+        case HOST_TIMER_DEBOUNCE:
+            garage_control_throttle_expired();
+            break;
+        case HOST_TIMER_STATE_WINDOW:
+            garage_publish_flush_state();
+            break;
+        default:
+            break;
+    }
+}
+
+void host_hal_advance_ms(uint32_t ms)
+{
+    int64_t target_us = s_now_us + (int64_t)ms * 1000;
+    for (;;) {
+        int next = -1;
+        for (int timer = 0; timer < HOST_TIMER_COUNT; ++timer) {
+            if (s_deadline_us[timer] >= 0 && s_deadline_us[timer] <= target_us &&
+                (next < 0 || s_deadline_us[timer] < s_deadline_us[next])) {
+                next = timer;
+            }
+        }
+        if (next < 0) {
+            break;
+        }
+        s_now_us = s_deadline_us[next];
+        fire((host_timer_t)next);
+    }
+    s_now_us = target_us;
+}
+
+static void gpio_write(host_gpio_pin_t pin, bool level)
+{
+    if (s_levels[pin] == level) {
+        return;
+    }
+    s_levels[pin] = level;
+    host_gpio_edge_t *edge = &s_edges[s_edge_count % HOST_GPIO_EDGES_MAX];
+    edge->pin = pin;
+    edge->level = level;
+    edge->at_us = s_now_us;
+    edge->mono_ns = host_hal_mono_ns();
+    ++s_edge_count;
+}
+
+uint32_t host_gpio_edge_count(void)
+{
+    return s_edge_count;
+}
+
+const host_gpio_edge_t *host_gpio_edge(uint32_t index)
+{
+    if (index >= s_edge_count || index >= HOST_GPIO_EDGES_MAX) {
+        return NULL;
+    }
+    return &s_edges[(s_edge_count - 1 - index) % HOST_GPIO_EDGES_MAX];
+}
+
+bool host_gpio_level(host_gpio_pin_t pin)
+{
+    return s_levels[pin];
+}
+
+void host_broker_set_connected(bool connected)
+{
+    s_connected = connected;
+}
+
+void host_broker_fail_next(uint32_t n)
+{
+    s_fail_next = n;
+}
+
+uint32_t host_broker_publish_count(void)
+{
+    return s_publish_count;
+}
+
+const host_broker_message_t *host_broker_message(uint32_t index)
+{
+    if (index >= s_publish_count || index >= HOST_BROKER_LOG_MAX) {
+        return NULL;
+    }
+    return &s_log[(s_publish_count - 1 - index) % HOST_BROKER_LOG_MAX];
+}
+
+const char *host_broker_retained(const char *topic)
+{
+    for (int i = 0; i < HOST_BROKER_RETAINED_MAX; ++i) {
+        if (s_retained[i].topic[0] && strcmp(s_retained[i].topic, topic) == 0) {
+            return s_retained[i].payload;
+        }
+    }
+    return NULL;
+}
+
+static void broker_retain(const char *topic, const char *payload, size_t len)
+{
+    host_retained_t *slot = NULL;
+    for (int i = 0; i < HOST_BROKER_RETAINED_MAX && !slot; ++i) {
+        if (!s_retained[i].topic[0] || strcmp(s_retained[i].topic, topic) == 0) {
+            slot = &s_retained[i];
+        }
+    }
+    if (!slot) {
+        return;
+    }
+    snprintf(slot->topic, sizeof(slot->topic), "%s", topic);
+    snprintf(slot->payload, sizeof(slot->payload), "%.*s", (int)len, payload);
+}
+
+void garage_hal_relay_set(bool active)
+{
+    gpio_write(HOST_GPIO_RELAY, active);
+}
+
+void garage_hal_status_led_set(bool on)
+{
+    gpio_write(HOST_GPIO_STATUS_LED, on);
+}
+
+int64_t garage_hal_now_us(void)
+{
+    return s_now_us;
+}
+
+bool garage_hal_relay_pulse_start(uint32_t duration_ms)
+{
+    // esp_timer_start_once() refuses a timer that is already running.
+    if (s_deadline_us[HOST_TIMER_RELAY_PULSE] >= 0) {
+        return false;
+    }
+    s_deadline_us[HOST_TIMER_RELAY_PULSE] = s_now_us + (int64_t)duration_ms * 1000;
+    return true;
+}
+
+void garage_hal_debounce_start(uint32_t duration_ms)
+{
+    s_deadline_us[HOST_TIMER_DEBOUNCE] = s_now_us + (int64_t)duration_ms * 1000;
+}
+
+void garage_hal_state_window_start(uint32_t delay_ms)
+{
+    s_deadline_us[HOST_TIMER_STATE_WINDOW] = s_now_us + (int64_t)delay_ms * 1000;
+}
+
+void garage_hal_heap_stats(uint32_t *free_bytes, uint32_t *min_free_bytes, uint32_t *largest_block)
+{
+    host_heap_stats_t stats;
+    host_heap_snapshot(&stats);
+    uint32_t live = stats.live_bytes < HOST_HEAP_SIZE ? (uint32_t)stats.live_bytes : HOST_HEAP_SIZE;
+    uint32_t peak = stats.peak_bytes < HOST_HEAP_SIZE ? (uint32_t)stats.peak_bytes : HOST_HEAP_SIZE;
+    *free_bytes = HOST_HEAP_SIZE - live;
+    *min_free_bytes = HOST_HEAP_SIZE - peak;
+    *largest_block = *free_bytes;
+}
+
+bool garage_hal_mqtt_connected(void)
+{
+    return s_connected;
+}
+
+bool garage_hal_publish_ready(void)
+{
+    return s_connected;
+}
+
+int garage_hal_mqtt_publish(const char *topic, const char *payload, size_t len, int qos, bool retain)
+{
+    if (!s_connected) {
+        return -1;
+    }
+    if (s_fail_next > 0) {
+        --s_fail_next;
+        s_connected = false;
+        return -1;
+    }
+
+    host_broker_message_t *message = &s_log[s_publish_count % HOST_BROKER_LOG_MAX];
+    snprintf(message->topic, sizeof(message->topic), "%s", topic);
+    message->len = len < sizeof(message->payload) ? len : sizeof(message->payload) - 1;
+    memcpy(message->payload, payload, message->len);
+    message->payload[message->len] = '\0';
+    message->qos = qos;
+    message->retain = retain;
+    message->msg_id = qos > 0 ? s_next_msg_id++ : 0;
+    ++s_publish_count;
+    if (retain) {
+        broker_retain(topic, payload, len);
+    }
+    return message->msg_id;
+}
+
+void garage_hal_local_publish(const char *topic, const char *payload, size_t len, bool retain)
+{
+    (void)topic;
+    (void)payload;
+    (void)len;
+    (void)retain;
+}
+
+void garage_hal_publish_lock(void)
+{
+}
+
+void garage_hal_publish_unlock(void)
+{
+}
+
+size_t garage_hal_format_broker_status(char *out, size_t size)
+{
+    size_t len = garage_broker_format(&s_brokers, out, size);
+    if (len == 0) {
+        return 0;
+    }
+    int written = snprintf(out + len, size - len, ",\"keepaliveS\":%" PRIu32, (uint32_t)60);
+    return written < 0 || (size_t)written >= size - len ? 0 : len + (size_t)written;
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code) {
+        case ESP_OK:
+            return "ESP_OK";
+        case ESP_FAIL:
+            return "ESP_FAIL";
+        case ESP_ERR_NO_MEM:
+            return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG:
+            return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_NOT_FOUND:
+            return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NVS_NOT_FOUND:
+            return "ESP_ERR_NVS_NOT_FOUND";
+        default:
+            return "UNKNOWN ERROR";
+    }
+}
+
+// Table driven like the ROM routine, so CRC cost in benchmarks stays in
+// proportion to the device.
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+    static uint32_t table[256];
+    if (table[1] == 0) {
+        for (uint32_t byte = 0; byte < 256; ++byte) {
+            uint32_t value = byte;
+            for (int bit = 0; bit < 8; ++bit) {
+                value = (value >> 1) ^ (0xedb88320u & (0u - (value & 1u)));
+            }
+            table[byte] = value;
+        }
+    }
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; ++i) {
+        crc = (crc >> 8) ^ table[(crc ^ buf[i]) & 0xffu];
+    }
+    return ~crc;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "garage_hal.h"
+
+/*
+ * Host implementation of garage_hal.h. Time is virtual: nothing expires
+ * until host_hal_advance_ms() moves the clock, which then fires the relay
+ * pulse, debounce and state window timers in deadline order, exactly like
+ * the esp_timer / FreeRTOS timer callbacks do on the device. Relay and LED
+ * writes are recorded as edges carrying both the virtual time and a real
+ * monotonic timestamp, so benchmarks can measure command-to-GPIO latency.
+ * The broker is an in-process fake that logs every publish.
+ */
+
+#define HOST_GPIO_EDGES_MAX 64
+#define HOST_BROKER_LOG_MAX 64
+#define HOST_BROKER_TOPIC_LEN 96
+#define HOST_BROKER_PAYLOAD_LEN 2048
+
+typedef enum {
+    HOST_GPIO_RELAY = 0,
+    HOST_GPIO_STATUS_LED,
+} host_gpio_pin_t;
+
+typedef struct {
+    host_gpio_pin_t pin;
+    bool level;
+    int64_t at_us;        // virtual clock
+    uint64_t mono_ns;     // real monotonic clock
+} host_gpio_edge_t;
+
+typedef struct {
+    char topic[HOST_BROKER_TOPIC_LEN];
+    char payload[HOST_BROKER_PAYLOAD_LEN];
+    size_t len;
+    int qos;
+    bool retain;
+    int msg_id;
+} host_broker_message_t;
+
+// Clears the clock, timers, GPIO recorder and broker (connected again).
+void host_hal_reset(void);
+void host_hal_advance_ms(uint32_t ms);
+uint64_t host_hal_mono_ns(void);
+
+// GPIO recorder: a ring of the newest edges plus running totals.
+uint32_t host_gpio_edge_count(void);
+// index 0 is the newest edge; NULL past the recorded history.
+const host_gpio_edge_t *host_gpio_edge(uint32_t index);
+bool host_gpio_level(host_gpio_pin_t pin);
+
+// Fake broker.
+void host_broker_set_connected(bool connected);
+// The next n publishes fail as if the socket dropped mid-flush.
+void host_broker_fail_next(uint32_t n);
+uint32_t host_broker_publish_count(void);
+// index 0 is the newest message; NULL past the log.
+const host_broker_message_t *host_broker_message(uint32_t index);
+// Retained payload for topic, or NULL if none.
+const char *host_broker_retained(const char *topic);
+
+// Heap counters fed by the linker-wrapped malloc family (host_heap.c).
+typedef struct {
+    uint64_t allocations;
+    uint64_t frees;
+    size_t live_bytes;
+    size_t peak_bytes;
+} host_heap_stats_t;
+
+void host_heap_snapshot(host_heap_stats_t *out);
+void host_heap_reset_peak(void);
+
+// Largest value one NVS entry holds (strings include the NUL).
+#define HOST_NVS_VALUE_MAX 2048
+
+// Points the file-backed NVS at path and forgets the cached contents;
+// NULL keeps everything in memory.
+void host_nvs_init(const char *path);
+uint32_t host_nvs_commit_count(void);
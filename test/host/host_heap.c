@@ -0,0 +1,84 @@
+#include <malloc.h>
+#include <stdlib.h>
+
+#include "host_hal.h"
+
+/*
+ * Allocation accounting for host builds. The test executables link with
+ * -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free, so every call
+ * from firmware code, cJSON and the tests lands here first. Sizes come from
+ * malloc_usable_size(), which keeps the live byte count consistent without
+ * a header in front of each block.
+ */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static host_heap_stats_t s_stats;
+
+static void account_alloc(void *ptr)
+{
+    if (!ptr) {
+        return;
+    }
+    ++s_stats.allocations;
+    s_stats.live_bytes += malloc_usable_size(ptr);
+    if (s_stats.live_bytes > s_stats.peak_bytes) {
+        s_stats.peak_bytes = s_stats.live_bytes;
+    }
+}
+
+static void account_free(void *ptr)
+{
+    if (!ptr) {
+        return;
+    }
+    ++s_stats.frees;
+    s_stats.live_bytes -= malloc_usable_size(ptr);
+}
+
+void *__wrap_malloc(size_t size)
+{
+    void *ptr = __real_malloc(size);
+    account_alloc(ptr);
+    return ptr;
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    void *ptr = __real_calloc(count, size);
+    account_alloc(ptr);
+    return ptr;
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    size_t old_size = ptr ? malloc_usable_size(ptr) : 0;
+    void *moved = __real_realloc(ptr, size);
+    if (!moved) {
+        return NULL;
+    }
+    s_stats.live_bytes -= old_size;
+    if (ptr) {
+        ++s_stats.frees;
+    }
+    account_alloc(moved);
+    return moved;
+}
+
+void __wrap_free(void *ptr)
+{
+    account_free(ptr);
+    __real_free(ptr);
+}
+
+void host_heap_snapshot(host_heap_stats_t *out)
+{
+    *out = s_stats;
+}
+
+void host_heap_reset_peak(void)
+{
+    s_stats.peak_bytes = s_stats.live_bytes;
+}
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "host_hal.h"
+#include "nvs.h"
+
+/*
+ * NVS stand-in backed by a fixed table, so reading config costs no heap
+ * like the real driver. Writes are visible immediately; nvs_commit() also
+ * rewrites the backing file, if any, which host_nvs_init() reloads, so a
+ * test can "reboot" and find its data again.
+ */
+#define HOST_NVS_ENTRIES_MAX 32
+#define HOST_NVS_NAME_LEN 16
+#define HOST_NVS_NAMESPACES_MAX 4
+
+typedef enum {
+    HOST_NVS_FREE = 0,
+    HOST_NVS_I32,
+    HOST_NVS_STR,
+    HOST_NVS_BLOB,
+} host_nvs_type_t;
+
+typedef struct {
+    host_nvs_type_t type;
+    char ns[HOST_NVS_NAME_LEN];
+    char key[HOST_NVS_NAME_LEN];
+    size_t len;
+    unsigned char value[HOST_NVS_VALUE_MAX];
+} host_nvs_entry_t;
+
+static host_nvs_entry_t s_entries[HOST_NVS_ENTRIES_MAX];
+static char s_namespaces[HOST_NVS_NAMESPACES_MAX][HOST_NVS_NAME_LEN];
+static bool s_writable[HOST_NVS_NAMESPACES_MAX];
+static char s_path[256];
+static uint32_t s_commits;
+
+void host_nvs_init(const char *path)
+{
+    memset(s_entries, 0, sizeof(s_entries));
+    memset(s_namespaces, 0, sizeof(s_namespaces));
+    s_commits = 0;
+    s_path[0] = '\0';
+    if (!path) {
+        return;
+    }
+    snprintf(s_path, sizeof(s_path), "%s", path);
+    FILE *file = fopen(s_path, "rb");
+    if (file) {
+        if (fread(s_entries, sizeof(s_entries), 1, file) != 1) {
+            memset(s_entries, 0, sizeof(s_entries));
+        }
+        fclose(file);
+    }
+}
+
+uint32_t host_nvs_commit_count(void)
+{
+    return s_commits;
+}
+
+static const char *handle_namespace(nvs_handle_t handle)
+{
+    if (handle == 0 || handle > HOST_NVS_NAMESPACES_MAX || !s_namespaces[handle - 1][0]) {
+        return NULL;
+    }
+    return s_namespaces[handle - 1];
+}
+
+static host_nvs_entry_t *find(nvs_handle_t handle, const char *key, host_nvs_type_t type)
+{
+    const char *ns = handle_namespace(handle);
+    for (int i = 0; ns && i < HOST_NVS_ENTRIES_MAX; ++i) {
+        host_nvs_entry_t *entry = &s_entries[i];
+        if (entry->type == type && strcmp(entry->ns, ns) == 0 && strcmp(entry->key, key) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static esp_err_t store(nvs_handle_t handle, const char *key, host_nvs_type_t type, const void *value, size_t len)
+{
+    const char *ns = handle_namespace(handle);
+    if (!ns || !s_writable[handle - 1]) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (strlen(key) >= HOST_NVS_NAME_LEN || len > HOST_NVS_VALUE_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    host_nvs_entry_t *entry = find(handle, key, type);
+    for (int i = 0; !entry && i < HOST_NVS_ENTRIES_MAX; ++i) {
+        if (s_entries[i].type == HOST_NVS_FREE) {
+            entry = &s_entries[i];
+        }
+    }
+    if (!entry) {
+        return ESP_ERR_NO_MEM;
+    }
+    entry->type = type;
+    snprintf(entry->ns, sizeof(entry->ns), "%s", ns);
+    snprintf(entry->key, sizeof(entry->key), "%s", key);
+    entry->len = len;
+    memcpy(entry->value, value, len);
+    return ESP_OK;
+}
+
+static esp_err_t load(nvs_handle_t handle, const char *key, host_nvs_type_t type, void *out, size_t *length)
+{
+    const host_nvs_entry_t *entry = find(handle, key, type);
+    if (!entry) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (!out) {
+        *length = entry->len;
+        return ESP_OK;
+    }
+    if (*length < entry->len) {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    memcpy(out, entry->value, entry->len);
+    *length = entry->len;
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    if (!name || strlen(name) >= HOST_NVS_NAME_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (int i = 0; i < HOST_NVS_NAMESPACES_MAX; ++i) {
+        if (!s_namespaces[i][0] || strcmp(s_namespaces[i], name) == 0) {
+            snprintf(s_namespaces[i], sizeof(s_namespaces[i]), "%s", name);
+            s_writable[i] = open_mode == NVS_READWRITE;
+            *out_handle = (nvs_handle_t)(i + 1);
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    (void)handle;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    if (!handle_namespace(handle)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ++s_commits;
+    if (!s_path[0]) {
+        return ESP_OK;
+    }
+    FILE *file = fopen(s_path, "wb");
+    if (!file) {
+        return ESP_FAIL;
+    }
+    bool ok = fwrite(s_entries, sizeof(s_entries), 1, file) == 1;
+    ok = fclose(file) == 0 && ok;
+    return ok ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *out_value, size_t *length)
+{
+    return load(handle, key, HOST_NVS_STR, out_value, length);
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value)
+{
+    return store(handle, key, HOST_NVS_STR, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    return load(handle, key, HOST_NVS_BLOB, out_value, length);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    return store(handle, key, HOST_NVS_BLOB, value, length);
+}
+
+esp_err_t nvs_get_i32(nvs_handle_t handle, const char *key, int32_t *out_value)
+{
+    size_t length = sizeof(*out_value);
+    return load(handle, key, HOST_NVS_I32, out_value, &length);
+}
+
+esp_err_t nvs_set_i32(nvs_handle_t handle, const char *key, int32_t value)
+{
+    return store(handle, key, HOST_NVS_I32, &value, sizeof(value));
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    static const host_nvs_type_t types[] = {HOST_NVS_I32, HOST_NVS_STR, HOST_NVS_BLOB};
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); ++i) {
+        host_nvs_entry_t *entry = find(handle, key, types[i]);
+        if (entry) {
+            memset(entry, 0, sizeof(*entry));
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NVS_NOT_FOUND;
+}
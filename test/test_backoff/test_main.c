@@ -0,0 +1,111 @@
+#include <stdint.h>
+
+#include "garage_backoff.h"
+#include "unity.h"
+
+#define BASE_MS 1000
+#define MAX_MS 60000
+
+static garage_backoff_t s_backoff;
+
+void setUp(void)
+{
+    garage_backoff_init(&s_backoff, BASE_MS, MAX_MS);
+}
+
+void tearDown(void)
+{
+}
+
+static uint32_t expected_cap(uint32_t attempt)
+{
+    uint64_t cap = BASE_MS;
+    for (uint32_t i = 0; i < attempt && cap < MAX_MS; ++i) {
+        cap *= 2;
+    }
+    return cap > MAX_MS ? MAX_MS : (uint32_t)cap;
+}
+
+static void test_delay_within_half_cap_and_cap(void)
+{
+    static const uint32_t randoms[] = {0, 1, 499, 500, 501, 12345, 0x7fffffffu, UINT32_MAX};
+    for (uint32_t attempt = 0; attempt < 12; ++attempt) {
+        uint32_t cap = expected_cap(attempt);
+        for (size_t r = 0; r < sizeof(randoms) / sizeof(randoms[0]); ++r) {
+            garage_backoff_t backoff = s_backoff;
+            backoff.attempts = attempt;
+            uint32_t delay = garage_backoff_next_delay_ms(&backoff, 1000, randoms[r]);
+            TEST_ASSERT_GREATER_OR_EQUAL_UINT32(cap / 2, delay);
+            TEST_ASSERT_LESS_OR_EQUAL_UINT32(cap, delay);
+        }
+    }
+}
+
+static void test_delay_spans_whole_range(void)
+{
+    // random % (cap - cap/2 + 1) reaches both ends of the window.
+    garage_backoff_t backoff = s_backoff;
+    TEST_ASSERT_EQUAL_UINT32(BASE_MS / 2, garage_backoff_next_delay_ms(&backoff, 1000, 0));
+    backoff = s_backoff;
+    TEST_ASSERT_EQUAL_UINT32(BASE_MS, garage_backoff_next_delay_ms(&backoff, 1000, BASE_MS - BASE_MS / 2));
+}
+
+static void test_cap_doubles_until_max(void)
+{
+    for (uint32_t attempt = 0; attempt < 40; ++attempt) {
+        // The largest random value the window allows yields the cap itself.
+        uint32_t cap = expected_cap(attempt);
+        uint32_t delay = garage_backoff_next_delay_ms(&s_backoff, 1000, cap - cap / 2);
+        TEST_ASSERT_EQUAL_UINT32(cap, delay);
+    }
+    TEST_ASSERT_EQUAL_UINT32(40, s_backoff.attempts);
+}
+
+static void test_reset_reports_outage_and_restarts(void)
+{
+    garage_backoff_next_delay_ms(&s_backoff, 5000000, 0);
+    garage_backoff_next_delay_ms(&s_backoff, 7000000, 0);
+    garage_backoff_next_delay_ms(&s_backoff, 9000000, 0);
+    TEST_ASSERT_EQUAL_UINT32(3, s_backoff.attempts);
+
+    TEST_ASSERT_EQUAL_INT64(6000000, garage_backoff_reset(&s_backoff, 11000000));
+    TEST_ASSERT_EQUAL_UINT32(0, s_backoff.attempts);
+    // No outage in progress any more.
+    TEST_ASSERT_EQUAL_INT64(0, garage_backoff_reset(&s_backoff, 12000000));
+
+    uint32_t delay = garage_backoff_next_delay_ms(&s_backoff, 13000000, UINT32_MAX);
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(BASE_MS / 2, delay);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(BASE_MS, delay);
+}
+
+static void test_init_sanitizes_limits(void)
+{
+    garage_backoff_t backoff;
+    garage_backoff_init(&backoff, 0, 0);
+    TEST_ASSERT_EQUAL_UINT32(1, backoff.base_ms);
+    TEST_ASSERT_EQUAL_UINT32(1, backoff.max_ms);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(1, garage_backoff_next_delay_ms(&backoff, 1, UINT32_MAX));
+
+    garage_backoff_init(&backoff, 5000, 1000);
+    TEST_ASSERT_EQUAL_UINT32(5000, backoff.max_ms);
+}
+
+static void test_attempts_saturate(void)
+{
+    s_backoff.attempts = UINT32_MAX;
+    uint32_t delay = garage_backoff_next_delay_ms(&s_backoff, 1000, 0);
+    TEST_ASSERT_EQUAL_UINT32(MAX_MS / 2, delay);
+    TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, s_backoff.attempts);
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_delay_within_half_cap_and_cap);
+    RUN_TEST(test_delay_spans_whole_range);
+    RUN_TEST(test_cap_doubles_until_max);
+    RUN_TEST(test_reset_reports_outage_and_restarts);
+    RUN_TEST(test_init_sanitizes_limits);
+    RUN_TEST(test_attempts_saturate);
+    return UNITY_END();
+}
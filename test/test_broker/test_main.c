@@ -0,0 +1,179 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "garage_broker.h"
+#include "unity.h"
+
+#define SECOND_US (1000LL * 1000)
+
+static garage_broker_list_t s_list;
+
+void setUp(void)
+{
+    TEST_ASSERT_EQUAL_size_t(3, garage_broker_list_init(&s_list, "primary.example,mqtt://lan.example:1883,backup.example:8884", 8883));
+}
+
+void tearDown(void)
+{
+}
+
+// Makes `index` active and gives it a measured PUBACK time.
+static void measure(size_t index, uint32_t ack_ms)
+{
+    garage_broker_activate(&s_list, index);
+    garage_broker_record_connect(&s_list, ack_ms);
+    garage_broker_record_ack(&s_list, ack_ms);
+}
+
+static void test_list_parsing(void)
+{
+    TEST_ASSERT_EQUAL_STRING("mqtts://primary.example:8883", s_list.brokers[0].uri);
+    TEST_ASSERT_EQUAL_STRING("mqtt://lan.example:1883", s_list.brokers[1].uri);
+    TEST_ASSERT_EQUAL_STRING("mqtts://backup.example:8884", s_list.brokers[2].uri);
+    TEST_ASSERT_EQUAL_STRING("mqtts://primary.example:8883", garage_broker_active_uri(&s_list));
+
+    garage_broker_list_t list;
+    TEST_ASSERT_EQUAL_size_t(1, garage_broker_list_init(&list, " bad host ,ok.example:99999,,ok.example", 8883));
+    TEST_ASSERT_EQUAL_STRING("mqtts://ok.example:8883", list.brokers[0].uri);
+}
+
+static void test_failover_after_consecutive_failures(void)
+{
+    measure(1, 40);
+    measure(2, 90);
+    measure(0, 60);
+
+    TEST_ASSERT_FALSE(garage_broker_record_failure(&s_list, 0));
+    TEST_ASSERT_EQUAL_size_t(0, s_list.active);
+    TEST_ASSERT_TRUE(garage_broker_record_failure(&s_list, 0));
+    TEST_ASSERT_EQUAL_size_t(1, s_list.active);
+    TEST_ASSERT_EQUAL_INT64(30 * SECOND_US, s_list.brokers[0].quarantined_until_us);
+}
+
+static void test_ack_resets_failure_streak(void)
+{
+    TEST_ASSERT_FALSE(garage_broker_record_failure(&s_list, 0));
+    garage_broker_record_ack(&s_list, 50);
+    TEST_ASSERT_FALSE(garage_broker_record_failure(&s_list, 0));
+    TEST_ASSERT_EQUAL_size_t(0, s_list.active);
+    TEST_ASSERT_EQUAL_INT64(0, s_list.brokers[0].quarantined_until_us);
+}
+
+static void test_quarantine_doubles_up_to_ten_minutes(void)
+{
+    garage_broker_list_t list;
+    garage_broker_list_init(&list, "only.example", 8883);
+    static const int64_t expected_s[] = {30, 60, 120, 240, 480, 600, 600};
+    TEST_ASSERT_FALSE(garage_broker_record_failure(&list, 0));
+    for (size_t i = 0; i < sizeof(expected_s) / sizeof(expected_s[0]); ++i) {
+        int64_t now_us = (int64_t)i * 1000 * SECOND_US;
+        // A single broker has nowhere to go but is still quarantined.
+        TEST_ASSERT_FALSE(garage_broker_record_failure(&list, now_us));
+        TEST_ASSERT_EQUAL_INT64(now_us + expected_s[i] * SECOND_US, list.brokers[0].quarantined_until_us);
+    }
+
+    garage_broker_record_connect(&list, 120);
+    TEST_ASSERT_EQUAL_INT64(0, list.brokers[0].quarantined_until_us);
+}
+
+static void test_untried_broker_gets_its_chance(void)
+{
+    measure(1, 40);
+    measure(0, 500);
+    garage_broker_record_failure(&s_list, 0);
+    TEST_ASSERT_TRUE(garage_broker_record_failure(&s_list, 0));
+    // backup.example has no samples, so it scores ahead of lan.example.
+    TEST_ASSERT_EQUAL_size_t(2, s_list.active);
+}
+
+static void test_all_quarantined_picks_first_to_return(void)
+{
+    measure(0, 50);
+    measure(1, 50);
+    measure(2, 50);
+    garage_broker_activate(&s_list, 2);
+    garage_broker_record_failure(&s_list, 0);
+    garage_broker_record_failure(&s_list, 0);
+    garage_broker_activate(&s_list, 1);
+    garage_broker_record_failure(&s_list, 5 * SECOND_US);
+    garage_broker_record_failure(&s_list, 5 * SECOND_US);
+    garage_broker_activate(&s_list, 0);
+    garage_broker_record_failure(&s_list, 10 * SECOND_US);
+    TEST_ASSERT_TRUE(garage_broker_record_failure(&s_list, 10 * SECOND_US));
+    TEST_ASSERT_EQUAL_size_t(2, s_list.active);
+}
+
+static void test_drift_back_waits_for_quarantine(void)
+{
+    measure(2, 500);
+    measure(1, 60);
+    measure(0, 60);
+    garage_broker_record_failure(&s_list, 0);
+    garage_broker_record_failure(&s_list, 0);
+    TEST_ASSERT_EQUAL_size_t(1, s_list.active);
+
+    TEST_ASSERT_FALSE(garage_broker_primary_due(&s_list, 30 * SECOND_US - 1));
+    TEST_ASSERT_TRUE(garage_broker_primary_due(&s_list, 30 * SECOND_US));
+}
+
+static void test_drift_back_keeps_a_markedly_faster_secondary(void)
+{
+    measure(2, 1000);
+    measure(0, 300);
+    measure(1, 100);
+    // Within 200 ms of the fastest healthy broker: back to the primary.
+    TEST_ASSERT_TRUE(garage_broker_primary_due(&s_list, 0));
+
+    // Markedly slower: the faster secondary stays.
+    s_list.brokers[0].ack_ms = 301;
+    TEST_ASSERT_FALSE(garage_broker_primary_due(&s_list, 0));
+}
+
+static void test_drift_back_follows_untried_scoring(void)
+{
+    measure(0, 300);
+    measure(1, 100);
+    // backup.example is untried and scores 0, so a failover would try it
+    // before the primary; drifting back would skip that choice.
+    TEST_ASSERT_FALSE(garage_broker_primary_due(&s_list, 0));
+}
+
+static void test_drift_back_not_due_on_primary(void)
+{
+    TEST_ASSERT_FALSE(garage_broker_primary_due(&s_list, 0));
+
+    garage_broker_list_t single;
+    garage_broker_list_init(&single, "only.example", 8883);
+    TEST_ASSERT_FALSE(garage_broker_primary_due(&single, 0));
+}
+
+static void test_format(void)
+{
+    measure(1, 40);
+    garage_broker_record_failure(&s_list, 0);
+    char out[256];
+    size_t len = garage_broker_format(&s_list, out, sizeof(out));
+    TEST_ASSERT_EQUAL_size_t(strlen(out), len);
+    TEST_ASSERT_EQUAL_STRING("\"broker\":{\"active\":1,\"uri\":\"mqtt://lan.example:1883\",\"connectMs\":[0,40,0],"
+                             "\"ackMs\":[0,40,0],\"failures\":[0,1,0]}",
+                             out);
+    TEST_ASSERT_EQUAL_size_t(0, garage_broker_format(&s_list, out, len));
+    TEST_ASSERT_EQUAL_size_t(len, garage_broker_format(&s_list, out, len + 1));
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_list_parsing);
+    RUN_TEST(test_failover_after_consecutive_failures);
+    RUN_TEST(test_ack_resets_failure_streak);
+    RUN_TEST(test_quarantine_doubles_up_to_ten_minutes);
+    RUN_TEST(test_untried_broker_gets_its_chance);
+    RUN_TEST(test_all_quarantined_picks_first_to_return);
+    RUN_TEST(test_drift_back_waits_for_quarantine);
+    RUN_TEST(test_drift_back_keeps_a_markedly_faster_secondary);
+    RUN_TEST(test_drift_back_follows_untried_scoring);
+    RUN_TEST(test_drift_back_not_due_on_primary);
+    RUN_TEST(test_format);
+    return UNITY_END();
+}
@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cJSON.h"
+#include "garage_command.h"
+#include "unity.h"
+
+/*
+ * Differential test: every payload goes through garage_command_tokenize()
+ * and through cJSON_Parse() the way the firmware used to call it (a NUL
+ * terminated copy), and the two must agree on acceptance and on every
+ * field the command handlers read.
+ */
+
+typedef struct {
+    const char *json;
+    size_t len;  // 0: strlen(json)
+} corpus_entry_t;
+
+#define ENTRY(literal) {literal, 0}
+#define ENTRY_LEN(literal) {literal, sizeof(literal) - 1}
+
+static const char *const s_field_keys[COMMAND_FIELD_COUNT] = {
+    [COMMAND_FIELD_TYPE] = "type",
+    [COMMAND_FIELD_HEARTBEAT_INTERVAL_S] = "heartbeatIntervalS",
+    [COMMAND_FIELD_DEBOUNCE_MS] = "debounceMs",
+    [COMMAND_FIELD_RELAY_PULSE_MS] = "relayPulseMs",
+    [COMMAND_FIELD_TAG] = "tag",
+    [COMMAND_FIELD_ASSET] = "asset",
+    [COMMAND_FIELD_TIMESTAMP] = "timestamp",
+    [COMMAND_FIELD_REQUEST_ID] = "requestId",
+    [COMMAND_FIELD_ROLLOUT_WINDOW_S] = "rolloutWindowS",
+    [COMMAND_FIELD_CANARY_PERCENT] = "canaryPercent",
+    [COMMAND_FIELD_CANARY_QUORUM] = "canaryQuorum",
+    [COMMAND_FIELD_STATUS] = "status",
+    [COMMAND_FIELD_DETAIL] = "detail",
+};
+
+static const corpus_entry_t s_valid[] = {
+    ENTRY("{\"type\":\"open\"}"),
+    ENTRY("{\"type\":\"open\",\"requestId\":\"abc-1\",\"timestamp\":1700000000123}"),
+    ENTRY("{\"type\":\"config_update\",\"debounceMs\":1500,\"relayPulseMs\":250,\"heartbeatIntervalS\":60}"),
+    ENTRY("{\"type\":\"ota\",\"tag\":\"v1.2.3\",\"asset\":\"firmware.bin\",\"rolloutWindowS\":600,"
+          "\"canaryPercent\":10,\"canaryQuorum\":2}"),
+    ENTRY("{}"),
+    ENTRY("{\"Type\":\"open\"}"),
+    // Whitespace: cJSON skips every byte up to and including space.
+    ENTRY(" \t\r\n{ \"type\" : \"open\" , \"tag\" :\"x\"\n} "),
+    ENTRY("\x0b{\"type\":\x0c\"open\"\x01}"),
+    ENTRY("\xEF\xBB\xBF{\"type\":\"open\"}"),
+    ENTRY("\xEF\xBB\xBF  {\"type\":\"open\"}"),
+    // Escapes.
+    ENTRY("{\"type\":\"op\\\"en\",\"detail\":\"a\\nb \\\\ \\/ \\b\\f\\r\\t\",\"status\":\"\\u00e9\\uD83D\\uDE00\"}"),
+    ENTRY("{\"tag\":\"\\u0041\\u00E9\\u20AC\\udbff\\udfff\"}"),
+    ENTRY("{\"tag\":\"a\tb\x01\x1f\"}"),
+    ENTRY("{\"detail\":\"caf\xC3\xA9 \xff\"}"),
+    // Nesting and types.
+    ENTRY("{\"type\":\"metrics\",\"extra\":{\"a\":[1,2,{\"b\":null}],\"c\":true},\"status\":false}"),
+    ENTRY("{\"type\":1,\"tag\":[\"x\"],\"asset\":{\"a\":1},\"status\":null,\"detail\":true}"),
+    ENTRY("{\"type\":\"open\",\"type\":\"ota\",\"debounceMs\":1,\"debounceMs\":\"x\"}"),
+    // Numbers, including cJSON's valueint saturation.
+    ENTRY("{\"debounceMs\":-0,\"relayPulseMs\":1e3,\"heartbeatIntervalS\":2.9,\"canaryPercent\":-2.5E-1}"),
+    ENTRY("{\"timestamp\":1e400,\"canaryQuorum\":-99999999999,\"rolloutWindowS\":2147483648,\"debounceMs\":1.}"),
+    // Non-objects are well-formed but carry no fields.
+    ENTRY("[1,2,3]"),
+    ENTRY("\"open\""),
+    ENTRY("42"),
+    ENTRY("true"),
+    ENTRY("null"),
+    // Trailing bytes after the top-level value are ignored by both.
+    ENTRY("{\"type\":\"open\"}xyz"),
+    ENTRY("{\"type\":\"open\"}}"),
+    ENTRY("1 2"),
+    ENTRY("1.2.3"),
+    ENTRY_LEN("{\"type\":\"open\"}\0{garbage"),
+};
+
+static const corpus_entry_t s_malformed[] = {
+    ENTRY(""),
+    ENTRY("   "),
+    ENTRY_LEN("\0{\"type\":\"open\"}"),
+    ENTRY("{"),
+    ENTRY("}"),
+    ENTRY("{\"type\""),
+    ENTRY("{\"type\":"),
+    ENTRY("{\"type\":\"open\""),
+    ENTRY("{\"type\":\"open\",}"),
+    ENTRY("{,}"),
+    ENTRY("{\"type\" \"open\"}"),
+    ENTRY("{type:\"open\"}"),
+    ENTRY("{'type':'open'}"),
+    ENTRY("[1,2,]"),
+    ENTRY("[1 2]"),
+    ENTRY("{\"a\":[}"),
+    ENTRY("{\"a\":{\"b\":1]}"),
+    ENTRY("{\"a\":tru}"),
+    ENTRY("{\"a\":nul}"),
+    ENTRY("{\"a\":True}"),
+    ENTRY("{\"a\":-}"),
+    ENTRY("{\"a\":+1}"),
+    ENTRY("{\"a\":.5}"),
+    ENTRY("{\"a\":1.2.3}"),
+    ENTRY("{\"a\":0x10}"),
+    ENTRY("{\"a\":1e}"),
+    ENTRY("{\"a\":NaN}"),
+    ENTRY("{\"a\":Infinity}"),
+    ENTRY("{\"a\":\"\\x\"}"),
+    ENTRY("{\"a\":\"\\u12\"}"),
+    ENTRY("{\"a\":\"\\uDC00\"}"),
+    ENTRY("{\"a\":\"\\uD800\"}"),
+    ENTRY("{\"a\":\"\\uD800\\u0041\"}"),
+    ENTRY("{\"a\":\"\\uD800\\uD800\"}"),
+    ENTRY("{\"a\":\"\\uD800x      \"}"),
+    ENTRY("{\"a\":\"unterminated}"),
+    ENTRY("{\"a\":\"abc\\\"}"),
+    ENTRY_LEN("{\"type\":\"op\0en\"}"),
+    ENTRY(" \xEF\xBB\xBF{}"),
+    ENTRY("\xEF\xBB{}"),
+};
+
+static cJSON *parse_like_firmware(const char *data, size_t len)
+{
+    char *copy = malloc(len + 1);
+    TEST_ASSERT_NOT_NULL(copy);
+    memcpy(copy, data, len);
+    copy[len] = '\0';
+    cJSON *root = cJSON_Parse(copy);
+    free(copy);
+    return root;
+}
+
+static size_t entry_len(const corpus_entry_t *entry)
+{
+    return entry->len ? entry->len : strlen(entry->json);
+}
+
+static void describe(char *out, size_t size, const char *data, size_t len)
+{
+    size_t used = 0;
+    for (size_t i = 0; i < len && used + 5 < size; ++i) {
+        unsigned char ch = (unsigned char)data[i];
+        used += (size_t)snprintf(out + used, size - used, ch >= 0x20 && ch < 0x7f ? "%c" : "\\x%02x", ch);
+    }
+}
+
+static void assert_fields_agree(const cJSON *root, const command_fields_t *fields, const char *what)
+{
+    for (int id = 0; id < COMMAND_FIELD_COUNT; ++id) {
+        const command_value_t *value = &fields->fields[id];
+        const cJSON *item = cJSON_IsObject(root) ? cJSON_GetObjectItemCaseSensitive(root, s_field_keys[id]) : NULL;
+        char message[256];
+        snprintf(message, sizeof(message), "field %s in %s", s_field_keys[id], what);
+
+        switch (value->kind) {
+            case COMMAND_VALUE_ABSENT:
+                TEST_ASSERT_NULL_MESSAGE(item, message);
+                break;
+            case COMMAND_VALUE_STRING:
+                TEST_ASSERT_TRUE_MESSAGE(cJSON_IsString(item), message);
+                // Spans keep escapes; only unescaped strings compare verbatim.
+                if (!memchr(value->text.ptr, '\\', value->text.len)) {
+                    TEST_ASSERT_EQUAL_size_t_MESSAGE(strlen(item->valuestring), value->text.len, message);
+                    TEST_ASSERT_EQUAL_MEMORY_MESSAGE(item->valuestring, value->text.ptr, value->text.len, message);
+                }
+                break;
+            case COMMAND_VALUE_NUMBER:
+                TEST_ASSERT_TRUE_MESSAGE(cJSON_IsNumber(item), message);
+                TEST_ASSERT_EQUAL_INT_MESSAGE(item->valueint, value->number, message);
+                TEST_ASSERT_TRUE_MESSAGE(item->valuedouble == value->real, message);
+                break;
+            case COMMAND_VALUE_OTHER:
+                TEST_ASSERT_NOT_NULL_MESSAGE(item, message);
+                TEST_ASSERT_FALSE_MESSAGE(cJSON_IsString(item) || cJSON_IsNumber(item), message);
+                break;
+        }
+    }
+}
+
+// Returns whether the payload was accepted (both agree, or the test fails).
+static bool check_agreement(const char *data, size_t len)
+{
+    char what[160] = "";
+    describe(what, sizeof(what), data, len);
+
+    command_fields_t fields;
+    bool tokenized = garage_command_tokenize(data, len, &fields);
+    cJSON *root = parse_like_firmware(data, len);
+    TEST_ASSERT_EQUAL_MESSAGE(root != NULL, tokenized, what);
+    if (root) {
+        assert_fields_agree(root, &fields, what);
+        cJSON_Delete(root);
+    }
+    return tokenized;
+}
+
+static char *nested_objects(int levels)
+{
+    // {"a":{"a":...{}...}}
+    char *json = malloc((size_t)levels * 6 + 1);
+    TEST_ASSERT_NOT_NULL(json);
+    size_t len = 0;
+    for (int i = 0; i < levels; ++i) {
+        memcpy(json + len, i + 1 < levels ? "{\"a\":" : "{", i + 1 < levels ? 5 : 1);
+        len += i + 1 < levels ? 5 : 1;
+    }
+    memset(json + len, '}', (size_t)levels);
+    json[len + (size_t)levels] = '\0';
+    return json;
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+static void test_valid_corpus_agrees(void)
+{
+    for (size_t i = 0; i < sizeof(s_valid) / sizeof(s_valid[0]); ++i) {
+        TEST_ASSERT_TRUE(check_agreement(s_valid[i].json, entry_len(&s_valid[i])));
+    }
+}
+
+static void test_malformed_corpus_agrees(void)
+{
+    for (size_t i = 0; i < sizeof(s_malformed) / sizeof(s_malformed[0]); ++i) {
+        TEST_ASSERT_FALSE(check_agreement(s_malformed[i].json, entry_len(&s_malformed[i])));
+    }
+}
+
+static void test_truncated_input_agrees(void)
+{
+    for (size_t i = 0; i < sizeof(s_valid) / sizeof(s_valid[0]); ++i) {
+        size_t len = entry_len(&s_valid[i]);
+        for (size_t cut = 0; cut < len; ++cut) {
+            check_agreement(s_valid[i].json, cut);
+        }
+    }
+}
+
+static void test_nesting_up_to_limit_agrees(void)
+{
+    for (int levels = 1; levels <= 17; ++levels) {
+        char *json = nested_objects(levels);
+        TEST_ASSERT_TRUE(check_agreement(json, strlen(json)));
+        free(json);
+    }
+}
+
+/*
+ * Deliberate differences, each one a payload no client sends: the
+ * tokenizer recurses on a small task stack and keeps a fixed number buffer.
+ */
+static void test_nesting_past_limit_rejected(void)
+{
+    command_fields_t fields;
+    char *json = nested_objects(18);
+    TEST_ASSERT_FALSE(garage_command_tokenize(json, strlen(json), &fields));
+    cJSON *root = cJSON_Parse(json);
+    TEST_ASSERT_NOT_NULL(root);
+    cJSON_Delete(root);
+    free(json);
+
+    const char *array = "{\"type\":\"open\",\"x\":[[[[[[[[[[[[[[[[[1]]]]]]]]]]]]]]]]]}";
+    TEST_ASSERT_FALSE(garage_command_tokenize(array, strlen(array), &fields));
+}
+
+static void test_long_number_rejected(void)
+{
+    char json[128];
+    snprintf(json, sizeof(json), "{\"debounceMs\":%064d}", 1);
+    command_fields_t fields;
+    TEST_ASSERT_FALSE(garage_command_tokenize(json, strlen(json), &fields));
+    cJSON *root = cJSON_Parse(json);
+    TEST_ASSERT_NOT_NULL(root);
+    cJSON_Delete(root);
+
+    snprintf(json, sizeof(json), "{\"debounceMs\":%063d}", 1);
+    TEST_ASSERT_TRUE(check_agreement(json, strlen(json)));
+}
+
+static void test_non_hex_unicode_escape_rejected(void)
+{
+    const char *json = "{\"type\":\"open\",\"detail\":\"\\u00ZZ\"}";
+    command_fields_t fields;
+    TEST_ASSERT_FALSE(garage_command_tokenize(json, strlen(json), &fields));
+    cJSON *root = cJSON_Parse(json);
+    TEST_ASSERT_NOT_NULL(root);
+    cJSON_Delete(root);
+}
+
+static void test_escaped_key_not_matched(void)
+{
+    const char *json = "{\"typ\\u0065\":\"open\"}";
+    command_fields_t fields;
+    TEST_ASSERT_TRUE(garage_command_tokenize(json, strlen(json), &fields));
+    TEST_ASSERT_EQUAL(COMMAND_VALUE_ABSENT, fields.fields[COMMAND_FIELD_TYPE].kind);
+}
+
+static void test_type_lookup(void)
+{
+    json_span_t open = {"open", 4};
+    json_span_t config = {"config_update", 13};
+    json_span_t ota = {"ota", 3};
+    json_span_t metrics = {"metrics", 7};
+    json_span_t prefix = {"open", 3};
+    json_span_t other = {"OPEN", 4};
+    TEST_ASSERT_EQUAL(COMMAND_TYPE_OPEN, garage_command_type_lookup(open));
+    TEST_ASSERT_EQUAL(COMMAND_TYPE_CONFIG_UPDATE, garage_command_type_lookup(config));
+    TEST_ASSERT_EQUAL(COMMAND_TYPE_OTA, garage_command_type_lookup(ota));
+    TEST_ASSERT_EQUAL(COMMAND_TYPE_METRICS, garage_command_type_lookup(metrics));
+    TEST_ASSERT_EQUAL(COMMAND_TYPE_UNKNOWN, garage_command_type_lookup(prefix));
+    TEST_ASSERT_EQUAL(COMMAND_TYPE_UNKNOWN, garage_command_type_lookup(other));
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_valid_corpus_agrees);
+    RUN_TEST(test_malformed_corpus_agrees);
+    RUN_TEST(test_truncated_input_agrees);
+    RUN_TEST(test_nesting_up_to_limit_agrees);
+    RUN_TEST(test_nesting_past_limit_rejected);
+    RUN_TEST(test_long_number_rejected);
+    RUN_TEST(test_non_hex_unicode_escape_rejected);
+    RUN_TEST(test_escaped_key_not_matched);
+    RUN_TEST(test_type_lookup);
+    return UNITY_END();
+}
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "garage_broker.h"
+#include "garage_config.h"
+#include "host_hal.h"
+#include "nvs.h"
+#include "unity.h"
+
+#define NVS_PATH "test_config.nvs"
+
+static const char *const s_json =
+    "{\"CONFIG_GARAGE_WIFI_SSID\":\"garage-net\",\"CONFIG_GARAGE_WIFI_PASSWORD\":\"secret\","
+    "\"CONFIG_GARAGE_DEVICE_ID\":\"garage-test\",\"CONFIG_GARAGE_MQTT_HOST\":\"broker.example\","
+    "\"CONFIG_GARAGE_MQTT_PORT\":8884,\"CONFIG_GARAGE_RELAY_GPIO\":4,\"CONFIG_GARAGE_RELAY_ACTIVE_HIGH\":\"n\","
+    "\"CONFIG_GARAGE_DEBOUNCE_MS\":1500}";
+
+void setUp(void)
+{
+    host_hal_reset();
+    remove(NVS_PATH);
+    host_nvs_init(NVS_PATH);
+}
+
+void tearDown(void)
+{
+    remove(NVS_PATH);
+}
+
+static void write_json(const char *json)
+{
+    nvs_handle_t handle;
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_open(GARAGE_CONFIG_NAMESPACE, NVS_READWRITE, &handle));
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_set_str(handle, "config", json));
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_commit(handle));
+    nvs_close(handle);
+}
+
+// Drops everything cached in RAM and reads NVS back from the file.
+static void reboot(void)
+{
+    host_nvs_init(NVS_PATH);
+}
+
+static void test_json_migrates_to_binary_record(void)
+{
+    write_json(s_json);
+    garage_config_t config;
+    host_heap_stats_t before;
+    host_heap_stats_t after;
+    host_heap_snapshot(&before);
+    TEST_ASSERT_EQUAL(ESP_OK, garage_config_load(&config));
+    host_heap_snapshot(&after);
+
+    // The migration parses JSON once, on the heap, and gives it all back.
+    TEST_ASSERT_GREATER_THAN_UINT32(0, (uint32_t)(after.allocations - before.allocations));
+    TEST_ASSERT_EQUAL_size_t(before.live_bytes, after.live_bytes);
+    TEST_ASSERT_EQUAL_STRING("garage-net", config.wifi_ssid);
+    TEST_ASSERT_EQUAL_STRING("garage-test", config.device_id);
+    TEST_ASSERT_EQUAL_STRING("broker.example", config.mqtt_host);
+    TEST_ASSERT_EQUAL_INT(8884, config.mqtt_port);
+    TEST_ASSERT_EQUAL_INT(4, config.relay_gpio);
+    TEST_ASSERT_FALSE(config.relay_active_high);
+    TEST_ASSERT_EQUAL_INT(1500, config.debounce_ms);
+    // Absent optional fields take the defaults.
+    TEST_ASSERT_EQUAL_INT(500, config.relay_pulse_ms);
+    TEST_ASSERT_EQUAL_INT(3600, config.heartbeat_interval_s);
+}
+
+static void test_binary_load_uses_no_heap(void)
+{
+    write_json(s_json);
+    garage_config_t migrated;
+    TEST_ASSERT_EQUAL(ESP_OK, garage_config_load(&migrated));
+    reboot();
+
+    garage_config_t loaded;
+    host_heap_stats_t before;
+    host_heap_stats_t after;
+    host_heap_reset_peak();
+    host_heap_snapshot(&before);
+    TEST_ASSERT_EQUAL(ESP_OK, garage_config_load(&loaded));
+    host_heap_snapshot(&after);
+
+    TEST_ASSERT_EQUAL_UINT64(before.allocations, after.allocations);
+    TEST_ASSERT_EQUAL_size_t(before.peak_bytes, after.peak_bytes);
+    TEST_ASSERT_EQUAL_UINT32(0, host_nvs_commit_count());
+    TEST_ASSERT_EQUAL_MEMORY(&migrated, &loaded, sizeof(loaded));
+}
+
+static void test_corrupt_record_rebuilt_from_json(void)
+{
+    write_json(s_json);
+    garage_config_t config;
+    TEST_ASSERT_EQUAL(ESP_OK, garage_config_load(&config));
+
+    nvs_handle_t handle;
+    unsigned char record[HOST_NVS_VALUE_MAX];
+    size_t size = sizeof(record);
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_open(GARAGE_CONFIG_NAMESPACE, NVS_READWRITE, &handle));
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_get_blob(handle, "config_bin", record, &size));
+    record[size / 2] ^= 0x5a;
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_set_blob(handle, "config_bin", record, size));
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_commit(handle));
+    nvs_close(handle);
+    reboot();
+
+    host_heap_stats_t before;
+    host_heap_stats_t after;
+    host_heap_snapshot(&before);
+    memset(&config, 0, sizeof(config));
+    TEST_ASSERT_EQUAL(ESP_OK, garage_config_load(&config));
+    host_heap_snapshot(&after);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, (uint32_t)(after.allocations - before.allocations));
+    TEST_ASSERT_EQUAL_STRING("garage-test", config.device_id);
+    TEST_ASSERT_EQUAL_UINT32(1, host_nvs_commit_count());
+}
+
+static void test_missing_required_field_rejected(void)
+{
+    write_json("{\"CONFIG_GARAGE_WIFI_SSID\":\"garage-net\",\"CONFIG_GARAGE_MQTT_HOST\":\"broker.example\"}");
+    garage_config_t config;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, garage_config_load(&config));
+}
+
+static void test_tunables_survive_reboot(void)
+{
+    write_json(s_json);
+    garage_config_t config;
+    TEST_ASSERT_EQUAL(ESP_OK, garage_config_load(&config));
+    config.debounce_ms = 2500;
+    garage_config_stage(&config);
+    config.debounce_ms = 4000;
+    config.relay_pulse_ms = 300;
+    garage_config_stage(&config);
+    uint32_t commits = host_nvs_commit_count();
+    TEST_ASSERT_EQUAL(ESP_OK, garage_config_flush());
+    TEST_ASSERT_EQUAL_UINT32(commits + 1, host_nvs_commit_count());
+    reboot();
+
+    TEST_ASSERT_EQUAL(ESP_OK, garage_config_load(&config));
+    TEST_ASSERT_EQUAL_INT(4000, config.debounce_ms);
+    TEST_ASSERT_EQUAL_INT(300, config.relay_pulse_ms);
+    TEST_ASSERT_EQUAL_INT(3600, config.heartbeat_interval_s);
+}
+
+// Builds "CONFIG_GARAGE_MQTT_HOST" holding GARAGE_BROKER_MAX brokers with
+// 253-character names; extra pads the last name past the limit.
+static void write_long_host_list(char *hosts, size_t size, size_t extra)
+{
+    size_t len = 0;
+    for (int broker = 0; broker < GARAGE_BROKER_MAX; ++broker) {
+        char name[254 + 8];
+        size_t name_len = 253 + (broker == GARAGE_BROKER_MAX - 1 ? extra : 0);
+        memset(name, 'a' + broker, name_len);
+        name[name_len] = '\0';
+        len += (size_t)snprintf(hosts + len, size - len, "%smqtts://%s:65535", broker ? "," : "", name);
+    }
+    static char json[HOST_NVS_VALUE_MAX];
+    snprintf(json, sizeof(json),
+             "{\"CONFIG_GARAGE_WIFI_SSID\":\"garage-net\",\"CONFIG_GARAGE_DEVICE_ID\":\"garage-test\","
+             "\"CONFIG_GARAGE_MQTT_HOST\":\"%s\"}",
+             hosts);
+    write_json(json);
+}
+
+static void test_three_longest_brokers_fit(void)
+{
+    char hosts[GARAGE_CONFIG_HOST_LEN + 8];
+    write_long_host_list(hosts, sizeof(hosts), 0);
+    TEST_ASSERT_EQUAL_size_t(GARAGE_CONFIG_HOST_LEN - 1, strlen(hosts));
+
+    garage_config_t config;
+    TEST_ASSERT_EQUAL(ESP_OK, garage_config_load(&config));
+    TEST_ASSERT_EQUAL_STRING(hosts, config.mqtt_host);
+    garage_broker_list_t brokers;
+    TEST_ASSERT_EQUAL_size_t(GARAGE_BROKER_MAX, garage_broker_list_init(&brokers, config.mqtt_host, 8883));
+}
+
+static void test_host_list_past_limit_rejected(void)
+{
+    char hosts[GARAGE_CONFIG_HOST_LEN + 8];
+    write_long_host_list(hosts, sizeof(hosts), 1);
+    garage_config_t config;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, garage_config_load(&config));
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_json_migrates_to_binary_record);
+    RUN_TEST(test_binary_load_uses_no_heap);
+    RUN_TEST(test_corrupt_record_rebuilt_from_json);
+    RUN_TEST(test_missing_required_field_rejected);
+    RUN_TEST(test_tunables_survive_reboot);
+    RUN_TEST(test_three_longest_brokers_fit);
+    RUN_TEST(test_host_list_past_limit_rejected);
+    return UNITY_END();
+}
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "garage_control.h"
+#include "garage_publish.h"
+#include "host_hal.h"
+#include "unity.h"
+
+#define RELAY_PULSE_MS 500
+#define DEBOUNCE_MS 2000
+#define STATE_TOPIC "garage/test/state"
+
+void setUp(void)
+{
+    host_hal_reset();
+    garage_publish_init("test", STATE_TOPIC, "garage/test/metrics", "garage/test/result", 0);
+    garage_publish_forget_state();
+    garage_control_init(RELAY_PULSE_MS, DEBOUNCE_MS);
+}
+
+void tearDown(void)
+{
+}
+
+static bool retained_state_is(const char *state)
+{
+    const char *payload = host_broker_retained(STATE_TOPIC);
+    char needle[48];
+    snprintf(needle, sizeof(needle), "\"state\":\"%s\"", state);
+    return payload && strstr(payload, needle);
+}
+
+static void test_open_pulses_relay_then_throttles(void)
+{
+    TEST_ASSERT_EQUAL(GARAGE_OPEN_TRIGGERED, garage_control_open());
+    TEST_ASSERT_EQUAL(GARAGE_STATE_TRIGGERING, garage_control_state());
+    TEST_ASSERT_TRUE(host_gpio_level(HOST_GPIO_RELAY));
+    TEST_ASSERT_TRUE(host_gpio_level(HOST_GPIO_STATUS_LED));
+    TEST_ASSERT_TRUE(retained_state_is("TRIGGERING"));
+    int64_t pressed_us = host_gpio_edge(0)->at_us;
+
+    host_hal_advance_ms(RELAY_PULSE_MS - 1);
+    TEST_ASSERT_TRUE(host_gpio_level(HOST_GPIO_RELAY));
+    host_hal_advance_ms(1);
+    TEST_ASSERT_FALSE(host_gpio_level(HOST_GPIO_RELAY));
+    const host_gpio_edge_t *release = host_gpio_edge(0);
+    TEST_ASSERT_EQUAL(HOST_GPIO_RELAY, release->pin);
+    TEST_ASSERT_EQUAL_INT64(pressed_us + RELAY_PULSE_MS * 1000, release->at_us);
+    TEST_ASSERT_EQUAL(GARAGE_STATE_THROTTLED, garage_control_state());
+    TEST_ASSERT_TRUE(retained_state_is("THROTTLED"));
+
+    host_hal_advance_ms(DEBOUNCE_MS);
+    TEST_ASSERT_EQUAL(GARAGE_STATE_LISTENING, garage_control_state());
+    TEST_ASSERT_FALSE(host_gpio_level(HOST_GPIO_STATUS_LED));
+    TEST_ASSERT_TRUE(retained_state_is("LISTENING"));
+}
+
+static void test_open_refused_while_busy_or_cooling_down(void)
+{
+    garage_control_open();
+    uint32_t edges = host_gpio_edge_count();
+    TEST_ASSERT_EQUAL(GARAGE_OPEN_BUSY, garage_control_open());
+    TEST_ASSERT_EQUAL_UINT32(edges, host_gpio_edge_count());
+
+    host_hal_advance_ms(RELAY_PULSE_MS + 500);
+    TEST_ASSERT_EQUAL(GARAGE_OPEN_COOLDOWN, garage_control_open());
+    TEST_ASSERT_EQUAL_INT32(DEBOUNCE_MS - 500, garage_control_remaining_cooldown_ms());
+    TEST_ASSERT_FALSE(host_gpio_level(HOST_GPIO_RELAY));
+
+    host_hal_advance_ms(DEBOUNCE_MS);
+    TEST_ASSERT_EQUAL(GARAGE_OPEN_TRIGGERED, garage_control_open());
+}
+
+static void test_open_refused_during_update(void)
+{
+    garage_control_set_state(GARAGE_STATE_UPDATING);
+    TEST_ASSERT_EQUAL(GARAGE_OPEN_UPDATING, garage_control_open());
+    TEST_ASSERT_FALSE(host_gpio_level(HOST_GPIO_RELAY));
+    TEST_ASSERT_TRUE(retained_state_is("UPDATING"));
+}
+
+// The pulse runs on a timer, so open returns at once and a snapshot asked
+// for mid-pulse goes out without waiting for the relay to drop.
+static void test_snapshot_not_delayed_by_pulse(void)
+{
+    int64_t before_us = garage_hal_now_us();
+    TEST_ASSERT_EQUAL(GARAGE_OPEN_TRIGGERED, garage_control_open());
+    TEST_ASSERT_EQUAL_INT64(before_us, garage_hal_now_us());
+
+    host_hal_advance_ms(RELAY_PULSE_MS / 2);
+    uint32_t published = host_broker_publish_count();
+    garage_publish_forget_state();
+    garage_control_publish_snapshot();
+    TEST_ASSERT_EQUAL_UINT32(published + 1, host_broker_publish_count());
+    const host_broker_message_t *snapshot = host_broker_message(0);
+    TEST_ASSERT_EQUAL_STRING(STATE_TOPIC, snapshot->topic);
+    TEST_ASSERT_NOT_NULL(strstr(snapshot->payload, "\"state\":\"TRIGGERING\""));
+    TEST_ASSERT_TRUE(host_gpio_level(HOST_GPIO_RELAY));
+    TEST_ASSERT_EQUAL_INT64(before_us + RELAY_PULSE_MS / 2 * 1000, garage_hal_now_us());
+}
+
+static void test_state_held_while_broker_away(void)
+{
+    host_broker_set_connected(false);
+    garage_control_open();
+    host_hal_advance_ms(RELAY_PULSE_MS + DEBOUNCE_MS);
+    TEST_ASSERT_EQUAL(GARAGE_STATE_LISTENING, garage_control_state());
+    TEST_ASSERT_NULL(host_broker_retained(STATE_TOPIC));
+
+    host_broker_set_connected(true);
+    garage_publish_flush_outbox();
+    TEST_ASSERT_TRUE(retained_state_is("LISTENING"));
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_open_pulses_relay_then_throttles);
+    RUN_TEST(test_open_refused_while_busy_or_cooling_down);
+    RUN_TEST(test_open_refused_during_update);
+    RUN_TEST(test_snapshot_not_delayed_by_pulse);
+    RUN_TEST(test_state_held_while_broker_away);
+    return UNITY_END();
+}
@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "garage_dedupe.h"
+#include "unity.h"
+
+#define TTL_MS 60000
+#define TTL_US (TTL_MS * 1000LL)
+// Ring size in garage_dedupe.c.
+#define DEDUPE_SLOTS 16
+
+void setUp(void)
+{
+    garage_dedupe_init(TTL_MS);
+}
+
+void tearDown(void)
+{
+}
+
+static bool seen(const char *id, int64_t now_us)
+{
+    return garage_dedupe_check_and_insert(id, strlen(id), now_us);
+}
+
+static void test_repeat_within_ttl_is_duplicate(void)
+{
+    TEST_ASSERT_FALSE(seen("req-1", 1000));
+    TEST_ASSERT_TRUE(seen("req-1", 2000));
+    TEST_ASSERT_TRUE(seen("req-1", 1000 + TTL_US));
+    TEST_ASSERT_FALSE(seen("req-2", 3000));
+    TEST_ASSERT_FALSE(seen("req-10", 3000));
+}
+
+static void test_ttl_expiry(void)
+{
+    TEST_ASSERT_FALSE(seen("req-1", 1000));
+    TEST_ASSERT_FALSE(seen("req-1", 1000 + TTL_US + 1));
+    // The expired entry was refreshed, so the TTL counts from the new sighting.
+    TEST_ASSERT_TRUE(seen("req-1", 1000 + TTL_US + 2));
+    TEST_ASSERT_TRUE(seen("req-1", 1000 + 2 * TTL_US));
+    TEST_ASSERT_FALSE(seen("req-1", 1000 + 2 * TTL_US + 2));
+}
+
+static void test_ring_evicts_oldest(void)
+{
+    char id[16];
+    for (int i = 0; i < DEDUPE_SLOTS; ++i) {
+        snprintf(id, sizeof(id), "id-%d", i);
+        TEST_ASSERT_FALSE(seen(id, 1000 + i));
+    }
+    for (int i = 0; i < DEDUPE_SLOTS; ++i) {
+        snprintf(id, sizeof(id), "id-%d", i);
+        TEST_ASSERT_TRUE(seen(id, 2000));
+    }
+
+    // One more id overwrites the oldest slot only.
+    TEST_ASSERT_FALSE(seen("id-new", 3000));
+    TEST_ASSERT_FALSE(seen("id-0", 3000));
+    TEST_ASSERT_TRUE(seen("id-2", 3000));
+    TEST_ASSERT_TRUE(seen("id-new", 3000));
+}
+
+static void test_expired_entry_refresh_keeps_ring_slot(void)
+{
+    TEST_ASSERT_FALSE(seen("keep", 1000));
+    TEST_ASSERT_FALSE(seen("keep", 1000 + TTL_US + 1));
+    char id[16];
+    for (int i = 0; i < DEDUPE_SLOTS - 1; ++i) {
+        snprintf(id, sizeof(id), "id-%d", i);
+        TEST_ASSERT_FALSE(seen(id, 1000 + TTL_US + 2));
+    }
+    // The refresh reused its slot instead of taking a second one.
+    TEST_ASSERT_TRUE(seen("keep", 1000 + TTL_US + 3));
+}
+
+static void test_forget_allows_retry(void)
+{
+    TEST_ASSERT_FALSE(seen("req-1", 1000));
+    garage_dedupe_forget("req-1", 5);
+    TEST_ASSERT_FALSE(seen("req-1", 2000));
+    TEST_ASSERT_TRUE(seen("req-1", 3000));
+    garage_dedupe_forget("unknown", 7);
+}
+
+static void test_ids_compared_by_length(void)
+{
+    TEST_ASSERT_FALSE(garage_dedupe_check_and_insert("abcdef", 3, 1000));
+    TEST_ASSERT_TRUE(garage_dedupe_check_and_insert("abcxyz", 3, 2000));
+    TEST_ASSERT_FALSE(garage_dedupe_check_and_insert("abcdef", 4, 2000));
+}
+
+static void test_id_validation(void)
+{
+    char longest[GARAGE_REQUEST_ID_MAX_LEN + 2];
+    memset(longest, 'a', sizeof(longest));
+    TEST_ASSERT_TRUE(garage_dedupe_id_is_valid("A-z_0.9:x", 9));
+    TEST_ASSERT_TRUE(garage_dedupe_id_is_valid(longest, GARAGE_REQUEST_ID_MAX_LEN));
+    TEST_ASSERT_FALSE(garage_dedupe_id_is_valid(longest, GARAGE_REQUEST_ID_MAX_LEN + 1));
+    TEST_ASSERT_FALSE(garage_dedupe_id_is_valid("", 0));
+    TEST_ASSERT_FALSE(garage_dedupe_id_is_valid(NULL, 3));
+    TEST_ASSERT_FALSE(garage_dedupe_id_is_valid("a b", 3));
+    TEST_ASSERT_FALSE(garage_dedupe_id_is_valid("a\"b", 3));
+    TEST_ASSERT_FALSE(garage_dedupe_id_is_valid("a/b", 3));
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_repeat_within_ttl_is_duplicate);
+    RUN_TEST(test_ttl_expiry);
+    RUN_TEST(test_ring_evicts_oldest);
+    RUN_TEST(test_expired_entry_refresh_keeps_ring_slot);
+    RUN_TEST(test_forget_allows_retry);
+    RUN_TEST(test_ids_compared_by_length);
+    RUN_TEST(test_id_validation);
+    return UNITY_END();
+}
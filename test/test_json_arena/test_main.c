@@ -0,0 +1,91 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "cJSON.h"
+#include "garage_json_arena.h"
+#include "host_hal.h"
+#include "unity.h"
+
+static const char *const s_command =
+    "{\"type\":\"config_update\",\"debounceMs\":1500,\"relayPulseMs\":250,\"requestId\":\"abc-123\"}";
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+static void test_parse_stays_in_arena(void)
+{
+    static uint8_t buffer[4096];
+    garage_json_arena_t arena;
+    host_heap_stats_t before;
+    host_heap_stats_t after;
+    host_heap_snapshot(&before);
+    garage_json_arena_begin(&arena, buffer, sizeof(buffer));
+    cJSON *root = cJSON_Parse(s_command);
+    TEST_ASSERT_NOT_NULL(root);
+    TEST_ASSERT_EQUAL_INT(1500, cJSON_GetObjectItemCaseSensitive(root, "debounceMs")->valueint);
+    cJSON_Delete(root);
+    garage_json_arena_end(&arena);
+    host_heap_snapshot(&after);
+
+    TEST_ASSERT_EQUAL_UINT64(before.allocations, after.allocations);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, arena.allocations);
+    TEST_ASSERT_EQUAL_UINT32(0, arena.heap_fallbacks);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, (uint32_t)arena.high_water);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(sizeof(buffer), (uint32_t)arena.high_water);
+    TEST_ASSERT_EQUAL_size_t(0, arena.used);
+}
+
+static void test_overflow_falls_back_to_heap(void)
+{
+    static uint8_t buffer[256];
+    garage_json_arena_t arena;
+    host_heap_stats_t before;
+    host_heap_stats_t after;
+    host_heap_snapshot(&before);
+    garage_json_arena_begin(&arena, buffer, sizeof(buffer));
+    cJSON *root = cJSON_Parse(s_command);
+    TEST_ASSERT_NOT_NULL(root);
+    TEST_ASSERT_EQUAL_STRING("abc-123", cJSON_GetObjectItemCaseSensitive(root, "requestId")->valuestring);
+    cJSON_Delete(root);
+    garage_json_arena_end(&arena);
+    host_heap_snapshot(&after);
+
+    // What did not fit went to the heap and came back on cJSON_Delete.
+    TEST_ASSERT_GREATER_THAN_UINT32(0, arena.heap_fallbacks);
+    TEST_ASSERT_EQUAL_UINT64(arena.heap_fallbacks, after.allocations - before.allocations);
+    TEST_ASSERT_EQUAL_size_t(before.live_bytes, after.live_bytes);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(sizeof(buffer), (uint32_t)arena.high_water);
+}
+
+static void test_end_restores_heap_hooks(void)
+{
+    static uint8_t buffer[1024];
+    garage_json_arena_t arena;
+    garage_json_arena_begin(&arena, buffer, sizeof(buffer));
+    garage_json_arena_end(&arena);
+
+    host_heap_stats_t before;
+    host_heap_stats_t after;
+    host_heap_snapshot(&before);
+    cJSON *root = cJSON_Parse(s_command);
+    TEST_ASSERT_NOT_NULL(root);
+    TEST_ASSERT_FALSE((uint8_t *)root >= buffer && (uint8_t *)root < buffer + sizeof(buffer));
+    cJSON_Delete(root);
+    host_heap_snapshot(&after);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, (uint32_t)(after.allocations - before.allocations));
+    TEST_ASSERT_EQUAL_size_t(before.live_bytes, after.live_bytes);
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_parse_stays_in_arena);
+    RUN_TEST(test_overflow_falls_back_to_heap);
+    RUN_TEST(test_end_restores_heap_hooks);
+    return UNITY_END();
+}
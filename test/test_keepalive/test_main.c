@@ -0,0 +1,198 @@
+#include <stdint.h>
+
+#include "garage_keepalive.h"
+#include "unity.h"
+
+#define S_US 1000000LL
+#define HOUR_US (3600 * S_US)
+#define MIN_S 30
+#define MAX_S 600
+
+static garage_keepalive_t s_keepalive;
+static int64_t s_now_us;
+
+void setUp(void)
+{
+    garage_keepalive_init(&s_keepalive, 120, MIN_S, MAX_S);
+    s_now_us = S_US;
+}
+
+void tearDown(void)
+{
+}
+
+static void connect_now(void)
+{
+    garage_keepalive_connected(&s_keepalive, s_now_us);
+}
+
+// Connects and loses the link `periods` keepalive periods later.
+static bool drop_after(double periods)
+{
+    connect_now();
+    s_now_us += (int64_t)(periods * s_keepalive.keepalive_s * S_US);
+    return garage_keepalive_lost(&s_keepalive, s_now_us);
+}
+
+// Connects and probes once the connection has been stable long enough.
+static bool grow_after_stable_run(void)
+{
+    connect_now();
+    s_now_us += 8 * (int64_t)s_keepalive.keepalive_s * S_US;
+    return garage_keepalive_grow(&s_keepalive, s_now_us);
+}
+
+static void test_init_clamps(void)
+{
+    garage_keepalive_t keepalive;
+    garage_keepalive_init(&keepalive, 5, MIN_S, MAX_S);
+    TEST_ASSERT_EQUAL_UINT32(MIN_S, keepalive.keepalive_s);
+    garage_keepalive_init(&keepalive, 3600, MIN_S, MAX_S);
+    TEST_ASSERT_EQUAL_UINT32(MAX_S, keepalive.keepalive_s);
+    garage_keepalive_init(&keepalive, 120, 0, 0);
+    TEST_ASSERT_EQUAL_UINT32(1, keepalive.min_s);
+    TEST_ASSERT_EQUAL_UINT32(1, keepalive.max_s);
+}
+
+static void test_grows_after_stable_periods(void)
+{
+    connect_now();
+    TEST_ASSERT_EQUAL_INT64(8 * 120 * S_US, garage_keepalive_probe_delay_us(&s_keepalive));
+    TEST_ASSERT_FALSE(garage_keepalive_grow(&s_keepalive, s_now_us + 8 * 120 * S_US - 1));
+    TEST_ASSERT_TRUE(garage_keepalive_grow(&s_keepalive, s_now_us + 8 * 120 * S_US));
+    TEST_ASSERT_EQUAL_UINT32(180, s_keepalive.keepalive_s);
+    TEST_ASSERT_EQUAL_UINT32(120, s_keepalive.good_s);
+}
+
+static void test_grow_stops_at_max(void)
+{
+    for (int i = 0; i < 10; ++i) {
+        grow_after_stable_run();
+    }
+    TEST_ASSERT_EQUAL_UINT32(MAX_S, s_keepalive.keepalive_s);
+    connect_now();
+    TEST_ASSERT_EQUAL_INT64(-1, garage_keepalive_probe_delay_us(&s_keepalive));
+    TEST_ASSERT_FALSE(garage_keepalive_grow(&s_keepalive, s_now_us + 24 * HOUR_US));
+}
+
+static void test_probe_needs_a_connection(void)
+{
+    TEST_ASSERT_EQUAL_INT64(-1, garage_keepalive_probe_delay_us(&s_keepalive));
+    TEST_ASSERT_FALSE(garage_keepalive_grow(&s_keepalive, 24 * HOUR_US));
+}
+
+static void test_suspect_drops_fall_back_to_last_good_value(void)
+{
+    TEST_ASSERT_TRUE(grow_after_stable_run());
+    TEST_ASSERT_EQUAL_UINT32(180, s_keepalive.keepalive_s);
+
+    // One drop could be anything; the second in a row shrinks.
+    TEST_ASSERT_FALSE(drop_after(1.5));
+    TEST_ASSERT_EQUAL_UINT32(180, s_keepalive.keepalive_s);
+    TEST_ASSERT_TRUE(drop_after(1.5));
+    TEST_ASSERT_EQUAL_UINT32(120, s_keepalive.keepalive_s);
+    TEST_ASSERT_EQUAL_UINT32(180, s_keepalive.ceiling_s);
+}
+
+static void test_suspect_drops_halve_without_good_value(void)
+{
+    drop_after(2);
+    TEST_ASSERT_TRUE(drop_after(2));
+    TEST_ASSERT_EQUAL_UINT32(60, s_keepalive.keepalive_s);
+    TEST_ASSERT_EQUAL_UINT32(120, s_keepalive.ceiling_s);
+
+    drop_after(2);
+    TEST_ASSERT_TRUE(drop_after(2));
+    TEST_ASSERT_EQUAL_UINT32(MIN_S, s_keepalive.keepalive_s);
+    // Clamped at the floor: nothing left to shrink, no ceiling to keep.
+    TEST_ASSERT_FALSE(drop_after(2));
+    TEST_ASSERT_FALSE(drop_after(2));
+    TEST_ASSERT_EQUAL_UINT32(MIN_S, s_keepalive.keepalive_s);
+}
+
+static void test_early_and_late_drops_are_not_suspect(void)
+{
+    // Under half a period: the broker or the network failed.
+    TEST_ASSERT_FALSE(drop_after(0.4));
+    TEST_ASSERT_FALSE(drop_after(0.4));
+    TEST_ASSERT_EQUAL_UINT32(120, s_keepalive.keepalive_s);
+
+    // A late drop breaks a run of suspect ones.
+    TEST_ASSERT_FALSE(drop_after(2));
+    TEST_ASSERT_FALSE(drop_after(5));
+    TEST_ASSERT_FALSE(drop_after(2));
+    TEST_ASSERT_EQUAL_UINT32(120, s_keepalive.keepalive_s);
+
+    // Not connected: nothing to blame.
+    TEST_ASSERT_FALSE(garage_keepalive_lost(&s_keepalive, s_now_us));
+}
+
+static void test_growth_stays_below_ceiling_midpoint(void)
+{
+    TEST_ASSERT_TRUE(garage_keepalive_restore(&s_keepalive, 120, 180));
+    TEST_ASSERT_TRUE(grow_after_stable_run());
+    TEST_ASSERT_EQUAL_UINT32(150, s_keepalive.keepalive_s);
+
+    // Halfway to 180 is 165, a step under 1/8 of 150: not worth a reconnect.
+    TEST_ASSERT_FALSE(grow_after_stable_run());
+    TEST_ASSERT_EQUAL_UINT32(150, s_keepalive.keepalive_s);
+}
+
+static void test_ceiling_forgotten_after_a_day(void)
+{
+    TEST_ASSERT_TRUE(garage_keepalive_restore(&s_keepalive, 150, 180));
+    connect_now();
+    int64_t stable_since_us = s_now_us;
+    // Only forgetting the ceiling allows another step, so the probe waits
+    // for the day to pass.
+    TEST_ASSERT_EQUAL_INT64(24 * HOUR_US, garage_keepalive_probe_delay_us(&s_keepalive));
+    TEST_ASSERT_FALSE(garage_keepalive_grow(&s_keepalive, stable_since_us + 24 * HOUR_US - 1));
+    TEST_ASSERT_EQUAL_UINT32(180, s_keepalive.ceiling_s);
+
+    TEST_ASSERT_TRUE(garage_keepalive_grow(&s_keepalive, stable_since_us + 24 * HOUR_US));
+    TEST_ASSERT_EQUAL_UINT32(0, s_keepalive.ceiling_s);
+    TEST_ASSERT_EQUAL_UINT32(225, s_keepalive.keepalive_s);
+}
+
+static void test_suspect_drop_restarts_the_day(void)
+{
+    TEST_ASSERT_TRUE(garage_keepalive_restore(&s_keepalive, 150, 180));
+    s_now_us += 20 * HOUR_US;
+    drop_after(2);
+    connect_now();
+    s_now_us += 5 * HOUR_US;
+    TEST_ASSERT_FALSE(garage_keepalive_grow(&s_keepalive, s_now_us));
+    TEST_ASSERT_EQUAL_UINT32(180, s_keepalive.ceiling_s);
+}
+
+static void test_restore_bounds(void)
+{
+    TEST_ASSERT_FALSE(garage_keepalive_restore(&s_keepalive, MIN_S - 1, 0));
+    TEST_ASSERT_FALSE(garage_keepalive_restore(&s_keepalive, MAX_S + 1, 0));
+    TEST_ASSERT_FALSE(garage_keepalive_restore(&s_keepalive, 200, 200));
+    TEST_ASSERT_FALSE(garage_keepalive_restore(&s_keepalive, 200, 100));
+    TEST_ASSERT_FALSE(garage_keepalive_restore(&s_keepalive, 200, MAX_S + 1));
+    TEST_ASSERT_EQUAL_UINT32(120, s_keepalive.keepalive_s);
+    TEST_ASSERT_EQUAL_UINT32(0, s_keepalive.ceiling_s);
+
+    TEST_ASSERT_TRUE(garage_keepalive_restore(&s_keepalive, MIN_S, MAX_S));
+    TEST_ASSERT_TRUE(garage_keepalive_restore(&s_keepalive, MAX_S, 0));
+    TEST_ASSERT_EQUAL_UINT32(MAX_S, s_keepalive.keepalive_s);
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_init_clamps);
+    RUN_TEST(test_grows_after_stable_periods);
+    RUN_TEST(test_grow_stops_at_max);
+    RUN_TEST(test_probe_needs_a_connection);
+    RUN_TEST(test_suspect_drops_fall_back_to_last_good_value);
+    RUN_TEST(test_suspect_drops_halve_without_good_value);
+    RUN_TEST(test_early_and_late_drops_are_not_suspect);
+    RUN_TEST(test_growth_stays_below_ceiling_midpoint);
+    RUN_TEST(test_ceiling_forgotten_after_a_day);
+    RUN_TEST(test_suspect_drop_restarts_the_day);
+    RUN_TEST(test_restore_bounds);
+    return UNITY_END();
+}
@@ -0,0 +1,170 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cJSON.h"
+#include "garage_metrics.h"
+#include "unity.h"
+
+// The histograms and counters are process-wide, so each test uses stages
+// and counters of its own.
+static char s_out[4096];
+static cJSON *s_root;
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+    cJSON_Delete(s_root);
+    s_root = NULL;
+}
+
+static cJSON *format_and_parse(void)
+{
+    size_t len = garage_metrics_format(s_out + 1, sizeof(s_out) - 2);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, (uint32_t)len);
+    s_out[0] = '{';
+    s_out[len + 1] = '}';
+    s_out[len + 2] = '\0';
+    cJSON_Delete(s_root);
+    s_root = cJSON_Parse(s_out);
+    TEST_ASSERT_NOT_NULL(s_root);
+    return s_root;
+}
+
+static double stage_field(const char *stage, const char *field)
+{
+    const cJSON *stages = cJSON_GetObjectItemCaseSensitive(format_and_parse(), "stages");
+    const cJSON *value = cJSON_GetObjectItemCaseSensitive(cJSON_GetObjectItemCaseSensitive(stages, stage), field);
+    TEST_ASSERT_TRUE(cJSON_IsNumber(value));
+    return value->valuedouble;
+}
+
+static double counter(const char *name)
+{
+    const cJSON *counters = cJSON_GetObjectItemCaseSensitive(format_and_parse(), "counters");
+    const cJSON *value = cJSON_GetObjectItemCaseSensitive(counters, name);
+    TEST_ASSERT_TRUE(cJSON_IsNumber(value));
+    return value->valuedouble;
+}
+
+// Percentiles report the upper bound of the bucket, [2^i, 2^(i+1)) us.
+static void test_bucket_boundaries(void)
+{
+    garage_metrics_record(GARAGE_LATENCY_MQTT_TO_QUEUE, 0);
+    garage_metrics_record(GARAGE_LATENCY_MQTT_TO_QUEUE, -5);
+    TEST_ASSERT_EQUAL_UINT32(2, stage_field("mqttToQueue", "n"));
+    TEST_ASSERT_EQUAL_UINT32(2, stage_field("mqttToQueue", "p50Us"));
+    TEST_ASSERT_EQUAL_UINT32(0, stage_field("mqttToQueue", "maxUs"));
+
+    garage_metrics_record(GARAGE_LATENCY_QUEUE_WAIT, 1023);
+    TEST_ASSERT_EQUAL_UINT32(1024, stage_field("queueWait", "p50Us"));
+    garage_metrics_record(GARAGE_LATENCY_DISPATCH, 1024);
+    TEST_ASSERT_EQUAL_UINT32(2048, stage_field("dispatch", "p50Us"));
+    TEST_ASSERT_EQUAL_UINT32(1024, stage_field("dispatch", "maxUs"));
+
+    garage_metrics_record(GARAGE_LATENCY_WIFI_RECOVERY, INT32_MAX);
+    TEST_ASSERT_EQUAL_UINT32(UINT32_C(1) << 31, (uint32_t)stage_field("wifiRecovery", "p50Us"));
+    // The last bucket is open-ended.
+    garage_metrics_record(GARAGE_LATENCY_MQTT_RECOVERY, (int64_t)1 << 31);
+    TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, (uint32_t)stage_field("mqttRecovery", "p50Us"));
+}
+
+static void test_durations_clamp_to_32_bits(void)
+{
+    garage_metrics_record(GARAGE_LATENCY_BOOT_TO_STATE, INT64_C(1) << 40);
+    TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, (uint32_t)stage_field("bootToState", "p99Us"));
+    TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, (uint32_t)stage_field("bootToState", "maxUs"));
+}
+
+static void test_percentiles(void)
+{
+    for (int i = 0; i < 98; ++i) {
+        garage_metrics_record(GARAGE_LATENCY_END_TO_END, 10);
+    }
+    garage_metrics_record(GARAGE_LATENCY_END_TO_END, 5000);
+    garage_metrics_record(GARAGE_LATENCY_END_TO_END, 4000);
+    TEST_ASSERT_EQUAL_UINT32(100, stage_field("endToEnd", "n"));
+    TEST_ASSERT_EQUAL_UINT32(16, stage_field("endToEnd", "p50Us"));
+    // The 99th sample is 4000 us, in [2048, 4096).
+    TEST_ASSERT_EQUAL_UINT32(4096, stage_field("endToEnd", "p99Us"));
+    TEST_ASSERT_EQUAL_UINT32(5000, stage_field("endToEnd", "maxUs"));
+}
+
+static void test_counters_saturate(void)
+{
+    garage_metrics_count(GARAGE_COUNTER_CONFIG_UPDATES, 3);
+    garage_metrics_count(GARAGE_COUNTER_CONFIG_UPDATES, 4);
+    TEST_ASSERT_EQUAL_UINT32(7, counter("configUpdates"));
+
+    garage_metrics_count(GARAGE_COUNTER_MQTT_BYTES_OUT, UINT32_MAX - 1);
+    garage_metrics_count(GARAGE_COUNTER_MQTT_BYTES_OUT, 5);
+    TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, (uint32_t)counter("mqttBytesOut"));
+    garage_metrics_count(GARAGE_COUNTER_MQTT_BYTES_OUT, 1);
+    TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, (uint32_t)counter("mqttBytesOut"));
+}
+
+static void test_out_of_range_ignored(void)
+{
+    garage_metrics_record(GARAGE_LATENCY_STAGE_COUNT, 10);
+    garage_metrics_count(GARAGE_COUNTER_COUNT, 10);
+    TEST_ASSERT_EQUAL_UINT32(0, stage_field("tlsFull", "n"));
+}
+
+static void test_payload_shape(void)
+{
+    static const char *const stages[] = {"mqttToQueue", "queueWait", "dispatch", "endToEnd", "bootToState",
+                                         "wifiRecovery", "mqttRecovery", "mqttReady", "tlsFull", "tlsResumed"};
+    cJSON *root = format_and_parse();
+    TEST_ASSERT_EQUAL_INT(2, cJSON_GetArraySize(root));
+
+    const cJSON *stage_object = cJSON_GetObjectItemCaseSensitive(root, "stages");
+    TEST_ASSERT_EQUAL_INT(GARAGE_LATENCY_STAGE_COUNT, cJSON_GetArraySize(stage_object));
+    for (size_t i = 0; i < sizeof(stages) / sizeof(stages[0]); ++i) {
+        const cJSON *stage = cJSON_GetObjectItemCaseSensitive(stage_object, stages[i]);
+        TEST_ASSERT_NOT_NULL_MESSAGE(stage, stages[i]);
+        TEST_ASSERT_EQUAL_INT(4, cJSON_GetArraySize(stage));
+        TEST_ASSERT_TRUE(cJSON_IsNumber(cJSON_GetObjectItemCaseSensitive(stage, "n")));
+        TEST_ASSERT_TRUE(cJSON_IsNumber(cJSON_GetObjectItemCaseSensitive(stage, "p50Us")));
+        TEST_ASSERT_TRUE(cJSON_IsNumber(cJSON_GetObjectItemCaseSensitive(stage, "p99Us")));
+        TEST_ASSERT_TRUE(cJSON_IsNumber(cJSON_GetObjectItemCaseSensitive(stage, "maxUs")));
+    }
+
+    const cJSON *counters = cJSON_GetObjectItemCaseSensitive(root, "counters");
+    TEST_ASSERT_EQUAL_INT(GARAGE_COUNTER_COUNT, cJSON_GetArraySize(counters));
+    const cJSON *item = NULL;
+    cJSON_ArrayForEach(item, counters)
+    {
+        TEST_ASSERT_NOT_NULL(item->string);
+        TEST_ASSERT_TRUE(cJSON_IsNumber(item));
+    }
+}
+
+static void test_truncation_returns_zero(void)
+{
+    size_t len = garage_metrics_format(s_out, sizeof(s_out));
+    TEST_ASSERT_GREATER_THAN_UINT32(0, (uint32_t)len);
+    TEST_ASSERT_EQUAL_size_t(strlen(s_out), len);
+
+    char small[sizeof(s_out)];
+    for (size_t size = 1; size <= len; ++size) {
+        TEST_ASSERT_EQUAL_size_t(0, garage_metrics_format(small, size));
+    }
+    TEST_ASSERT_EQUAL_size_t(len, garage_metrics_format(small, len + 1));
+    TEST_ASSERT_EQUAL_STRING(s_out, small);
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_bucket_boundaries);
+    RUN_TEST(test_durations_clamp_to_32_bits);
+    RUN_TEST(test_percentiles);
+    RUN_TEST(test_counters_saturate);
+    RUN_TEST(test_out_of_range_ignored);
+    RUN_TEST(test_payload_shape);
+    RUN_TEST(test_truncation_returns_zero);
+    return UNITY_END();
+}
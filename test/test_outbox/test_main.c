@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "garage_outbox.h"
+#include "unity.h"
+
+#define RECORD_SIZE(len) ((sizeof(garage_outbox_record_t) + (len) + 3u) & ~(size_t)3u)
+#define KIND_STATE 0
+#define KIND_EVENT 1
+
+void setUp(void)
+{
+    garage_outbox_init();
+}
+
+void tearDown(void)
+{
+}
+
+static garage_outbox_push_result_t push(uint8_t kind, bool collapsible, const char *payload)
+{
+    garage_outbox_push_result_t result;
+    TEST_ASSERT_TRUE(garage_outbox_push(kind, collapsible, payload, strlen(payload), &result));
+    return result;
+}
+
+static void expect_pop(uint8_t kind, const char *payload)
+{
+    garage_outbox_record_t record;
+    char buffer[GARAGE_OUTBOX_BYTES];
+    TEST_ASSERT_TRUE(garage_outbox_peek(&record, buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL_UINT8(kind, record.kind);
+    TEST_ASSERT_EQUAL_size_t(strlen(payload), record.len);
+    TEST_ASSERT_EQUAL_MEMORY(payload, buffer, record.len);
+    garage_outbox_pop(record.seq);
+}
+
+static void test_fifo_order(void)
+{
+    TEST_ASSERT_TRUE(garage_outbox_empty());
+    push(KIND_EVENT, false, "one");
+    push(KIND_EVENT, false, "two");
+    push(KIND_STATE, true, "three");
+    expect_pop(KIND_EVENT, "one");
+    expect_pop(KIND_EVENT, "two");
+    expect_pop(KIND_STATE, "three");
+    TEST_ASSERT_TRUE(garage_outbox_empty());
+}
+
+static void test_collapsible_replaces_newest_collapsible(void)
+{
+    push(KIND_EVENT, false, "ota");
+    TEST_ASSERT_FALSE(push(KIND_STATE, true, "TRIGGERING").collapsed);
+    TEST_ASSERT_TRUE(push(KIND_STATE, true, "THROTTLED").collapsed);
+    TEST_ASSERT_TRUE(push(KIND_STATE, true, "LISTENING").collapsed);
+    expect_pop(KIND_EVENT, "ota");
+    expect_pop(KIND_STATE, "LISTENING");
+    TEST_ASSERT_TRUE(garage_outbox_empty());
+}
+
+static void test_event_between_states_keeps_both(void)
+{
+    push(KIND_STATE, true, "TRIGGERING");
+    TEST_ASSERT_FALSE(push(KIND_EVENT, false, "result").collapsed);
+    TEST_ASSERT_FALSE(push(KIND_STATE, true, "THROTTLED").collapsed);
+    expect_pop(KIND_STATE, "TRIGGERING");
+    expect_pop(KIND_EVENT, "result");
+    expect_pop(KIND_STATE, "THROTTLED");
+}
+
+static void test_collapse_after_partial_flush(void)
+{
+    push(KIND_STATE, true, "TRIGGERING");
+    expect_pop(KIND_STATE, "TRIGGERING");
+    // The popped state is gone; a new one must not collapse into it.
+    TEST_ASSERT_FALSE(push(KIND_STATE, true, "THROTTLED").collapsed);
+    expect_pop(KIND_STATE, "THROTTLED");
+    TEST_ASSERT_TRUE(garage_outbox_empty());
+}
+
+static void test_full_outbox_evicts_oldest(void)
+{
+    char payload[200];
+    memset(payload, 'x', sizeof(payload) - 1);
+    payload[sizeof(payload) - 1] = '\0';
+    size_t fit = GARAGE_OUTBOX_BYTES / RECORD_SIZE(strlen(payload));
+
+    push(KIND_STATE, true, payload);
+    for (size_t i = 1; i < fit; ++i) {
+        TEST_ASSERT_EQUAL_UINT32(0, push(KIND_EVENT, false, payload).evicted);
+    }
+    garage_outbox_push_result_t result = push(KIND_EVENT, false, payload);
+    TEST_ASSERT_EQUAL_UINT32(1, result.evicted);
+    TEST_ASSERT_TRUE(result.evicted_collapsible);
+    result = push(KIND_EVENT, false, payload);
+    TEST_ASSERT_EQUAL_UINT32(1, result.evicted);
+    TEST_ASSERT_FALSE(result.evicted_collapsible);
+}
+
+static void test_space_reused_after_pops(void)
+{
+    // Fill, drain half, then push records that only fit once the live
+    // records slide back to the start of the buffer.
+    char payload[100];
+    memset(payload, 'a', sizeof(payload) - 1);
+    payload[sizeof(payload) - 1] = '\0';
+    size_t fit = GARAGE_OUTBOX_BYTES / RECORD_SIZE(strlen(payload));
+    for (size_t i = 0; i < fit; ++i) {
+        payload[0] = (char)('A' + i % 26);
+        push(KIND_EVENT, false, payload);
+    }
+    for (size_t i = 0; i < fit / 2; ++i) {
+        payload[0] = (char)('A' + i % 26);
+        expect_pop(KIND_EVENT, payload);
+    }
+    for (size_t i = fit; i < fit + fit / 2; ++i) {
+        payload[0] = (char)('A' + i % 26);
+        TEST_ASSERT_EQUAL_UINT32(0, push(KIND_EVENT, false, payload).evicted);
+    }
+    for (size_t i = fit / 2; i < fit + fit / 2; ++i) {
+        payload[0] = (char)('A' + i % 26);
+        expect_pop(KIND_EVENT, payload);
+    }
+    TEST_ASSERT_TRUE(garage_outbox_empty());
+}
+
+typedef struct {
+    uint8_t kind;
+    bool collapsible;
+    size_t len;
+    char payload[64];
+} model_record_t;
+
+static void test_matches_fifo_model(void)
+{
+    // Random pushes and pops against a plain array model of the same rules.
+    model_record_t model[GARAGE_OUTBOX_BYTES / 8];
+    size_t count = 0;
+    size_t used = 0;
+    srand(1);
+    for (int step = 0; step < 20000; ++step) {
+        if (rand() % 3 == 0 && count > 0) {
+            expect_pop(model[0].kind, model[0].payload);
+            used -= RECORD_SIZE(model[0].len);
+            memmove(&model[0], &model[1], (count - 1) * sizeof(model[0]));
+            --count;
+            continue;
+        }
+
+        model_record_t record = {.kind = (uint8_t)(rand() % 2)};
+        record.collapsible = record.kind == KIND_STATE;
+        record.len = (size_t)snprintf(record.payload, sizeof(record.payload), "%d:%.*s", step, rand() % 40,
+                                      "........................................");
+        bool collapse = record.collapsible && count > 0 && model[count - 1].collapsible;
+        if (collapse) {
+            used -= RECORD_SIZE(model[count - 1].len);
+            --count;
+        }
+        uint32_t evicted = 0;
+        while (count > 0 && GARAGE_OUTBOX_BYTES - used < RECORD_SIZE(record.len)) {
+            used -= RECORD_SIZE(model[0].len);
+            memmove(&model[0], &model[1], (count - 1) * sizeof(model[0]));
+            --count;
+            ++evicted;
+        }
+        model[count++] = record;
+        used += RECORD_SIZE(record.len);
+
+        garage_outbox_push_result_t result = push(record.kind, record.collapsible, record.payload);
+        TEST_ASSERT_EQUAL(collapse, result.collapsed);
+        TEST_ASSERT_EQUAL_UINT32(evicted, result.evicted);
+    }
+    while (count > 0) {
+        expect_pop(model[0].kind, model[0].payload);
+        memmove(&model[0], &model[1], (count - 1) * sizeof(model[0]));
+        --count;
+    }
+    TEST_ASSERT_TRUE(garage_outbox_empty());
+}
+
+static void test_pop_ignores_stale_seq(void)
+{
+    push(KIND_EVENT, false, "one");
+    garage_outbox_record_t record;
+    char buffer[16];
+    TEST_ASSERT_TRUE(garage_outbox_peek(&record, buffer, sizeof(buffer)));
+    garage_outbox_pop(record.seq + 1);
+    expect_pop(KIND_EVENT, "one");
+    garage_outbox_pop(record.seq);
+    TEST_ASSERT_TRUE(garage_outbox_empty());
+}
+
+static void test_oversize_payload_rejected(void)
+{
+    static char payload[GARAGE_OUTBOX_BYTES];
+    garage_outbox_push_result_t result;
+    push(KIND_EVENT, false, "keep");
+    TEST_ASSERT_FALSE(garage_outbox_push(KIND_EVENT, false, payload, sizeof(payload), &result));
+    expect_pop(KIND_EVENT, "keep");
+
+    garage_outbox_record_t record;
+    char small[2];
+    push(KIND_EVENT, false, "too long for the buffer");
+    TEST_ASSERT_FALSE(garage_outbox_peek(&record, small, sizeof(small)));
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_fifo_order);
+    RUN_TEST(test_collapsible_replaces_newest_collapsible);
+    RUN_TEST(test_event_between_states_keeps_both);
+    RUN_TEST(test_collapse_after_partial_flush);
+    RUN_TEST(test_full_outbox_evicts_oldest);
+    RUN_TEST(test_space_reused_after_pops);
+    RUN_TEST(test_matches_fifo_model);
+    RUN_TEST(test_pop_ignores_stale_seq);
+    RUN_TEST(test_oversize_payload_rejected);
+    return UNITY_END();
+}
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "garage_control.h"
+#include "garage_publish.h"
+#include "host_hal.h"
+#include "unity.h"
+
+#define STATE_TOPIC "garage/test/state"
+#define RESULT_TOPIC "garage/test/result"
+
+void setUp(void)
+{
+    host_hal_reset();
+    garage_publish_init("test", STATE_TOPIC, "garage/test/metrics", RESULT_TOPIC, 0);
+    garage_publish_forget_state();
+    garage_publish_flush_outbox();
+}
+
+void tearDown(void)
+{
+}
+
+static bool message_has(const host_broker_message_t *message, const char *topic, const char *needle)
+{
+    return message && strcmp(message->topic, topic) == 0 && strstr(message->payload, needle);
+}
+
+static void hold_three_results(void)
+{
+    host_broker_set_connected(false);
+    garage_publish_result("req-1", "executed", NULL);
+    garage_publish_result("req-2", "executed", NULL);
+    garage_publish_result("req-3", "executed", NULL);
+    host_broker_set_connected(true);
+}
+
+static void test_interrupted_flush_stays_pending(void)
+{
+    hold_three_results();
+    TEST_ASSERT_TRUE(garage_publish_outbox_pending());
+
+    host_broker_fail_next(1);
+    garage_publish_flush_outbox();
+    TEST_ASSERT_TRUE(garage_publish_outbox_pending());
+    TEST_ASSERT_EQUAL_UINT32(0, host_broker_publish_count());
+}
+
+static void test_publishes_queue_behind_interrupted_flush(void)
+{
+    hold_three_results();
+    host_broker_fail_next(1);
+    garage_publish_flush_outbox();
+    // The link is back (or never really went away) but no CONNECTED
+    // follows; a retained state must still not overtake the held results.
+    host_broker_set_connected(true);
+    garage_publish_state(GARAGE_PUBLISH_STATE, GARAGE_STATE_LISTENING, true, NULL, 0);
+    TEST_ASSERT_NULL(host_broker_retained(STATE_TOPIC));
+
+    // What the retry timer does.
+    garage_publish_flush_outbox();
+    TEST_ASSERT_FALSE(garage_publish_outbox_pending());
+    TEST_ASSERT_EQUAL_UINT32(4, host_broker_publish_count());
+    TEST_ASSERT_TRUE(message_has(host_broker_message(3), RESULT_TOPIC, "req-1"));
+    TEST_ASSERT_TRUE(message_has(host_broker_message(2), RESULT_TOPIC, "req-2"));
+    TEST_ASSERT_TRUE(message_has(host_broker_message(1), RESULT_TOPIC, "req-3"));
+    TEST_ASSERT_TRUE(message_has(host_broker_message(0), STATE_TOPIC, "\"state\":\"LISTENING\""));
+    TEST_ASSERT_NOT_NULL(host_broker_retained(STATE_TOPIC));
+}
+
+static void test_nothing_pending_after_clean_flush(void)
+{
+    TEST_ASSERT_FALSE(garage_publish_outbox_pending());
+    hold_three_results();
+    garage_publish_flush_outbox();
+    TEST_ASSERT_FALSE(garage_publish_outbox_pending());
+    TEST_ASSERT_EQUAL_UINT32(3, host_broker_publish_count());
+}
+
+static void test_publishes_allocate_nothing(void)
+{
+    // Earlier tests left the state topic active, which would make the
+    // first heartbeat redundant; this one clears that.
+    garage_publish_state(GARAGE_PUBLISH_HEARTBEAT, GARAGE_STATE_LISTENING, false, NULL, 0);
+    uint32_t published = host_broker_publish_count();
+
+    host_heap_stats_t before;
+    host_heap_stats_t after;
+    host_heap_snapshot(&before);
+    garage_publish_state(GARAGE_PUBLISH_HEARTBEAT, GARAGE_STATE_LISTENING, false, NULL, 0);
+    garage_publish_state(GARAGE_PUBLISH_STATE, GARAGE_STATE_TRIGGERING, true, "cooldownMs", 1500);
+    garage_publish_ota_status("downloading", "v1.4.0/firmware.bin", NULL);
+    garage_publish_ota_status("failed", "download", "ESP_ERR_TIMEOUT");
+    garage_publish_result("req-1", "executed", NULL);
+    host_heap_snapshot(&after);
+    TEST_ASSERT_EQUAL_UINT32(published + 5, host_broker_publish_count());
+    TEST_ASSERT_EQUAL_UINT64(before.allocations, after.allocations);
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_interrupted_flush_stays_pending);
+    RUN_TEST(test_publishes_queue_behind_interrupted_flush);
+    RUN_TEST(test_nothing_pending_after_clean_flush);
+    RUN_TEST(test_publishes_allocate_nothing);
+    return UNITY_END();
+}
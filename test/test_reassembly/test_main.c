@@ -0,0 +1,127 @@
+#include <string.h>
+
+#include "garage_reassembly.h"
+#include "unity.h"
+
+#define CAPACITY 64
+
+static const char s_message[] = "{\"type\":\"config_update\",\"debounceMs\":1500}";
+#define MESSAGE_LEN (sizeof(s_message) - 1)
+
+static char s_buffer[CAPACITY];
+static garage_reassembly_t s_reassembly;
+
+void setUp(void)
+{
+    memset(s_buffer, 0, sizeof(s_buffer));
+    garage_reassembly_init(&s_reassembly, s_buffer, sizeof(s_buffer));
+}
+
+void tearDown(void)
+{
+}
+
+static garage_reassembly_result_t feed(size_t offset, size_t chunk, size_t total, int64_t now_us)
+{
+    return garage_reassembly_feed(&s_reassembly, s_message + offset, chunk, offset, total, now_us);
+}
+
+static void assert_message_complete(int64_t started_us)
+{
+    TEST_ASSERT_FALSE(s_reassembly.active);
+    TEST_ASSERT_EQUAL_size_t(MESSAGE_LEN, s_reassembly.received);
+    TEST_ASSERT_EQUAL_MEMORY(s_message, s_reassembly.buffer, MESSAGE_LEN);
+    TEST_ASSERT_EQUAL_INT64(started_us, s_reassembly.started_us);
+}
+
+static void test_in_order_fragments_complete(void)
+{
+    TEST_ASSERT_EQUAL(GARAGE_REASSEMBLY_PENDING, feed(0, 16, MESSAGE_LEN, 100));
+    TEST_ASSERT_EQUAL(GARAGE_REASSEMBLY_PENDING, feed(16, 16, MESSAGE_LEN, 200));
+    TEST_ASSERT_EQUAL(GARAGE_REASSEMBLY_COMPLETE, feed(32, MESSAGE_LEN - 32, MESSAGE_LEN, 300));
+    assert_message_complete(100);
+}
+
+static void test_out_of_order_offset_drops_message(void)
+{
+    TEST_ASSERT_EQUAL(GARAGE_REASSEMBLY_PENDING, feed(0, 16, MESSAGE_LEN, 100));
+    TEST_ASSERT_EQUAL(GARAGE_REASSEMBLY_OUT_OF_SEQUENCE, feed(32, 8, MESSAGE_LEN, 200));
+    TEST_ASSERT_FALSE(s_reassembly.active);
+    // The skipped fragment arriving late no longer belongs to anything.
+    TEST_ASSERT_EQUAL(GARAGE_REASSEMBLY_IGNORED, feed(16, 16, MESSAGE_LEN, 300));
+    TEST_ASSERT_EQUAL(GARAGE_REASSEMBLY_IGNORED, feed(32, MESSAGE_LEN - 32, MESSAGE_LEN, 400));
+}
+
+static void test_repeated_offset_drops_message(void)
+{
+    TEST_ASSERT_EQUAL(GARAGE_REASSEMBLY_PENDING, feed(0, 16, MESSAGE_LEN, 100));
+    TEST_ASSERT_EQUAL(GARAGE_REASSEMBLY_PENDING, feed(16, 16, MESSAGE_LEN, 200));
+    TEST_ASSERT_EQUAL(GARAGE_REASSEMBLY_OUT_OF_SEQUENCE, feed(16, 16, MESSAGE_LEN, 300));
+}
+
+static void test_duplicate_first_fragment_restarts_message(void)
+{
+    TEST_ASSERT_EQUAL(GARAGE_REASSEMBLY_PENDING, feed(0, 16, MESSAGE_LEN, 100));
+    TEST_ASSERT_EQUAL(GARAGE_REASSEMBLY_PENDING, feed(0, 16, MESSAGE_LEN, 150));
+    TEST_ASSERT_EQUAL_size_t(16, s_reassembly.received);
+    TEST_ASSERT_EQUAL(GARAGE_REASSEMBLY_COMPLETE, feed(16, MESSAGE_LEN - 16, MESSAGE_LEN, 200));
+    assert_message_complete(150);
+}
+
+static void test_total_len_change_drops_message(void)
+{
+    TEST_ASSERT_EQUAL(GARAGE_REASSEMBLY_PENDING, feed(0, 16, MESSAGE_LEN, 100));
+    TEST_ASSERT_EQUAL(GARAGE_REASSEMBLY_OUT_OF_SEQUENCE, feed(16, 16, MESSAGE_LEN + 8, 200));
+    TEST_ASSERT_FALSE(s_reassembly.active);
+    TEST_ASSERT_EQUAL(GARAGE_REASSEMBLY_IGNORED, feed(32, MESSAGE_LEN - 32, MESSAGE_LEN, 300));
+}
+
+static void test_fragment_past_total_drops_message(void)
+{
+    TEST_ASSERT_EQUAL(GARAGE_REASSEMBLY_PENDING, feed(0, 16, 24, 100));
+    TEST_ASSERT_EQUAL(GARAGE_REASSEMBLY_OUT_OF_SEQUENCE, feed(16, 16, 24, 200));
+    TEST_ASSERT_FALSE(s_reassembly.active);
+}
+
+static void test_oversize_total_ignored(void)
+{
+    TEST_ASSERT_EQUAL(GARAGE_REASSEMBLY_OVERSIZE, feed(0, 16, CAPACITY + 1, 100));
+    TEST_ASSERT_FALSE(s_reassembly.active);
+    TEST_ASSERT_EQUAL(GARAGE_REASSEMBLY_IGNORED, feed(16, 16, CAPACITY + 1, 200));
+
+    // Exactly the capacity still fits.
+    static const char filler[CAPACITY] = {0};
+    TEST_ASSERT_EQUAL(GARAGE_REASSEMBLY_PENDING,
+                      garage_reassembly_feed(&s_reassembly, filler, CAPACITY / 2, 0, CAPACITY, 300));
+    TEST_ASSERT_EQUAL(GARAGE_REASSEMBLY_COMPLETE,
+                      garage_reassembly_feed(&s_reassembly, filler, CAPACITY / 2, CAPACITY / 2, CAPACITY, 400));
+}
+
+static void test_oversize_abandons_message_in_progress(void)
+{
+    TEST_ASSERT_EQUAL(GARAGE_REASSEMBLY_PENDING, feed(0, 16, MESSAGE_LEN, 100));
+    TEST_ASSERT_EQUAL(GARAGE_REASSEMBLY_OVERSIZE, feed(0, 16, CAPACITY * 2, 200));
+    TEST_ASSERT_EQUAL(GARAGE_REASSEMBLY_IGNORED, feed(16, MESSAGE_LEN - 16, MESSAGE_LEN, 300));
+}
+
+static void test_reset_forgets_message(void)
+{
+    TEST_ASSERT_EQUAL(GARAGE_REASSEMBLY_PENDING, feed(0, 16, MESSAGE_LEN, 100));
+    garage_reassembly_reset(&s_reassembly);
+    TEST_ASSERT_EQUAL(GARAGE_REASSEMBLY_IGNORED, feed(16, MESSAGE_LEN - 16, MESSAGE_LEN, 200));
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_in_order_fragments_complete);
+    RUN_TEST(test_out_of_order_offset_drops_message);
+    RUN_TEST(test_repeated_offset_drops_message);
+    RUN_TEST(test_duplicate_first_fragment_restarts_message);
+    RUN_TEST(test_total_len_change_drops_message);
+    RUN_TEST(test_fragment_past_total_drops_message);
+    RUN_TEST(test_oversize_total_ignored);
+    RUN_TEST(test_oversize_abandons_message_in_progress);
+    RUN_TEST(test_reset_forgets_message);
+    return UNITY_END();
+}
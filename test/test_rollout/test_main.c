@@ -0,0 +1,136 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "garage_rollout.h"
+#include "unity.h"
+
+#define DETAIL "v1.4.0/firmware.bin"
+
+void setUp(void)
+{
+    garage_rollout_gate_disarm();
+}
+
+void tearDown(void)
+{
+}
+
+static bool observe(const char *device_id, const char *status, const char *detail)
+{
+    return garage_rollout_gate_observe(device_id, strlen(device_id), status, strlen(status), detail, strlen(detail));
+}
+
+// Values from rollout_plan() in scripts/ota-fleet-sim.py.
+static void test_plan_matches_fleet_simulator(void)
+{
+    garage_rollout_plan_t plan = garage_rollout_plan("garage-01", 600, 10);
+    TEST_ASSERT_FALSE(plan.canary);
+    TEST_ASSERT_EQUAL_UINT32(31068, plan.delay_ms);
+
+    plan = garage_rollout_plan("garage-02", 86400, 50);
+    TEST_ASSERT_FALSE(plan.canary);
+    TEST_ASSERT_EQUAL_UINT32(25569256, plan.delay_ms);
+
+    plan = garage_rollout_plan("garage-05", 86400, 50);
+    TEST_ASSERT_TRUE(plan.canary);
+    TEST_ASSERT_EQUAL_UINT32(62448003, plan.delay_ms);
+}
+
+static void test_canary_bucket_boundary(void)
+{
+    // garage-01 hashes into bucket 40.
+    TEST_ASSERT_FALSE(garage_rollout_plan("garage-01", 600, 40).canary);
+    TEST_ASSERT_TRUE(garage_rollout_plan("garage-01", 600, 41).canary);
+    TEST_ASSERT_FALSE(garage_rollout_plan("garage-01", 600, 0).canary);
+    TEST_ASSERT_TRUE(garage_rollout_plan("garage-01", 600, 100).canary);
+}
+
+static void test_plan_spreads_over_window(void)
+{
+    unsigned canaries = 0;
+    uint32_t latest_ms = 0;
+    for (int i = 0; i < 1000; ++i) {
+        char id[24];
+        snprintf(id, sizeof(id), "garage-%04d", i);
+        garage_rollout_plan_t plan = garage_rollout_plan(id, 600, 10);
+        TEST_ASSERT_LESS_THAN_UINT32(600 * 1000, plan.delay_ms);
+        latest_ms = plan.delay_ms > latest_ms ? plan.delay_ms : latest_ms;
+        canaries += plan.canary;
+    }
+    TEST_ASSERT_UINT32_WITHIN(40, 100, canaries);
+    TEST_ASSERT_GREATER_THAN_UINT32(590 * 1000, latest_ms);
+}
+
+static void test_plan_clamps_window(void)
+{
+    garage_rollout_plan_t clamped = garage_rollout_plan("garage-02", 10 * GARAGE_ROLLOUT_MAX_WINDOW_S, 50);
+    garage_rollout_plan_t max = garage_rollout_plan("garage-02", GARAGE_ROLLOUT_MAX_WINDOW_S, 50);
+    TEST_ASSERT_EQUAL_UINT32(max.delay_ms, clamped.delay_ms);
+    TEST_ASSERT_EQUAL_UINT32(0, garage_rollout_plan("garage-02", 0, 50).delay_ms);
+}
+
+static void test_gate_opens_at_quorum_once(void)
+{
+    garage_rollout_gate_arm("self", DETAIL, 2);
+    TEST_ASSERT_TRUE(garage_rollout_gate_armed());
+    TEST_ASSERT_FALSE(observe("canary-a", "success", DETAIL));
+    TEST_ASSERT_TRUE(observe("canary-b", "success", DETAIL));
+    TEST_ASSERT_FALSE(observe("canary-c", "success", DETAIL));
+
+    garage_rollout_gate_disarm();
+    TEST_ASSERT_FALSE(garage_rollout_gate_armed());
+    TEST_ASSERT_FALSE(observe("canary-d", "success", DETAIL));
+}
+
+static void test_gate_ignores_self_duplicates_and_other_reports(void)
+{
+    garage_rollout_gate_arm("self", DETAIL, 2);
+    TEST_ASSERT_FALSE(observe("self", "success", DETAIL));
+    TEST_ASSERT_FALSE(observe("canary-a", "success", DETAIL));
+    TEST_ASSERT_FALSE(observe("canary-a", "success", DETAIL));
+    TEST_ASSERT_FALSE(observe("canary-b", "failed", DETAIL));
+    TEST_ASSERT_FALSE(observe("canary-b", "successful", DETAIL));
+    TEST_ASSERT_FALSE(observe("canary-b", "success", "v1.3.9/firmware.bin"));
+    TEST_ASSERT_FALSE(observe("canary-b", "success", DETAIL "x"));
+    // The device id is length-delimited, as sliced out of the topic.
+    TEST_ASSERT_FALSE(garage_rollout_gate_observe("canary-a/state", 8, "success", 7, DETAIL, strlen(DETAIL)));
+    TEST_ASSERT_TRUE(observe("canary-b", "success", DETAIL));
+}
+
+static void test_gate_clamps_quorum(void)
+{
+    garage_rollout_gate_arm("self", DETAIL, 0);
+    TEST_ASSERT_TRUE(observe("canary-a", "success", DETAIL));
+
+    garage_rollout_gate_arm("self", DETAIL, 1000);
+    for (int i = 0; i < GARAGE_ROLLOUT_MAX_QUORUM; ++i) {
+        char id[24];
+        snprintf(id, sizeof(id), "canary-%d", i);
+        TEST_ASSERT_EQUAL(i == GARAGE_ROLLOUT_MAX_QUORUM - 1, observe(id, "success", DETAIL));
+    }
+}
+
+static void test_rearm_forgets_previous_reports(void)
+{
+    garage_rollout_gate_arm("self", DETAIL, 2);
+    TEST_ASSERT_FALSE(observe("canary-a", "success", DETAIL));
+    garage_rollout_gate_arm("self", "v1.5.0/firmware.bin", 2);
+    TEST_ASSERT_FALSE(observe("canary-b", "success", DETAIL));
+    TEST_ASSERT_FALSE(observe("canary-a", "success", "v1.5.0/firmware.bin"));
+    TEST_ASSERT_TRUE(observe("canary-b", "success", "v1.5.0/firmware.bin"));
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_plan_matches_fleet_simulator);
+    RUN_TEST(test_canary_bucket_boundary);
+    RUN_TEST(test_plan_spreads_over_window);
+    RUN_TEST(test_plan_clamps_window);
+    RUN_TEST(test_gate_opens_at_quorum_once);
+    RUN_TEST(test_gate_ignores_self_duplicates_and_other_reports);
+    RUN_TEST(test_gate_clamps_quorum);
+    RUN_TEST(test_rearm_forgets_previous_reports);
+    return UNITY_END();
+}
@@ -20,6 +20,14 @@ interface ResolvedConnection {
   deviceId: string;
   commandTopic: string;
   stateTopic: string;
+  resultTopic: string;
+  availabilityTopic: string;
+}
+
+export interface CommandResult {
+  requestId: string;
+  status: string;
+  detail?: string;
 }
 
 export interface MqttStoreValue {
@@ -28,6 +36,9 @@ export interface MqttStoreValue {
   garageState: GarageState;
   cooldownMs?: number;
   lastUpdate?: number;
+  lastResult?: CommandResult;
+  // Retained birth/Last Will on garage/<deviceId>/status; undefined until seen.
+  deviceOnline?: boolean;
   connection?: Pick<ResolvedConnection, 'url' | 'deviceId' | 'stateTopic' | 'commandTopic'>;
 }
 
@@ -53,6 +64,32 @@ const parseStatePayload = (payload: Buffer | Uint8Array): Partial<MqttStoreValue
   }
 };
 
+const parseResultPayload = (payload: Buffer | Uint8Array): CommandResult | undefined => {
+  try {
+    const data = JSON.parse(payload.toString());
+    if (typeof data.requestId !== 'string' || typeof data.status !== 'string') {
+      return undefined;
+    }
+    return {
+      requestId: data.requestId,
+      status: data.status,
+      detail: typeof data.detail === 'string' ? data.detail : undefined
+    };
+  } catch (error) {
+    console.warn('[mqtt] Failed to parse result payload', error);
+    return undefined;
+  }
+};
+
+// The firmware echoes this id on garage/<deviceId>/result and ignores
+// repeats, so a QoS1 redelivery or a double-tap opens the door only once.
+const createRequestId = (): string => {
+  if (typeof crypto !== 'undefined' && typeof crypto.randomUUID === 'function') {
+    return crypto.randomUUID();
+  }
+  return `${Date.now().toString(36)}-${Math.random().toString(36).slice(2, 10)}`;
+};
+
 function resolveTopics(params: ConnectionParams): ResolvedConnection {
   const deviceId = params.deviceId.trim();
   if (!deviceId) {
@@ -70,7 +107,9 @@ function resolveTopics(params: ConnectionParams): ResolvedConnection {
     password: params.password || undefined,
     deviceId,
     commandTopic: params.commandTopic?.trim() || `garage/${deviceId}/command`,
-    stateTopic: params.stateTopic?.trim() || `garage/${deviceId}/state`
+    stateTopic: params.stateTopic?.trim() || `garage/${deviceId}/state`,
+    resultTopic: `garage/${deviceId}/result`,
+    availabilityTopic: `garage/${deviceId}/status`
   };
 }
 
@@ -79,6 +118,8 @@ export const createMqttStore = () => {
   let client: MqttClient | undefined;
   let activeConnection: ResolvedConnection | undefined;
   let reconnectTimeout: ReturnType<typeof setTimeout> | undefined;
+  // Last state the device reported, shown again once it is back online.
+  let reportedState: Partial<MqttStoreValue> = {};
 
   const cleanupClient = () => {
     if (reconnectTimeout) {
@@ -94,6 +135,7 @@ export const createMqttStore = () => {
 
   function connectWithResolved(resolved: ResolvedConnection) {
     cleanupClient();
+    reportedState = {};
 
     const options: IClientOptions = {
       protocolVersion: 5,
@@ -129,7 +171,8 @@ export const createMqttStore = () => {
     activeConnection = resolved;
 
     client.on('connect', () => {
-      client?.subscribe(resolved.stateTopic, { qos: 1 }, (err) => {
+      const topics = [resolved.stateTopic, resolved.resultTopic, resolved.availabilityTopic];
+      client?.subscribe(topics, { qos: 1 }, (err) => {
         if (err) {
           update((state) => ({
             ...state,
@@ -150,10 +193,24 @@ export const createMqttStore = () => {
     client.on('message', (topic, payload) => {
       if (topic === resolved.stateTopic) {
         const partial = parseStatePayload(payload);
+        reportedState = partial;
+        update((state) => (state.deviceOnline === false ? state : { ...state, ...partial }));
+      } else if (topic === resolved.availabilityTopic) {
+        const online = payload.toString() === 'online';
+        // The retained state of an offline opener is stale; do not offer to open.
         update((state) => ({
           ...state,
-          ...partial
+          ...(online ? reportedState : { garageState: 'UNKNOWN' as GarageState, cooldownMs: undefined }),
+          deviceOnline: online
         }));
+      } else if (topic === resolved.resultTopic) {
+        const result = parseResultPayload(payload);
+        if (result) {
+          update((state) => ({
+            ...state,
+            lastResult: result
+          }));
+        }
       }
     });
 
@@ -205,9 +262,11 @@ export const createMqttStore = () => {
       throw new Error('MQTT client is not connected');
     }
 
+    const requestId = createRequestId();
     const payload = {
       type: 'open',
       source: 'web-app',
+      requestId,
       timestamp: Date.now()
     };
 
@@ -220,6 +279,7 @@ export const createMqttStore = () => {
         }));
       }
     });
+    return requestId;
   };
 
   return {